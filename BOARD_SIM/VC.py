@@ -0,0 +1,36 @@
+#!/usr/bin/env python
+
+from make_makefile import SourceFile
+from make_makefile import Context
+from make_makefile import CLANGContext
+
+import os
+
+class MyContext(CLANGContext):
+	def __init__(self):
+		super(MyContext,self).__init__()
+
+	SOURCE_FILES = (
+			SourceFile("board_sim.cpp"),
+			SourceFile("board_simulator.cpp"),
+			SourceFile("scale_test.cpp"),
+			SourceFile("alloc_counter.cpp"),
+			SourceFile("message_bench.cpp"),
+			)
+
+	TAG = "BOARD_SIM"
+
+	EXE_TARGET=os.path.join(Context.OUTPUT_DIR,"BOARD_SIM")
+
+	RELATED_PROJECTS=("../HVAC_LIB",)
+
+	LIBRARIES = ["util"]
+
+
+
+def vc_init():
+	return MyContext()
+
+
+if __name__ == "main":
+	vc_init()
@@ -0,0 +1,97 @@
+/*
+ * This file is part of the software stack for Vic's IO board and its
+ * associated projects.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+ */
+
+/*
+ * Replacement global allocation functions that count the allocations.  The array and nothrow forms end up here too.
+ */
+
+#include "include/alloc_counter.hpp"
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+
+static std::atomic<uint64_t> allocation_count( 0 );
+
+void* operator new( size_t _size )
+{
+	allocation_count.fetch_add( 1, std::memory_order_relaxed );
+
+	void* ret = malloc( _size == 0 ? 1 : _size );
+
+	if ( ret == nullptr )
+	{
+		throw std::bad_alloc();
+	}
+
+	return ret;
+}
+
+void* operator new[]( size_t _size )
+{
+	return operator new( _size );
+}
+
+void* operator new( size_t _size, const std::nothrow_t& ) noexcept
+{
+	allocation_count.fetch_add( 1, std::memory_order_relaxed );
+	return malloc( _size == 0 ? 1 : _size );
+}
+
+void* operator new[]( size_t _size, const std::nothrow_t& _tag ) noexcept
+{
+	return operator new( _size, _tag );
+}
+
+void operator delete( void* _ptr ) noexcept
+{
+	free( _ptr );
+	return;
+}
+
+void operator delete[]( void* _ptr ) noexcept
+{
+	free( _ptr );
+	return;
+}
+
+void operator delete( void* _ptr, size_t ) noexcept
+{
+	free( _ptr );
+	return;
+}
+
+void operator delete[]( void* _ptr, size_t ) noexcept
+{
+	free( _ptr );
+	return;
+}
+
+namespace BBB_HVAC
+{
+	namespace SIM
+	{
+		uint64_t get_allocation_count( void )
+		{
+			return allocation_count.load( std::memory_order_relaxed );
+		}
+	}
+}
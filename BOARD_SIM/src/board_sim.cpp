@@ -0,0 +1,984 @@
+/*
+ * This file is part of the software stack for Vic's IO board and its
+ * associated projects.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+ */
+
+/*
+ * Stands in for one or more IO boards.  In simulation mode the boards run until the program is signaled and a BOARD configuration line is printed
+ * for each so that LOGIC_CORE can be pointed at them.  In benchmark mode a single board is simulated in a child process and SER_IO_COMM is run against it
+ * in this one; the decoding throughput, CPU cost, and command round trip latency are printed as key=value pairs.  In scale mode the LOGIC_CORE threads are run
+ * against growing numbers of simulated boards.  In checksum mode the checksum kernels are checked against the scalar one and timed.
+ * In replay mode a serial wire capture is fed through the SER_IO_COMM decoder.  In text mode protocol lines are fed through it and the heap allocations counted.
+ */
+
+#include "include/board_simulator.hpp"
+#include "include/scale_test.hpp"
+#include "include/alloc_counter.hpp"
+#include "include/message_bench.hpp"
+
+#include "lib/threads/serial_io_thread.hpp"
+#include "lib/threads/serial_io_reactor.hpp"
+#include "lib/threads/thread_registry.hpp"
+#include "lib/log_configurator.hpp"
+#include "lib/globals.hpp"
+#include "lib/string_lib.hpp"
+#include "lib/checksum.hpp"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+using namespace BBB_HVAC;
+using namespace BBB_HVAC::SIM;
+using namespace BBB_HVAC::IOCOMM;
+
+DEF_LOGGER_STAT( "BBB_HVAC::SIM(MAIN)" );
+
+/**
+ * Command line options.  Every option takes a value except for --verbose and --help.
+ */
+static const struct option long_options[] =
+{
+	{ "boards", required_argument, nullptr, 'b' },
+	{ "config_out", required_argument, nullptr, 'o' },
+	{ "stream_interval", required_argument, nullptr, 'i' },
+	{ "status_every", required_argument, nullptr, 'e' },
+	{ "noise_ppm", required_argument, nullptr, 'n' },
+	{ "corruption_ppm", required_argument, nullptr, 'c' },
+	{ "stall_interval", required_argument, nullptr, 't' },
+	{ "stall_length", required_argument, nullptr, 'T' },
+	{ "reset_interval", required_argument, nullptr, 'r' },
+	{ "reset_length", required_argument, nullptr, 'R' },
+	{ "hang_interval", required_argument, nullptr, 'g' },
+	{ "hang_length", required_argument, nullptr, 'G' },
+	{ "seed", required_argument, nullptr, 's' },
+	{ "bench", required_argument, nullptr, 'B' },
+	{ "bench_io_mode", required_argument, nullptr, 'm' },
+	{ "rtt_samples", required_argument, nullptr, 'S' },
+	{ "scale", required_argument, nullptr, 'N' },
+	{ "scale_template", required_argument, nullptr, 'C' },
+	{ "scale_seconds", required_argument, nullptr, 'D' },
+	{ "scale_request_interval", required_argument, nullptr, 'q' },
+	{ "report", required_argument, nullptr, 'p' },
+	{ "bench_checksum", required_argument, nullptr, 'K' },
+	{ "bench_text", required_argument, nullptr, 'L' },
+	{ "bench_message", required_argument, nullptr, 'M' },
+	{ "capture", required_argument, nullptr, 'W' },
+	{ "replay", required_argument, nullptr, 'P' },
+	{ "replay_speed", required_argument, nullptr, 'Y' },
+	{ "verbose", no_argument, nullptr, 'v' },
+	{ "help", no_argument, nullptr, 'h' },
+	{ nullptr, 0, nullptr, 0 }
+};
+
+/**
+ * Everything the command line can specify.
+ */
+typedef struct
+{
+	ST_BOARD_SIM_CONFIG board_config;
+	size_t board_count;
+	string config_out;
+	uint64_t bench_seconds;
+	bool reactor_mode;
+	size_t rtt_samples;
+	size_t scale_boards;
+	string scale_template;
+	uint64_t scale_seconds;
+	uint64_t scale_request_interval;
+	string report;
+	size_t checksum_bytes;
+	size_t text_lines;
+	size_t message_count;
+	string capture;
+	string replay;
+	bool replay_realtime;
+	bool verbose;
+} ST_SIM_OPTIONS;
+
+#define IO_MODE_THREAD "THREAD"
+#define IO_MODE_REACTOR "REACTOR"
+
+#define REPLAY_SPEED_FAST "FAST"
+#define REPLAY_SPEED_RECORDED "RECORDED"
+
+/**
+ * How long the benchmark waits for SER_IO_COMM to reset the board and start the stream.
+ */
+#define BENCH_STARTUP_TIMEOUT 10000000
+
+/**
+ * How long the benchmark waits for a single command round trip.
+ */
+#define BENCH_RTT_TIMEOUT 1000000
+
+/**
+ * How long each checksum kernel is timed for, per buffer size.
+ */
+#define CHECKSUM_BENCH_TIME 500000
+
+/**
+ * Size of the buffer the checksum kernels are timed on in frame mode.  That of an analog input response.
+ */
+#define CHECKSUM_FRAME_BYTES 24
+
+static void print_help( const char* _exe )
+{
+	std::cout << "Usage: " << _exe << " [options]" << std::endl;
+	std::cout << "Simulates IO boards on pseudo terminals.  Prints a BOARD configuration line for each board and runs until signaled." << std::endl << std::endl;
+	std::cout << "\t--boards N - Number of boards to simulate.  Default: 1." << std::endl;
+	std::cout << "\t--config_out FILE - File the BOARD configuration lines are written to.  Default: standard output." << std::endl;
+	std::cout << "\t--stream_interval USEC - Microseconds between streamed analog input frames.  Default: 1000." << std::endl;
+	std::cout << "\t--status_every N - Stream DO and PMIC status after every N analog input frames.  Default: 10." << std::endl;
+	std::cout << "\t--noise_ppm N - Chance, in parts per million, of line noise in front of a frame.  Default: 0." << std::endl;
+	std::cout << "\t--corruption_ppm N - Chance, in parts per million, of a corrupted frame.  Default: 0." << std::endl;
+	std::cout << "\t--stall_interval USEC - Microseconds between flow control stalls.  Default: 0 (never)." << std::endl;
+	std::cout << "\t--stall_length USEC - Length of a flow control stall." << std::endl;
+	std::cout << "\t--reset_interval USEC - Microseconds between spontaneous board resets.  Default: 0 (never)." << std::endl;
+	std::cout << "\t--reset_length USEC - Time the board takes to come back up after a reset.  Default: 500000." << std::endl;
+	std::cout << "\t--hang_interval USEC - Microseconds between firmware hangs.  A hung board is silent and ignores commands.  Default: 0 (never)." << std::endl;
+	std::cout << "\t--hang_length USEC - Length of a firmware hang.  Reset commands are ignored during it." << std::endl;
+	std::cout << "\t--seed N - Random seed.  Default: 1." << std::endl;
+	std::cout << "\t--bench SECONDS - Benchmark SER_IO_COMM against a single simulated board instead." << std::endl;
+	std::cout << "\t--bench_io_mode [THREAD|REACTOR] - How the benchmark and the scale test service the boards.  Default: THREAD." << std::endl;
+	std::cout << "\t--rtt_samples N - Number of command round trips the benchmark measures.  Default: 200." << std::endl;
+	std::cout << "\t--scale N - Run the LOGIC_CORE threads against 1, 2, 4, ... N simulated boards instead and report CPU and latency per step." << std::endl;
+	std::cout << "\t--scale_template FILE - LOGIC_CORE configuration the scale test configurations are generated from.  Required with --scale." << std::endl;
+	std::cout << "\t--scale_seconds SECONDS - How long each scale step is measured for.  Default: 10." << std::endl;
+	std::cout << "\t--scale_request_interval USEC - Time between READ_STATUS requests during a scale step.  Default: 10000." << std::endl;
+	std::cout << "\t--report FILE - File the scale test report is written to.  Default: standard output." << std::endl;
+	std::cout << "\t--bench_text LINES - Feed LINES text lines through the SER_IO_COMM decoder instead and count the heap allocations.  Fails if there are any." << std::endl;
+	std::cout << "\t--bench_message N - Check the MESSAGE serializer and time it on N READ_STATUS responses instead." << std::endl;
+	std::cout << "\t--capture FILE - Capture the serial traffic of the benchmark into FILE." << std::endl;
+	std::cout << "\t--replay FILE - Feed a serial wire capture through the SER_IO_COMM decoder instead and report the decoding throughput." << std::endl;
+	std::cout << "\t--replay_speed [FAST|RECORDED] - Replay as fast as possible or with the recorded timing.  Default: FAST." << std::endl;
+	std::cout << "\t--bench_checksum BYTES - Check the checksum kernels against the scalar one and time them on frames and on BYTES long buffers instead." << std::endl;
+	std::cout << "\t--verbose - Log everything to stderr.  Only warnings and errors are logged otherwise." << std::endl;
+	return;
+}
+
+/**
+ * Parses the command line.  Does not return on a command line error or if help was asked for.
+ */
+static ST_SIM_OPTIONS parse_command_line( int _argc, char** _argv )
+{
+	ST_SIM_OPTIONS ret;
+	int opt;
+
+	ret.board_config = BOARD_SIMULATOR::get_default_config();
+	ret.board_count = 1;
+	ret.bench_seconds = 0;
+	ret.reactor_mode = false;
+	ret.rtt_samples = 200;
+	ret.scale_boards = 0;
+	ret.scale_seconds = 10;
+	ret.scale_request_interval = 10000;
+	ret.checksum_bytes = 0;
+	ret.text_lines = 0;
+	ret.message_count = 0;
+	ret.replay_realtime = false;
+	ret.verbose = false;
+
+	while ( ( opt = getopt_long( _argc, _argv, "", long_options, nullptr ) ) != -1 )
+	{
+		uint64_t value = 0;
+
+		if ( optarg != nullptr && opt != 'o' && opt != 'm' && opt != 'C' && opt != 'p' && opt != 'W' && opt != 'P' && opt != 'Y' )
+		{
+			try
+			{
+				value = ( uint64_t ) stoull( optarg );
+			}
+			catch ( const exception& _e )
+			{
+				std::cerr << "Invalid numeric value: " << optarg << std::endl;
+				exit( EXIT_FAILURE );
+			}
+		}
+
+		switch ( opt )
+		{
+			case 'b':
+				ret.board_count = ( size_t ) value;
+				break;
+			case 'o':
+				ret.config_out = optarg;
+				break;
+			case 'i':
+				ret.board_config.stream_interval = value;
+				break;
+			case 'e':
+				ret.board_config.status_every = ( unsigned int ) value;
+				break;
+			case 'n':
+				ret.board_config.noise_ppm = ( unsigned int ) value;
+				break;
+			case 'c':
+				ret.board_config.corruption_ppm = ( unsigned int ) value;
+				break;
+			case 't':
+				ret.board_config.stall_interval = value;
+				break;
+			case 'T':
+				ret.board_config.stall_length = value;
+				break;
+			case 'r':
+				ret.board_config.reset_interval = value;
+				break;
+			case 'R':
+				ret.board_config.reset_length = value;
+				break;
+			case 'g':
+				ret.board_config.hang_interval = value;
+				break;
+			case 'G':
+				ret.board_config.hang_length = value;
+				break;
+			case 's':
+				ret.board_config.seed = ( unsigned int ) value;
+				break;
+			case 'B':
+				ret.bench_seconds = std::max( ( uint64_t ) 1, value );
+				break;
+			case 'm':
+				if ( string( optarg ) == IO_MODE_REACTOR )
+				{
+					ret.reactor_mode = true;
+				}
+				else if ( string( optarg ) != IO_MODE_THREAD )
+				{
+					std::cerr << "Unknown IO mode: " << optarg << std::endl;
+					exit( EXIT_FAILURE );
+				}
+
+				break;
+			case 'S':
+				ret.rtt_samples = ( size_t ) value;
+				break;
+			case 'N':
+				ret.scale_boards = ( size_t ) value;
+				break;
+			case 'C':
+				ret.scale_template = optarg;
+				break;
+			case 'D':
+				ret.scale_seconds = std::max( ( uint64_t ) 1, value );
+				break;
+			case 'q':
+				ret.scale_request_interval = value;
+				break;
+			case 'p':
+				ret.report = optarg;
+				break;
+			case 'L':
+				ret.text_lines = ( size_t ) value;
+				break;
+			case 'M':
+				ret.message_count = ( size_t ) value;
+				break;
+			case 'W':
+				ret.capture = optarg;
+				break;
+			case 'P':
+				ret.replay = optarg;
+				break;
+			case 'Y':
+				if ( string( optarg ) == REPLAY_SPEED_RECORDED )
+				{
+					ret.replay_realtime = true;
+				}
+				else if ( string( optarg ) != REPLAY_SPEED_FAST )
+				{
+					std::cerr << "Unknown replay speed: " << optarg << std::endl;
+					exit( EXIT_FAILURE );
+				}
+
+				break;
+			case 'K':
+				ret.checksum_bytes = std::max( ( size_t ) CHECKSUM_FRAME_BYTES, ( size_t ) value );
+				break;
+			case 'v':
+				ret.verbose = true;
+				break;
+			case 'h':
+				print_help( _argv[0] );
+				exit( EXIT_SUCCESS );
+			default:
+				print_help( _argv[0] );
+				exit( EXIT_FAILURE );
+		}
+	}
+
+	if ( ret.scale_boards > 0 && ret.scale_template.empty() )
+	{
+		std::cerr << "--scale requires --scale_template" << std::endl;
+		exit( EXIT_FAILURE );
+	}
+
+	return ret;
+}
+
+static uint64_t rusage_usec( void )
+{
+	struct rusage ru;
+	getrusage( RUSAGE_SELF, &ru );
+	return ( ( uint64_t ) ru.ru_utime.tv_sec * 1000000 ) + ( uint64_t ) ru.ru_utime.tv_usec + ( ( uint64_t ) ru.ru_stime.tv_sec * 1000000 ) + ( uint64_t ) ru.ru_stime.tv_usec;
+}
+
+static void print_stat( const string& _key, uint64_t _value )
+{
+	std::cout << _key << "=" << _value << std::endl;
+	return;
+}
+
+static void print_stat( const string& _key, double _value )
+{
+	std::cout << _key << "=" << _value << std::endl;
+	return;
+}
+
+/**
+ * Runs the simulated boards until the program is signaled.
+ */
+static int do_simulate( const ST_SIM_OPTIONS& _options )
+{
+	ST_BOARD_SIM_CONFIG config = _options.board_config;
+	std::vector<BOARD_SIMULATOR*> boards;
+	string lines;
+
+	for ( size_t i = 0; i < _options.board_count; i++ )
+	{
+		BOARD_SIMULATOR* board = new BOARD_SIMULATOR( "SIM" + num_to_str( ( unsigned long ) i + 1 ), config );
+		config.seed += 1;
+
+		boards.push_back( board );
+
+		if ( !board->open() )
+		{
+			LOG_ERROR( "Failed to open board: " + board->get_tag() );
+			GLOBALS::global_exit_flag = true;
+			break;
+		}
+
+		lines += "BOARD\t" + board->get_tag() + "\t" + board->get_device() + "\n";
+	}
+
+	if ( !GLOBALS::global_exit_flag )
+	{
+		if ( !_options.config_out.empty() )
+		{
+			std::ofstream out( _options.config_out.c_str() );
+			out << lines;
+		}
+		else
+		{
+			std::cout << lines << std::flush;
+		}
+
+		BOARD_SIMULATOR::run( boards, &GLOBALS::global_exit_flag );
+	}
+
+	for ( auto i = boards.begin(); i != boards.end(); ++i )
+	{
+		const ST_BOARD_SIM_STATS& s = ( *i )->get_stats();
+		LOG_INFO( ( *i )->get_tag() + ": frames sent: " + num_to_str( s.frames_sent ) + ", commands received: " + num_to_str( s.commands_received ) + ", resets: " + num_to_str( s.resets ) + ", bytes dropped: " + num_to_str( s.bytes_dropped ) );
+		delete( *i );
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Runs SER_IO_COMM against a simulated board and reports how it did.
+ */
+static int do_bench( const ST_SIM_OPTIONS& _options )
+{
+	const ST_BOARD_SIM_CONFIG& config = _options.board_config;
+	uint64_t duration = _options.bench_seconds * 1000000;
+	size_t rtt_samples = _options.rtt_samples;
+	bool reactor_mode = _options.reactor_mode;
+	BOARD_SIMULATOR board( "SIM1", config );
+	int stats_pipe[2];
+
+	if ( !board.open() )
+	{
+		return EXIT_FAILURE;
+	}
+
+	if ( pipe( stats_pipe ) != 0 )
+	{
+		LOG_ERROR( create_perror_string( "pipe" ) );
+		return EXIT_FAILURE;
+	}
+
+	/*
+	 * The board runs in its own process so that the CPU time of this one is all SER_IO_COMM.
+	 */
+	pid_t child = fork();
+
+	if ( child < 0 )
+	{
+		LOG_ERROR( create_perror_string( "fork" ) );
+		return EXIT_FAILURE;
+	}
+
+	if ( child == 0 )
+	{
+		close( stats_pipe[0] );
+
+		std::vector<BOARD_SIMULATOR*> boards( 1, &board );
+		BOARD_SIMULATOR::run( boards, &GLOBALS::global_exit_flag );
+
+		if ( write( stats_pipe[1], &board.get_stats(), sizeof( ST_BOARD_SIM_STATS ) ) != sizeof( ST_BOARD_SIM_STATS ) )
+		{
+			LOG_ERROR( create_perror_string( "Failed to report board stats" ) );
+		}
+
+		close( stats_pipe[1] );
+		_exit( EXIT_SUCCESS );
+	}
+
+	close( stats_pipe[1] );
+
+	SER_IO_COMM* comm = new SER_IO_COMM( board.get_device().c_str(), "BENCH", false );
+	SER_IO_REACTOR* reactor = nullptr;
+	BOARD_STATE_SNAPSHOT snapshot;
+	SERIAL_IO_STATS stats_start;
+	SERIAL_IO_STATS stats_end;
+	std::vector<uint64_t> rtts;
+	size_t rtt_timeouts = 0;
+	int ret = EXIT_SUCCESS;
+
+	if ( comm->init() != ENUM_ERRORS::ERR_NONE )
+	{
+		LOG_ERROR( "Failed to initialize SER_IO_COMM on /dev/" + board.get_device() );
+		delete comm;
+		ret = EXIT_FAILURE;
+		goto done;
+	}
+
+	if ( !_options.capture.empty() && !comm->start_capture( _options.capture ) )
+	{
+		delete comm;
+		ret = EXIT_FAILURE;
+		goto done;
+	}
+
+	if ( reactor_mode )
+	{
+		reactor = new SER_IO_REACTOR( "BENCH" );
+
+		if ( !reactor->init() )
+		{
+			delete reactor;
+			delete comm;
+			ret = EXIT_FAILURE;
+			goto done;
+		}
+
+		reactor->add_board( comm );
+		reactor->start_thread();
+	}
+	else
+	{
+		comm->start_thread();
+	}
+
+	/*
+	 * Wait for the reset and the start of the stream.
+	 */
+	{
+		uint64_t give_up = monotonic_usec() + BENCH_STARTUP_TIMEOUT;
+
+		do
+		{
+			usleep( 10000 );
+			comm->get_io_stats( stats_start );
+		}
+		while ( stats_start.frames_decoded < 10 && monotonic_usec() < give_up && !GLOBALS::global_exit_flag );
+
+		if ( stats_start.frames_decoded < 10 )
+		{
+			LOG_ERROR( "Board never started streaming." );
+			ret = EXIT_FAILURE;
+			goto stop;
+		}
+	}
+
+	/*
+	 * Throughput.  This thread sleeps through it so the CPU time is that of the IO thread.
+	 */
+	{
+		uint64_t cpu_start = rusage_usec();
+		uint64_t time_start = monotonic_usec();
+
+		comm->get_io_stats( stats_start );
+		usleep( ( useconds_t ) duration );
+		comm->get_io_stats( stats_end );
+
+		uint64_t elapsed = monotonic_usec() - time_start;
+		uint64_t cpu = rusage_usec() - cpu_start;
+		uint64_t frames = stats_end.frames_decoded - stats_start.frames_decoded;
+
+		print_stat( "io_mode", ( uint64_t ) reactor_mode );
+		print_stat( "stream_interval_usec", config.stream_interval );
+		print_stat( "elapsed_usec", elapsed );
+		print_stat( "frames_decoded", frames );
+		print_stat( "frames_per_sec", ( double ) frames * 1000000.0 / ( double ) elapsed );
+		print_stat( "bytes_received", stats_end.bytes_received - stats_start.bytes_received );
+		print_stat( "checksum_errors", stats_end.checksum_errors - stats_start.checksum_errors );
+		print_stat( "frames_rejected", stats_end.frames_rejected - stats_start.frames_rejected );
+		print_stat( "lines_decoded", stats_end.lines_decoded - stats_start.lines_decoded );
+		print_stat( "cpu_usec", cpu );
+		print_stat( "cpu_usec_per_frame", ( frames > 0 ? ( double ) cpu / ( double ) frames : 0.0 ) );
+
+		uint64_t recoveries = stats_end.recoveries - stats_start.recoveries;
+		uint64_t recover_usec = stats_end.recover_usec - stats_start.recover_usec;
+
+		print_stat( "hung_boards", stats_end.hung_boards - stats_start.hung_boards );
+		print_stat( "reopen_failures", stats_end.reopen_failures - stats_start.reopen_failures );
+		print_stat( "reset_timeouts", stats_end.reset_timeouts - stats_start.reset_timeouts );
+		print_stat( "recoveries", recoveries );
+		print_stat( "recover_avg_usec", ( recoveries > 0 ? recover_usec / recoveries : 0 ) );
+		print_stat( "recover_max_usec", stats_end.recover_max_usec );
+	}
+
+	/*
+	 * Command round trip.  From queuing a DO change to seeing it in the published snapshot.
+	 */
+	comm->get_state_snapshot( snapshot );
+
+	for ( size_t i = 0; i < rtt_samples && !GLOBALS::global_exit_flag; i++ )
+	{
+		/*
+		 * The new value has to differ from the current one or the round trip is over before it starts.
+		 */
+		uint8_t value = ( uint8_t )( ( snapshot.do_status % 15 ) + 1 );
+		uint64_t start = monotonic_usec();
+		uint64_t give_up = start + BENCH_RTT_TIMEOUT;
+		bool seen = false;
+
+		if ( !comm->cmd_set_do_status( value ) )
+		{
+			rtt_timeouts += 1;
+			continue;
+		}
+
+		while ( monotonic_usec() < give_up )
+		{
+			comm->get_state_snapshot( snapshot );
+
+			if ( snapshot.do_status == value )
+			{
+				seen = true;
+				break;
+			}
+
+			usleep( 10 );
+		}
+
+		if ( seen )
+		{
+			rtts.push_back( monotonic_usec() - start );
+		}
+		else
+		{
+			rtt_timeouts += 1;
+		}
+	}
+
+	print_stat( "rtt_samples", ( uint64_t ) rtts.size() );
+	print_stat( "rtt_timeouts", ( uint64_t ) rtt_timeouts );
+
+	if ( !rtts.empty() )
+	{
+		std::sort( rtts.begin(), rtts.end() );
+		print_stat( "rtt_min_usec", rtts.front() );
+		print_stat( "rtt_p50_usec", rtts[rtts.size() / 2] );
+		print_stat( "rtt_p99_usec", rtts[( rtts.size() * 99 ) / 100] );
+		print_stat( "rtt_max_usec", rtts.back() );
+	}
+
+	comm->get_io_stats( stats_end );
+	print_stat( "cold_attach_usec", stats_end.attach_usec );
+
+	/*
+	 * Warm reattach.  A second instance takes the port of the streaming board over the way a restarted LOGIC_CORE would.
+	 * Only in thread mode.  In reactor mode the first instance belongs to the reactor.
+	 */
+	if ( !reactor_mode && !GLOBALS::global_exit_flag )
+	{
+		comm->stop_thread( true );
+		THREAD_REGISTRY::init_cleanup();
+
+		comm = new SER_IO_COMM( board.get_device().c_str(), "BENCH", false );
+		comm->set_warm_attach( true );
+
+		if ( comm->init() != ENUM_ERRORS::ERR_NONE )
+		{
+			LOG_ERROR( "Failed to reattach SER_IO_COMM to /dev/" + board.get_device() );
+			delete comm;
+			ret = EXIT_FAILURE;
+			goto stop;
+		}
+
+		comm->start_thread();
+
+		uint64_t give_up = monotonic_usec() + BENCH_STARTUP_TIMEOUT;
+
+		while ( !comm->has_valid_state() && monotonic_usec() < give_up && !GLOBALS::global_exit_flag )
+		{
+			usleep( 1000 );
+		}
+
+		comm->get_io_stats( stats_end );
+		print_stat( "warm_attach_usec", stats_end.attach_usec );
+		print_stat( "warm_attaches", stats_end.warm_attaches );
+		print_stat( "attach_fallbacks", stats_end.attach_fallbacks );
+	}
+
+stop:
+	GLOBALS::global_exit_flag = true;
+	THREAD_REGISTRY::stop_all();
+	THREAD_REGISTRY::destroy_global();
+
+done:
+	kill( child, SIGTERM );
+	waitpid( child, nullptr, 0 );
+
+	{
+		ST_BOARD_SIM_STATS board_stats;
+
+		if ( read( stats_pipe[0], &board_stats, sizeof( board_stats ) ) == sizeof( board_stats ) )
+		{
+			print_stat( "board_frames_sent", board_stats.frames_sent );
+			print_stat( "board_bytes_dropped", board_stats.bytes_dropped );
+			print_stat( "board_noise_bursts", board_stats.noise_bursts );
+			print_stat( "board_corrupted_frames", board_stats.corrupted_frames );
+			print_stat( "board_stalls", board_stats.stalls );
+			print_stat( "board_resets", board_stats.resets );
+			print_stat( "board_hangs", board_stats.hangs );
+		}
+	}
+
+	close( stats_pipe[0] );
+	return ret;
+}
+
+/**
+ * Feeds a serial wire capture through the decoder and reports how long it took.
+ * Only the data received from the board is decoded.  The commands sent to the board are counted.
+ */
+static int do_replay( const ST_SIM_OPTIONS& _options )
+{
+	SERIAL_CAPTURE_READER reader;
+	ST_CAPTURE_RECORD record;
+	SERIAL_IO_STATS stats;
+	uint64_t records = 0;
+	uint64_t from_board = 0;
+	uint64_t to_board = 0;
+	uint64_t first_usec = 0;
+	uint64_t last_usec = 0;
+
+	if ( !reader.open( _options.replay ) )
+	{
+		return EXIT_FAILURE;
+	}
+
+	SER_IO_COMM comm( "replay", "REPLAY", false );
+	uint64_t cpu_start = rusage_usec();
+	uint64_t start = monotonic_usec();
+
+	while ( reader.next( record ) && !GLOBALS::global_exit_flag )
+	{
+		if ( records == 0 )
+		{
+			first_usec = record.time_usec;
+		}
+
+		last_usec = record.time_usec;
+		records += 1;
+
+		if ( _options.replay_realtime )
+		{
+			uint64_t due = start + ( record.time_usec - first_usec );
+			uint64_t now = monotonic_usec();
+
+			if ( due > now )
+			{
+				usleep( ( useconds_t )( due - now ) );
+			}
+		}
+
+		if ( record.direction == ENUM_CAPTURE_DIRECTION::FROM_BOARD )
+		{
+			comm.replay_input( record.data, record.length );
+			from_board += record.length;
+		}
+		else
+		{
+			to_board += record.length;
+		}
+	}
+
+	uint64_t elapsed = std::max( ( uint64_t ) 1, monotonic_usec() - start );
+	uint64_t cpu = rusage_usec() - cpu_start;
+	comm.get_io_stats( stats );
+
+	print_stat( "records", records );
+	print_stat( "bytes_from_board", from_board );
+	print_stat( "bytes_to_board", to_board );
+	print_stat( "captured_usec", last_usec - first_usec );
+	print_stat( "elapsed_usec", elapsed );
+	print_stat( "frames_decoded", stats.frames_decoded );
+	print_stat( "frames_per_sec", ( double ) stats.frames_decoded * 1000000.0 / ( double ) elapsed );
+	print_stat( "mbytes_per_sec", ( double ) from_board / ( double ) elapsed );
+	print_stat( "checksum_errors", stats.checksum_errors );
+	print_stat( "frames_rejected", stats.frames_rejected );
+	print_stat( "lines_decoded", stats.lines_decoded );
+	print_stat( "cpu_usec", cpu );
+	print_stat( "cpu_usec_per_frame", ( stats.frames_decoded > 0 ? ( double ) cpu / ( double ) stats.frames_decoded : 0.0 ) );
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Feeds protocol and debug text lines through the decoder and counts the heap allocations made while doing so.
+ * Nothing on the text path should allocate unless debug logging is on.
+ */
+static int do_bench_text( const ST_SIM_OPTIONS& _options )
+{
+	static const char* const lines[] =
+	{
+		"0:9|F CC.CC UP\n",
+		"0:9|F IC.IC UP\n",
+		"0:9|F IC . IC UP . EXTRA\n",
+		"0:1|Debug output from the board\n"
+	};
+	static const size_t line_count = sizeof( lines ) / sizeof( lines[0] );
+	SER_IO_COMM comm( "replay", "TEXT", false );
+	SERIAL_IO_STATS stats;
+
+	/*
+	 * The first pass takes care of the one time allocations.
+	 */
+	for ( size_t i = 0; i < line_count; i++ )
+	{
+		comm.replay_input( ( const unsigned char* ) lines[i], strlen( lines[i] ) );
+	}
+
+	uint64_t allocations = get_allocation_count();
+	uint64_t start = monotonic_usec();
+
+	for ( size_t i = 0; i < _options.text_lines; i++ )
+	{
+		const char* line = lines[i % line_count];
+		comm.replay_input( ( const unsigned char* ) line, strlen( line ) );
+	}
+
+	uint64_t elapsed = std::max( ( uint64_t ) 1, monotonic_usec() - start );
+	allocations = get_allocation_count() - allocations;
+	comm.get_io_stats( stats );
+
+	print_stat( "lines", ( uint64_t ) _options.text_lines );
+	print_stat( "lines_decoded", stats.lines_decoded - line_count );
+	print_stat( "allocations", allocations );
+	print_stat( "allocations_per_line", ( double ) allocations / ( double ) _options.text_lines );
+	print_stat( "ns_per_line", ( double ) elapsed * 1000.0 / ( double ) _options.text_lines );
+	return ( allocations == 0 ? EXIT_SUCCESS : EXIT_FAILURE );
+}
+
+/**
+ * Times a checksum kernel.
+ * \return Nanoseconds per call.
+ */
+static double time_checksum_kernel( const CHECKSUM_KERNEL& _kernel, const unsigned char* _data, size_t _length )
+{
+	uint64_t start = monotonic_usec();
+	uint64_t elapsed = 0;
+	uint64_t calls = 0;
+	volatile uint16_t sink = 0;
+
+	while ( elapsed < CHECKSUM_BENCH_TIME )
+	{
+		for ( size_t i = 0; i < 1000; i++ )
+		{
+			sink = ( uint16_t )( sink + _kernel.sum( _data, _length ) );
+		}
+
+		calls += 1000;
+		elapsed = monotonic_usec() - start;
+	}
+
+	( void ) sink;
+	return ( ( double ) elapsed * 1000.0 ) / ( double ) calls;
+}
+
+/**
+ * Checks every checksum kernel the CPU supports against the scalar kernel and times them.
+ * The buffers are summed at every alignment; one of them is all ones so that the kernels have to carry out of their lanes.
+ */
+static int do_bench_checksum( const ST_SIM_OPTIONS& _options )
+{
+	CHECKSUM_KERNEL kernels[8];
+	size_t kernel_count = get_checksum_kernels( kernels, 8 );
+	size_t bulk_length = std::max( _options.checksum_bytes, ( size_t ) 1 << 20 );
+	std::vector<unsigned char> random_data( bulk_length + 64 );
+	std::vector<unsigned char> ones_data( bulk_length + 64, 0xFF );
+	int ret = EXIT_SUCCESS;
+
+	srandom( _options.board_config.seed );
+
+	for ( size_t i = 0; i < random_data.size(); i++ )
+	{
+		random_data[i] = ( unsigned char )( random() & 0xFF );
+	}
+
+	std::cout << "checksum_kernel_frame=" << get_checksum_kernel( CHECKSUM_FRAME_BYTES ).name << std::endl;
+	std::cout << "checksum_kernel_bulk=" << get_checksum_kernel( _options.checksum_bytes ).name << std::endl;
+
+	for ( size_t k = 0; k < kernel_count; k++ )
+	{
+		const string name = kernels[k].name;
+		size_t mismatches = 0;
+
+		for ( size_t offset = 0; offset < 64; offset++ )
+		{
+			for ( size_t length = 0; length <= 600; length++ )
+			{
+				mismatches += ( kernels[k].sum( random_data.data() + offset, length ) != ones_complement_sum_scalar( random_data.data() + offset, length ) ? 1 : 0 );
+				mismatches += ( kernels[k].sum( ones_data.data() + offset, length ) != ones_complement_sum_scalar( ones_data.data() + offset, length ) ? 1 : 0 );
+			}
+
+			mismatches += ( kernels[k].sum( random_data.data() + offset, bulk_length - offset ) != ones_complement_sum_scalar( random_data.data() + offset, bulk_length - offset ) ? 1 : 0 );
+			mismatches += ( kernels[k].sum( ones_data.data() + offset, bulk_length - offset ) != ones_complement_sum_scalar( ones_data.data() + offset, bulk_length - offset ) ? 1 : 0 );
+		}
+
+		if ( mismatches > 0 )
+		{
+			ret = EXIT_FAILURE;
+		}
+
+		double frame_ns = time_checksum_kernel( kernels[k], random_data.data() + 1, CHECKSUM_FRAME_BYTES );
+		double bulk_ns = time_checksum_kernel( kernels[k], random_data.data() + 1, _options.checksum_bytes );
+
+		print_stat( name + "_mismatches", ( uint64_t ) mismatches );
+		print_stat( name + "_frame_ns", frame_ns );
+		print_stat( name + "_bulk_mbytes_per_sec", ( double ) _options.checksum_bytes * 1000.0 / bulk_ns );
+	}
+
+	{
+		/*
+		 * The kernel picked by length, as the serial decoder sees it.
+		 */
+		const CHECKSUM_KERNEL picked = { "picked", &ones_complement_sum, 0 };
+		double frame_ns = time_checksum_kernel( picked, random_data.data() + 1, CHECKSUM_FRAME_BYTES );
+		double bulk_ns = time_checksum_kernel( picked, random_data.data() + 1, _options.checksum_bytes );
+
+		print_stat( "picked_frame_ns", frame_ns );
+		print_stat( "picked_bulk_mbytes_per_sec", ( double ) _options.checksum_bytes * 1000.0 / bulk_ns );
+	}
+
+	return ret;
+}
+
+/**
+ * Runs the scale test.
+ */
+static int do_scale( const ST_SIM_OPTIONS& _options )
+{
+	ST_SCALE_TEST_CONFIG config;
+	FILE* report = stdout;
+
+	config.board_config = _options.board_config;
+	config.max_boards = _options.scale_boards;
+	config.template_file = _options.scale_template;
+	config.duration = _options.scale_seconds * 1000000;
+	config.request_interval = _options.scale_request_interval;
+	config.reactor_mode = _options.reactor_mode;
+
+	if ( !_options.report.empty() && ( report = fopen( _options.report.c_str(), "w" ) ) == nullptr )
+	{
+		LOG_ERROR( create_perror_string( "Failed to open report file" ) );
+		return EXIT_FAILURE;
+	}
+
+	int ret = run_scale_test( config, report );
+
+	if ( report != stdout )
+	{
+		fclose( report );
+	}
+
+	return ret;
+}
+
+int main( int argc, char** argv )
+{
+	ST_SIM_OPTIONS options = parse_command_line( argc, argv );
+
+	/*
+	 * Standard output is for the configuration lines and the benchmark results.
+	 */
+	GLOBALS::configure_logging( 2, ( options.verbose ? LOGGING::ENUM_LOG_LEVEL::TRACE : LOGGING::ENUM_LOG_LEVEL::WARNING ) );
+	GLOBALS::configure_signals();
+
+	int ret;
+
+	if ( !options.replay.empty() )
+	{
+		ret = do_replay( options );
+	}
+	else if ( options.text_lines > 0 )
+	{
+		ret = do_bench_text( options );
+	}
+	else if ( options.message_count > 0 )
+	{
+		ret = run_message_bench( options.message_count );
+	}
+	else if ( options.checksum_bytes > 0 )
+	{
+		ret = do_bench_checksum( options );
+	}
+	else if ( options.scale_boards > 0 )
+	{
+		ret = do_scale( options );
+	}
+	else if ( options.bench_seconds > 0 )
+	{
+		ret = do_bench( options );
+	}
+	else
+	{
+		ret = do_simulate( options );
+	}
+
+	LOGGING::LOG_CONFIGURATOR::destroy_root_configurator();
+	return ret;
+}
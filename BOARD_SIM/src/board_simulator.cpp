@@ -0,0 +1,830 @@
+/*
+ * This file is part of the software stack for Vic's IO board and its
+ * associated projects.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+ */
+
+#include <pty.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "include/board_simulator.hpp"
+
+#include "lib/threads/serial_io_thread.hpp"
+#include "lib/string_lib.hpp"
+
+using namespace BBB_HVAC;
+using namespace BBB_HVAC::SIM;
+using namespace BBB_HVAC::IOCOMM;
+
+/*
+ * Beyond this the simulated UART starts dropping output, same as the real one would with nobody reading the port.
+ */
+#define SIM_OUTPUT_LIMIT		65536
+
+/*
+ * Longest command the firmware accepts.  The calibration commands are the longest at 17 bytes.
+ */
+#define SIM_MAX_COMMAND_LENGTH	64
+
+#define SIM_READ_CHUNK			512
+
+/*
+ * Longest burst of line noise.
+ */
+#define SIM_MAX_NOISE_BURST		8
+
+BOARD_SIMULATOR::BOARD_SIMULATOR( const std::string& _tag, const ST_BOARD_SIM_CONFIG& _config ) : tag( _tag ), config( _config ), random( _config.seed )
+{
+	INIT_LOGGER( "BBB_HVAC::SIM::BOARD_SIMULATOR[" + _tag + "]" );
+
+	memset( &this->stats, 0, sizeof( this->stats ) );
+	this->master_fd = -1;
+	this->slave_fd = -1;
+
+	for ( size_t i = 0; i < GC_IO_AI_COUNT; i++ )
+	{
+		this->ai_values[i] = ( uint16_t )( 1000 + ( i * 100 ) );
+		this->l1_cal_values[i] = 0;
+		this->l2_cal_values[i] = 0;
+	}
+
+	this->do_status = 0;
+	this->pmic_status = 0;
+	this->boot_count = 1;
+
+	this->streaming = false;
+	this->frames_since_status = 0;
+
+	this->reset_until = 0;
+	this->stall_until = 0;
+	this->hang_until = 0;
+
+	this->next_frame = 0;
+	this->next_stall = 0;
+	this->next_reset = 0;
+	this->next_hang = 0;
+
+	return;
+}
+
+BOARD_SIMULATOR::~BOARD_SIMULATOR()
+{
+	if ( this->master_fd >= 0 )
+	{
+		close( this->master_fd );
+		this->master_fd = -1;
+	}
+
+	if ( this->slave_fd >= 0 )
+	{
+		close( this->slave_fd );
+		this->slave_fd = -1;
+	}
+
+	return;
+}
+
+ST_BOARD_SIM_CONFIG BOARD_SIMULATOR::get_default_config( void )
+{
+	ST_BOARD_SIM_CONFIG ret;
+	memset( &ret, 0, sizeof( ret ) );
+
+	ret.stream_interval = 1000;
+	ret.status_every = 10;
+	ret.reset_length = 500000;
+	ret.seed = 1;
+
+	return ret;
+}
+
+bool BOARD_SIMULATOR::open( void )
+{
+	char name[128];
+	struct termios tio;
+	int flags;
+
+	memset( &tio, 0, sizeof( tio ) );
+	cfmakeraw( &tio );
+
+	if ( openpty( &this->master_fd, &this->slave_fd, name, &tio, nullptr ) != 0 )
+	{
+		LOG_ERROR( create_perror_string( "openpty" ) );
+		return false;
+	}
+
+	/*
+	 * The slave stays open for the life of the simulator.  Otherwise the master reads EIO every time SER_IO_COMM closes the port to recover a hung board.
+	 */
+	if ( ( flags = fcntl( this->master_fd, F_GETFL, 0 ) ) < 0 || fcntl( this->master_fd, F_SETFL, flags | O_NONBLOCK ) < 0 )
+	{
+		LOG_ERROR( create_perror_string( "Failed to make master non-blocking" ) );
+		return false;
+	}
+
+	if ( fcntl( this->master_fd, F_SETFD, FD_CLOEXEC ) < 0 || fcntl( this->slave_fd, F_SETFD, FD_CLOEXEC ) < 0 )
+	{
+		LOG_ERROR( create_perror_string( "Failed to set FD_CLOEXEC" ) );
+		return false;
+	}
+
+	this->device = name;
+
+	if ( this->device.compare( 0, 5, "/dev/" ) == 0 )
+	{
+		this->device = this->device.substr( 5 );
+	}
+
+	uint64_t now = monotonic_usec();
+
+	if ( this->config.stall_interval > 0 )
+	{
+		this->next_stall = now + this->config.stall_interval;
+	}
+
+	if ( this->config.reset_interval > 0 )
+	{
+		this->next_reset = now + this->config.reset_interval;
+	}
+
+	if ( this->config.hang_interval > 0 )
+	{
+		this->next_hang = now + this->config.hang_interval;
+	}
+
+	LOG_INFO( "Simulating board on /dev/" + this->device );
+	return true;
+}
+
+const std::string& BOARD_SIMULATOR::get_device( void ) const
+{
+	return this->device;
+}
+
+int BOARD_SIMULATOR::get_fd( void ) const
+{
+	return this->master_fd;
+}
+
+const std::string& BOARD_SIMULATOR::get_tag( void ) const
+{
+	return this->tag;
+}
+
+const ST_BOARD_SIM_STATS& BOARD_SIMULATOR::get_stats( void ) const
+{
+	return this->stats;
+}
+
+bool BOARD_SIMULATOR::is_reading( void ) const
+{
+	return ( this->stall_until == 0 );
+}
+
+bool BOARD_SIMULATOR::has_output( void ) const
+{
+	return !this->output.empty();
+}
+
+bool BOARD_SIMULATOR::roll( unsigned int _ppm )
+{
+	if ( _ppm == 0 )
+	{
+		return false;
+	}
+
+	return ( ( this->random() % 1000000 ) < _ppm );
+}
+
+void BOARD_SIMULATOR::wander_ai_values( void )
+{
+	for ( size_t i = 0; i < GC_IO_AI_COUNT; i++ )
+	{
+		int v = ( int ) this->ai_values[i] + ( int )( this->random() % 7 ) - 3;
+		this->ai_values[i] = ( uint16_t ) std::max( 0, std::min( 4095, v ) );
+	}
+
+	return;
+}
+
+/***
+ * OUTPUT
+ ***/
+
+void BOARD_SIMULATOR::send_raw( const unsigned char* _data, size_t _length )
+{
+	size_t room = SIM_OUTPUT_LIMIT - std::min( ( size_t ) SIM_OUTPUT_LIMIT, this->output.size() );
+	size_t take = std::min( room, _length );
+
+	this->output.insert( this->output.end(), _data, _data + take );
+	this->stats.bytes_dropped += ( _length - take );
+	return;
+}
+
+void BOARD_SIMULATOR::send_line( const std::string& _line )
+{
+	std::string line = _line + "\r\n";
+
+	this->send_raw( ( const unsigned char* ) line.data(), line.length() );
+	this->stats.lines_sent += 1;
+	return;
+}
+
+void BOARD_SIMULATOR::send_response( unsigned char _cmd, const unsigned char* _data, size_t _length )
+{
+	/*
+	 * Header, data padded to a whole number of words, and the checksum word.  The length in the header covers everything after the header.
+	 */
+	unsigned char frame[6 + SIM_MAX_COMMAND_LENGTH + 2];
+	size_t padded = ( _length + 1 ) & ~( ( size_t ) 1 );
+	size_t payload = padded + 2;
+	size_t total = 6 + payload;
+	uint32_t sum = 0;
+
+	if ( padded > SIM_MAX_COMMAND_LENGTH )
+	{
+		LOG_ERROR( "Response data too long: " + num_to_str( ( unsigned long ) _length ) );
+		return;
+	}
+
+	memset( frame, 0, sizeof( frame ) );
+	frame[0] = 0x10;
+	frame[1] = _cmd;
+	frame[2] = 0x00;	// status LSB
+	frame[3] = 0x00;	// status MSB
+	frame[4] = ( unsigned char )( payload & 0xFF );
+	frame[5] = ( unsigned char )( ( payload >> 8 ) & 0xFF );
+
+	if ( _length > 0 )
+	{
+		memcpy( frame + 6, _data, _length );
+	}
+
+	/*
+	 * One's complement sum of the little endian words.  The words of a good frame, checksum included, add up to 0xFFFF.
+	 */
+	for ( size_t i = 0; i < 6 + padded; i += 2 )
+	{
+		sum += ( uint32_t )( frame[i] | ( frame[i + 1] << 8 ) );
+	}
+
+	sum = ( sum >> 16 ) + ( sum & 0xFFFF );
+	sum += sum >> 16;
+	sum = ~sum & 0xFFFF;
+
+	frame[6 + padded] = ( unsigned char )( sum & 0xFF );
+	frame[6 + padded + 1] = ( unsigned char )( ( sum >> 8 ) & 0xFF );
+
+	if ( this->roll( this->config.noise_ppm ) )
+	{
+		unsigned char noise[SIM_MAX_NOISE_BURST];
+		size_t noise_length = 1 + ( this->random() % SIM_MAX_NOISE_BURST );
+
+		for ( size_t i = 0; i < noise_length; i++ )
+		{
+			noise[i] = ( unsigned char )( this->random() & 0xFF );
+		}
+
+		this->send_raw( noise, noise_length );
+		this->stats.noise_bursts += 1;
+	}
+
+	if ( this->roll( this->config.corruption_ppm ) )
+	{
+		/*
+		 * The marker is left alone so that the host sees a frame that fails the checksum rather than garbage.
+		 */
+		size_t idx = 1 + ( this->random() % ( total - 1 ) );
+		frame[idx] ^= ( unsigned char )( 1 << ( this->random() % 8 ) );
+		this->stats.corrupted_frames += 1;
+	}
+
+	this->send_raw( frame, total );
+	this->stats.frames_sent += 1;
+	return;
+}
+
+void BOARD_SIMULATOR::send_ai_status( void )
+{
+	unsigned char data[GC_IO_AI_COUNT * 2];
+
+	for ( size_t i = 0; i < GC_IO_AI_COUNT; i++ )
+	{
+		data[i * 2] = ( unsigned char )( this->ai_values[i] & 0xFF );
+		data[( i * 2 ) + 1] = ( unsigned char )( ( this->ai_values[i] >> 8 ) & 0xFF );
+	}
+
+	this->send_response( SER_IO_COMM::CMD_ID_GET_AI_STATUS, data, sizeof( data ) );
+	return;
+}
+
+void BOARD_SIMULATOR::send_do_status( void )
+{
+	this->send_response( SER_IO_COMM::CMD_ID_GET_DO_STATUS, &this->do_status, 1 );
+	return;
+}
+
+void BOARD_SIMULATOR::send_pmic_status( void )
+{
+	this->send_response( SER_IO_COMM::CMD_ID_GET_PMIC_STATUS, &this->pmic_status, 1 );
+	return;
+}
+
+void BOARD_SIMULATOR::flush_output( void )
+{
+	while ( !this->output.empty() )
+	{
+		ssize_t written = write( this->master_fd, this->output.data(), this->output.size() );
+
+		if ( written < 0 )
+		{
+			if ( errno == EINTR )
+			{
+				continue;
+			}
+
+			if ( errno != EAGAIN && errno != EWOULDBLOCK )
+			{
+				LOG_ERROR( create_perror_string( "Failed to write to master" ) );
+			}
+
+			break;
+		}
+
+		this->stats.bytes_sent += ( uint64_t ) written;
+		this->output.erase( this->output.begin(), this->output.begin() + written );
+	}
+
+	return;
+}
+
+/***
+ * INPUT
+ ***/
+
+void BOARD_SIMULATOR::handle_input( uint64_t _now )
+{
+	unsigned char buffer[SIM_READ_CHUNK];
+
+	while ( true )
+	{
+		ssize_t bytes_read = read( this->master_fd, buffer, sizeof( buffer ) );
+
+		if ( bytes_read < 0 )
+		{
+			if ( errno == EINTR )
+			{
+				continue;
+			}
+
+			if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EIO )
+			{
+				LOG_ERROR( create_perror_string( "Failed to read from master" ) );
+			}
+
+			break;
+		}
+
+		if ( bytes_read == 0 )
+		{
+			break;
+		}
+
+		if ( this->reset_until == 0 && this->hang_until == 0 )
+		{
+			this->input.insert( this->input.end(), buffer, buffer + bytes_read );
+		}
+	}
+
+	size_t idx = 0;
+
+	while ( idx < this->input.size() )
+	{
+		if ( this->input[idx] != '@' )
+		{
+			/*
+			 * Anything in front of the marker is garbage.  The firmware skips it the same way.
+			 */
+			idx += 1;
+			continue;
+		}
+
+		if ( this->input.size() - idx < 3 )
+		{
+			break;
+		}
+
+		size_t length = ( size_t )( ( this->input[idx + 1] << 8 ) | this->input[idx + 2] );
+
+		if ( length == 0 || length > SIM_MAX_COMMAND_LENGTH )
+		{
+			LOG_WARNING( "Rejecting command with length " + num_to_str( ( unsigned long ) length ) );
+			this->stats.commands_rejected += 1;
+			idx += 1;
+			continue;
+		}
+
+		if ( this->input.size() - idx < 3 + length )
+		{
+			break;
+		}
+
+		this->stats.commands_received += 1;
+		this->process_command( this->input.data() + idx + 3, length, _now );
+		idx += 3 + length;
+
+		if ( this->reset_until != 0 )
+		{
+			/*
+			 * Whatever followed the reset command went nowhere.
+			 */
+			idx = this->input.size();
+		}
+	}
+
+	this->input.erase( this->input.begin(), this->input.begin() + idx );
+	return;
+}
+
+void BOARD_SIMULATOR::process_command( const unsigned char* _payload, size_t _length, uint64_t _now )
+{
+	unsigned char cmd = _payload[0];
+
+	switch ( cmd )
+	{
+		case SER_IO_COMM::CMD_ID_GET_AI_STATUS:
+		{
+			this->send_ai_status();
+			break;
+		}
+
+		case SER_IO_COMM::CMD_ID_GET_DO_STATUS:
+		{
+			this->send_do_status();
+			break;
+		}
+
+		case SER_IO_COMM::CMD_ID_GET_PMIC_STATUS:
+		{
+			this->send_pmic_status();
+			break;
+		}
+
+		case SER_IO_COMM::CMD_ID_GET_L1_CAL_VALS:
+		case SER_IO_COMM::CMD_ID_GET_L2_CAL_VALS:
+		{
+			const uint16_t* values = ( cmd == SER_IO_COMM::CMD_ID_GET_L1_CAL_VALS ? this->l1_cal_values : this->l2_cal_values );
+			unsigned char data[GC_IO_AI_COUNT * 2];
+
+			for ( size_t i = 0; i < GC_IO_AI_COUNT; i++ )
+			{
+				data[i * 2] = ( unsigned char )( values[i] & 0xFF );
+				data[( i * 2 ) + 1] = ( unsigned char )( ( values[i] >> 8 ) & 0xFF );
+			}
+
+			this->send_response( cmd, data, sizeof( data ) );
+			break;
+		}
+
+		case SER_IO_COMM::CMD_ID_GET_BOOT_COUNT:
+		{
+			unsigned char data[2];
+			data[0] = ( unsigned char )( this->boot_count & 0xFF );
+			data[1] = ( unsigned char )( ( this->boot_count >> 8 ) & 0xFF );
+			this->send_response( cmd, data, sizeof( data ) );
+			break;
+		}
+
+		case SER_IO_COMM::CMD_ID_SET_DO_STATUS:
+		case SER_IO_COMM::CMD_ID_SET_PMIC_STATUS:
+		{
+			if ( _length < 2 )
+			{
+				this->send_response( SER_IO_COMM::CMD_ID_SYS_FAILURE, nullptr, 0 );
+				this->stats.commands_rejected += 1;
+				break;
+			}
+
+			this->send_response( cmd, nullptr, 0 );
+
+			/*
+			 * The new state is reported right away.  This is what the host sees of the command round trip.
+			 */
+			if ( cmd == SER_IO_COMM::CMD_ID_SET_DO_STATUS )
+			{
+				this->do_status = _payload[1];
+				this->send_do_status();
+			}
+			else
+			{
+				this->pmic_status = _payload[1];
+				this->send_pmic_status();
+			}
+
+			break;
+		}
+
+		case SER_IO_COMM::CMD_ID_SET_L1_CAL_VALS:
+		case SER_IO_COMM::CMD_ID_SET_L2_CAL_VALS:
+		{
+			uint16_t* values = ( cmd == SER_IO_COMM::CMD_ID_SET_L1_CAL_VALS ? this->l1_cal_values : this->l2_cal_values );
+
+			if ( _length < 1 + ( GC_IO_AI_COUNT * 2 ) )
+			{
+				this->send_response( SER_IO_COMM::CMD_ID_SYS_FAILURE, nullptr, 0 );
+				this->stats.commands_rejected += 1;
+				break;
+			}
+
+			/*
+			 * Calibration values go out MSB first.
+			 */
+			for ( size_t i = 0; i < GC_IO_AI_COUNT; i++ )
+			{
+				values[i] = ( uint16_t )( ( _payload[1 + ( i * 2 )] << 8 ) | _payload[2 + ( i * 2 )] );
+			}
+
+			this->send_response( cmd, nullptr, 0 );
+			break;
+		}
+
+		case SER_IO_COMM::CMD_ID_GET_BOARD_STATS:
+		case SER_IO_COMM::CMD_ID_GET_CONFIRM_OUTPUT:
+		{
+			this->send_response( cmd, nullptr, 0 );
+			break;
+		}
+
+		case SER_IO_COMM::CMD_ID_START_STREAM:
+		{
+			this->send_response( cmd, nullptr, 0 );
+			this->streaming = true;
+			this->frames_since_status = 0;
+			this->next_frame = _now;
+			break;
+		}
+
+		case SER_IO_COMM::CMD_ID_RESET_BOARD:
+		{
+			this->start_reset( _now );
+			break;
+		}
+
+		default:
+		{
+			LOG_WARNING( "Unknown command: " + num_to_str( ( unsigned int ) cmd ) );
+			this->send_response( SER_IO_COMM::CMD_ID_SYS_FAILURE, nullptr, 0 );
+			this->stats.commands_rejected += 1;
+			break;
+		}
+	}
+
+	return;
+}
+
+/***
+ * TIMED BEHAVIOR
+ ***/
+
+void BOARD_SIMULATOR::start_reset( uint64_t _now )
+{
+	this->streaming = false;
+	this->reset_until = _now + std::max( ( uint64_t ) 1, this->config.reset_length );
+	this->input.clear();
+	this->stats.resets += 1;
+	return;
+}
+
+void BOARD_SIMULATOR::tick( uint64_t _now )
+{
+	if ( this->stall_until != 0 && _now >= this->stall_until )
+	{
+		this->stall_until = 0;
+	}
+
+	if ( this->next_stall != 0 && _now >= this->next_stall )
+	{
+		this->stall_until = _now + std::max( ( uint64_t ) 1, this->config.stall_length );
+		this->next_stall = _now + this->config.stall_interval;
+		this->stats.stalls += 1;
+	}
+
+	if ( this->next_hang != 0 && _now >= this->next_hang )
+	{
+		this->next_hang = _now + this->config.hang_interval;
+
+		if ( this->hang_until == 0 )
+		{
+			this->hang_until = _now + std::max( ( uint64_t ) 1, this->config.hang_length );
+			this->input.clear();
+			this->stats.hangs += 1;
+		}
+	}
+
+	if ( this->hang_until != 0 )
+	{
+		if ( _now < this->hang_until )
+		{
+			return;
+		}
+
+		/*
+		 * The firmware carries on where it stopped.  Frames that were due during the hang are not made up.
+		 */
+		this->hang_until = 0;
+	}
+
+	if ( this->next_reset != 0 && _now >= this->next_reset )
+	{
+		this->next_reset = _now + this->config.reset_interval;
+
+		if ( this->reset_until == 0 )
+		{
+			this->start_reset( _now );
+		}
+	}
+
+	if ( this->reset_until != 0 )
+	{
+		if ( _now < this->reset_until )
+		{
+			return;
+		}
+
+		/*
+		 * The communication controller comes up first and then the input controller.  Same lines the firmware prints.
+		 */
+		this->reset_until = 0;
+		this->boot_count += 1;
+		this->do_status = 0;
+		this->pmic_status = 0;
+		this->send_line( "0:9|F CC.CC UP" );
+		this->send_line( "0:9|F IC.IC UP" );
+	}
+
+	if ( this->streaming && this->config.stream_interval > 0 )
+	{
+		/*
+		 * Frames that were due while the loop was busy are not made up.  A real board does not queue them either.
+		 */
+		if ( _now >= this->next_frame )
+		{
+			this->wander_ai_values();
+			this->send_ai_status();
+			this->frames_since_status += 1;
+
+			if ( this->config.status_every > 0 && this->frames_since_status >= this->config.status_every )
+			{
+				this->send_do_status();
+				this->send_pmic_status();
+				this->frames_since_status = 0;
+			}
+
+			this->next_frame += this->config.stream_interval;
+
+			if ( this->next_frame <= _now )
+			{
+				this->next_frame = _now + this->config.stream_interval;
+			}
+		}
+	}
+
+	return;
+}
+
+uint64_t BOARD_SIMULATOR::get_next_deadline( void ) const
+{
+	uint64_t ret = UINT64_MAX;
+
+	if ( this->stall_until != 0 )
+	{
+		ret = std::min( ret, this->stall_until );
+	}
+
+	if ( this->next_stall != 0 )
+	{
+		ret = std::min( ret, this->next_stall );
+	}
+
+	if ( this->next_reset != 0 )
+	{
+		ret = std::min( ret, this->next_reset );
+	}
+
+	if ( this->next_hang != 0 )
+	{
+		ret = std::min( ret, this->next_hang );
+	}
+
+	if ( this->hang_until != 0 )
+	{
+		ret = std::min( ret, this->hang_until );
+	}
+
+	if ( this->reset_until != 0 )
+	{
+		ret = std::min( ret, this->reset_until );
+	}
+	else if ( this->streaming && this->config.stream_interval > 0 )
+	{
+		ret = std::min( ret, this->next_frame );
+	}
+
+	return ret;
+}
+
+void BOARD_SIMULATOR::run( const std::vector<BOARD_SIMULATOR*>& _boards, const volatile bool* _stop )
+{
+	std::vector<struct pollfd> fds( _boards.size() );
+
+	while ( !( *_stop ) )
+	{
+		uint64_t now = monotonic_usec();
+		uint64_t deadline = UINT64_MAX;
+
+		for ( size_t i = 0; i < _boards.size(); i++ )
+		{
+			_boards[i]->tick( now );
+			_boards[i]->flush_output();
+			deadline = std::min( deadline, _boards[i]->get_next_deadline() );
+
+			/*
+			 * A stalled board is not polled for input.  The host's writes back up in the pty the same way they back up behind a dropped CTS line.
+			 */
+			fds[i].fd = _boards[i]->get_fd();
+			fds[i].events = ( short )( ( _boards[i]->is_reading() ? POLLIN : 0 ) | ( _boards[i]->has_output() ? POLLOUT : 0 ) );
+			fds[i].revents = 0;
+		}
+
+		/*
+		 * Stream intervals can be well under a millisecond so the wait is done at microsecond resolution.  Never longer than 100ms so that the stop flag is noticed.
+		 */
+		uint64_t timeout = 100000;
+		timespec ts;
+
+		now = monotonic_usec();
+
+		if ( deadline != UINT64_MAX )
+		{
+			timeout = ( deadline <= now ? 0 : std::min( timeout, deadline - now ) );
+		}
+
+		ts.tv_sec = ( time_t )( timeout / 1000000 );
+		ts.tv_nsec = ( long )( ( timeout % 1000000 ) * 1000 );
+
+		int ready = ppoll( fds.data(), fds.size(), &ts, nullptr );
+
+		if ( ready < 0 )
+		{
+			if ( errno != EINTR )
+			{
+				return;
+			}
+
+			continue;
+		}
+
+		if ( ready == 0 )
+		{
+			continue;
+		}
+
+		now = monotonic_usec();
+
+		for ( size_t i = 0; i < _boards.size(); i++ )
+		{
+			if ( fds[i].revents & POLLIN )
+			{
+				_boards[i]->handle_input( now );
+			}
+
+			if ( fds[i].revents & POLLOUT )
+			{
+				_boards[i]->flush_output();
+			}
+		}
+	}
+
+	return;
+}
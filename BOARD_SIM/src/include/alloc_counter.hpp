@@ -0,0 +1,38 @@
+/*
+ * This file is part of the software stack for Vic's IO board and its
+ * associated projects.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+ */
+
+#ifndef BOARD_SIM_ALLOC_COUNTER_HPP_
+#define BOARD_SIM_ALLOC_COUNTER_HPP_
+
+#include <stdint.h>
+
+namespace BBB_HVAC
+{
+	namespace SIM
+	{
+		/**
+		 * Returns the number of heap allocations made through operator new by the whole process so far.
+		 * BOARD_SIM replaces the global operator new so that the benchmarks can tell whether a code path allocates.
+		 */
+		uint64_t get_allocation_count( void );
+	}
+}
+
+#endif /* BOARD_SIM_ALLOC_COUNTER_HPP_ */
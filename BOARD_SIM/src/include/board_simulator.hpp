@@ -0,0 +1,320 @@
+/*
+ * This file is part of the software stack for Vic's IO board and its
+ * associated projects.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+ */
+
+#ifndef BOARD_SIM_BOARD_SIMULATOR_HPP_
+#define BOARD_SIM_BOARD_SIMULATOR_HPP_
+
+#include <stdint.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "lib/config.hpp"
+#include "lib/logger.hpp"
+
+namespace BBB_HVAC
+{
+	/**
+	 * Everything needed to stand in for IO boards without the hardware.
+	 */
+	namespace SIM
+	{
+		/**
+		 * Simulated board behavior.  All of the intervals are in microseconds; zero turns the behavior off.
+		 */
+		typedef struct
+		{
+			/**
+			 * Interval between analog input frames once the host starts the stream.
+			 */
+			uint64_t stream_interval;
+
+			/**
+			 * A DO and a PMIC status frame is streamed after every this many analog input frames.
+			 */
+			unsigned int status_every;
+
+			/**
+			 * Chance, in parts per million, that a burst of line noise is sent in front of a frame.
+			 */
+			unsigned int noise_ppm;
+
+			/**
+			 * Chance, in parts per million, that a byte of a frame is flipped on the way out.
+			 */
+			unsigned int corruption_ppm;
+
+			/**
+			 * Interval between flow control stalls.
+			 */
+			uint64_t stall_interval;
+
+			/**
+			 * Length of a flow control stall.  The board does not read the port while stalled.
+			 */
+			uint64_t stall_length;
+
+			/**
+			 * Interval between spontaneous board resets.
+			 */
+			uint64_t reset_interval;
+
+			/**
+			 * Time it takes the board to come back up after a reset.
+			 */
+			uint64_t reset_length;
+
+			/**
+			 * Interval between firmware hangs.  A hung board sends nothing and ignores everything, reset commands included.
+			 */
+			uint64_t hang_interval;
+
+			/**
+			 * Length of a firmware hang.
+			 */
+			uint64_t hang_length;
+
+			/**
+			 * Seed of the pseudo random generator.  Same seed, same noise.
+			 */
+			unsigned int seed;
+		} ST_BOARD_SIM_CONFIG;
+
+		/**
+		 * Simulator counters.
+		 */
+		typedef struct
+		{
+			uint64_t frames_sent;
+			uint64_t lines_sent;
+			uint64_t bytes_sent;
+			uint64_t bytes_dropped;
+			uint64_t commands_received;
+			uint64_t commands_rejected;
+			uint64_t noise_bursts;
+			uint64_t corrupted_frames;
+			uint64_t stalls;
+			uint64_t resets;
+			uint64_t hangs;
+		} ST_BOARD_SIM_STATS;
+
+		/**
+		 * Simulates one IO board on the master side of a pseudo terminal.  SER_IO_COMM is pointed at the slave side the same way it would be pointed at /dev/ttyS*.
+		 * The simulator speaks the firmware protocol:  '@' framed binary commands in, 0x10 framed binary responses with a trailing checksum word out,
+		 * stream mode, and the protocol level text lines that announce a reset.
+		 *
+		 * The simulator never blocks.  It is driven by an external loop that waits on the master descriptor and the deadline of the simulator.
+		 * \see run
+		 */
+		class BOARD_SIMULATOR
+		{
+			public:
+				/**
+				 * Constructor.  Instantiating the class DOES NOT open the pseudo terminal.
+				 * \param _tag Tag destined for human consumption used for debugging purposes.
+				 * \param _config Board behavior.
+				 */
+				BOARD_SIMULATOR( const std::string& _tag, const ST_BOARD_SIM_CONFIG& _config );
+				~BOARD_SIMULATOR();
+
+				/**
+				 * Returns the default board behavior:  a 1ms stream, status frames every tenth frame, and no noise, stalls, or resets.
+				 */
+				static ST_BOARD_SIM_CONFIG get_default_config( void );
+
+				/**
+				 * Opens the pseudo terminal.
+				 * \return True on success, false otherwise.
+				 */
+				bool open( void );
+
+				/**
+				 * Returns the slave device name relative to /dev (pts/N).  Suitable for a BOARD configuration line.
+				 */
+				const std::string& get_device( void ) const;
+
+				/**
+				 * Returns the master descriptor.
+				 */
+				int get_fd( void ) const;
+
+				/**
+				 * Returns the tag of the board.
+				 */
+				const std::string& get_tag( void ) const;
+
+				/**
+				 * Returns the counters.
+				 */
+				const ST_BOARD_SIM_STATS& get_stats( void ) const;
+
+				/**
+				 * Is the board reading the port.  False during a flow control stall.
+				 */
+				bool is_reading( void ) const;
+
+				/**
+				 * Does the board have output that the port did not take yet.
+				 */
+				bool has_output( void ) const;
+
+				/**
+				 * Reads and processes whatever the host sent.
+				 * \param _now Current time in microseconds off of CLOCK_MONOTONIC.
+				 */
+				void handle_input( uint64_t _now );
+
+				/**
+				 * Writes as much of the pending output as the port will take.
+				 */
+				void flush_output( void );
+
+				/**
+				 * Runs the timed behavior: stream frames, stalls, resets, and hangs.
+				 * \param _now Current time in microseconds off of CLOCK_MONOTONIC.
+				 */
+				void tick( uint64_t _now );
+
+				/**
+				 * Returns when tick needs to be called next.
+				 */
+				uint64_t get_next_deadline( void ) const;
+
+				/**
+				 * Drives a set of simulators from the calling thread until the supplied flag is raised.
+				 * \param _boards Boards to drive.
+				 * \param _stop Flag that stops the loop.
+				 */
+				static void run( const std::vector<BOARD_SIMULATOR*>& _boards, const volatile bool* _stop );
+
+			protected:
+				/**
+				 * Acts on a single command.
+				 * \param _payload Command payload.  The first byte is the call index.
+				 * \param _length Length of the payload.
+				 * \param _now Current time.
+				 */
+				void process_command( const unsigned char* _payload, size_t _length, uint64_t _now );
+
+				/**
+				 * Queues a binary response.  The payload is padded to a whole number of words and followed by the checksum word.
+				 * \param _cmd Call index the response is for.
+				 * \param _data Response data.
+				 * \param _length Length of the response data.
+				 */
+				void send_response( unsigned char _cmd, const unsigned char* _data, size_t _length );
+
+				/**
+				 * Queues a line of text.  The line terminator is added.
+				 */
+				void send_line( const std::string& _line );
+
+				/**
+				 * Queues raw bytes.  Bytes that do not fit in the output buffer are dropped, same as a UART would.
+				 */
+				void send_raw( const unsigned char* _data, size_t _length );
+
+				/**
+				 * Queues the analog input values.
+				 */
+				void send_ai_status( void );
+
+				/**
+				 * Queues the DO status.
+				 */
+				void send_do_status( void );
+
+				/**
+				 * Queues the PMIC status.
+				 */
+				void send_pmic_status( void );
+
+				/**
+				 * Puts the board in reset.  The board comes back up reset_length microseconds later.
+				 */
+				void start_reset( uint64_t _now );
+
+				/**
+				 * Moves the analog inputs a little.
+				 */
+				void wander_ai_values( void );
+
+				/**
+				 * Returns true with a chance of _ppm parts per million.
+				 */
+				bool roll( unsigned int _ppm );
+
+				std::string tag;
+				std::string device;
+				ST_BOARD_SIM_CONFIG config;
+				ST_BOARD_SIM_STATS stats;
+
+				int master_fd;
+				int slave_fd;
+
+				/**
+				 * Bytes received from the host that do not form a whole command yet.
+				 */
+				std::vector<unsigned char> input;
+
+				/**
+				 * Bytes the port has not taken yet.
+				 */
+				std::vector<unsigned char> output;
+
+				uint16_t ai_values[GC_IO_AI_COUNT];
+				uint16_t l1_cal_values[GC_IO_AI_COUNT];
+				uint16_t l2_cal_values[GC_IO_AI_COUNT];
+				uint8_t do_status;
+				uint8_t pmic_status;
+				uint16_t boot_count;
+
+				bool streaming;
+				unsigned int frames_since_status;
+
+				/**
+				 * Time the board comes out of reset.  Zero when not in reset.
+				 */
+				uint64_t reset_until;
+
+				/**
+				 * Time a flow control stall ends.  Zero when not stalled.
+				 */
+				uint64_t stall_until;
+
+				/**
+				 * Time a firmware hang ends.  Zero when not hung.
+				 */
+				uint64_t hang_until;
+
+				uint64_t next_frame;
+				uint64_t next_stall;
+				uint64_t next_reset;
+				uint64_t next_hang;
+
+				std::minstd_rand random;
+
+				DEF_LOGGER;
+		};
+	}
+}
+
+#endif /* BOARD_SIM_BOARD_SIMULATOR_HPP_ */
@@ -0,0 +1,42 @@
+/*
+ * This file is part of the software stack for Vic's IO board and its
+ * associated projects.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+ */
+
+
+#ifndef BOARD_SIM_MESSAGE_BENCH_HPP_
+#define BOARD_SIM_MESSAGE_BENCH_HPP_
+
+#include <stddef.h>
+
+namespace BBB_HVAC
+{
+	namespace SIM
+	{
+		/**
+		 * Checks the MESSAGE serializer against the previous implementation and times both on a READ_STATUS response.
+		 * Then runs READ_STATUS requests and responses through a MESSAGE_PROCESSOR and counts the heap allocations once its message pool is warm.
+		 * The results are printed as key=value pairs.
+		 * \param _messages Number of messages each implementation serializes.
+		 * \return EXIT_SUCCESS if every check passed, EXIT_FAILURE otherwise.
+		 */
+		int run_message_bench( size_t _messages );
+	}
+}
+
+#endif /* BOARD_SIM_MESSAGE_BENCH_HPP_ */
@@ -0,0 +1,87 @@
+/*
+ * This file is part of the software stack for Vic's IO board and its
+ * associated projects.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+ */
+
+#ifndef BOARD_SIM_SCALE_TEST_HPP_
+#define BOARD_SIM_SCALE_TEST_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "board_simulator.hpp"
+
+namespace BBB_HVAC
+{
+	namespace SIM
+	{
+		/**
+		 * Scale test parameters.
+		 */
+		typedef struct
+		{
+			/**
+			 * Behavior of every simulated board.  Each board gets its own seed.
+			 */
+			ST_BOARD_SIM_CONFIG board_config;
+
+			/**
+			 * The test is run with 1, 2, 4, ... boards up to and including this many.
+			 */
+			size_t max_boards;
+
+			/**
+			 * LOGIC_CORE configuration the generated configurations are based on.  Its first BOARD line is pointed at the first simulated board;
+			 * the rest of the boards get one DO and one AI point each so that the logic loop polls all of them.
+			 */
+			std::string template_file;
+
+			/**
+			 * How long each step is measured for, in microseconds.  The logic loop ticks about once a second.
+			 */
+			uint64_t duration;
+
+			/**
+			 * Time between READ_STATUS requests, in microseconds.  The requests go round robin over the boards.
+			 */
+			uint64_t request_interval;
+
+			/**
+			 * Service the boards from a single reactor thread rather than a thread per board.
+			 */
+			bool reactor_mode;
+		} ST_SCALE_TEST_CONFIG;
+
+		/**
+		 * Runs the LOGIC_CORE threads (serial IO, shim listener, and logic loop) against growing numbers of simulated boards and writes a report.
+		 * Every step runs in a process of its own so that it starts from a clean thread registry; the boards of the step are simulated in yet another process
+		 * so that they do not show up in the CPU numbers.
+		 *
+		 * The report is one record per line, each a list of space separated key=value pairs.  The first pair is always the record type:
+		 * record=step for the summary of a step and record=thread for the CPU time of a single thread within a step.
+		 * \param _config Test parameters.
+		 * \param _report Where the report is written to.
+		 * \return EXIT_SUCCESS if every step ran, EXIT_FAILURE otherwise.
+		 */
+		int run_scale_test( const ST_SCALE_TEST_CONFIG& _config, FILE* _report );
+	}
+}
+
+#endif /* BOARD_SIM_SCALE_TEST_HPP_ */
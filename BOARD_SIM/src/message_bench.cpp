@@ -0,0 +1,1136 @@
+/*
+ * This file is part of the software stack for Vic's IO board and its
+ * associated projects.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+ */
+
+
+#include "include/message_bench.hpp"
+#include "include/alloc_counter.hpp"
+#include "include/board_simulator.hpp"
+
+#include "lib/context.hpp"
+#include "lib/message_processor.hpp"
+#include "lib/serial_io_types.hpp"
+#include "lib/socket_reader.hpp"
+#include "lib/string_lib.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+using namespace BBB_HVAC;
+using namespace BBB_HVAC::SIM;
+using namespace BBB_HVAC::IOCOMM;
+using namespace BBB_HVAC::SERVER;
+
+DEF_LOGGER_STAT( "BBB_HVAC::SIM::MESSAGE_BENCH" );
+
+/**
+ * Longest part the length prefix check goes through.  Takes the total length past 1000.
+ */
+#define MESSAGE_BENCH_MAX_PART 1100
+
+/**
+ * Request/response rounds run before the allocations are counted.  Enough to fill both message queues and the message pool.
+ */
+#define MESSAGE_BENCH_WARMUP ( GC_MESSAGE_POOL_SIZE * 2 )
+
+/**
+ * Size of the single part of the messages run_client_flush sends.  Together they take more than a socket buffer and less than
+ * GC_OUTPUT_BUFFER_HIGH_WATER.
+ */
+#define MESSAGE_BENCH_FLUSH_PART 50000
+
+/**
+ * Number of messages run_client_flush sends.
+ */
+#define MESSAGE_BENCH_FLUSH_MESSAGES 16
+
+/**
+ * How long the remote of run_client_flush leaves the socket alone after the client queued everything.  In microseconds.
+ */
+#define MESSAGE_BENCH_FLUSH_DELAY 100000
+
+/**
+ * Longest run_client_flush may take to deliver the messages once the remote reads.  Well under the select timeout of the context thread.
+ */
+#define MESSAGE_BENCH_FLUSH_MAX_USEC 250000
+
+template <typename T> static void print_stat( const std::string& _key, T _value )
+{
+	std::cout << _key << "=" << _value << std::endl;
+	return;
+}
+
+/**
+ * The serializer MESSAGE used before the single pass one.  Kept here to compare against.
+ */
+static std::string legacy_serialize( const MESSAGE_TYPE& _type, const std::vector<std::string>& _parts )
+{
+	std::vector<std::string> v;
+	v.push_back( _type->label );
+	v.insert( v.end(), _parts.begin(), _parts.end() );
+	std::string pld = join_vector( v, MESSAGE::sep_char );
+	size_t pld_length = pld.length();
+	std::stringstream ret;
+	ret << pld_length;
+	size_t pld_length_length = ret.str().length();
+	ret.str( "" );
+	ret.clear();
+	ret.seekp( std::ios_base::beg );
+	ret << ( pld_length + pld_length_length );
+	pld_length_length = ret.str().length();
+	ret.str( "" );
+	ret.clear();
+	ret.seekp( std::ios_base::beg );
+	ret << ( pld_length_length + pld_length + 2 );
+	ret << MESSAGE::sep_char << pld << std::endl;
+	return ret.str();
+}
+
+/**
+ * Fills in the parts of a READ_STATUS response the way HS_CLIENT_CONTEXT does:  the analog inputs, DO and PMIC status, both sets of calibration values,
+ * and the boot count.
+ */
+static void make_read_status_parts( const timespec& _now, std::vector<std::string>& _parts )
+{
+	const timespec& now = _now;
+
+	_parts.clear();
+
+	for ( size_t i = 0; i < GC_IO_AI_COUNT; i++ )
+	{
+		_parts.push_back( ADC_CACHE_ENTRY( ( uint16_t )( 1000 + i * 311 ), now ).to_string() );
+	}
+
+	_parts.push_back( DO_CACHE_ENTRY( 0x05, now ).to_string() );
+	_parts.push_back( PMIC_CACHE_ENTRY( 0x01, now ).to_string() );
+
+	for ( size_t i = 0; i < GC_IO_AI_COUNT * 2; i++ )
+	{
+		_parts.push_back( CAL_VALUE_ENTRY( ( uint16_t )( 100 + i ), now ).to_string() );
+	}
+
+	_parts.push_back( CACHE_ENTRY_16BIT( 42, now ).to_string() );
+	return;
+}
+
+/**
+ * What MESSAGE_PROCESSOR::send_message used to do:  copy the payload into a buffer of its own and write it in a blocking loop.
+ */
+static void legacy_send( const MESSAGE_PTR& _msg, int _fd )
+{
+	const std::string& payload = _msg->get_payload();
+	std::unique_ptr<char[] > buffer( new char[payload.length()] );
+	memset( buffer.get(), 0, payload.length() );
+	strncpy( buffer.get(), payload.data(), payload.length() );
+	size_t bytes_written = 0;
+
+	while ( bytes_written < payload.length() )
+	{
+		ssize_t rc = write( _fd, buffer.get() + bytes_written, payload.length() - bytes_written );
+
+		if ( rc == -1 )
+		{
+			return;
+		}
+
+		bytes_written += ( size_t ) rc;
+	}
+
+	return;
+}
+
+/**
+ * Reads whatever is waiting in the socket and throws it away.
+ */
+static void drain_socket( int _fd )
+{
+	static char buffer[65536];
+
+	while ( recv( _fd, buffer, sizeof( buffer ), MSG_DONTWAIT ) > 0 )
+	{
+	}
+
+	return;
+}
+
+/**
+ * What the process_hello_message of a v1 client checks:  the HELLO has to be the first message received and may not ask for more than version 1.
+ */
+static bool legacy_hello_accepted( size_t _received, const MESSAGE_PTR& _hello )
+{
+	try
+	{
+		return ( _received == 0 && _hello->get_part_as_ui( 1 ) <= 1 );
+	}
+	catch ( const std::exception& )
+	{
+		return false;
+	}
+}
+
+/**
+ * Connects a peer that offers _peer_version to a server context over a socket pair, pings the server, and waits a second at most for the PONG.
+ * A v1 peer holds every HELLO it receives to the rules of legacy_hello_accepted, where a rejected HELLO would have cost it the connection.
+ * Both ends have to settle on _peer_version, and the server must not hang up.
+ * \return Number of things that did not go as expected.
+ */
+static size_t run_hello_exchange( unsigned int _peer_version )
+{
+	int fds[2];
+
+	if ( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) != 0 )
+	{
+		return 1;
+	}
+
+	/*
+	 * The context owns fds[0] from here on.
+	 */
+	HS_CLIENT_CONTEXT* server = new HS_CLIENT_CONTEXT( fds[0] );
+	server->start_thread();
+
+	MESSAGE_PROCESSOR peer;
+	peer.set_max_protocol( _peer_version );
+	MESSAGE_PTR out = peer.create_hello_message( _peer_version );
+	peer.send_message( out, fds[1] );
+	out = peer.create_ping_message();
+	peer.send_message( out, fds[1] );
+
+	SOCKET_READER reader;
+	size_t failures = 0;
+	size_t received = 0;
+	size_t hellos = 0;
+	bool pong = false;
+	bool hung_up = false;
+	uint64_t deadline = monotonic_usec() + 1000000;
+
+	while ( !pong && !hung_up && monotonic_usec() < deadline )
+	{
+		struct pollfd pfd;
+		pfd.fd = fds[1];
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if ( poll( &pfd, 1, 100 ) <= 0 )
+		{
+			continue;
+		}
+
+		try
+		{
+			reader.read( fds[1] );
+		}
+		catch ( const EXCEPTIONS::CONNECTION_ERROR& e )
+		{
+			hung_up = true;
+		}
+
+		TEXT_VIEW line;
+
+		while ( reader.next_line( line ) )
+		{
+			MESSAGE_PTR in = peer.parse_message( line.data, line.length );
+
+			if ( in->get_message_type()->type == ENUM_MESSAGE_TYPE::HELLO )
+			{
+				hellos += 1;
+
+				try
+				{
+					if ( _peer_version == 1 && !legacy_hello_accepted( received, in ) )
+					{
+						failures += 1;
+					}
+					else if ( peer.process_hello_message() )
+					{
+						/*
+						 * Only a server answers an offer.
+						 */
+						failures += 1;
+					}
+				}
+				catch ( const EXCEPTIONS::PROTOCOL_ERROR& e )
+				{
+					failures += 1;
+				}
+			}
+			else if ( in->get_message_type()->type == ENUM_MESSAGE_TYPE::PONG )
+			{
+				pong = true;
+			}
+
+			received += 1;
+		}
+	}
+
+	/*
+	 * The server opens with 1 and answers an offer of 2 with a second HELLO.  The answer goes out before the PONG.
+	 */
+	if ( !pong || hung_up || hellos != ( _peer_version > 1 ? 2 : 1 ) || peer.get_protocol_version() != _peer_version )
+	{
+		failures += 1;
+	}
+
+	if ( hung_up )
+	{
+		/*
+		 * The context deleted itself on its way out.
+		 */
+		close( fds[1] );
+		return failures;
+	}
+
+	if ( server->message_processor->get_protocol_version() != _peer_version )
+	{
+		failures += 1;
+	}
+
+	server->stop_thread( true );
+	close( fds[1] );
+	return failures;
+}
+
+/**
+ * One of the threads of run_pool_race.
+ */
+typedef struct
+{
+	/**
+	 * Processor whose pool the threads share.
+	 */
+	MESSAGE_PROCESSOR* processor;
+
+	/**
+	 * Number of messages the thread creates.
+	 */
+	size_t messages;
+
+	/**
+	 * Written into every message the thread creates.
+	 */
+	std::string tag;
+
+	/**
+	 * Messages that were changed under the thread.
+	 */
+	size_t mismatches;
+} ST_POOL_RACER;
+
+/**
+ * Creates messages from the shared pool and checks that nobody else touches them while they are held.  A handful are kept at a time so that the
+ * pool has to hand out recycled messages.
+ */
+static void* pool_racer( void* _arg )
+{
+	ST_POOL_RACER* racer = ( ST_POOL_RACER* ) _arg;
+	std::vector<MESSAGE_PTR> held( 8 );
+	std::vector<std::string> parts( 2 );
+
+	parts[0] = racer->tag;
+
+	for ( size_t i = 0; i < racer->messages; i++ )
+	{
+		MESSAGE_PTR& slot = held[i % held.size()];
+
+		if ( slot && ( slot->get_part_as_s( 0 ) != racer->tag || slot->get_part_as_s( 1 ) != num_to_str( ( unsigned long )( i - held.size() ) ) ) )
+		{
+			racer->mismatches += 1;
+		}
+
+		parts[1] = num_to_str( ( unsigned long ) i );
+		slot = racer->processor->create_message( ENUM_MESSAGE_TYPE::READ_STATUS, parts );
+	}
+
+	return nullptr;
+}
+
+/**
+ * Creates messages from two threads at once the way a client program and its context thread do.
+ * \return Number of messages that were handed to both threads.
+ */
+static size_t run_pool_race( size_t _messages )
+{
+	MESSAGE_PROCESSOR processor;
+	ST_POOL_RACER racers[2];
+	pthread_t threads[2];
+	size_t ret = 0;
+
+	for ( size_t i = 0; i < 2; i++ )
+	{
+		racers[i].processor = &processor;
+		racers[i].messages = _messages;
+		racers[i].tag = "RACER" + num_to_str( ( unsigned long ) i );
+		racers[i].mismatches = 0;
+
+		if ( pthread_create( &threads[i], nullptr, pool_racer, &racers[i] ) != 0 )
+		{
+			racers[i].messages = 0;
+			ret += 1;
+		}
+	}
+
+	for ( size_t i = 0; i < 2; i++ )
+	{
+		if ( racers[i].messages > 0 )
+		{
+			pthread_join( threads[i], nullptr );
+		}
+
+		ret += racers[i].mismatches;
+	}
+
+	return ret;
+}
+
+/**
+ * Far end of run_client_flush.  Plays the server:  accepts the client, opens with a HELLO, and stays away from the socket for a while before it
+ * reads the big messages.
+ */
+typedef struct
+{
+	/**
+	 * Listening socket.
+	 */
+	int listen_fd;
+
+	/**
+	 * Number of big messages to wait for.
+	 */
+	size_t messages;
+
+	/**
+	 * Set by the client once it has queued all of the messages.  0 until then.
+	 */
+	std::atomic<uint64_t> start_usec;
+
+	/**
+	 * When the last big message arrived.  0 if it did not.
+	 */
+	uint64_t done_usec;
+} ST_FLUSH_PEER;
+
+/**
+ * \see ST_FLUSH_PEER
+ */
+static void* flush_peer( void* _arg )
+{
+	ST_FLUSH_PEER* peer = ( ST_FLUSH_PEER* ) _arg;
+	MESSAGE_PROCESSOR processor;
+	SOCKET_READER reader;
+	size_t received = 0;
+	int fd = accept( peer->listen_fd, nullptr, nullptr );
+
+	if ( fd < 0 )
+	{
+		return nullptr;
+	}
+
+	try
+	{
+		MESSAGE_PTR hello = processor.create_hello_message( 1 );
+		processor.send_message( hello, fd );
+	}
+	catch ( const exception& e )
+	{
+		close( fd );
+		return nullptr;
+	}
+
+	while ( peer->start_usec == 0 )
+	{
+		usleep( 1000 );
+	}
+
+	usleep( MESSAGE_BENCH_FLUSH_DELAY );
+
+	uint64_t deadline = monotonic_usec() + ( GC_CLIENT_THREAD_SELECT_TIME * 3000000 );
+
+	while ( received < peer->messages && monotonic_usec() < deadline )
+	{
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if ( poll( &pfd, 1, 100 ) <= 0 )
+		{
+			continue;
+		}
+
+		try
+		{
+			reader.read( fd );
+		}
+		catch ( const exception& e )
+		{
+			break;
+		}
+
+		TEXT_VIEW line;
+
+		while ( reader.next_line( line ) )
+		{
+			received += ( line.length >= MESSAGE_BENCH_FLUSH_PART ? 1 : 0 );
+		}
+	}
+
+	if ( received == peer->messages )
+	{
+		peer->done_usec = monotonic_usec();
+	}
+
+	close( fd );
+	return nullptr;
+}
+
+/**
+ * Queues more than the socket takes through a CLIENT_CONTEXT while its thread sits in select, and times how long the rest takes to go out once the
+ * remote starts reading.
+ * \param _usec Set to the time from the remote starting to read to the last message arriving.
+ * \return False if the messages did not make it.
+ */
+static bool run_client_flush( uint64_t& _usec )
+{
+	char dir_template[] = "/tmp/message_bench.XXXXXX";
+	ST_FLUSH_PEER peer;
+	pthread_t peer_thread;
+	CLIENT::CLIENT_CONTEXT* client = nullptr;
+	struct sockaddr_un address;
+	bool ret = false;
+
+	if ( mkdtemp( dir_template ) == nullptr )
+	{
+		return false;
+	}
+
+	std::string socket_file = std::string( dir_template ) + "/socket";
+
+	memset( &address, 0, sizeof( address ) );
+	address.sun_family = AF_UNIX;
+	strncpy( address.sun_path, socket_file.c_str(), sizeof( address.sun_path ) - 1 );
+	peer.listen_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	peer.messages = MESSAGE_BENCH_FLUSH_MESSAGES;
+	peer.start_usec = 0;
+	peer.done_usec = 0;
+
+	if ( peer.listen_fd < 0 || bind( peer.listen_fd, ( sockaddr* ) &address, sizeof( address ) ) != 0 || listen( peer.listen_fd, 1 ) != 0 ||
+			pthread_create( &peer_thread, nullptr, flush_peer, &peer ) != 0 )
+	{
+		close( peer.listen_fd );
+		unlink( socket_file.c_str() );
+		rmdir( dir_template );
+		return false;
+	}
+
+	try
+	{
+		std::vector<std::string> parts( 1, std::string( MESSAGE_BENCH_FLUSH_PART, 'x' ) );
+
+		client = CLIENT::CLIENT_CONTEXT::create_instance( SOCKET_TYPE::DOMAIN, socket_file, 0 );
+		client->connect();
+
+		for ( size_t i = 0; i < MESSAGE_BENCH_FLUSH_MESSAGES; i++ )
+		{
+			MESSAGE_PTR m = client->message_processor->create_message( ENUM_MESSAGE_TYPE::READ_STATUS, parts );
+			client->send_message( m );
+		}
+	}
+	catch ( const exception& e )
+	{
+		LOG_ERROR( "Client flush check failed: " + string( e.what() ) );
+	}
+
+	peer.start_usec = monotonic_usec();
+	pthread_join( peer_thread, nullptr );
+
+	if ( peer.done_usec != 0 )
+	{
+		_usec = peer.done_usec - peer.start_usec - MESSAGE_BENCH_FLUSH_DELAY;
+		ret = true;
+	}
+
+	if ( client != nullptr )
+	{
+		client->stop_thread( true );
+	}
+
+	close( peer.listen_fd );
+	unlink( socket_file.c_str() );
+	rmdir( dir_template );
+	return ret;
+}
+
+/**
+ * Builds the same READ_STATUS response as make_read_status_parts as a binary frame.
+ */
+static MESSAGE_PTR make_read_status_frame( MESSAGE_PROCESSOR& _processor, const timespec& _now )
+{
+	MESSAGE_PTR ret = _processor.create_frame( ENUM_MESSAGE_TYPE::READ_STATUS, ( GC_IO_AI_COUNT * 3 ) + 3 );
+
+	for ( size_t i = 0; i < GC_IO_AI_COUNT; i++ )
+	{
+		ret->append_entry( ( uint16_t )( 1000 + i * 311 ), _now );
+	}
+
+	ret->append_entry( ( uint8_t ) 0x05, _now );
+	ret->append_entry( ( uint8_t ) 0x01, _now );
+
+	for ( size_t i = 0; i < GC_IO_AI_COUNT * 2; i++ )
+	{
+		ret->append_entry( ( uint16_t )( 100 + i ), _now );
+	}
+
+	ret->append_entry( ( uint16_t ) 42, _now );
+	ret->finish_frame();
+	return ret;
+}
+
+int BBB_HVAC::SIM::run_message_bench( size_t _messages )
+{
+	MESSAGE_PROCESSOR processor;
+	MESSAGE_TYPE read_status = MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::READ_STATUS );
+	std::vector<std::string> parts;
+	std::string buffer;
+	size_t bad_lengths = 0;
+	size_t legacy_bad_lengths = 0;
+	int ret = EXIT_SUCCESS;
+
+	/*
+	 * Every message has to carry its own length.  Run the part length through the points where the prefix gains a digit.
+	 */
+	for ( size_t i = 0; i <= MESSAGE_BENCH_MAX_PART; i++ )
+	{
+		parts.clear();
+		parts.push_back( "BOARD1" );
+		parts.push_back( std::string( i, 'x' ) );
+		MESSAGE::serialize( read_status, parts, buffer );
+
+		try
+		{
+			processor.parse_message( buffer );
+		}
+		catch ( const std::exception& e )
+		{
+			bad_lengths += 1;
+		}
+
+		try
+		{
+			processor.parse_message( legacy_serialize( read_status, parts ) );
+		}
+		catch ( const std::exception& e )
+		{
+			legacy_bad_lengths += 1;
+		}
+	}
+
+	timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	make_read_status_parts( now, parts );
+	MESSAGE::serialize( read_status, parts, buffer );
+
+	size_t mismatches = ( buffer != legacy_serialize( read_status, parts ) ? 1 : 0 );
+	size_t message_bytes = buffer.length();
+
+	uint64_t start = monotonic_usec();
+	size_t legacy_bytes = 0;
+
+	for ( size_t i = 0; i < _messages; i++ )
+	{
+		legacy_bytes += legacy_serialize( read_status, parts ).length();
+	}
+
+	uint64_t legacy_elapsed = std::max( ( uint64_t ) 1, monotonic_usec() - start );
+
+	uint64_t allocations = get_allocation_count();
+	size_t bytes = 0;
+	start = monotonic_usec();
+
+	for ( size_t i = 0; i < _messages; i++ )
+	{
+		MESSAGE::serialize( read_status, parts, buffer );
+		bytes += buffer.length();
+	}
+
+	uint64_t elapsed = std::max( ( uint64_t ) 1, monotonic_usec() - start );
+	allocations = get_allocation_count() - allocations;
+
+	/*
+	 * A request parsed and a response created the way a client connection does it.  Once the pool is warm neither should allocate.
+	 */
+	std::string request;
+	MESSAGE::serialize( read_status, std::vector<std::string>( 1, "BOARD1" ), request );
+	uint64_t round_allocations = 0;
+	start = monotonic_usec();
+
+	for ( size_t i = 0; i < _messages + MESSAGE_BENCH_WARMUP; i++ )
+	{
+		if ( i == MESSAGE_BENCH_WARMUP )
+		{
+			round_allocations = get_allocation_count();
+			start = monotonic_usec();
+		}
+
+		MESSAGE_PTR in = processor.parse_message( request );
+		MESSAGE_PTR out = processor.create_message( ENUM_MESSAGE_TYPE::READ_STATUS, parts );
+	}
+
+	uint64_t round_elapsed = std::max( ( uint64_t ) 1, monotonic_usec() - start );
+	round_allocations = get_allocation_count() - round_allocations;
+
+	/*
+	 * The response parsed back the way a client reads it.  The parts have to survive the trip, and once the pool is warm parsing should not allocate.
+	 */
+	MESSAGE::serialize( read_status, parts, buffer );
+	MESSAGE_PTR parsed = processor.parse_message( buffer );
+
+	if ( parsed->get_part_count() != parts.size() )
+	{
+		mismatches += 1;
+	}
+	else
+	{
+		for ( size_t i = 0; i < parts.size(); i++ )
+		{
+			if ( ( parsed->get_part( i ) == parts[i] ) == false )
+			{
+				mismatches += 1;
+			}
+		}
+	}
+
+	parsed.reset();
+	uint64_t parse_allocations = 0;
+	start = monotonic_usec();
+
+	for ( size_t i = 0; i < _messages + MESSAGE_BENCH_WARMUP; i++ )
+	{
+		if ( i == MESSAGE_BENCH_WARMUP )
+		{
+			parse_allocations = get_allocation_count();
+			start = monotonic_usec();
+		}
+
+		MESSAGE_PTR in = processor.parse_message( buffer.data(), buffer.length() );
+	}
+
+	uint64_t parse_elapsed = std::max( ( uint64_t ) 1, monotonic_usec() - start );
+	parse_allocations = get_allocation_count() - parse_allocations;
+
+	/*
+	 * Messages that do not fit the schema of their type have to be turned away.
+	 */
+	const char* bad_messages[] = { "99|READ_STATUS|BOARD1\n", "11|NOTHING\n", "9|PING|X\n", "25|SET_STATUS|BOARD1|0x1\n", "27|SET_STATUS|BOARD1|70000\n",
+								   "19|SET_SP|SP1|warm\n", "25|FORCE_AI_VALUE|BOARD1\n"
+								 };
+	size_t accepted_bad = 0;
+
+	for ( size_t i = 0; i < sizeof( bad_messages ) / sizeof( bad_messages[0] ); i++ )
+	{
+		try
+		{
+			processor.parse_message( bad_messages[i], strlen( bad_messages[i] ) );
+			accepted_bad += 1;
+		}
+		catch ( const std::exception& e )
+		{
+		}
+	}
+
+	/*
+	 * Message type lookups by label, every known label and one that is not.  The map is what the lookup used to be.
+	 */
+	std::vector<std::string> labels;
+	std::map<std::string, MESSAGE_TYPE> legacy_labels;
+
+	for ( size_t i = 0; i < MESSAGE_TYPE_MAPPER::get_message_type_count(); i++ )
+	{
+		MESSAGE_TYPE mt = MESSAGE_TYPE_MAPPER::get_message_type_by_enum( static_cast<ENUM_MESSAGE_TYPE>( i ) );
+		labels.push_back( mt->label );
+		legacy_labels[mt->label] = mt;
+	}
+
+	labels.push_back( "READ_STATUS_RAW_ANALOGX" );
+	size_t lookup_mismatches = 0;
+	size_t lookups = 0;
+	uint64_t lookup_allocations = get_allocation_count();
+	start = monotonic_usec();
+
+	for ( size_t i = 0; i < _messages; i++ )
+	{
+		for ( size_t j = 0; j < labels.size(); j++ )
+		{
+			MESSAGE_TYPE mt = MESSAGE_TYPE_MAPPER::get_message_type_by_label( labels[j].data(), labels[j].length() );
+
+			if ( ( j < labels.size() - 1 ? ( mt == nullptr || static_cast<size_t>( mt->type ) != j ) : mt != nullptr ) )
+			{
+				lookup_mismatches += 1;
+			}
+		}
+
+		lookups += labels.size();
+	}
+
+	uint64_t lookup_elapsed = std::max( ( uint64_t ) 1, monotonic_usec() - start );
+	lookup_allocations = get_allocation_count() - lookup_allocations;
+	size_t legacy_found = 0;
+	start = monotonic_usec();
+
+	for ( size_t i = 0; i < _messages; i++ )
+	{
+		for ( size_t j = 0; j < labels.size(); j++ )
+		{
+			/*
+			 * The label used to be copied out of the line into a string of its own before the lookup.
+			 */
+			auto k = legacy_labels.find( std::string( labels[j].data(), labels[j].length() ) );
+			legacy_found += ( k != legacy_labels.end() ? 1 : 0 );
+		}
+	}
+
+	uint64_t legacy_lookup_elapsed = std::max( ( uint64_t ) 1, monotonic_usec() - start );
+
+	if ( legacy_found != _messages * ( labels.size() - 1 ) )
+	{
+		lookup_mismatches += 1;
+	}
+
+	/*
+	 * Version 2 of the protocol.  Both ends offer 2 in their HELLO; the processor that has not seen a HELLO stays on text.
+	 */
+	MESSAGE_PROCESSOR v2_processor;
+	std::string hello;
+	MESSAGE::serialize( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::HELLO ), { "VERSION", "2" }, hello );
+	v2_processor.parse_message( hello );
+	v2_processor.process_hello_message();
+
+	size_t v2_mismatches = ( v2_processor.get_protocol_version() == 2 && v2_processor.use_binary( ENUM_MESSAGE_TYPE::READ_STATUS ) &&
+							 v2_processor.use_binary( ENUM_MESSAGE_TYPE::SET_STATUS ) == false && processor.use_binary( ENUM_MESSAGE_TYPE::READ_STATUS ) == false ? 0 : 1 );
+	std::string frame = make_read_status_frame( v2_processor, now )->get_payload();
+	uint64_t frame_allocations = 0;
+	size_t frame_bytes = 0;
+	start = monotonic_usec();
+
+	for ( size_t i = 0; i < _messages + MESSAGE_BENCH_WARMUP; i++ )
+	{
+		if ( i == MESSAGE_BENCH_WARMUP )
+		{
+			frame_allocations = get_allocation_count();
+			start = monotonic_usec();
+		}
+
+		frame_bytes = make_read_status_frame( v2_processor, now )->get_payload().length();
+	}
+
+	uint64_t frame_elapsed = std::max( ( uint64_t ) 1, monotonic_usec() - start );
+	frame_allocations = get_allocation_count() - frame_allocations;
+
+	/*
+	 * The frame parsed back has to read the same as the text response, both part by part and entry by entry.
+	 */
+	MESSAGE_PTR text_parsed = processor.parse_message( buffer );
+	MESSAGE_PTR frame_parsed = v2_processor.parse_message( frame.data(), frame.length() );
+
+	if ( frame_parsed->get_part_count() != parts.size() || frame_parsed->is_binary() == false )
+	{
+		v2_mismatches += 1;
+	}
+	else
+	{
+		for ( size_t i = 0; i < parts.size(); i++ )
+		{
+			uint16_t text_value = 0;
+			uint16_t frame_value = 1;
+			timespec text_time;
+			timespec frame_time;
+
+			if ( ( frame_parsed->get_part( i ) == parts[i] ) == false || text_parsed->decode_entry( i, text_value, text_time ) == false ||
+					frame_parsed->decode_entry( i, frame_value, frame_time ) == false || text_value != frame_value ||
+					text_time.tv_sec != frame_time.tv_sec || text_time.tv_nsec != frame_time.tv_nsec )
+			{
+				v2_mismatches += 1;
+			}
+		}
+	}
+
+	uint64_t frame_parse_allocations = 0;
+	start = monotonic_usec();
+
+	for ( size_t i = 0; i < _messages + MESSAGE_BENCH_WARMUP; i++ )
+	{
+		if ( i == MESSAGE_BENCH_WARMUP )
+		{
+			frame_parse_allocations = get_allocation_count();
+			start = monotonic_usec();
+		}
+
+		MESSAGE_PTR in = v2_processor.parse_message( frame.data(), frame.length() );
+	}
+
+	uint64_t frame_parse_elapsed = std::max( ( uint64_t ) 1, monotonic_usec() - start );
+	frame_parse_allocations = get_allocation_count() - frame_parse_allocations;
+
+	/*
+	 * Pulling every entry out of the response, text against binary.
+	 */
+	uint64_t checksum = 0;
+	start = monotonic_usec();
+
+	for ( size_t i = 0; i < _messages; i++ )
+	{
+		for ( size_t j = 0; j < parts.size(); j++ )
+		{
+			uint16_t value = 0;
+			timespec time;
+			text_parsed->decode_entry( j, value, time );
+			checksum += value;
+		}
+	}
+
+	uint64_t text_decode_elapsed = std::max( ( uint64_t ) 1, monotonic_usec() - start );
+	start = monotonic_usec();
+
+	for ( size_t i = 0; i < _messages; i++ )
+	{
+		for ( size_t j = 0; j < parts.size(); j++ )
+		{
+			uint16_t value = 0;
+			timespec time;
+			frame_parsed->decode_entry( j, value, time );
+			checksum -= value;
+		}
+	}
+
+	uint64_t frame_decode_elapsed = std::max( ( uint64_t ) 1, monotonic_usec() - start );
+
+	if ( checksum != 0 )
+	{
+		v2_mismatches += 1;
+	}
+
+	/*
+	 * Frames that are cut short, carry a type that stays text, or show up before version 2 was negotiated have to be turned away.
+	 */
+	std::vector<std::string> bad_frames;
+	std::string bad_frame = frame;
+	BINARY_FRAME::put_u32( &bad_frame[BINARY_FRAME::length_offset], ( uint32_t )( bad_frame.length() - 3 ) );
+	bad_frames.push_back( bad_frame.substr( 0, bad_frame.length() - 3 ) );
+	bad_frame = frame;
+	bad_frame[BINARY_FRAME::type_offset] = ( char ) ENUM_MESSAGE_TYPE::SET_STATUS;
+	bad_frames.push_back( bad_frame );
+	bad_frame = frame;
+	BINARY_FRAME::put_u16( &bad_frame[BINARY_FRAME::part_count_offset], ( uint16_t )( parts.size() + 1 ) );
+	bad_frames.push_back( bad_frame );
+	bad_frame = frame;
+	bad_frame[BINARY_FRAME::header_size] = ( char ) 0x7F;
+	bad_frames.push_back( bad_frame );
+	size_t accepted_bad_frames = 0;
+
+	for ( size_t i = 0; i < bad_frames.size() + 1; i++ )
+	{
+		try
+		{
+			if ( i < bad_frames.size() )
+			{
+				v2_processor.parse_message( bad_frames[i].data(), bad_frames[i].length() );
+			}
+			else
+			{
+				processor.parse_message( frame.data(), frame.length() );
+			}
+
+			accepted_bad_frames += 1;
+		}
+		catch ( const std::exception& e )
+		{
+		}
+	}
+
+	/*
+	 * Sending over a socket pair, against the old copy and blocking write.  The other end is drained after every message.
+	 */
+	int fds[2];
+	size_t send_mismatches = 0;
+	uint64_t send_allocations = 0;
+	uint64_t send_elapsed = 1;
+	uint64_t legacy_send_elapsed = 1;
+	size_t high_water_sends = 0;
+	size_t high_water_bytes = 0;
+
+	if ( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) != 0 )
+	{
+		send_mismatches += 1;
+	}
+	else
+	{
+		start = monotonic_usec();
+
+		for ( size_t i = 0; i < _messages; i++ )
+		{
+			MESSAGE_PTR out = processor.create_message( ENUM_MESSAGE_TYPE::READ_STATUS, parts );
+			legacy_send( out, fds[0] );
+			drain_socket( fds[1] );
+		}
+
+		legacy_send_elapsed = std::max( ( uint64_t ) 1, monotonic_usec() - start );
+
+		for ( size_t i = 0; i < _messages + MESSAGE_BENCH_WARMUP; i++ )
+		{
+			if ( i == MESSAGE_BENCH_WARMUP )
+			{
+				send_allocations = get_allocation_count();
+				start = monotonic_usec();
+			}
+
+			MESSAGE_PTR out = processor.create_message( ENUM_MESSAGE_TYPE::READ_STATUS, parts );
+			processor.send_message( out, fds[0] );
+			drain_socket( fds[1] );
+		}
+
+		send_elapsed = std::max( ( uint64_t ) 1, monotonic_usec() - start );
+		send_allocations = get_allocation_count() - send_allocations;
+
+		/*
+		 * A remote that stops reading.  The sends have to be turned away once the output buffer is past its mark, and everything that was taken
+		 * has to come out the other end whole and in order once the remote reads again.
+		 */
+		MESSAGE_PROCESSOR stalled;
+		MESSAGE_PROCESSOR remote;
+		SOCKET_READER reader;
+
+		try
+		{
+			while ( 1 )
+			{
+				std::vector<std::string> numbered( parts );
+				numbered[0] = num_to_str( ( unsigned long ) high_water_sends );
+				MESSAGE_PTR out = stalled.create_message( ENUM_MESSAGE_TYPE::READ_STATUS, numbered );
+				stalled.send_message( out, fds[0] );
+				high_water_sends += 1;
+				high_water_bytes = std::max( high_water_bytes, stalled.get_pending_output() );
+			}
+		}
+		catch ( const EXCEPTIONS::CONNECTION_ERROR& e )
+		{
+		}
+
+		if ( high_water_bytes > GC_OUTPUT_BUFFER_HIGH_WATER || high_water_bytes == 0 )
+		{
+			send_mismatches += 1;
+		}
+
+		size_t received = 0;
+
+		while ( received < high_water_sends )
+		{
+			stalled.flush_output( fds[0] );
+			reader.read( fds[1] );
+
+			TEXT_VIEW line;
+
+			while ( reader.next_line( line ) )
+			{
+				MESSAGE_PTR in = remote.parse_message( line.data, line.length );
+
+				if ( ( in->get_part( 0 ) == num_to_str( ( unsigned long ) received ) ) == false )
+				{
+					send_mismatches += 1;
+				}
+
+				received += 1;
+			}
+		}
+
+		if ( stalled.get_pending_output() != 0 )
+		{
+			send_mismatches += 1;
+		}
+
+		close( fds[0] );
+		close( fds[1] );
+	}
+
+	/*
+	 * A v1 client that rejects any HELLO above 1 has to be able to talk to a v2 server.  A v2 client gets upgraded by the answer of the server.
+	 */
+	size_t hello_mismatches = run_hello_exchange( 1 ) + run_hello_exchange( 2 );
+	size_t pool_mismatches = run_pool_race( _messages );
+	uint64_t client_flush_usec = 0;
+	bool client_flushed = run_client_flush( client_flush_usec );
+
+	if ( bad_lengths > 0 || mismatches > 0 || allocations > 0 || round_allocations > 0 || parse_allocations > 0 || accepted_bad > 0 || lookup_mismatches > 0 || lookup_allocations > 0 ||
+			v2_mismatches > 0 || frame_allocations > 0 || frame_parse_allocations > 0 || accepted_bad_frames > 0 || send_mismatches > 0 || send_allocations > 0 ||
+			hello_mismatches > 0 || pool_mismatches > 0 || !client_flushed || client_flush_usec > MESSAGE_BENCH_FLUSH_MAX_USEC )
+	{
+		ret = EXIT_FAILURE;
+	}
+
+	print_stat( "message_bytes", ( uint64_t ) message_bytes );
+	print_stat( "messages", ( uint64_t ) _messages );
+	print_stat( "bad_lengths", ( uint64_t ) bad_lengths );
+	print_stat( "legacy_bad_lengths", ( uint64_t ) legacy_bad_lengths );
+	print_stat( "mismatches", ( uint64_t ) mismatches );
+	print_stat( "allocations_per_message", ( double ) allocations / ( double ) std::max( ( size_t ) 1, _messages ) );
+	print_stat( "legacy_ns_per_message", ( double ) legacy_elapsed * 1000.0 / ( double ) std::max( ( size_t ) 1, _messages ) );
+	print_stat( "ns_per_message", ( double ) elapsed * 1000.0 / ( double ) std::max( ( size_t ) 1, _messages ) );
+	print_stat( "legacy_mbytes_per_sec", ( double ) legacy_bytes / ( double ) legacy_elapsed );
+	print_stat( "mbytes_per_sec", ( double ) bytes / ( double ) elapsed );
+	print_stat( "round_allocations_per_message", ( double ) round_allocations / ( double ) std::max( ( size_t ) 1, _messages ) );
+	print_stat( "round_ns_per_message", ( double ) round_elapsed * 1000.0 / ( double ) std::max( ( size_t ) 1, _messages ) );
+	print_stat( "parse_allocations_per_message", ( double ) parse_allocations / ( double ) std::max( ( size_t ) 1, _messages ) );
+	print_stat( "parse_ns_per_message", ( double ) parse_elapsed * 1000.0 / ( double ) std::max( ( size_t ) 1, _messages ) );
+	print_stat( "accepted_bad_messages", ( uint64_t ) accepted_bad );
+	print_stat( "lookup_mismatches", ( uint64_t ) lookup_mismatches );
+	print_stat( "lookup_allocations", lookup_allocations );
+	print_stat( "lookup_ns", ( double ) lookup_elapsed * 1000.0 / ( double ) std::max( ( size_t ) 1, lookups ) );
+	print_stat( "legacy_lookup_ns", ( double ) legacy_lookup_elapsed * 1000.0 / ( double ) std::max( ( size_t ) 1, lookups ) );
+	print_stat( "v2_mismatches", ( uint64_t ) v2_mismatches );
+	print_stat( "frame_bytes", ( uint64_t ) frame_bytes );
+	print_stat( "frame_allocations_per_message", ( double ) frame_allocations / ( double ) std::max( ( size_t ) 1, _messages ) );
+	print_stat( "frame_ns_per_message", ( double ) frame_elapsed * 1000.0 / ( double ) std::max( ( size_t ) 1, _messages ) );
+	print_stat( "frame_parse_allocations_per_message", ( double ) frame_parse_allocations / ( double ) std::max( ( size_t ) 1, _messages ) );
+	print_stat( "frame_parse_ns_per_message", ( double ) frame_parse_elapsed * 1000.0 / ( double ) std::max( ( size_t ) 1, _messages ) );
+	print_stat( "text_decode_ns_per_message", ( double ) text_decode_elapsed * 1000.0 / ( double ) std::max( ( size_t ) 1, _messages ) );
+	print_stat( "frame_decode_ns_per_message", ( double ) frame_decode_elapsed * 1000.0 / ( double ) std::max( ( size_t ) 1, _messages ) );
+	print_stat( "accepted_bad_frames", ( uint64_t ) accepted_bad_frames );
+	print_stat( "send_mismatches", ( uint64_t ) send_mismatches );
+	print_stat( "send_allocations_per_message", ( double ) send_allocations / ( double ) std::max( ( size_t ) 1, _messages ) );
+	print_stat( "legacy_send_ns_per_message", ( double ) legacy_send_elapsed * 1000.0 / ( double ) std::max( ( size_t ) 1, _messages ) );
+	print_stat( "send_ns_per_message", ( double ) send_elapsed * 1000.0 / ( double ) std::max( ( size_t ) 1, _messages ) );
+	print_stat( "high_water_sends", ( uint64_t ) high_water_sends );
+	print_stat( "high_water_bytes", ( uint64_t ) high_water_bytes );
+	print_stat( "hello_mismatches", ( uint64_t ) hello_mismatches );
+	print_stat( "pool_mismatches", ( uint64_t ) pool_mismatches );
+	print_stat( "client_flushed", ( client_flushed ? 1 : 0 ) );
+	print_stat( "client_flush_usec", client_flush_usec );
+	return ret;
+}
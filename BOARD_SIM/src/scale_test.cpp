@@ -0,0 +1,650 @@
+/*
+ * This file is part of the software stack for Vic's IO board and its
+ * associated projects.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+ */
+
+#include "include/scale_test.hpp"
+
+#include "lib/threads/serial_io_thread.hpp"
+#include "lib/threads/serial_io_reactor.hpp"
+#include "lib/threads/shim_listener_thread.hpp"
+#include "lib/threads/HVAC_logic_loop.hpp"
+#include "lib/threads/thread_registry.hpp"
+#include "lib/message_processor.hpp"
+#include "lib/configurator.hpp"
+#include "lib/context.hpp"
+#include "lib/globals.hpp"
+#include "lib/string_lib.hpp"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+using namespace BBB_HVAC;
+using namespace BBB_HVAC::SIM;
+using namespace BBB_HVAC::IOCOMM;
+
+DEF_LOGGER_STAT( "BBB_HVAC::SIM::SCALE_TEST" );
+
+/**
+ * How long a step waits for every board to be reset and streaming.
+ */
+#define SCALE_STARTUP_TIMEOUT 20000000
+
+/**
+ * How many times the client tries to connect to the shim listener.  The listener thread may not be listening yet.
+ */
+#define SCALE_CONNECT_ATTEMPTS 50
+
+/**
+ * Oldest the timestamp of the first analog input in a READ_STATUS reply may be.  The boards stream continuously, so anything older means the
+ * server sent a stale timestamp.
+ */
+#define SCALE_MAX_SAMPLE_AGE 1000000
+
+/**
+ * History window asked for at the end of a step, in milliseconds.  Long enough to hold more samples than fit into one reply.
+ */
+#define SCALE_HISTORY_WINDOW 60000
+
+/**
+ * Tag of the boards past the first one.  Numbered from 2.
+ */
+#define SCALE_BOARD_TAG "SCALE"
+
+/**
+ * Everything a step needs to know about a board.
+ */
+typedef struct
+{
+	std::string tag;
+	std::string device;
+	SER_IO_COMM* comm;
+	uint64_t cpu_start;
+	SERIAL_IO_STATS stats_start;
+} ST_SCALE_BOARD;
+
+static uint64_t self_cpu_usec( void )
+{
+	struct rusage ru;
+	getrusage( RUSAGE_SELF, &ru );
+	return ( ( uint64_t ) ru.ru_utime.tv_sec * 1000000 ) + ( uint64_t ) ru.ru_utime.tv_usec + ( ( uint64_t ) ru.ru_stime.tv_sec * 1000000 ) + ( uint64_t ) ru.ru_stime.tv_usec;
+}
+
+/**
+ * Writes the LOGIC_CORE configuration for a step.  The BOARD lines of the template are replaced by the simulated boards.
+ * \return True on success, false otherwise.
+ */
+static bool write_scale_config( const std::string& _template, const std::string& _dest, std::vector<ST_SCALE_BOARD>& _boards )
+{
+	std::ifstream in( _template.c_str() );
+	std::ofstream out( _dest.c_str() );
+	std::string body;
+	std::string line;
+	std::string first_tag;
+
+	if ( !in.is_open() || !out.is_open() )
+	{
+		LOG_ERROR( "Failed to open " + _template + " or " + _dest );
+		return false;
+	}
+
+	while ( std::getline( in, line ) )
+	{
+		if ( line.compare( 0, 6, "BOARD\t" ) == 0 )
+		{
+			if ( first_tag.empty() )
+			{
+				std::string::size_type end = line.find( '\t', 6 );
+				first_tag = line.substr( 6, ( end == std::string::npos ? std::string::npos : end - 6 ) );
+			}
+
+			continue;
+		}
+
+		body += line + "\n";
+	}
+
+	if ( first_tag.empty() )
+	{
+		LOG_ERROR( "No BOARD line in " + _template );
+		return false;
+	}
+
+	for ( size_t i = 0; i < _boards.size(); i++ )
+	{
+		_boards[i].tag = ( i == 0 ? first_tag : SCALE_BOARD_TAG + num_to_str( ( unsigned long ) i + 1 ) );
+		out << "BOARD\t" << _boards[i].tag << "\t" << _boards[i].device << "\n";
+	}
+
+	out << body;
+
+	for ( size_t i = 1; i < _boards.size(); i++ )
+	{
+		const std::string& tag = _boards[i].tag;
+
+		out << "DO\t" << tag << "\t0\tSCALE OUTPUT\n";
+		out << "AI\t" << tag << "\t0\tSCALE INPUT\tICTD\tF\n";
+		out << "MAP\tDO\t" << tag << "\t0\t" << tag << "_DO_0\n";
+		out << "MAP\tAI\t" << tag << "\t0\t" << tag << "_AI_0\n";
+	}
+
+	return out.good();
+}
+
+/**
+ * Starts the serial IO for all of the boards the same way LOGIC_CORE does.
+ * \param _boards Boards to start.
+ * \param _reactor If not null the boards are serviced by a reactor and the reactor is returned here.
+ * \return True on success, false otherwise.
+ */
+static bool start_scale_io( std::vector<ST_SCALE_BOARD>& _boards, SER_IO_REACTOR** _reactor )
+{
+	SER_IO_REACTOR* reactor = nullptr;
+
+	if ( _reactor != nullptr )
+	{
+		reactor = new SER_IO_REACTOR( "SERIAL_IO_REACTOR" );
+
+		if ( !reactor->init() )
+		{
+			delete reactor;
+			return false;
+		}
+
+		*_reactor = reactor;
+	}
+
+	for ( auto i = _boards.begin(); i != _boards.end(); ++i )
+	{
+		i->comm = new SER_IO_COMM( i->device.c_str(), i->tag, false );
+
+		if ( i->comm->init() != ENUM_ERRORS::ERR_NONE )
+		{
+			LOG_ERROR( "Failed to initialize serial IO for board: " + i->tag );
+			return false;
+		}
+
+		if ( reactor != nullptr )
+		{
+			reactor->add_board( i->comm );
+		}
+		else
+		{
+			i->comm->start_thread();
+		}
+	}
+
+	if ( reactor != nullptr )
+	{
+		reactor->start_thread();
+	}
+
+	return true;
+}
+
+static void print_thread_record( FILE* _report, size_t _board_count, const std::string& _thread, uint64_t _cpu_usec, uint64_t _elapsed )
+{
+	fprintf( _report, "record=thread boards=%zu thread=%s cpu_usec=%llu cpu_pct=%.3f\n", _board_count, _thread.c_str(), ( unsigned long long ) _cpu_usec, ( double ) _cpu_usec * 100.0 / ( double ) _elapsed );
+	return;
+}
+
+/**
+ * Runs a single step of the test.  Runs in a process of its own.
+ * \return Process exit code.
+ */
+static int run_scale_step( const ST_SCALE_TEST_CONFIG& _config, size_t _board_count, FILE* _report )
+{
+	std::vector<BOARD_SIMULATOR*> simulators;
+	std::vector<ST_SCALE_BOARD> boards( _board_count );
+	ST_BOARD_SIM_CONFIG board_config = _config.board_config;
+	char dir_template[] = "/tmp/BOARD_SIM.XXXXXX";
+	int stats_pipe[2];
+	int ret = EXIT_FAILURE;
+
+	for ( size_t i = 0; i < _board_count; i++ )
+	{
+		BOARD_SIMULATOR* sim = new BOARD_SIMULATOR( "SIM" + num_to_str( ( unsigned long ) i + 1 ), board_config );
+		board_config.seed += 1;
+		simulators.push_back( sim );
+
+		if ( !sim->open() )
+		{
+			return EXIT_FAILURE;
+		}
+
+		boards[i].device = sim->get_device();
+		boards[i].comm = nullptr;
+	}
+
+	if ( pipe( stats_pipe ) != 0 )
+	{
+		LOG_ERROR( create_perror_string( "pipe" ) );
+		return EXIT_FAILURE;
+	}
+
+	pid_t child = fork();
+
+	if ( child < 0 )
+	{
+		LOG_ERROR( create_perror_string( "fork" ) );
+		return EXIT_FAILURE;
+	}
+
+	if ( child == 0 )
+	{
+		ST_BOARD_SIM_STATS total;
+		memset( &total, 0, sizeof( total ) );
+		close( stats_pipe[0] );
+
+		BOARD_SIMULATOR::run( simulators, &GLOBALS::global_exit_flag );
+
+		for ( auto i = simulators.begin(); i != simulators.end(); ++i )
+		{
+			total.frames_sent += ( *i )->get_stats().frames_sent;
+			total.bytes_dropped += ( *i )->get_stats().bytes_dropped;
+		}
+
+		if ( write( stats_pipe[1], &total, sizeof( total ) ) != sizeof( total ) )
+		{
+			LOG_ERROR( create_perror_string( "Failed to report board stats" ) );
+		}
+
+		_exit( EXIT_SUCCESS );
+	}
+
+	close( stats_pipe[1] );
+
+	/*
+	 * The board process has its own copies of the descriptors.
+	 */
+	for ( auto i = simulators.begin(); i != simulators.end(); ++i )
+	{
+		delete( *i );
+	}
+
+	simulators.clear();
+
+	std::string dir;
+	std::string config_file;
+	std::string socket_file;
+	SHIM_LISTENER* listener = nullptr;
+	CONFIGURATOR* configurator = nullptr;
+	CLIENT::CLIENT_CONTEXT* client = nullptr;
+	std::vector<uint64_t> latencies;
+	size_t request_failures = 0;
+	size_t stale_replies = 0;
+	size_t history_samples = 0;
+	bool history_failed = false;
+	LOGIC_STATS logic_start;
+	LOGIC_STATS logic_end;
+	uint64_t logic_cpu_start = 0;
+	uint64_t reactor_cpu_start = 0;
+	uint64_t self_cpu_start = 0;
+	uint64_t time_start = 0;
+	SER_IO_REACTOR* reactor = nullptr;
+
+	if ( mkdtemp( dir_template ) == nullptr )
+	{
+		LOG_ERROR( create_perror_string( "mkdtemp" ) );
+		goto done;
+	}
+
+	dir = dir_template;
+	config_file = dir + "/configuration.cfg";
+	socket_file = dir + "/socket";
+
+	if ( !write_scale_config( _config.template_file, config_file, boards ) )
+	{
+		goto done;
+	}
+
+	THREAD_REGISTRY::get_instance();
+	GLOBALS::configure_watchdog();
+
+	try
+	{
+		configurator = new CONFIGURATOR( config_file );
+		configurator->read_file();
+	}
+	catch ( const exception& _e )
+	{
+		LOG_ERROR( "Failed to process generated configuration: " + string( _e.what() ) );
+		goto stop;
+	}
+
+	if ( !start_scale_io( boards, ( _config.reactor_mode ? &reactor : nullptr ) ) )
+	{
+		goto stop;
+	}
+
+	listener = new SHIM_LISTENER( SOCKET_TYPE::DOMAIN, socket_file, 0 );
+
+	try
+	{
+		listener->init();
+	}
+	catch ( const exception& _e )
+	{
+		LOG_ERROR( "Failed to initialize shim listener: " + string( _e.what() ) );
+		delete listener;
+		goto stop;
+	}
+
+	listener->start_thread();
+
+	/*
+	 * Same as LOGIC_CORE the logic loop is only started once every board has a complete state.
+	 */
+	{
+		uint64_t give_up = monotonic_usec() + SCALE_STARTUP_TIMEOUT;
+		size_t streaming = 0;
+
+		while ( streaming < boards.size() && monotonic_usec() < give_up && !GLOBALS::global_exit_flag )
+		{
+			usleep( 10000 );
+			streaming = 0;
+
+			for ( auto i = boards.begin(); i != boards.end(); ++i )
+			{
+				streaming += ( i->comm->has_valid_state() ? 1 : 0 );
+			}
+		}
+
+		if ( streaming < boards.size() )
+		{
+			LOG_ERROR( "Only " + num_to_str( ( unsigned long ) streaming ) + " of " + num_to_str( ( unsigned long ) boards.size() ) + " boards started streaming." );
+			goto stop;
+		}
+	}
+
+	/*
+	 * HVAC_LOGIC_LOOP takes ownership of the CONFIGURATOR instance.
+	 */
+	GLOBALS::logic_instance = new HVAC_LOGIC::HVAC_LOGIC_LOOP( configurator );
+	configurator = nullptr;
+	GLOBALS::logic_instance->start_thread();
+
+	for ( size_t attempt = 0; client == nullptr && attempt < SCALE_CONNECT_ATTEMPTS; attempt++ )
+	{
+		client = CLIENT::CLIENT_CONTEXT::create_instance( SOCKET_TYPE::DOMAIN, socket_file, 0 );
+
+		try
+		{
+			client->connect();
+		}
+		catch ( const exception& _e )
+		{
+			delete client;
+			client = nullptr;
+			usleep( 100000 );
+		}
+	}
+
+	if ( client == nullptr )
+	{
+		LOG_ERROR( "Failed to connect to the shim listener." );
+		goto stop;
+	}
+
+	/*
+	 * Measurement window.  The per thread CPU times are sampled by the threads themselves so they are only as current as their last sample.
+	 */
+	for ( auto i = boards.begin(); i != boards.end(); ++i )
+	{
+		i->cpu_start = i->comm->get_cpu_usec();
+		i->comm->get_io_stats( i->stats_start );
+	}
+
+	GLOBALS::logic_instance->get_logic_stats( logic_start );
+	logic_cpu_start = GLOBALS::logic_instance->get_cpu_usec();
+	reactor_cpu_start = ( reactor != nullptr ? reactor->get_cpu_usec() : 0 );
+	self_cpu_start = self_cpu_usec();
+	time_start = monotonic_usec();
+
+	for ( size_t idx = 0; monotonic_usec() - time_start < _config.duration && !GLOBALS::global_exit_flag; idx++ )
+	{
+		MESSAGE_PTR request = client->message_processor->create_get_status( boards[idx % boards.size()].tag );
+		uint64_t request_start = monotonic_usec();
+
+		try
+		{
+			MESSAGE_PTR reply = client->send_message_and_wait( request );
+			uint16_t value;
+			timespec value_time;
+			timespec do_time;
+
+			/*
+			 * The reply has to decode whichever protocol version was negotiated.
+			 */
+			if ( !reply || reply->get_part_count() != ( GC_IO_AI_COUNT * 3 ) + 3 || reply->decode_entry( 0, value, value_time ) == false ||
+					reply->decode_entry( GC_IO_AI_COUNT, value, do_time ) == false )
+			{
+				request_failures += 1;
+			}
+			else if ( monotonic_usec() - std::min( timespec_to_usec( value_time ), timespec_to_usec( do_time ) ) > SCALE_MAX_SAMPLE_AGE )
+			{
+				/*
+				 * The DO status hardly ever changes value, but every sample still carries a fresh timestamp.
+				 */
+				stale_replies += 1;
+			}
+
+			latencies.push_back( monotonic_usec() - request_start );
+		}
+		catch ( const exception& _e )
+		{
+			/*
+			 * A timed out client context aborts its thread.  There's no point in going on with it.
+			 */
+			LOG_ERROR( "READ_STATUS failed: " + string( _e.what() ) );
+			request_failures += 1;
+			break;
+		}
+
+		if ( _config.request_interval > 0 )
+		{
+			usleep( ( useconds_t ) _config.request_interval );
+		}
+	}
+
+	/*
+	 * The whole history of the first board takes more than one reply can carry.  The server has to thin it out instead of sending a line the
+	 * client can not read.
+	 */
+	try
+	{
+		std::vector<std::string> parts;
+		parts.push_back( boards[0].tag );
+		parts.push_back( num_to_str( ( unsigned long ) SCALE_HISTORY_WINDOW ) );
+		MESSAGE_PTR request = client->message_processor->create_message( ENUM_MESSAGE_TYPE::READ_STATUS_RAW_ANALOG, parts );
+		MESSAGE_PTR reply = client->send_message_and_wait( request );
+
+		if ( !reply || reply->get_part_count() == 0 || reply->get_part_count() % ( GC_IO_AI_COUNT + 2 ) != 0 ||
+				reply->get_part_count() / ( GC_IO_AI_COUNT + 2 ) > GC_IO_HISTORY_REPLY_MAX_SAMPLES )
+		{
+			history_failed = true;
+		}
+		else
+		{
+			history_samples = reply->get_part_count() / ( GC_IO_AI_COUNT + 2 );
+		}
+	}
+	catch ( const exception& _e )
+	{
+		LOG_ERROR( "History request failed: " + string( _e.what() ) );
+		history_failed = true;
+	}
+
+	{
+		uint64_t elapsed = monotonic_usec() - time_start;
+		uint64_t self_cpu = self_cpu_usec() - self_cpu_start;
+		uint64_t logic_cpu = GLOBALS::logic_instance->get_cpu_usec() - logic_cpu_start;
+		uint64_t io_cpu_total = 0;
+		uint64_t io_cpu_max = 0;
+		uint64_t frames = 0;
+		uint64_t checksum_errors = 0;
+
+		GLOBALS::logic_instance->get_logic_stats( logic_end );
+
+		for ( auto i = boards.begin(); i != boards.end(); ++i )
+		{
+			SERIAL_IO_STATS stats;
+			i->comm->get_io_stats( stats );
+			frames += stats.frames_decoded - i->stats_start.frames_decoded;
+			checksum_errors += stats.checksum_errors - i->stats_start.checksum_errors;
+
+			if ( reactor == nullptr )
+			{
+				uint64_t cpu = i->comm->get_cpu_usec() - i->cpu_start;
+				io_cpu_total += cpu;
+				io_cpu_max = std::max( io_cpu_max, cpu );
+				print_thread_record( _report, _board_count, i->tag, cpu, elapsed );
+			}
+		}
+
+		if ( reactor != nullptr )
+		{
+			io_cpu_total = reactor->get_cpu_usec() - reactor_cpu_start;
+			io_cpu_max = io_cpu_total;
+			print_thread_record( _report, _board_count, reactor->get_thread_tag(), io_cpu_total, elapsed );
+		}
+
+		print_thread_record( _report, _board_count, "LOGIC", logic_cpu, elapsed );
+
+		uint64_t ticks = logic_end.ticks - logic_start.ticks;
+		uint64_t lag_samples = logic_end.ingest_lag_samples - logic_start.ingest_lag_samples;
+
+		std::sort( latencies.begin(), latencies.end() );
+
+		fprintf( _report, "record=step boards=%zu io_mode=%s elapsed_usec=%llu process_cpu_usec=%llu", _board_count, ( reactor != nullptr ? "REACTOR" : "THREAD" ), ( unsigned long long ) elapsed, ( unsigned long long ) self_cpu );
+		fprintf( _report, " io_cpu_usec_total=%llu io_cpu_usec_max=%llu", ( unsigned long long ) io_cpu_total, ( unsigned long long ) io_cpu_max );
+
+		fprintf( _report, " logic_cpu_usec=%llu frames_decoded=%llu frames_per_sec=%.1f checksum_errors=%llu", ( unsigned long long ) logic_cpu, ( unsigned long long ) frames, ( double ) frames * 1000000.0 / ( double ) elapsed, ( unsigned long long ) checksum_errors );
+		fprintf( _report, " logic_ticks=%llu tick_usec_avg=%llu tick_usec_max=%llu", ( unsigned long long ) ticks, ( unsigned long long )( ticks > 0 ? ( logic_end.tick_usec_total - logic_start.tick_usec_total ) / ticks : 0 ), ( unsigned long long ) logic_end.tick_usec_max );
+		fprintf( _report, " ingest_lag_usec_avg=%llu ingest_lag_usec_max=%llu", ( unsigned long long )( lag_samples > 0 ? ( logic_end.ingest_lag_usec_total - logic_start.ingest_lag_usec_total ) / lag_samples : 0 ), ( unsigned long long ) logic_end.ingest_lag_usec_max );
+		fprintf( _report,  " protocol=%u read_status_count=%zu read_status_failures=%zu read_status_stale=%zu", client->message_processor->get_protocol_version(), latencies.size(),
+				 request_failures, stale_replies );
+		fprintf( _report, " history_samples=%zu history_failed=%d", history_samples, ( history_failed ? 1 : 0 ) );
+
+		if ( !latencies.empty() )
+		{
+			fprintf( _report, " read_status_usec_p50=%llu read_status_usec_p99=%llu read_status_usec_max=%llu", ( unsigned long long ) latencies[latencies.size() / 2], ( unsigned long long ) latencies[( latencies.size() * 99 ) / 100], ( unsigned long long ) latencies.back() );
+		}
+
+		ret = EXIT_SUCCESS;
+	}
+
+stop:
+	GLOBALS::global_exit_flag = true;
+	THREAD_REGISTRY::stop_all();
+	delete configurator;
+
+done:
+	kill( child, SIGTERM );
+	waitpid( child, nullptr, 0 );
+
+	{
+		ST_BOARD_SIM_STATS board_stats;
+
+		if ( ret == EXIT_SUCCESS && read( stats_pipe[0], &board_stats, sizeof( board_stats ) ) == sizeof( board_stats ) )
+		{
+			fprintf( _report, " board_frames_sent=%llu board_bytes_dropped=%llu", ( unsigned long long ) board_stats.frames_sent, ( unsigned long long ) board_stats.bytes_dropped );
+		}
+	}
+
+	if ( ret == EXIT_SUCCESS )
+	{
+		fprintf( _report, "\n" );
+	}
+	else
+	{
+		fprintf( _report, "record=step boards=%zu status=failed\n", _board_count );
+	}
+
+	fflush( _report );
+	close( stats_pipe[0] );
+
+	if ( !dir.empty() )
+	{
+		unlink( config_file.c_str() );
+		unlink( ( config_file + ".overlay" ).c_str() );
+		unlink( socket_file.c_str() );
+		rmdir( dir.c_str() );
+	}
+
+	return ret;
+}
+
+int BBB_HVAC::SIM::run_scale_test( const ST_SCALE_TEST_CONFIG& _config, FILE* _report )
+{
+	int ret = EXIT_SUCCESS;
+	std::vector<size_t> steps;
+
+	for ( size_t n = 1; n < _config.max_boards; n *= 2 )
+	{
+		steps.push_back( n );
+	}
+
+	steps.push_back( _config.max_boards );
+
+	for ( auto i = steps.begin(); i != steps.end() && !GLOBALS::global_exit_flag; ++i )
+	{
+		LOG_INFO( "Running step with " + num_to_str( ( unsigned long ) *i ) + " board(s)." );
+		fflush( _report );
+
+		pid_t child = fork();
+
+		if ( child < 0 )
+		{
+			LOG_ERROR( create_perror_string( "fork" ) );
+			return EXIT_FAILURE;
+		}
+
+		if ( child == 0 )
+		{
+			/*
+			 * Threads are left to the exit.  Nothing in the step process is worth tearing down cleanly.
+			 */
+			_exit( run_scale_step( _config, *i, _report ) );
+		}
+
+		int status = 0;
+
+		while ( waitpid( child, &status, 0 ) < 0 && errno == EINTR )
+		{
+		}
+
+		if ( !WIFEXITED( status ) || WEXITSTATUS( status ) != EXIT_SUCCESS )
+		{
+			LOG_ERROR( "Step with " + num_to_str( ( unsigned long ) *i ) + " board(s) failed." );
+			ret = EXIT_FAILURE;
+		}
+	}
+
+	return ret;
+}
@@ -42,6 +42,7 @@ class MyContext(CLANGContext):
 			SourceFile("threads/HVAC_logic_loop.cpp"),
 			SourceFile("threads/logic_thread.cpp"),
 			SourceFile("threads/serial_io_thread.cpp"),
+			SourceFile("threads/serial_io_reactor.cpp"),
 			SourceFile("threads/shim_listener_thread.cpp"),
 			SourceFile("threads/thread_base.cpp"),
 			SourceFile("threads/thread_registry.cpp"),
@@ -59,8 +60,10 @@ class MyContext(CLANGContext):
 			SourceFile("message_processor.cpp"),
 			SourceFile("message_types.cpp"),
 			SourceFile("serial_io_types.cpp"),
+			SourceFile("serial_capture.cpp"),
 			SourceFile("socket_reader.cpp"),
 			SourceFile("string_lib.cpp"),
+			SourceFile("checksum.cpp"),
 			SourceFile("command_line_parms.cpp"),
 			SourceFile("configurator/set_point.cpp"),
 			SourceFile("configurator/board_point.cpp"),
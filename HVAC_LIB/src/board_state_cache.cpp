@@ -19,24 +19,32 @@
 */
 
 #include "lib/board_state_cache.hpp"
+#include "lib/string_lib.hpp"
 
 namespace BBB_HVAC
 {
 	namespace IOCOMM
 	{
-		BOARD_STATE_CACHE::BOARD_STATE_CACHE( const std::string& _board_id )
+		BOARD_STATE_CACHE::BOARD_STATE_CACHE( const std::string& _board_id, size_t _history_depth ) : history( _history_depth )
 		{
 			this->pmic_cache_index = 0;
 			this->adc_cache_index = 0;
 			this->do_cache_index = 0;
 			this->l1_cal_cache_index = 0;
 			this->l2_cal_cache_index = 0;
+			this->boot_count = 0;
+			this->generation = 0;
 
 			for ( unsigned int i = 0; i < GC_IO_AI_COUNT; i++ )
 			{
 				this->forced_ai_value[i] = false;
 			}
 
+			for ( unsigned int i = 0; i < BOARD_STATE_FIELD_COUNT; i++ )
+			{
+				this->field_generations[i] = 0;
+			}
+
 			this->board_id = _board_id;
 
 			INIT_LOGGER( "BBB_HVAC::BOARD_STATE_CACHE(" + this->board_id + ")" );
@@ -44,8 +52,66 @@ namespace BBB_HVAC
 			return;
 		}
 
+		void BOARD_STATE_CACHE::mark_changed( uint32_t _mask )
+		{
+			for ( unsigned int i = 0; i < BOARD_STATE_FIELD_COUNT; i++ )
+			{
+				if ( _mask & ( 1u << i ) )
+				{
+					this->field_generations[i] = this->generation;
+				}
+			}
+
+			return;
+		}
+
+		uint64_t BOARD_STATE_CACHE::get_generation( void ) const
+		{
+			return this->generation;
+		}
+
+		uint32_t BOARD_STATE_CACHE::get_changes_since( uint64_t _generation ) const
+		{
+			uint32_t ret = 0;
+
+			for ( unsigned int i = 0; i < BOARD_STATE_FIELD_COUNT; i++ )
+			{
+				if ( this->field_generations[i] > _generation )
+				{
+					ret |= ( 1u << i );
+				}
+			}
+
+			return ret;
+		}
+
+		uint32_t BOARD_STATE_CACHE::get_changes_since( const BOARD_STATE_SNAPSHOT& _snapshot, uint64_t _generation )
+		{
+			uint32_t ret = 0;
+
+			for ( unsigned int i = 0; i < BOARD_STATE_FIELD_COUNT; i++ )
+			{
+				if ( _snapshot.field_generations[i] > _generation )
+				{
+					ret |= ( 1u << i );
+				}
+			}
+
+			return ret;
+		}
+
 		void BOARD_STATE_CACHE::add_pmic_status( uint8_t _value )
 		{
+			size_t previous_index = ( this->pmic_cache_index == 0 ? GC_IO_STATE_BUFFER_DEPTH - 1 : this->pmic_cache_index - 1 );
+			bool changed = ( this->pmic_cache[previous_index].get_value() != _value );
+
+			this->generation += 1;
+
+			if ( changed )
+			{
+				this->mark_changed( 1u << BOARD_STATE_FIELD_PMIC );
+			}
+
 			this->pmic_cache[this->pmic_cache_index] = PMIC_CACHE_ENTRY( _value );
 			this->pmic_cache_index += 1;
 
@@ -59,6 +125,16 @@ namespace BBB_HVAC
 
 		void BOARD_STATE_CACHE::add_do_status( uint8_t _value )
 		{
+			size_t previous_index = ( this->do_cache_index == 0 ? GC_IO_STATE_BUFFER_DEPTH - 1 : this->do_cache_index - 1 );
+			bool changed = ( this->do_cache[previous_index].get_value() != _value );
+
+			this->generation += 1;
+
+			if ( changed )
+			{
+				this->mark_changed( 1u << BOARD_STATE_FIELD_DO );
+			}
+
 			this->do_cache[this->do_cache_index] = DO_CACHE_ENTRY( _value );
 			this->do_cache_index += 1;
 
@@ -87,12 +163,16 @@ namespace BBB_HVAC
 			//LOG_DEBUG( "Forcing AI" + num_to_str( _x_index ) + " to " + num_to_str( _value ) );
 			this->forced_ai_value[_x_index] = true;
 			this->adc_cache[this->get_previous_cache_index()][_x_index] = ADC_CACHE_ENTRY( _value );
+			this->generation += 1;
+			this->mark_changed( 1u << ( BOARD_STATE_FIELD_AI + _x_index ) );
 			return true;
 		}
 		bool BOARD_STATE_CACHE::unforce_ai_value( size_t _x_index )
 		{
 			LOG_DEBUG( "Unforcing AI" + num_to_str( _x_index ) );
 			this->forced_ai_value[_x_index] = false;
+			this->generation += 1;
+			this->mark_changed( 1u << ( BOARD_STATE_FIELD_AI + _x_index ) );
 			return true;
 		}
 
@@ -103,11 +183,18 @@ namespace BBB_HVAC
 				throw out_of_range( "Supplied x_index " + num_to_str( _x_index ) + " is greater than number of defined analog inputs.  See GC_IO_AI_COUNT." );
 			}
 
+			this->generation += 1;
+
 			if ( this->forced_ai_value[_x_index] == false )
 			{
 				/*
 				Value is not forced.  Set value
 				*/
+				if ( this->adc_cache[this->get_previous_cache_index()][_x_index].get_value() != _value )
+				{
+					this->mark_changed( 1u << ( BOARD_STATE_FIELD_AI + _x_index ) );
+				}
+
 				this->adc_cache[this->adc_cache_index][_x_index] = ADC_CACHE_ENTRY( _value );
 			}
 			else
@@ -121,6 +208,22 @@ namespace BBB_HVAC
 
 			if ( _x_index == GC_IO_AI_COUNT - 1 )
 			{
+				/*
+				The row is complete.  Record it along with the DO and PMIC status as they stand right now.
+				*/
+				uint16_t row[GC_IO_AI_COUNT];
+				DO_CACHE_ENTRY do_status;
+				PMIC_CACHE_ENTRY pmic_status;
+
+				for ( size_t i = 0; i < GC_IO_AI_COUNT; i++ )
+				{
+					row[i] = this->adc_cache[this->adc_cache_index][i].get_value();
+				}
+
+				this->get_latest_do_status( do_status );
+				this->get_latest_pmic_status( pmic_status );
+				this->history.add_sample( row, do_status.get_value(), pmic_status.get_value(), monotonic_usec() );
+
 				this->adc_cache_index += 1;
 			}
 
@@ -132,12 +235,21 @@ namespace BBB_HVAC
 			return;
 		}
 
+		const BOARD_STATE_HISTORY& BOARD_STATE_CACHE::get_history( void ) const
+		{
+			return this->history;
+		}
+
 		void BOARD_STATE_CACHE::add_l1_cal_value( size_t _x_index, uint16_t _value )
 		{
+			this->generation += 1;
+			this->mark_changed( 1u << BOARD_STATE_FIELD_L1_CAL );
 			this->add_cal_value( _x_index, _value, this->l1_cal_cache_index, ( this->cal_l1_cache ) );
 		}
 		void BOARD_STATE_CACHE::add_l2_cal_value( size_t _x_index, uint16_t _value )
 		{
+			this->generation += 1;
+			this->mark_changed( 1u << BOARD_STATE_FIELD_L2_CAL );
 			this->add_cal_value( _x_index, _value, this->l1_cal_cache_index, ( this->cal_l2_cache ) );
 		}
 
@@ -246,6 +358,13 @@ namespace BBB_HVAC
 
 		void BOARD_STATE_CACHE::set_boot_count( uint16_t _value )
 		{
+			this->generation += 1;
+
+			if ( this->boot_count != _value )
+			{
+				this->mark_changed( 1u << BOARD_STATE_FIELD_BOOT_COUNT );
+			}
+
 			this->boot_count = _value;
 		}
 
@@ -267,6 +386,51 @@ namespace BBB_HVAC
 				_dest[i] = this->cal_l1_cache[index][i];
 			}
 		}
+		void BOARD_STATE_CACHE::fill_snapshot( BOARD_STATE_SNAPSHOT& _dest )
+		{
+			ADC_CACHE_ENTRY adc_values[GC_IO_AI_COUNT];
+			CAL_VALUE_ENTRY l1_cal_values[GC_IO_AI_COUNT];
+			CAL_VALUE_ENTRY l2_cal_values[GC_IO_AI_COUNT];
+			DO_CACHE_ENTRY do_status;
+			PMIC_CACHE_ENTRY pmic_status;
+
+			/*
+			Go through the regular accessors so that the snapshot and the cache can never disagree on what "latest" means.
+			*/
+			this->get_latest_adc_values( adc_values );
+			this->get_latest_l1_cal_values( l1_cal_values );
+			this->get_latest_l2_cal_values( l2_cal_values );
+			this->get_latest_do_status( do_status );
+			this->get_latest_pmic_status( pmic_status );
+
+			for ( size_t i = 0; i < GC_IO_AI_COUNT; i++ )
+			{
+				_dest.ai_values[i] = adc_values[i].get_value();
+				_dest.ai_timestamps[i] = adc_values[i].get_timestamp();
+				_dest.ai_forced[i] = this->forced_ai_value[i];
+				_dest.l1_cal_values[i] = l1_cal_values[i].get_value();
+				_dest.l1_cal_timestamps[i] = l1_cal_values[i].get_timestamp();
+				_dest.l2_cal_values[i] = l2_cal_values[i].get_value();
+				_dest.l2_cal_timestamps[i] = l2_cal_values[i].get_timestamp();
+			}
+
+			_dest.do_status = do_status.get_value();
+			_dest.do_timestamp = do_status.get_timestamp();
+			_dest.pmic_status = pmic_status.get_value();
+			_dest.pmic_timestamp = pmic_status.get_timestamp();
+			_dest.boot_count = this->boot_count;
+			_dest.generation = this->generation;
+
+			for ( unsigned int i = 0; i < BOARD_STATE_FIELD_COUNT; i++ )
+			{
+				_dest.field_generations[i] = this->field_generations[i];
+			}
+
+			clock_gettime( CLOCK_MONOTONIC, &_dest.published );
+
+			return;
+		}
+
 		void BOARD_STATE_CACHE::get_latest_l2_cal_values( CAL_VALUE_ENTRY( & _dest ) [GC_IO_AI_COUNT] ) const
 		{
 			size_t index = 0;
@@ -285,5 +449,202 @@ namespace BBB_HVAC
 				_dest[i] = this->cal_l2_cache[index][i];
 			}
 		}
+
+		/************************************************************************
+		 *
+		 * BOARD_STATE_HISTORY
+		 *
+		 ************************************************************************/
+
+		BOARD_STATE_HISTORY::BOARD_STATE_HISTORY( size_t _depth )
+		{
+			this->depth = _depth;
+			this->head = 0;
+			this->count = 0;
+
+			this->time_column.resize( _depth, 0 );
+			this->do_column.resize( _depth, 0 );
+			this->pmic_column.resize( _depth, 0 );
+
+			for ( size_t i = 0; i < GC_IO_AI_COUNT; i++ )
+			{
+				this->ai_columns[i].resize( _depth, 0 );
+			}
+
+			return;
+		}
+
+		void BOARD_STATE_HISTORY::add_sample( const uint16_t( & _ai_values ) [GC_IO_AI_COUNT], uint8_t _do_status, uint8_t _pmic_status, uint64_t _time_usec )
+		{
+			if ( this->depth == 0 )
+			{
+				return;
+			}
+
+			this->time_column[this->head] = _time_usec;
+			this->do_column[this->head] = _do_status;
+			this->pmic_column[this->head] = _pmic_status;
+
+			for ( size_t i = 0; i < GC_IO_AI_COUNT; i++ )
+			{
+				this->ai_columns[i][this->head] = _ai_values[i];
+			}
+
+			this->head += 1;
+
+			if ( this->head == this->depth )
+			{
+				this->head = 0;
+			}
+
+			if ( this->count < this->depth )
+			{
+				this->count += 1;
+			}
+
+			return;
+		}
+
+		size_t BOARD_STATE_HISTORY::to_column_index( size_t _position ) const
+		{
+			/*
+			When the history is not full yet the oldest sample is in column 0, otherwise it's the one the head is about to overwrite.
+			*/
+			size_t oldest = ( this->count < this->depth ? 0 : this->head );
+			size_t idx = oldest + _position;
+
+			if ( idx >= this->depth )
+			{
+				idx -= this->depth;
+			}
+
+			return idx;
+		}
+
+		size_t BOARD_STATE_HISTORY::find_position( uint64_t _time_usec ) const
+		{
+			size_t low = 0;
+			size_t high = this->count;
+
+			while ( low < high )
+			{
+				size_t mid = low + ( ( high - low ) / 2 );
+
+				if ( this->time_column[this->to_column_index( mid )] < _time_usec )
+				{
+					low = mid + 1;
+				}
+				else
+				{
+					high = mid;
+				}
+			}
+
+			return low;
+		}
+
+		size_t BOARD_STATE_HISTORY::get_samples( uint64_t _from_usec, uint64_t _to_usec, size_t _decimation, std::vector<BOARD_HISTORY_SAMPLE>& _dest ) const
+		{
+			size_t step = ( _decimation == 0 ? 1 : _decimation );
+			size_t added = 0;
+
+			for ( size_t pos = this->find_position( _from_usec ); pos < this->count; pos += step )
+			{
+				size_t idx = this->to_column_index( pos );
+
+				if ( this->time_column[idx] > _to_usec )
+				{
+					break;
+				}
+
+				BOARD_HISTORY_SAMPLE sample;
+				sample.time_usec = this->time_column[idx];
+				sample.do_status = this->do_column[idx];
+				sample.pmic_status = this->pmic_column[idx];
+
+				for ( size_t i = 0; i < GC_IO_AI_COUNT; i++ )
+				{
+					sample.ai_values[i] = this->ai_columns[i][idx];
+				}
+
+				_dest.push_back( sample );
+				added += 1;
+			}
+
+			return added;
+		}
+
+		size_t BOARD_STATE_HISTORY::get_depth( void ) const
+		{
+			return this->depth;
+		}
+
+		size_t BOARD_STATE_HISTORY::get_count( void ) const
+		{
+			return this->count;
+		}
+
+		/************************************************************************
+		 *
+		 * BOARD_STATE_PUBLISHER
+		 *
+		 ************************************************************************/
+
+		BOARD_STATE_PUBLISHER::BOARD_STATE_PUBLISHER()
+		{
+			BOARD_STATE_SNAPSHOT empty;
+			memset( &empty, 0, sizeof( empty ) );
+
+			this->sequence.store( 0, std::memory_order_relaxed );
+			this->publish( empty );
+			return;
+		}
+
+		void BOARD_STATE_PUBLISHER::publish( const BOARD_STATE_SNAPSHOT& _src )
+		{
+			uint32_t buffer[WORD_COUNT];
+			uint32_t seq = this->sequence.load( std::memory_order_relaxed );
+
+			buffer[WORD_COUNT - 1] = 0;
+			memcpy( buffer, &_src, sizeof( BOARD_STATE_SNAPSHOT ) );
+
+			/*
+			Odd sequence tells the readers that the words are in flux.  The fence keeps the word stores from being hoisted above it.
+			*/
+			this->sequence.store( seq + 1, std::memory_order_relaxed );
+			std::atomic_thread_fence( std::memory_order_release );
+
+			for ( size_t i = 0; i < WORD_COUNT; i++ )
+			{
+				this->words[i].store( buffer[i], std::memory_order_relaxed );
+			}
+
+			this->sequence.store( seq + 2, std::memory_order_release );
+			return;
+		}
+
+		void BOARD_STATE_PUBLISHER::read( BOARD_STATE_SNAPSHOT& _dest ) const
+		{
+			uint32_t buffer[WORD_COUNT];
+			uint32_t seq_before;
+			uint32_t seq_after;
+
+			do
+			{
+				seq_before = this->sequence.load( std::memory_order_acquire );
+
+				for ( size_t i = 0; i < WORD_COUNT; i++ )
+				{
+					buffer[i] = this->words[i].load( std::memory_order_relaxed );
+				}
+
+				std::atomic_thread_fence( std::memory_order_acquire );
+				seq_after = this->sequence.load( std::memory_order_relaxed );
+			}
+			while ( ( seq_before & 1 ) != 0 || seq_before != seq_after );
+
+			memcpy( &_dest, buffer, sizeof( BOARD_STATE_SNAPSHOT ) );
+			return;
+		}
 	}
-}
\ No newline at end of file
+}
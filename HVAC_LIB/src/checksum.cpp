@@ -0,0 +1,277 @@
+/*
+* This file is part of the software stack for Vic's IO board and its
+* associated projects.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+* Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+*/
+
+
+#include "lib/checksum.hpp"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#define CHECKSUM_X86
+#elif ( defined( __ARM_NEON ) || defined( __ARM_NEON__ ) ) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_neon.h>
+#define CHECKSUM_NEON
+#endif
+
+/**
+ * Number of vectors summed into the 32 bit lanes before they are moved to the 64 bit total.  Each lane takes in at most two words per vector.
+ */
+#define CHECKSUM_BLOCK_VECTORS 16384
+
+/**
+ * Shortest buffer the 256 bit kernel is used for.  Below this the setup of the wide accumulator and the hand off of the tail to the 128 bit kernel
+ * cost more than the wider loads save; board frames are a few dozen bytes.
+ */
+#define CHECKSUM_AVX2_MIN_LENGTH 512
+
+namespace BBB_HVAC
+{
+	/**
+	 * Folds a wide sum down to 16 bits with end around carries.
+	 */
+	static inline uint16_t fold_sum( uint64_t _sum )
+	{
+		while ( _sum >> 16 )
+		{
+			_sum = ( _sum >> 16 ) + ( _sum & 0xFFFF );
+		}
+
+		return ( uint16_t ) _sum;
+	}
+
+	/**
+	 * Sums the whole words of a buffer one byte at a time.
+	 */
+	static inline uint64_t sum_words( const unsigned char* _data, size_t _length )
+	{
+		uint64_t sum = 0;
+
+		for ( size_t i = 0; i + 1 < _length; i += 2 )
+		{
+			sum += ( uint64_t )( _data[i] | ( _data[i + 1] << 8 ) );
+		}
+
+		return sum;
+	}
+
+	uint16_t ones_complement_sum_scalar( const unsigned char* _data, size_t _length )
+	{
+		return fold_sum( sum_words( _data, _length ) );
+	}
+
+#ifdef CHECKSUM_X86
+	static uint16_t ones_complement_sum_sse2( const unsigned char* _data, size_t _length )
+	{
+		const __m128i zero = _mm_setzero_si128();
+		uint64_t sum = 0;
+
+		while ( _length >= 16 )
+		{
+			size_t vectors = _length / 16;
+			__m128i acc = zero;
+			uint32_t lanes[4];
+
+			if ( vectors > CHECKSUM_BLOCK_VECTORS )
+			{
+				vectors = CHECKSUM_BLOCK_VECTORS;
+			}
+
+			for ( size_t i = 0; i < vectors; i++ )
+			{
+				__m128i v = _mm_loadu_si128( ( const __m128i* )( _data + ( i * 16 ) ) );
+				acc = _mm_add_epi32( acc, _mm_unpacklo_epi16( v, zero ) );
+				acc = _mm_add_epi32( acc, _mm_unpackhi_epi16( v, zero ) );
+			}
+
+			_mm_storeu_si128( ( __m128i* ) lanes, acc );
+			sum += ( uint64_t ) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+			_data += vectors * 16;
+			_length -= vectors * 16;
+		}
+
+		return fold_sum( sum + sum_words( _data, _length ) );
+	}
+
+	__attribute__( ( target( "avx2" ) ) )
+	static uint16_t ones_complement_sum_avx2( const unsigned char* _data, size_t _length )
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		uint64_t sum = 0;
+
+		while ( _length >= 32 )
+		{
+			size_t vectors = _length / 32;
+			__m256i acc = zero;
+			uint32_t lanes[8];
+
+			if ( vectors > CHECKSUM_BLOCK_VECTORS )
+			{
+				vectors = CHECKSUM_BLOCK_VECTORS;
+			}
+
+			for ( size_t i = 0; i < vectors; i++ )
+			{
+				__m256i v = _mm256_loadu_si256( ( const __m256i* )( _data + ( i * 32 ) ) );
+				acc = _mm256_add_epi32( acc, _mm256_unpacklo_epi16( v, zero ) );
+				acc = _mm256_add_epi32( acc, _mm256_unpackhi_epi16( v, zero ) );
+			}
+
+			_mm256_storeu_si256( ( __m256i* ) lanes, acc );
+
+			for ( size_t i = 0; i < 8; i++ )
+			{
+				sum += lanes[i];
+			}
+
+			_data += vectors * 32;
+			_length -= vectors * 32;
+		}
+
+		/*
+		 * Frames are mostly shorter than a vector.  The 128 bit kernel takes the rest.
+		 */
+		return fold_sum( sum + ones_complement_sum_sse2( _data, _length ) );
+	}
+#endif
+
+#ifdef CHECKSUM_NEON
+	static uint16_t ones_complement_sum_neon( const unsigned char* _data, size_t _length )
+	{
+		uint64_t sum = 0;
+
+		while ( _length >= 16 )
+		{
+			size_t vectors = _length / 16;
+			uint32x4_t acc = vdupq_n_u32( 0 );
+
+			if ( vectors > CHECKSUM_BLOCK_VECTORS )
+			{
+				vectors = CHECKSUM_BLOCK_VECTORS;
+			}
+
+			for ( size_t i = 0; i < vectors; i++ )
+			{
+				/*
+				 * Byte loads have no alignment requirement.  Adjacent words are added pairwise into the 32 bit lanes.
+				 */
+				acc = vpadalq_u16( acc, vreinterpretq_u16_u8( vld1q_u8( _data + ( i * 16 ) ) ) );
+			}
+
+			sum += ( uint64_t ) vgetq_lane_u32( acc, 0 ) + vgetq_lane_u32( acc, 1 ) + vgetq_lane_u32( acc, 2 ) + vgetq_lane_u32( acc, 3 );
+			_data += vectors * 16;
+			_length -= vectors * 16;
+		}
+
+		return fold_sum( sum + sum_words( _data, _length ) );
+	}
+#endif
+
+	size_t get_checksum_kernels( CHECKSUM_KERNEL* _dest, size_t _max )
+	{
+		size_t count = 0;
+
+		if ( count < _max )
+		{
+			_dest[count++] = { "scalar", &ones_complement_sum_scalar, 0 };
+		}
+
+#ifdef CHECKSUM_X86
+		__builtin_cpu_init();
+
+		if ( count < _max && __builtin_cpu_supports( "sse2" ) )
+		{
+			_dest[count++] = { "sse2", &ones_complement_sum_sse2, 0 };
+		}
+
+		if ( count < _max && __builtin_cpu_supports( "avx2" ) )
+		{
+			_dest[count++] = { "avx2", &ones_complement_sum_avx2, CHECKSUM_AVX2_MIN_LENGTH };
+		}
+
+#endif
+#ifdef CHECKSUM_NEON
+
+		if ( count < _max )
+		{
+			_dest[count++] = { "neon", &ones_complement_sum_neon, 0 };
+		}
+
+#endif
+		return count;
+	}
+
+	/**
+	 * The kernels ones_complement_sum picks from.
+	 */
+	typedef struct
+	{
+		/**
+		 * Widest kernel that pays off on any length.
+		 */
+		CHECKSUM_KERNEL narrow;
+
+		/**
+		 * Widest kernel overall.  Only used for buffers of at least wide.min_length bytes.
+		 */
+		CHECKSUM_KERNEL wide;
+	} CHECKSUM_SELECTION;
+
+	/**
+	 * Picks the kernels from the ones the CPU supports.  They are listed narrowest first.
+	 */
+	static CHECKSUM_SELECTION select_checksum_kernels( void )
+	{
+		CHECKSUM_KERNEL kernels[4];
+		size_t count = get_checksum_kernels( kernels, 4 );
+		CHECKSUM_SELECTION ret;
+
+		ret.narrow = kernels[0];
+
+		for ( size_t i = 1; i < count; i++ )
+		{
+			if ( kernels[i].min_length == 0 )
+			{
+				ret.narrow = kernels[i];
+			}
+		}
+
+		ret.wide = kernels[count - 1];
+		return ret;
+	}
+
+	/**
+	 * Returns the kernels picked for this CPU.  They are picked on the first call.
+	 */
+	static const CHECKSUM_SELECTION& get_checksum_selection( void )
+	{
+		static const CHECKSUM_SELECTION selection = select_checksum_kernels();
+		return selection;
+	}
+
+	const CHECKSUM_KERNEL& get_checksum_kernel( size_t _length )
+	{
+		const CHECKSUM_SELECTION& selection = get_checksum_selection();
+		return ( _length >= selection.wide.min_length ? selection.wide : selection.narrow );
+	}
+
+	uint16_t ones_complement_sum( const unsigned char* _data, size_t _length )
+	{
+		return get_checksum_kernel( _length ).sum( _data, _length );
+	}
+}
@@ -34,6 +34,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <sys/eventfd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
@@ -44,6 +45,7 @@
 
 #include <sstream>
 #include <iostream>
+#include <algorithm>
 
 #include <pthread.h>
 
@@ -207,6 +209,11 @@ BASE_CONTEXT::BASE_CONTEXT( const string& _tag, SOCKET_TYPE _st, const string& _
 		}
 	}
 
+	if ( ( this->wake_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) == -1 )
+	{
+		throw CONNECTION_ERROR( create_perror_string( "Failed to create context wake up eventfd" ) );
+	}
+
 	this->thread_ctx = 0;
 	this->abort_thread = false;
 	this->instance_tag = _tag;
@@ -221,6 +228,8 @@ BASE_CONTEXT::~BASE_CONTEXT()
 {
 	close( this->remote_socket );
 	this->remote_socket = -1;
+	close( this->wake_fd );
+	this->wake_fd = -1;
 	memset( &this->socket_struct_domain, 0, sizeof( struct sockaddr_un ) );
 	memset( &this->socket_struct_inet, 0, sizeof( struct sockaddr_in ) );
 	this->thread_ctx = 0;
@@ -232,6 +241,28 @@ BASE_CONTEXT::~BASE_CONTEXT()
 	return;
 }
 
+void BASE_CONTEXT::flag_for_stop( void )
+{
+	THREAD_BASE::flag_for_stop();
+	this->wake_select_loop();
+	return;
+}
+
+void BASE_CONTEXT::wake_select_loop( void )
+{
+	uint64_t one = 1;
+
+	/*
+	 * The counter only fails to take the increment once it is about to overflow, and then the loop is woken up anyway.
+	 */
+	if ( write( this->wake_fd, &one, sizeof( one ) ) != sizeof( one ) && errno != EAGAIN )
+	{
+		LOG_ERROR( create_perror_string( "Failed to wake up the context thread" ) );
+	}
+
+	return;
+}
+
 ENUM_MESSAGE_CALLBACK_RESULT BASE_CONTEXT::process_message( ENUM_MESSAGE_DIRECTION, BASE_CONTEXT*, const MESSAGE_PTR& _message )
 {
 	if ( _message->get_message_type()->type == ENUM_MESSAGE_TYPE::PING )
@@ -242,7 +273,12 @@ ENUM_MESSAGE_CALLBACK_RESULT BASE_CONTEXT::process_message( ENUM_MESSAGE_DIRECTI
 	}
 	else if ( _message->get_message_type()->type == ENUM_MESSAGE_TYPE::HELLO )
 	{
-		this->message_processor->process_hello_message();
+		if ( this->message_processor->process_hello_message() && this->is_in_client_mode == false )
+		{
+			MESSAGE_PTR m = this->message_processor->create_hello_message( this->message_processor->get_protocol_version() );
+			this->message_processor->send_message( m, this->remote_socket );
+		}
+
 		return ENUM_MESSAGE_CALLBACK_RESULT::PROCESSED;
 	}
 	else if ( _message->get_message_type()->type == ENUM_MESSAGE_TYPE::PONG )
@@ -259,12 +295,17 @@ ENUM_MESSAGE_CALLBACK_RESULT BASE_CONTEXT::process_message( ENUM_MESSAGE_DIRECTI
 bool BASE_CONTEXT::thread_func( void )
 {
 	fd_set read_fds;
+	fd_set write_fds;
 	int rc = 0;
 
 	try
 	{
+		/*
+		 * The server opens with version 1 so that v1 clients, which reject anything higher, can connect.  It answers the offer of a newer client with
+		 * the version it settled on.  \see MESSAGE_PROCESSOR::process_hello_message
+		 */
 		MESSAGE_PTR m;
-		m = this->message_processor->create_hello_message();
+		m = this->message_processor->create_hello_message( this->is_in_client_mode ? this->message_processor->get_max_protocol() : 1 );
 		this->message_processor->send_message( m, this->remote_socket );
 	}
 	catch ( const exception& e )
@@ -294,11 +335,26 @@ bool BASE_CONTEXT::thread_func( void )
 			}
 
 			FD_ZERO( &read_fds );
+			FD_ZERO( &write_fds );
 			FD_SET( this->remote_socket, &read_fds );
+			FD_SET( this->wake_fd, &read_fds );
+
+			/*
+			 * Only wait for the socket to become writable while there is output that it did not take.  Output queued by another thread while we wait
+			 * wakes us up through wake_fd.
+			 */
+			this->obtain_lock( true );
+
+			if ( this->message_processor->get_pending_output() > 0 )
+			{
+				FD_SET( this->remote_socket, &write_fds );
+			}
+
+			this->release_lock();
 			memset( & ( this->select_timeout_tv ), 0, sizeof( struct timeval ) );
 			this->select_timeout_tv.tv_sec = GC_CLIENT_THREAD_SELECT_TIME;
 			this->select_timeout_tv.tv_usec = usec_timeout;
-			rc = select( this->remote_socket + 1, &read_fds, nullptr, nullptr, & ( this->select_timeout_tv ) );
+			rc = select( std::max( this->remote_socket, this->wake_fd ) + 1, &read_fds, &write_fds, nullptr, & ( this->select_timeout_tv ) );
 			this->obtain_lock( true );
 
 			if ( rc == -1 )
@@ -332,80 +388,112 @@ bool BASE_CONTEXT::thread_func( void )
 					}
 				}
 			} // rc = 0; timeout
-			else if ( rc == 1 )
+			else
 			{
-				/*
-				 * We do have data available for reading
-				 */
+				if ( FD_ISSET( this->wake_fd, &read_fds ) )
+				{
+					/*
+					 * Nothing to do but to reset the counter.  The next pass through the loop picks up the pending output.
+					 */
+					uint64_t counter;
 
-				/*
-				 * Reset the timeout counter if this is not the first time through the loop.
-				 * If it is the first time through the loop we do want to send the initial ping.
-				 */
-				if ( this->timeout_counter != -1 )
+					if ( read( this->wake_fd, &counter, sizeof( counter ) ) != sizeof( counter ) && errno != EAGAIN )
+					{
+						LOG_ERROR( create_perror_string( "Failed to read the context wake up eventfd" ) );
+					}
+				}
+
+				if ( FD_ISSET( this->remote_socket, &write_fds ) )
 				{
-					this->timeout_counter = 0;
+					try
+					{
+						this->message_processor->flush_output( this->remote_socket );
+					}
+					catch ( exception& e )
+					{
+						LOG_DEBUG( "Failed to write to remote: " + string( e.what() ) );
+						this->abort_thread = true;
+						this->release_lock();
+						continue;
+					}
 				}
 
-				try
+				if ( FD_ISSET( this->remote_socket, &read_fds ) )
 				{
-					size_t read_count = socket_reader.read( this->remote_socket );
+					/*
+					 * We do have data available for reading
+					 */
 
-					for ( size_t i = 0; i < read_count; i++ )
+					/*
+					 * Reset the timeout counter if this is not the first time through the loop.
+					 * If it is the first time through the loop we do want to send the initial ping.
+					 */
+					if ( this->timeout_counter != -1 )
 					{
-						string s = socket_reader.pop_first_line();
-						/*
-						 * Process all of the read lines here.
-						 */
-						MESSAGE_PTR m;
+						this->timeout_counter = 0;
+					}
 
-						try
-						{
-							m = this->message_processor->parse_message( s );
-						}
-						catch ( exception& e )
-						{
-							/*
-							 * Log and ignore a bad message.
-							 */
-							LOG_DEBUG( "Failed to parse message: " + string( e.what() ) );
-							continue; //continue processing in the 'for' loop
-						}
+					try
+					{
+						socket_reader.read( this->remote_socket );
 
-						try
-						{
-							this->process_message( ENUM_MESSAGE_DIRECTION::IN, this, m );
-						}
-						catch ( const exception& e )
+						TEXT_VIEW line;
+
+						while ( socket_reader.next_line( line ) )
 						{
 							/*
-							This is where we end up if the client really screws up.
-							For example if they try to read from an IO board that doesn't exist.  The exception bubbles up to us here and we just punt.
-							*/
-							LOG_DEBUG( "Failed to process message:" + string( e.what() ) );
-							LOG_DEBUG( "Offending message: " + m->to_string() );
-							this->abort_thread = true;
-							break;	// break out of the line processing loop
-						}
-						catch ( ... )
-						{
-							LOG_DEBUG( "Unspecified exception caught while processing remote message" );
-							this->abort_thread = true;
-							break;	// break out of the line processing loop
+							 * Process all of the read lines here.  A partial line at the end of the read stays in the reader until the rest of it arrives.
+							 */
+							MESSAGE_PTR m;
+
+							try
+							{
+								m = this->message_processor->parse_message( line.data, line.length );
+							}
+							catch ( exception& e )
+							{
+								/*
+								 * Log and ignore a bad message.
+								 */
+								LOG_DEBUG( "Failed to parse message: " + string( e.what() ) );
+								continue; //continue processing in the 'while' loop
+							}
+
+							try
+							{
+								this->process_message( ENUM_MESSAGE_DIRECTION::IN, this, m );
+							}
+							catch ( const exception& e )
+							{
+								/*
+								This is where we end up if the client really screws up.
+								For example if they try to read from an IO board that doesn't exist.  The exception bubbles up to us here and we just punt.
+								*/
+								LOG_DEBUG( "Failed to process message:" + string( e.what() ) );
+								LOG_DEBUG( "Offending message: " + m->to_string() );
+								this->abort_thread = true;
+								break;	// break out of the line processing loop
+							}
+							catch ( ... )
+							{
+								LOG_DEBUG( "Unspecified exception caught while processing remote message" );
+								this->abort_thread = true;
+								break;	// break out of the line processing loop
+							}
 						}
 					}
+					catch ( exception& e )
+					{
+						LOG_DEBUG( "General failure to process remote request: " + string( e.what() ) );
+						this->abort_thread = true;
+					}
+					catch ( ... )
+					{
+						LOG_DEBUG( "Unknown exception caught while processing remote request." );
+						this->abort_thread = true;
+					}
 				}
-				catch ( exception& e )
-				{
-					LOG_DEBUG( "General failure to process remote request: " + string( e.what() ) );
-					this->abort_thread = true;
-				}
-				catch ( ... )
-				{
-					LOG_DEBUG( "Unknown exception caught while processing remote request." );
-					this->abort_thread = true;
-				}
-			} // Select indicated that a FD is ready to be read from.
+			} // Select indicated that the FD is ready to be read from or written to.
 
 			this->release_lock();
 		} //main select loop
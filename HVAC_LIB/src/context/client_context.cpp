@@ -147,6 +147,14 @@ bool CLIENT_CONTEXT::send_message( MESSAGE_PTR& _message )
 		throw runtime_error( string( "Failed to send message: " ) + _e.what() );
 	}
 
+	if ( this->message_processor->get_pending_output() > 0 )
+	{
+		/*
+		 * The socket did not take all of it.  The context thread has to start waiting for it to become writable now, not after its select times out.
+		 */
+		this->wake_select_loop();
+	}
+
 	this->release_lock();
 	return true;
 }
@@ -167,6 +175,14 @@ MESSAGE_PTR CLIENT_CONTEXT::send_message_and_wait( MESSAGE_PTR& _message )
 		throw runtime_error( string( "Failed to send message: " ) + _e.what() );
 	}
 
+	if ( this->message_processor->get_pending_output() > 0 )
+	{
+		/*
+		 * The socket did not take all of it.  The context thread has to start waiting for it to become writable now, not after its select times out.
+		 */
+		this->wake_select_loop();
+	}
+
 	timespec timeout_time;
 	memset( &timeout_time, 0, sizeof( struct timespec ) );
 	/*
@@ -50,6 +50,8 @@ using namespace BBB_HVAC::CLIENT;
 using namespace BBB_HVAC::SERVER;
 using namespace BBB_HVAC::EXCEPTIONS;
 
+static_assert( GC_IO_HISTORY_REPLY_MAX_SAMPLES * ( GC_IO_AI_COUNT + 2 ) * 32 < GC_SOCKET_READER_MAX_LINE, "History replies must fit into one reader line." );
+
 /*************************************
  *
  * Begin HS_CLIENT_CONTEXT stuff
@@ -70,6 +72,99 @@ HS_CLIENT_CONTEXT::~HS_CLIENT_CONTEXT()
 	return;
 }
 
+/**
+Has a part to be rendered again.  Every sample carries a timestamp of its own, so a part goes stale as soon as a newer sample comes in, changed value or not.
+*/
+static inline bool part_is_stale( uint32_t _changes, uint32_t _field_mask, const timespec& _rendered, const timespec& _current )
+{
+	return ( ( _changes & _field_mask ) != 0 || _rendered.tv_sec != _current.tv_sec || _rendered.tv_nsec != _current.tv_nsec );
+}
+
+void HS_CLIENT_CONTEXT::update_read_status_parts( READ_STATUS_CACHE& _cache, const IOCOMM::BOARD_STATE_SNAPSHOT& _snapshot, uint32_t _changes )
+{
+	/*
+	Layout of the response:  the ADC values, DO and PMIC status, L1 cal values, L2 cal values, and boot count.
+	The DO and PMIC status are kind of weird in the middle of arrays in order to maintain backwards compatibility with existing stuffs.
+	The timestamps are the ones of the latest samples, same as in the binary frame.
+	*/
+	const size_t do_idx = GC_IO_AI_COUNT;
+	const size_t pmic_idx = do_idx + 1;
+	const size_t l1_idx = pmic_idx + 1;
+	const size_t l2_idx = l1_idx + GC_IO_AI_COUNT;
+	const size_t boot_count_idx = l2_idx + GC_IO_AI_COUNT;
+	const IOCOMM::BOARD_STATE_SNAPSHOT& rendered = _cache.rendered;
+
+	for ( size_t j = 0; j < GC_IO_AI_COUNT; j++ )
+	{
+		if ( part_is_stale( _changes, 1u << ( IOCOMM::BOARD_STATE_FIELD_AI + j ), rendered.ai_timestamps[j], _snapshot.ai_timestamps[j] ) )
+		{
+			_cache.parts[j] = IOCOMM::ADC_CACHE_ENTRY( _snapshot.ai_values[j], _snapshot.ai_timestamps[j] ).to_string();
+		}
+
+		if ( part_is_stale( _changes, 1u << IOCOMM::BOARD_STATE_FIELD_L1_CAL, rendered.l1_cal_timestamps[j], _snapshot.l1_cal_timestamps[j] ) )
+		{
+			_cache.parts[l1_idx + j] = IOCOMM::CAL_VALUE_ENTRY( _snapshot.l1_cal_values[j], _snapshot.l1_cal_timestamps[j] ).to_string();
+		}
+
+		if ( part_is_stale( _changes, 1u << IOCOMM::BOARD_STATE_FIELD_L2_CAL, rendered.l2_cal_timestamps[j], _snapshot.l2_cal_timestamps[j] ) )
+		{
+			_cache.parts[l2_idx + j] = IOCOMM::CAL_VALUE_ENTRY( _snapshot.l2_cal_values[j], _snapshot.l2_cal_timestamps[j] ).to_string();
+		}
+	}
+
+	if ( part_is_stale( _changes, 1u << IOCOMM::BOARD_STATE_FIELD_DO, rendered.do_timestamp, _snapshot.do_timestamp ) )
+	{
+		_cache.parts[do_idx] = IOCOMM::DO_CACHE_ENTRY( _snapshot.do_status, _snapshot.do_timestamp ).to_string();
+	}
+
+	if ( part_is_stale( _changes, 1u << IOCOMM::BOARD_STATE_FIELD_PMIC, rendered.pmic_timestamp, _snapshot.pmic_timestamp ) )
+	{
+		_cache.parts[pmic_idx] = IOCOMM::PMIC_CACHE_ENTRY( _snapshot.pmic_status, _snapshot.pmic_timestamp ).to_string();
+	}
+
+	if ( part_is_stale( _changes, 1u << IOCOMM::BOARD_STATE_FIELD_BOOT_COUNT, rendered.published, _snapshot.published ) )
+	{
+		/*
+		We wrap it into a cache entry in order to keep the format consistent.  The boot count has no timestamp of its own; it goes out with the time of the snapshot.
+		*/
+		_cache.parts[boot_count_idx] = IOCOMM::CACHE_ENTRY_16BIT( _snapshot.boot_count, _snapshot.published ).to_string();
+	}
+
+	_cache.generation = _snapshot.generation;
+	_cache.rendered = _snapshot;
+	return;
+}
+
+MESSAGE_PTR HS_CLIENT_CONTEXT::create_read_status_frame( const IOCOMM::BOARD_STATE_SNAPSHOT& _snapshot )
+{
+	MESSAGE_PTR ret = this->message_processor->create_frame( ENUM_MESSAGE_TYPE::READ_STATUS, ( GC_IO_AI_COUNT * 3 ) + 3 );
+
+	for ( size_t j = 0; j < GC_IO_AI_COUNT; j++ )
+	{
+		ret->append_entry( _snapshot.ai_values[j], _snapshot.ai_timestamps[j] );
+	}
+
+	ret->append_entry( _snapshot.do_status, _snapshot.do_timestamp );
+	ret->append_entry( _snapshot.pmic_status, _snapshot.pmic_timestamp );
+
+	for ( size_t j = 0; j < GC_IO_AI_COUNT; j++ )
+	{
+		ret->append_entry( _snapshot.l1_cal_values[j], _snapshot.l1_cal_timestamps[j] );
+	}
+
+	for ( size_t j = 0; j < GC_IO_AI_COUNT; j++ )
+	{
+		ret->append_entry( _snapshot.l2_cal_values[j], _snapshot.l2_cal_timestamps[j] );
+	}
+
+	/*
+	The boot count has no timestamp of its own; it goes out with the time of the snapshot.
+	*/
+	ret->append_entry( _snapshot.boot_count, _snapshot.published );
+	ret->finish_frame();
+	return ret;
+}
+
 ENUM_MESSAGE_CALLBACK_RESULT HS_CLIENT_CONTEXT::process_message( ENUM_MESSAGE_DIRECTION _direction, BASE_CONTEXT* _ctx, const MESSAGE_PTR& _message )
 {
 	ENUM_MESSAGE_CALLBACK_RESULT ret = ENUM_MESSAGE_CALLBACK_RESULT::PROCESSED;
@@ -93,86 +188,161 @@ ENUM_MESSAGE_CALLBACK_RESULT HS_CLIENT_CONTEXT::process_message( ENUM_MESSAGE_DI
 		{
 			std::string board_tag = _message->get_part_as_s( 0 );
 			IOCOMM::SER_IO_COMM* comm_thread = THREAD_REGISTRY::get_serial_io_thread( board_tag );
-			IOCOMM::ADC_CACHE_ENTRY dac_cache[GC_IO_STATE_BUFFER_DEPTH][GC_IO_AI_COUNT];
-			comm_thread->get_dac_cache( dac_cache );
+			bool binary = this->message_processor->use_binary( ENUM_MESSAGE_TYPE::READ_STATUS_RAW_ANALOG );
 			vector<string> parts;
+			MESSAGE_PTR m;
 
-			for ( unsigned int i = 0; i < GC_IO_STATE_BUFFER_DEPTH; i++ )
+			if ( _message->get_part_count() >= 2 )
 			{
-				for ( unsigned int j = 0; j < GC_IO_AI_COUNT; j++ )
+				/*
+				History request:  board tag, window in milliseconds, and optionally the decimation factor.
+				Every sample is put out as the analog inputs followed by the DO and PMIC status, all stamped with the time of the sample.
+				The reply has to fit into one line of the remote's reader, so a window with more than GC_IO_HISTORY_REPLY_MAX_SAMPLES samples is
+				thinned further, keeping the newest sample.
+				*/
+				unsigned long window_ms = 0;
+				unsigned long decimation = 1;
+
+				if ( _message->decode_part( 1, window_ms ) == false || ( _message->get_part_count() >= 3 && _message->decode_part( 2, decimation ) == false ) )
+				{
+					THROW_EXCEPTION( EXCEPTIONS::PROTOCOL_ERROR, "Invalid history window or decimation in message: " + _message->to_string() );
+				}
+				std::vector<IOCOMM::BOARD_HISTORY_SAMPLE> samples;
+				uint64_t now_usec = monotonic_usec();
+				uint64_t window_usec = ( uint64_t ) window_ms * 1000;
+
+				comm_thread->get_history( ( window_usec < now_usec ? now_usec - window_usec : 0 ), now_usec, decimation, samples );
+
+				if ( samples.size() > GC_IO_HISTORY_REPLY_MAX_SAMPLES )
+				{
+					size_t step = ( samples.size() + GC_IO_HISTORY_REPLY_MAX_SAMPLES - 1 ) / GC_IO_HISTORY_REPLY_MAX_SAMPLES;
+					size_t kept = 0;
+
+					for ( size_t i = ( samples.size() - 1 ) % step; i < samples.size(); i += step )
+					{
+						samples[kept++] = samples[i];
+					}
+
+					samples.resize( kept );
+				}
+
+				if ( binary )
+				{
+					m = this->message_processor->create_frame( ENUM_MESSAGE_TYPE::READ_STATUS_RAW_ANALOG, samples.size() * ( GC_IO_AI_COUNT + 2 ) );
+				}
+				else
 				{
-					parts.push_back( dac_cache[i][j].to_string() );
+					parts.reserve( samples.size() * ( GC_IO_AI_COUNT + 2 ) );
+				}
+
+				for ( auto i = samples.cbegin(); i != samples.cend(); ++i )
+				{
+					timespec sample_time;
+					sample_time.tv_sec = ( time_t )( i->time_usec / 1000000 );
+					sample_time.tv_nsec = ( long )( ( i->time_usec % 1000000 ) * 1000 );
+
+					if ( binary )
+					{
+						for ( unsigned int j = 0; j < GC_IO_AI_COUNT; j++ )
+						{
+							m->append_entry( i->ai_values[j], sample_time );
+						}
+
+						m->append_entry( i->do_status, sample_time );
+						m->append_entry( i->pmic_status, sample_time );
+						continue;
+					}
+
+					for ( unsigned int j = 0; j < GC_IO_AI_COUNT; j++ )
+					{
+						parts.push_back( IOCOMM::ADC_CACHE_ENTRY( i->ai_values[j], sample_time ).to_string() );
+					}
+
+					parts.push_back( IOCOMM::DO_CACHE_ENTRY( i->do_status, sample_time ).to_string() );
+					parts.push_back( IOCOMM::PMIC_CACHE_ENTRY( i->pmic_status, sample_time ).to_string() );
+				}
+			}
+			else
+			{
+				IOCOMM::ADC_CACHE_ENTRY dac_cache[GC_IO_STATE_BUFFER_DEPTH][GC_IO_AI_COUNT];
+				comm_thread->get_dac_cache( dac_cache );
+
+				if ( binary )
+				{
+					m = this->message_processor->create_frame( ENUM_MESSAGE_TYPE::READ_STATUS_RAW_ANALOG, GC_IO_STATE_BUFFER_DEPTH * GC_IO_AI_COUNT );
+				}
+
+				for ( unsigned int i = 0; i < GC_IO_STATE_BUFFER_DEPTH; i++ )
+				{
+					for ( unsigned int j = 0; j < GC_IO_AI_COUNT; j++ )
+					{
+						if ( binary )
+						{
+							m->append_entry( dac_cache[i][j].get_value(), dac_cache[i][j].get_timestamp() );
+						}
+						else
+						{
+							parts.push_back( dac_cache[i][j].to_string() );
+						}
+					}
 				}
 			}
 
-			MESSAGE_PTR m( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::READ_STATUS_RAW_ANALOG ), parts ) );
+			if ( binary )
+			{
+				m->finish_frame();
+			}
+			else
+			{
+				m = this->message_processor->create_message( ENUM_MESSAGE_TYPE::READ_STATUS_RAW_ANALOG, parts );
+			}
+
 			this->message_processor->send_message( m, this->remote_socket );
 
 			ret = ENUM_MESSAGE_CALLBACK_RESULT::PROCESSED;
 		}
 		else if ( t == ENUM_MESSAGE_TYPE::READ_STATUS )
 		{
-			IOCOMM::DO_CACHE_ENTRY do_cache;
-			IOCOMM::PMIC_CACHE_ENTRY pmic_cache;
-			IOCOMM::ADC_CACHE_ENTRY dac_cache[GC_IO_AI_COUNT];
-			IOCOMM::CAL_VALUE_ENTRY l1_cal_cache[GC_IO_AI_COUNT];
-			IOCOMM::CAL_VALUE_ENTRY l2_cal_cache[GC_IO_AI_COUNT];
 			std::string board_tag = _message->get_part_as_s( 0 );
 			IOCOMM::SER_IO_COMM* comm_thread = THREAD_REGISTRY::get_serial_io_thread( board_tag );
 
 			/*
-			Rather than continually call into the serial IO thread and grabbing the lock we get the whole cache at once and tease out the individual components on our own time.
+			Rather than continually call into the serial IO thread we get a snapshot of the whole state at once and tease out the individual components on our own time.
+			The snapshot is published by the IO thread; reading it does not take the IO thread's lock.
+			Only the fields that changed since the last response to this client are serialized again.
 			*/
-			IOCOMM::BOARD_STATE_CACHE state_cache( board_tag + "[t]" );
-			comm_thread->get_latest_state_values( state_cache );
-			state_cache.get_latest_adc_values( dac_cache );
-			state_cache.get_latest_do_status( do_cache );
-			state_cache.get_latest_pmic_status( pmic_cache );
-			state_cache.get_latest_l1_cal_values( l1_cal_cache );
-			state_cache.get_latest_l2_cal_values( l2_cal_cache );
-			/*
-			Response message parts
-			*/
-			vector<string> parts;
+			IOCOMM::BOARD_STATE_SNAPSHOT snapshot;
+			MESSAGE_PTR m;
 
-			/*
-			Put the ADC values into the response.
-			*/
-			for ( size_t j = 0; j < GC_IO_AI_COUNT; j++ )
+			if ( this->message_processor->use_binary( ENUM_MESSAGE_TYPE::READ_STATUS ) )
 			{
-				parts.push_back( dac_cache[j].to_string() );
+				/*
+				Binary entries are cheap enough to encode that there is nothing to gain from caching them.
+				*/
+				comm_thread->get_state_snapshot( snapshot );
+				m = this->create_read_status_frame( snapshot );
 			}
-
-			/*
-			Put the DO and PMIC status into the response.
-			We do them kind of weird in the middle of arrays in order to maintain backwards compatibility with existing stuffs.
-			Not that it matters since the other stuffs will be rewritten shortly.  Either way, it doesn't really matter.
-			*/
-			parts.push_back( do_cache.to_string() );
-			parts.push_back( pmic_cache.to_string() );
-
-			/*
-			Put the L1 cal values into the response.
-			*/
-			for ( size_t j = 0; j < GC_IO_AI_COUNT; j++ )
+			else
 			{
-				parts.push_back( l1_cal_cache[j].to_string() );
-			}
+				auto cache_iterator = this->read_status_cache.find( board_tag );
+				uint32_t changes;
 
-			/*
-			Put the L2 cal values into the response.
-			*/
-			for ( size_t j = 0; j < GC_IO_AI_COUNT; j++ )
-			{
-				parts.push_back( l2_cal_cache[j].to_string() );
+				if ( cache_iterator == this->read_status_cache.end() )
+				{
+					cache_iterator = this->read_status_cache.emplace( std::make_pair( board_tag, READ_STATUS_CACHE() ) ).first;
+					cache_iterator->second.parts.resize( ( GC_IO_AI_COUNT * 3 ) + 3 );
+					comm_thread->get_state_snapshot( snapshot );
+					changes = IOCOMM::BOARD_STATE_CACHE::CHANGE_MASK_ALL;
+				}
+				else
+				{
+					changes = comm_thread->get_state_changes( cache_iterator->second.generation, snapshot );
+				}
+
+				this->update_read_status_parts( cache_iterator->second, snapshot, changes );
+				m = this->message_processor->create_message( ENUM_MESSAGE_TYPE::READ_STATUS, cache_iterator->second.parts );
 			}
 
-			/*
-			Finally put out the boot count.
-			We wrap it into a cache entry in order to keep the format consistent.
-			*/
-			parts.push_back( IOCOMM::CACHE_ENTRY_16BIT( state_cache.get_boot_count() ).to_string() );
-			MESSAGE_PTR m( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::READ_STATUS ), parts ) );
 			this->message_processor->send_message( m, this->remote_socket );
 
 			ret = ENUM_MESSAGE_CALLBACK_RESULT::PROCESSED;
@@ -268,27 +438,53 @@ ENUM_MESSAGE_CALLBACK_RESULT HS_CLIENT_CONTEXT::process_message( ENUM_MESSAGE_DI
 			}
 			else
 			{
-				/*
-				Response message parts
-				*/
-				vector<string> parts;
 				std::map<std::string, LOGIC_POINT_STATUS> logic_status = GLOBALS::logic_instance->get_logic_status();
+				MESSAGE_PTR m;
 
-				for ( auto map_iterator = logic_status.begin(); map_iterator != logic_status.end(); ++map_iterator )
+				if ( this->message_processor->use_binary( ENUM_MESSAGE_TYPE::READ_LOGIC_STATUS ) )
 				{
-					parts.push_back( map_iterator->first );
+					m = this->message_processor->create_frame( ENUM_MESSAGE_TYPE::READ_LOGIC_STATUS, logic_status.size() * 2 );
 
-					if ( map_iterator->second.is_double_value )
+					for ( auto map_iterator = logic_status.begin(); map_iterator != logic_status.end(); ++map_iterator )
 					{
-						parts.push_back( num_to_str( map_iterator->second.double_value ) );
+						m->append_text( map_iterator->first );
+
+						if ( map_iterator->second.is_double_value )
+						{
+							m->append_double( map_iterator->second.double_value );
+						}
+						else
+						{
+							m->append_bool( map_iterator->second.bool_value );
+						}
 					}
-					else
+
+					m->finish_frame();
+				}
+				else
+				{
+					/*
+					Response message parts
+					*/
+					vector<string> parts;
+
+					for ( auto map_iterator = logic_status.begin(); map_iterator != logic_status.end(); ++map_iterator )
 					{
-						parts.push_back( num_to_str( map_iterator->second.bool_value ) );
+						parts.push_back( map_iterator->first );
+
+						if ( map_iterator->second.is_double_value )
+						{
+							parts.push_back( num_to_str( map_iterator->second.double_value ) );
+						}
+						else
+						{
+							parts.push_back( num_to_str( map_iterator->second.bool_value ) );
+						}
 					}
+
+					m = this->message_processor->create_message( ENUM_MESSAGE_TYPE::READ_LOGIC_STATUS, parts );
 				}
 
-				MESSAGE_PTR m( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::READ_LOGIC_STATUS ), parts ) );
 				this->message_processor->send_message( m, this->remote_socket );
 			}
 
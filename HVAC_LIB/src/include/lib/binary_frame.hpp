@@ -0,0 +1,193 @@
+/*
+* This file is part of the software stack for Vic's IO board and its
+* associated projects.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+* Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+*/
+
+
+
+#ifndef SRC_INCLUDE_LIB_BINARY_FRAME_HPP_
+#define SRC_INCLUDE_LIB_BINARY_FRAME_HPP_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace BBB_HVAC
+{
+	/**
+	 * Layout of the binary frames of protocol version 2.
+	 *
+	 * A frame starts with an eight byte header:  the marker byte, the message type (ENUM_MESSAGE_TYPE), the number of parts as a uint16_t, and the length of
+	 * the whole frame, header included, as a uint32_t.  The parts follow.  Every part is a tag byte (ENUM_FIELD_TAG) followed by a fixed number of bytes
+	 * for the tag; only text parts carry their own uint16_t length.  Every number is little endian.  Timestamps are the seconds and nanoseconds of the
+	 * timespec as two uint32_t values.
+	 *
+	 * The marker can not start a protocol version 1 line, which always starts with its decimal length.  Frames are only sent once both ends agreed on
+	 * version 2 in the HELLO exchange.
+	 */
+	namespace BINARY_FRAME
+	{
+		/**
+		 * First byte of every frame.
+		 */
+		const unsigned char marker = 0xB2;
+
+		/**
+		 * Size of the frame header.
+		 */
+		const size_t header_size = 8;
+
+		/**
+		 * Offset of the message type in the header.
+		 */
+		const size_t type_offset = 1;
+
+		/**
+		 * Offset of the part count in the header.
+		 */
+		const size_t part_count_offset = 2;
+
+		/**
+		 * Offset of the frame length in the header.
+		 */
+		const size_t length_offset = 4;
+
+		/**
+		 * Kind of a part.  Tells how many bytes follow the tag and how the part is rendered as text.
+		 */
+		enum class ENUM_FIELD_TAG : unsigned char
+		{
+			TEXT = 1,	/// uint16_t length followed by that many bytes.
+			ENTRY8,		/// uint8_t value and a timestamp.  Rendered the way IOCOMM::CACHE_ENTRY_8BIT::to_string does.
+			ENTRY16,	/// uint16_t value and a timestamp.  Rendered the way IOCOMM::CACHE_ENTRY_16BIT::to_string does.
+			DOUBLE,		/// IEEE 754 double.
+			BOOL		/// uint8_t, zero or one.  Rendered as TRUE or FALSE.
+		} ;
+
+		/**
+		 * Writes a little endian uint16_t.  The destination does not have to be aligned.
+		 */
+		inline void put_u16( char* _dest, uint16_t _value ) {
+			_dest[0] = ( char )( _value & 0xFF );
+			_dest[1] = ( char )( _value >> 8 );
+			return;
+		}
+
+		/**
+		 * Writes a little endian uint32_t.
+		 */
+		inline void put_u32( char* _dest, uint32_t _value ) {
+			put_u16( _dest, ( uint16_t )( _value & 0xFFFF ) );
+			put_u16( _dest + 2, ( uint16_t )( _value >> 16 ) );
+			return;
+		}
+
+		/**
+		 * Writes a little endian uint64_t.
+		 */
+		inline void put_u64( char* _dest, uint64_t _value ) {
+			put_u32( _dest, ( uint32_t )( _value & 0xFFFFFFFF ) );
+			put_u32( _dest + 4, ( uint32_t )( _value >> 32 ) );
+			return;
+		}
+
+		/**
+		 * Reads a little endian uint16_t.  The source does not have to be aligned.
+		 */
+		inline uint16_t get_u16( const char* _src ) {
+			return ( uint16_t )( ( unsigned char ) _src[0] | ( ( unsigned char ) _src[1] << 8 ) );
+		}
+
+		/**
+		 * Reads a little endian uint32_t.
+		 */
+		inline uint32_t get_u32( const char* _src ) {
+			return ( uint32_t ) get_u16( _src ) | ( ( uint32_t ) get_u16( _src + 2 ) << 16 );
+		}
+
+		/**
+		 * Reads a little endian uint64_t.
+		 */
+		inline uint64_t get_u64( const char* _src ) {
+			return ( uint64_t ) get_u32( _src ) | ( ( uint64_t ) get_u32( _src + 4 ) << 32 );
+		}
+
+		/**
+		 * Writes a double as the little endian bits of its IEEE 754 representation.
+		 */
+		inline void put_double( char* _dest, double _value ) {
+			uint64_t bits;
+			memcpy( &bits, &_value, sizeof( bits ) );
+			put_u64( _dest, bits );
+			return;
+		}
+
+		/**
+		 * Reads a double written by put_double.
+		 */
+		inline double get_double( const char* _src ) {
+			uint64_t bits = get_u64( _src );
+			double ret;
+			memcpy( &ret, &bits, sizeof( ret ) );
+			return ret;
+		}
+
+		/**
+		 * Gets the number of bytes that follow the tag of a part.
+		 * \param _tag Part tag.
+		 * \param _data The bytes after the tag.  Only read for text parts.
+		 * \param _available Number of bytes after the tag.
+		 * \param _length Set to the number of bytes of the part.
+		 * \return False if the tag is unknown or the part does not fit into _available.
+		 */
+		inline bool field_length( unsigned char _tag, const char* _data, size_t _available, size_t& _length ) {
+			switch ( static_cast<ENUM_FIELD_TAG>( _tag ) ) {
+				case ENUM_FIELD_TAG::TEXT:
+					if ( _available < 2 ) {
+						return false;
+					}
+
+					_length = 2 + get_u16( _data );
+					break;
+
+				case ENUM_FIELD_TAG::ENTRY8:
+					_length = 1 + 8;
+					break;
+
+				case ENUM_FIELD_TAG::ENTRY16:
+					_length = 2 + 8;
+					break;
+
+				case ENUM_FIELD_TAG::DOUBLE:
+					_length = 8;
+					break;
+
+				case ENUM_FIELD_TAG::BOOL:
+					_length = 1;
+					break;
+
+				default:
+					return false;
+			}
+
+			return _length <= _available;
+		}
+	}
+}
+
+#endif /* SRC_INCLUDE_LIB_BINARY_FRAME_HPP_ */
@@ -22,9 +22,11 @@
 #ifndef BOARD_STATE_CACHE_HPP
 #define BOARD_STATE_CACHE_HPP
 
+#include <atomic>
 #include <cstdint>
 #include <exception>
 #include <functional>
+#include <vector>
 
 #include "serial_io_types.hpp"
 
@@ -36,6 +38,150 @@ namespace BBB_HVAC
 
 	namespace IOCOMM
 	{
+		/**
+		Fields of the board state that are tracked for changes.  Each analog input is its own field; the first one is BOARD_STATE_FIELD_AI.
+		The value of a field is also its bit position in a change mask.
+		\see BOARD_STATE_CACHE::get_changes_since
+		*/
+		enum ENUM_BOARD_STATE_FIELDS : unsigned int
+		{
+			BOARD_STATE_FIELD_AI = 0,
+			BOARD_STATE_FIELD_DO = GC_IO_AI_COUNT,
+			BOARD_STATE_FIELD_PMIC,
+			BOARD_STATE_FIELD_L1_CAL,
+			BOARD_STATE_FIELD_L2_CAL,
+			BOARD_STATE_FIELD_BOOT_COUNT,
+			BOARD_STATE_FIELD_COUNT
+		};
+
+		static_assert( BOARD_STATE_FIELD_COUNT <= 32, "Board state change masks are 32 bits wide." );
+
+		/**
+		One sample out of the board state history.
+		\see BOARD_STATE_HISTORY
+		*/
+		typedef struct
+		{
+			/**
+			Time the sample was taken in microseconds off of CLOCK_MONOTONIC.
+			*/
+			uint64_t time_usec;
+			uint16_t ai_values[GC_IO_AI_COUNT];
+			uint8_t do_status;
+			uint8_t pmic_status;
+		} BOARD_HISTORY_SAMPLE;
+
+		/**
+		Fixed depth time series of board samples.  Every column is preallocated when the instance is created and used as a ring; adding a sample is O(1) and never allocates.
+		The columns are kept separately (structure of arrays) so a query over a time range only walks the timestamp column until it finds its starting point.
+		Samples are added in time order so the timestamp column is sorted from the oldest sample to the newest.
+		*/
+		class BOARD_STATE_HISTORY
+		{
+			public:
+				/**
+				Constructor.
+				\param _depth Number of samples to keep.  Zero disables the history.
+				*/
+				explicit BOARD_STATE_HISTORY( size_t _depth );
+
+				/**
+				Adds a sample, overwriting the oldest one if the history is full.
+				\param _ai_values Analog input values.
+				\param _do_status DO status bits.
+				\param _pmic_status PMIC status bits.
+				\param _time_usec Time of the sample in microseconds off of CLOCK_MONOTONIC.
+				*/
+				void add_sample( const uint16_t( & _ai_values ) [GC_IO_AI_COUNT], uint8_t _do_status, uint8_t _pmic_status, uint64_t _time_usec );
+
+				/**
+				Copies the samples taken within a time range.
+				\param _from_usec Start of the range, inclusive.
+				\param _to_usec End of the range, inclusive.
+				\param _decimation Only every Nth sample in the range is returned.  Zero and one both return every sample.
+				\param _dest Samples are appended to this vector, oldest first.
+				\return Number of samples appended.
+				*/
+				size_t get_samples( uint64_t _from_usec, uint64_t _to_usec, size_t _decimation, std::vector<BOARD_HISTORY_SAMPLE>& _dest ) const;
+
+				/**
+				\return Number of samples the history can hold.
+				*/
+				size_t get_depth( void ) const;
+
+				/**
+				\return Number of samples currently held.
+				*/
+				size_t get_count( void ) const;
+
+			protected:
+				/**
+				Converts a position counted from the oldest sample into an index into the columns.
+				*/
+				size_t to_column_index( size_t _position ) const;
+
+				/**
+				Finds the position of the first sample taken at or after the supplied time.
+				\return Position counted from the oldest sample.  Equal to count if there is no such sample.
+				*/
+				size_t find_position( uint64_t _time_usec ) const;
+
+				size_t depth;
+
+				/**
+				Column index the next sample is written to.
+				*/
+				size_t head;
+
+				size_t count;
+
+				std::vector<uint64_t> time_column;
+				std::vector<uint16_t> ai_columns[GC_IO_AI_COUNT];
+				std::vector<uint8_t> do_column;
+				std::vector<uint8_t> pmic_column;
+		};
+
+		/**
+		A point in time copy of the latest values in a board's state cache.  Plain data only so that it can be handed between threads without locking.
+		The timestamps are the ones recorded by the respective cache entries.
+		\see BOARD_STATE_PUBLISHER
+		*/
+		typedef struct
+		{
+			uint16_t ai_values[GC_IO_AI_COUNT];
+			timespec ai_timestamps[GC_IO_AI_COUNT];
+			bool ai_forced[GC_IO_AI_COUNT];
+
+			uint8_t do_status;
+			timespec do_timestamp;
+
+			uint8_t pmic_status;
+			timespec pmic_timestamp;
+
+			uint16_t l1_cal_values[GC_IO_AI_COUNT];
+			timespec l1_cal_timestamps[GC_IO_AI_COUNT];
+
+			uint16_t l2_cal_values[GC_IO_AI_COUNT];
+			timespec l2_cal_timestamps[GC_IO_AI_COUNT];
+
+			uint16_t boot_count;
+
+			/**
+			Sample sequence number of the cache at the time of the snapshot.
+			*/
+			uint64_t generation;
+
+			/**
+			Sample sequence number at which each field last changed value.  Indexed by ENUM_BOARD_STATE_FIELDS.
+			*/
+			uint64_t field_generations[BOARD_STATE_FIELD_COUNT];
+
+			/**
+			Time the snapshot was published.
+			*/
+			timespec published;
+		} BOARD_STATE_SNAPSHOT;
+
 
 		/**
 		IO board's state cache.  When a thread asks for analog values, digital output status, etc. we don't immediately reach out to the board
@@ -56,10 +202,20 @@ namespace BBB_HVAC
 				*/
 				typedef std::function<void ( BOARD_STATE_CACHE&, size_t, uint16_t ) > CAL_VALUE_ADDER_PTR;
 
+				/**
+				Change mask bits of all of the analog inputs.
+				*/
+				static const uint32_t CHANGE_MASK_AI = ( 1u << GC_IO_AI_COUNT ) - 1;
+
+				/**
+				Change mask with every field set.
+				*/
+				static const uint32_t CHANGE_MASK_ALL = ( 1u << BOARD_STATE_FIELD_COUNT ) - 1;
+
 				/**
 				Constructor.
 				*/
-				BOARD_STATE_CACHE( const std::string& _board_id );
+				BOARD_STATE_CACHE( const std::string& _board_id, size_t _history_depth = GC_IO_HISTORY_DEPTH );
 
 				/**
 				Adds a PMIC (power management IC) status value to the cache
@@ -105,8 +261,60 @@ namespace BBB_HVAC
 
 				bool force_ai_value( size_t _x_index, uint16_t _value );
 				bool unforce_ai_value( size_t _x_index );
+
+				/**
+				Copies the latest values out of the cache.
+				\param _dest Snapshot to fill in.
+				*/
+				void fill_snapshot( BOARD_STATE_SNAPSHOT& _dest );
+
+				/**
+				Returns the sample sequence number.  The number is bumped every time a sample is added to the cache or an input is forced.
+				*/
+				uint64_t get_generation( void ) const;
+
+				/**
+				Returns which fields changed value after the supplied generation.
+				\param _generation Generation the caller last looked at.  Zero returns every field that ever changed.
+				\return Change mask.  Bit positions are ENUM_BOARD_STATE_FIELDS values.
+				*/
+				uint32_t get_changes_since( uint64_t _generation ) const;
+
+				/**
+				Same as the member version but works off of a published snapshot.
+				\param _snapshot Snapshot to examine.
+				\param _generation Generation the caller last looked at.
+				\return Change mask.
+				*/
+				static uint32_t get_changes_since( const BOARD_STATE_SNAPSHOT& _snapshot, uint64_t _generation );
+
+				/**
+				Returns the sample history.  A sample is recorded every time a full set of analog inputs has been added.
+				*/
+				const BOARD_STATE_HISTORY& get_history( void ) const;
 			protected:
 
+				/**
+				Sample history.
+				*/
+				BOARD_STATE_HISTORY history;
+
+				/**
+				Records that the fields in the supplied mask changed at the current generation.
+				\param _mask Change mask.
+				*/
+				void mark_changed( uint32_t _mask );
+
+				/**
+				Sample sequence number.
+				*/
+				uint64_t generation;
+
+				/**
+				Generation at which each field last changed value.  Indexed by ENUM_BOARD_STATE_FIELDS.
+				*/
+				uint64_t field_generations[BOARD_STATE_FIELD_COUNT];
+
 				size_t get_previous_cache_index( void );
 
 				/**
@@ -152,6 +360,50 @@ namespace BBB_HVAC
 			private:
 				void add_cal_value( size_t _x_index, uint16_t _value, size_t& _idx, CAL_VALUE_ENTRY( & _dest ) [GC_IO_STATE_BUFFER_DEPTH][GC_IO_AI_COUNT] ) ;
 		};
+
+		/**
+		Single writer, many reader sequence lock around a BOARD_STATE_SNAPSHOT.  The serial IO thread publishes a fresh snapshot after it updates the state cache
+		and any number of threads can read it without ever blocking the serial IO thread.
+		A reader copies the snapshot and retries if a publish happened in the meantime, so what it gets back is always internally consistent.
+		The snapshot is stored as an array of atomic words so that the racing copy is well defined.
+		Callers of publish must serialize among themselves; SER_IO_COMM does so with its own lock.
+		*/
+		class BOARD_STATE_PUBLISHER
+		{
+			public:
+				/**
+				Constructor.  Publishes an all zero snapshot.
+				*/
+				BOARD_STATE_PUBLISHER();
+
+				/**
+				Publishes a new snapshot.  Never blocks.
+				\param _src Snapshot to publish.
+				*/
+				void publish( const BOARD_STATE_SNAPSHOT& _src );
+
+				/**
+				Reads the latest published snapshot.  Never takes a lock; spins only while a publish is in progress.
+				\param _dest Destination of the copy.
+				*/
+				void read( BOARD_STATE_SNAPSHOT& _dest ) const;
+
+				/**
+				Number of words the snapshot is stored in.
+				*/
+				static const size_t WORD_COUNT = ( sizeof( BOARD_STATE_SNAPSHOT ) + sizeof( uint32_t ) - 1 ) / sizeof( uint32_t );
+
+			private:
+				/**
+				Sequence number.  Odd while a publish is in progress.
+				*/
+				std::atomic<uint32_t> sequence;
+
+				/**
+				The snapshot itself.
+				*/
+				std::atomic<uint32_t> words[WORD_COUNT];
+		};
 	}
 }
 #endif /* BOARD_STATE_CACHE_HPP */
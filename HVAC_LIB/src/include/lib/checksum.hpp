@@ -0,0 +1,89 @@
+/*
+* This file is part of the software stack for Vic's IO board and its
+* associated projects.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+* Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+*/
+
+
+#ifndef SRC_INCLUDE_LIB_CHECKSUM_HPP_
+#define SRC_INCLUDE_LIB_CHECKSUM_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ \file One's complement checksum kernels.  Every binary message from the board is checked with one of these.
+ The kernels the CPU supports are looked up the first time a checksum is computed.  The widest one is only used on buffers long enough for it to
+ pay off; the short board frames go to the widest kernel without a minimum length.
+ */
+
+namespace BBB_HVAC
+{
+	/**
+	 * Function that computes the folded, but not inverted, one's complement sum of a buffer.
+	 * The buffer is summed as little endian 16 bit words.  It may start at any address.  A trailing odd byte is ignored.
+	 */
+	typedef uint16_t ( *CHECKSUM_KERNEL_PTR )( const unsigned char* _data, size_t _length );
+
+	/**
+	 * A checksum kernel and its name.
+	 */
+	typedef struct
+	{
+		/**
+		 * Name for human consumption: scalar, sse2, avx2, or neon.
+		 */
+		const char* name;
+
+		/**
+		 * The kernel.
+		 */
+		CHECKSUM_KERNEL_PTR sum;
+
+		/**
+		 * Shortest buffer the kernel is picked for.  Zero if it is as fast as the narrower kernels on any length.
+		 */
+		size_t min_length;
+	} CHECKSUM_KERNEL;
+
+	/**
+	 * Computes the folded, but not inverted, one's complement sum of a buffer with the kernel picked for this CPU.
+	 * \see CHECKSUM_KERNEL_PTR
+	 */
+	uint16_t ones_complement_sum( const unsigned char* _data, size_t _length );
+
+	/**
+	 * Reference implementation of ones_complement_sum.  Assembles the words byte by byte.
+	 */
+	uint16_t ones_complement_sum_scalar( const unsigned char* _data, size_t _length );
+
+	/**
+	 * Returns the kernel ones_complement_sum uses for a buffer.
+	 * \param _length Length of the buffer in bytes.
+	 */
+	const CHECKSUM_KERNEL& get_checksum_kernel( size_t _length );
+
+	/**
+	 * Lists the kernels this CPU can run.  The scalar kernel is always first.
+	 * \param _dest Where the kernels are stored.
+	 * \param _max Size of _dest.
+	 * \return Number of kernels stored.
+	 */
+	size_t get_checksum_kernels( CHECKSUM_KERNEL* _dest, size_t _max );
+}
+
+#endif /* SRC_INCLUDE_LIB_CHECKSUM_HPP_ */
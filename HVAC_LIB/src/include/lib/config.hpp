@@ -50,6 +50,12 @@ Default PID file name
  */
 #define GC_BUFFER_SIZE 4096
 
+/**
+ * Longest line the socket reader will reassemble, in bytes.  The reader buffer starts at GC_BUFFER_SIZE and grows up to this size; a line longer
+ * than this is discarded.
+ */
+#define GC_SOCKET_READER_MAX_LINE 65536
+
 /**
  * Time in seconds that the server process client thread will use to timeout from the 'select' call.
  * The actual select timeout will be GC_CLIENT_THREAD_SELECT_TIME + GC_CLIENT_THREAD_SELECT_TIME * 1000 / GC_CLIENT_PING_DIVIDER in order to
@@ -75,7 +81,20 @@ Default PID file name
 
 #define GC_OUTGOING_MESSAGE_QUEUE_SIZE 32
 
-#define GC_WRITE_ATTEMPTS 100
+/**
+ * Most messages a connection keeps for reuse.  Both message queues hold on to their messages, so it has to be larger than the two combined.
+ */
+#define GC_MESSAGE_POOL_SIZE (GC_INCOMMING_MESSAGE_QUEUE_SIZE + GC_OUTGOING_MESSAGE_QUEUE_SIZE + 16)
+
+/**
+ * Most bytes a connection may have waiting to be written to its remote.  A remote that lets more than this pile up is not keeping up and gets dropped.
+ */
+#define GC_OUTPUT_BUFFER_HIGH_WATER (1024 * 1024)
+
+/**
+ * Most messages handed to the kernel in a single gather write.
+ */
+#define GC_OUTPUT_IOV_COUNT 16
 
 #define GC_NSEC_TIMEOUT 5000
 
@@ -120,18 +139,29 @@ Default PID file name
 #define GC_WATCHDOG_ATTEMPTS (1000000000/GC_WATCHDOG_SLEEP_NSEC) * 4
 
 /**
- * Size of the incoming serial data buffer.
- * \see BBB_HVAC::IOCOMM::SER_IO_COMM::buffer
+ * Size of the incoming serial data receive ring.  Must be a power of two.
+ * \see BBB_HVAC::IOCOMM::SER_IO_COMM::rx_ring
  */
 #define GC_SERIAL_BUFF_SIZE 1024
 
 /**
- * Number of lines in the processed line table.  Each line is of size GC_SERIAL_BUFF_SIZE
- * \see BBB_HVAC::IOCOMM::SER_IO_COMM::table_a
- * \see BBB_HVAC::IOCOMM::SER_IO_COMM::table_b
- *
+ * Largest payload, in bytes, of a binary message that will be accepted from the board.  A message header announcing a larger payload is treated as line noise.
+ * \see BBB_HVAC::IOCOMM::SER_IO_COMM::assemble_serial_data
+ */
+#define GC_SERIAL_MAX_BINARY_PAYLOAD 32
+
+/**
+ * Size, in bytes, of the queue of received text lines waiting to be processed.  Each line takes up its length plus two bytes.
+ * The queue is drained after every pass over the receive ring so twice the ring size is enough to hold a ring full of the shortest possible lines.
+ * \see BBB_HVAC::IOCOMM::SER_IO_COMM::frame_queue
+ */
+#define GC_SERIAL_FRAME_QUEUE_SIZE (GC_SERIAL_BUFF_SIZE * 2)
+
+/**
+ * Largest number of tokens parsed out of a protocol (P) text line.  The protocol messages the board sends have two.
+ * \see BBB_HVAC::IOCOMM::SER_IO_COMM::tokenize_protocol_line
  */
-#define GC_SERIAL_LINE_TABLE_ENTRIES 128
+#define GC_SERIAL_MAX_PROTOCOL_TOKENS 8
 
 /**
  * Baud rate of the serial port.  The value is the appropriate define for termios struct.
@@ -148,33 +178,145 @@ Default PID file name
 #define GC_SERIAL_PORT_B "ttyS4"
 
 /**
- * Number of nanoseconds to sleep between iterations of the main serial processing thread.
- * We need some delay there to give other threads waiting to call into the serial thread a chance to grab the lock.
- * 10 useconds seems to be a workable value.
- \note The unit here is NANOSECONDS
- * \see BBB_HVAC::IOCOMM::SER_IO_COMM::main_event_loop
- */
-#define GC_SERIAL_THREAD_SLEEP 10000
+Number of microseconds between output confirmations sent to the IO board.  The serial thread sleeps in epoll_wait between serial data and this timer.
+\note The unit here is MICROSECONDS
+\see BBB_HVAC::IOCOMM::SER_IO_COMM::main_event_loop
+*/
+#define GC_SERIAL_THREAD_UPDATE_INTERVAL 250000
 
 /**
-Number of milliseconds before a poll call times out.
-\note The unit here is MILLISECONDS
-\see BBB_HVAC::IOCOMM::SER_IO_COMM::main_event_loop
+Number of microseconds without any data from the IO board after which the board is considered hung and its port is closed.
+The supervisor runs on every wake up of the event loop so the deadlines are honored to within GC_SERIAL_THREAD_UPDATE_INTERVAL.
+\see BBB_HVAC::IOCOMM::SER_IO_COMM::supervise_board
 */
-#define GC_SERIAL_THREAD_POLL_TIMEOUT 2
+#define GC_SERIAL_HUNG_BOARD_TIMEOUT 2000000
+
 /**
-Number of main serial thread processing loop iterations between pulls of status data from the IO board.
-The nominal minimum interval between status updates from the board is (GC_SERIAL_THREAD_SLEEP + GC_SERIAL_THREAD_POLL_TIMEOUT) * GC_SERIAL_THREAD_UPADTE_INTERVAL.
-The interval is actually longer since the nominal interval does not take into account all of the other processing that the loop does
-XXX - need to update to reflect changes in timing mechanism
-\see BBB_HVAC::IOCOMM::SER_IO_COMM::main_event_loop
+Number of microseconds the supervisor waits for the board to announce that it has come back up after a reset before trying again.
+\see BBB_HVAC::IOCOMM::SER_IO_COMM::supervise_board
 */
-#define GC_SERIAL_THREAD_UPDATE_INTERVAL 250000
+#define GC_SERIAL_RESET_TIMEOUT 2000000
+
+/**
+Number of microseconds the port of a hung board is kept closed before the first attempt to reopen it.  Doubled after every failed attempt.
+\see BBB_HVAC::IOCOMM::SER_IO_COMM::supervise_board
+*/
+#define GC_SERIAL_REOPEN_BACKOFF_MIN 250000
+
+/**
+Upper limit of the time, in microseconds, the port of a hung board is kept closed between attempts to reopen it.
+\see BBB_HVAC::IOCOMM::SER_IO_COMM::supervise_board
+*/
+#define GC_SERIAL_REOPEN_BACKOFF_MAX 8000000
+
+/**
+Number of microseconds a board started in warm attach mode is listened to for an ongoing stream before it is reset after all.
+The stream has to deliver an analog input, a DO status, and a PMIC status frame within this time.
+\see BBB_HVAC::IOCOMM::SER_IO_COMM::set_warm_attach
+*/
+#define GC_SERIAL_ATTACH_TIMEOUT 1000000
+
+/**
+Number of microseconds LOGIC_CORE waits for every board to have a complete state before it starts the logic thread regardless.
+\see BBB_HVAC::IOCOMM::SER_IO_COMM::has_valid_state
+*/
+#define GC_BOARD_READY_TIMEOUT 10000000
+
+/**
+Number of milliseconds the serial reactor waits before retrying a write that the board was not clear to receive.
+\see BBB_HVAC::IOCOMM::SER_IO_REACTOR::thread_func
+*/
+#define GC_SERIAL_REACTOR_RETRY_INTERVAL 2
+
+/**
+Number of microseconds it takes to transmit one character at GC_SERIAL_BAUD_RATE with 8N1 framing.  Must be kept in sync with GC_SERIAL_BAUD_RATE.
+Used to estimate how long the port takes to drain its output queue.
+\see BBB_HVAC::IOCOMM::SER_IO_COMM::wait_for_clear_to_send
+*/
+#define GC_SERIAL_CHAR_TIME 521
+
+/**
+Number of microseconds before the first check of the CTS line on ports whose driver can not block in TIOCMIWAIT.  Doubled after every check.
+\see BBB_HVAC::IOCOMM::SER_IO_COMM::wait_for_clear_to_send
+*/
+#define GC_SERIAL_CTS_POLL_INTERVAL 1000
+
+/**
+Upper bound of the interval between checks of the CTS line on ports whose driver can not block in TIOCMIWAIT.
+\see BBB_HVAC::IOCOMM::SER_IO_COMM::wait_for_clear_to_send
+*/
+#define GC_SERIAL_CTS_POLL_INTERVAL_MAX 32000
+
+/**
+Number of microseconds the writer waits for the board to become clear to send before giving up and checking whether it should abort.
+The writer is woken out of TIOCMIWAIT by the supervisor so the timeout is honored to within GC_SERIAL_THREAD_UPDATE_INTERVAL.
+\see BBB_HVAC::IOCOMM::SER_IO_COMM::wait_for_clear_to_send
+*/
+#define GC_SERIAL_CTS_WAIT_TIMEOUT 500000
+
+/**
+Signal the supervisor sends the writer thread to interrupt a blocking wait.  The handler is installed without SA_RESTART.
+\see BBB_HVAC::IOCOMM::SER_IO_COMM::wake_writer
+*/
+#define GC_SERIAL_WRITER_WAKE_SIGNAL SIGUSR2
+
+/**
+Number of microseconds the supervisor waits for the writer thread to let go of the port before closing it.  If the writer is still on the port by then
+the port is left open, in PORT_CLOSED state, and the close is retried on the following supervisor ticks.
+\see BBB_HVAC::IOCOMM::SER_IO_COMM::release_port
+*/
+#define GC_SERIAL_WRITER_RELEASE_TIMEOUT 100000
+
+/**
+Largest number of pending outgoing messages gathered into a single write to the serial port.
+\see BBB_HVAC::IOCOMM::SER_IO_COMM::write_buffer
+*/
+#define GC_SERIAL_MAX_WRITE_SPANS 16
+
+/**
+Number of slots in the outgoing serial message queue of each board.  Must be a power of two.
+\see BBB_HVAC::IOCOMM::OUTGOING_MESSAGE_QUEUE
+*/
+#define GC_SERIAL_OUTGOING_QUEUE_SIZE 64
+
+/**
+Largest outgoing serial message, in bytes.  The largest board command is the calibration value command at 4 + (GC_IO_AI_COUNT * 2) bytes.
+\see BBB_HVAC::IOCOMM::OUTGOING_MESSAGE
+*/
+#define GC_SERIAL_OUTGOING_MESSAGE_SIZE 32
+
+/**
+Size, in bytes, of each of the two buffers a serial wire capture is collected in.  The IO threads fill one while the flusher writes out the other.
+Data that does not fit before the next flush is dropped and counted.
+\see BBB_HVAC::IOCOMM::SERIAL_CAPTURE
+*/
+#define GC_SERIAL_CAPTURE_BUFFER_SIZE 262144
+
+/**
+Number of microseconds between flushes of a serial wire capture to its file.
+\see BBB_HVAC::IOCOMM::SERIAL_CAPTURE
+*/
+#define GC_SERIAL_CAPTURE_FLUSH_INTERVAL 100000
+
 /**
  * The depth of the local IO state cache.
  */
 #define GC_IO_STATE_BUFFER_DEPTH 1
 
+/**
+ * Default number of samples kept in the per board sample history.  One sample is a full set of analog inputs plus the DO and PMIC status at the time.
+ * The history is allocated once when the board is created.  Can be overridden on the command line; zero disables the history.
+ * \see BBB_HVAC::IOCOMM::BOARD_STATE_HISTORY
+ */
+#define GC_IO_HISTORY_DEPTH 4096
+
+/**
+ * Most samples put into one READ_STATUS_RAW_ANALOG history reply.  A sample is ten parts of at most 32 bytes as text, or 108 bytes in a binary
+ * frame, so this keeps either form of the reply under GC_SOCKET_READER_MAX_LINE.  A window that holds more samples than this has its decimation
+ * raised until it fits.
+ */
+#define GC_IO_HISTORY_REPLY_MAX_SAMPLES 200
+
 /**
  * Number of analog inputs on the board.
  * \xxx really need to centralize this information.  The logic thread also uses this info.
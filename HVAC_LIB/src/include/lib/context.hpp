@@ -28,6 +28,10 @@
 #include <netinet/ip.h>
 #include <pthread.h>
 
+#include <map>
+#include <string>
+#include <vector>
+
 #include "lib/logger.hpp"
 #include "lib/exceptions.hpp"
 #include "lib/message_callbacks.hpp"
@@ -35,6 +39,7 @@
 #include "lib/hvac_types.hpp"
 #include "lib/threads/thread_base.hpp"
 #include "lib/config.hpp"
+#include "lib/serial_io_types.hpp"
 
 namespace BBB_HVAC
 {
@@ -110,14 +115,30 @@ namespace BBB_HVAC
 			timespec curr_time;
 			SOCKET_TYPE st;
 
+			/**
+			 * Flags the thread to stop and wakes up its select loop.
+			 */
+			virtual void flag_for_stop( void );
+
 		protected:
 			bool select_timeout_happened( void );
 			bool send_initial_ping( void );
 			bool thread_func( void );
 
+			/**
+			 * Wakes up the select loop of the context thread.  To be called by other threads after they queue output that the socket did not take, so
+			 * that the loop starts waiting for the socket to become writable.
+			 */
+			void wake_select_loop( void );
+
 			DEF_LOGGER;
 
 			bool is_in_client_mode;
+
+			/**
+			 * Eventfd the select loop waits on along with the remote socket.  \see wake_select_loop
+			 */
+			int wake_fd;
 	};
 
 	/**
@@ -125,6 +146,27 @@ namespace BBB_HVAC
 	 */
 	namespace SERVER
 	{
+		/**
+		 * Serialized READ_STATUS response parts of one board, as last sent to a client.
+		 */
+		typedef struct
+		{
+			/**
+			 * Generation of the board state snapshot the parts were built from.
+			 */
+			uint64_t generation;
+
+			/**
+			 * Snapshot the parts were built from.  A part is built again once its value changed or the timestamp of its latest sample moved.
+			 */
+			IOCOMM::BOARD_STATE_SNAPSHOT rendered;
+
+			/**
+			 * Response parts.
+			 */
+			std::vector<std::string> parts;
+		} READ_STATUS_CACHE;
+
 		/**
 		 * Server context.  This will be used by the server.  This context doesn't do much other than contain the thread context, quit flag, and listening socket.
 		 */
@@ -165,6 +207,26 @@ namespace BBB_HVAC
 				 */
 				virtual ENUM_MESSAGE_CALLBACK_RESULT process_message( ENUM_MESSAGE_DIRECTION _direction, BASE_CONTEXT* _ctx, const MESSAGE_PTR& _message );
 
+			protected:
+				/**
+				 * Re-serializes the READ_STATUS response parts of the fields that changed value or got a newer sample.  Everything else is left as it was last sent.
+				 * \param _cache Parts to update.
+				 * \param _snapshot Board state the parts are built from.
+				 * \param _changes Change mask of the fields whose value changed.
+				 */
+				void update_read_status_parts( READ_STATUS_CACHE& _cache, const IOCOMM::BOARD_STATE_SNAPSHOT& _snapshot, uint32_t _changes );
+
+				/**
+				 * Builds a READ_STATUS response as a binary frame.  The parts are in the same order as the text response.
+				 * \param _snapshot Board state the frame is built from.
+				 * \return Finished frame.
+				 */
+				MESSAGE_PTR create_read_status_frame( const IOCOMM::BOARD_STATE_SNAPSHOT& _snapshot );
+
+				/**
+				 * READ_STATUS responses last sent to this client.  The key is the board tag.
+				 */
+				std::map<std::string, READ_STATUS_CACHE> read_status_cache;
 		};
 	}
 
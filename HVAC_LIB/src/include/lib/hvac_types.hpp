@@ -92,7 +92,7 @@ namespace BBB_HVAC
 	 * 	-# Add an enum value to this type.
 	 * 	-# Add string representation to static 'std::string __message_type_list[]' in message_types.cpp.
 	 * 	-# Add response processing of the message to the code.  BBB_HVAC::SERVER::HS_CLIENT_CONTEXT::process_message in context.cpp is a good start.
-	 * 	-# If wanted, add sanity checking to BBB_HVAC::MESSAGE_PROCESSOR::parse_message(const std::string&).
+	 * 	-# Add the schema of the message to BBB_HVAC::MESSAGE_PROCESSOR::message_schemas in message_processor.cpp.
 	 * 	-# If wanted, add creation method to BBB_HVAC::MESSAGE_PROCESSOR.
 	 *
 	 */
@@ -103,7 +103,7 @@ namespace BBB_HVAC
 		PONG,						/// Response to ping.  Intended to be used as a check of the connection status
 		HELLO,						/// Opening message during connection establishment.
 		READ_STATUS,				/// Requests the status of all inputs and outputs.
-		READ_STATUS_RAW_ANALOG,		/// Requests the raw analog DAC values from the IO board.
+		READ_STATUS_RAW_ANALOG,		/// Requests the raw analog DAC values from the IO board.  With the optional window (ms) and decimation parts requests the sample history instead.
 		SET_STATUS, 				/// Requests for outputs to be set to specified states.
 		SET_PMIC_STATUS,			///	Requests for the DO and AI PMICs to be set to specified states.
 		GET_LABELS, 				/// Requests the map between human readable labels and input/output ports.
@@ -136,10 +136,10 @@ namespace BBB_HVAC
 
 	class __MESSAGE_TYPE;
 	/**
-	 * Typedef of the std::shared_ptr wrapper around __MESSAGE_TYPE.
-	 * This type will be passed around rather than the raw instances __MESSAGE_TYPE.
+	 * Pointer to one of the static __MESSAGE_TYPE instances owned by MESSAGE_TYPE_MAPPER.
+	 * This type will be passed around rather than the raw instances __MESSAGE_TYPE.  The instances live as long as the process does.
 	 */
-	typedef std::shared_ptr<__MESSAGE_TYPE> MESSAGE_TYPE;
+	typedef const __MESSAGE_TYPE* MESSAGE_TYPE;
 
 
 	/**
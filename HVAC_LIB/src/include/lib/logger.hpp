@@ -32,8 +32,11 @@
 
 #define INIT_LOGGER(name) this->__logger__.reset(new BBB_HVAC::LOGGING::LOGGER(name,BBB_HVAC::LOGGING::ENUM_LOG_LEVEL::TRACE));
 
-#define LOG_TRACE(message) __logger__->log_trace(message,__FILE__,__LINE__,__PRETTY_FUNCTION__);
-#define LOG_DEBUG(message) __logger__->log_debug(message,__FILE__,__LINE__,__PRETTY_FUNCTION__);
+/*
+Trace and debug messages are usually filtered out.  The message, file, and function strings are only built if the message is going to be emitted.
+*/
+#define LOG_TRACE(message) do { if ( __logger__->is_enabled( BBB_HVAC::LOGGING::ENUM_LOG_LEVEL::TRACE ) ) { __logger__->log_trace(message,__FILE__,__LINE__,__PRETTY_FUNCTION__); } } while ( 0 );
+#define LOG_DEBUG(message) do { if ( __logger__->is_enabled( BBB_HVAC::LOGGING::ENUM_LOG_LEVEL::DEBUG ) ) { __logger__->log_debug(message,__FILE__,__LINE__,__PRETTY_FUNCTION__); } } while ( 0 );
 #define LOG_INFO(message) __logger__->log_info(message,__FILE__,__LINE__,__PRETTY_FUNCTION__);
 #define LOG_WARNING(message) __logger__->log_warning(message,__FILE__,__LINE__,__PRETTY_FUNCTION__);
 #define LOG_ERROR(message) __logger__->log_error(message,__FILE__,__LINE__,__PRETTY_FUNCTION__);
@@ -98,6 +101,11 @@ namespace BBB_HVAC
 				void log_error( const string& _msg, const string& _file, int _line, const string& _function );
 
 				void log( const ENUM_LOG_LEVEL& _level, const string& _msg, const string& _file, int _line, const string& _function );
+
+				/**
+				Whether a message of the given level would be emitted by this logger and the root configurator.
+				*/
+				bool is_enabled( ENUM_LOG_LEVEL _level ) const;
 				void configure( const string& _name, const ENUM_LOG_LEVEL& _level = ENUM_LOG_LEVEL::ERROR );
 
 			protected:
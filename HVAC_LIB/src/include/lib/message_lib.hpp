@@ -24,12 +24,15 @@
 #include "lib/message_types.hpp"
 #include "lib/exceptions.hpp"
 #include "lib/hvac_types.hpp"
+#include "lib/text_view.hpp"
+#include "lib/binary_frame.hpp"
 
 #include <string>
 #include <vector>
 #include <memory>
 
 #include <time.h>
+#include <pthread.h>
 
 namespace BBB_HVAC
 {
@@ -37,6 +40,9 @@ namespace BBB_HVAC
 
 	/**
 	 * A message used to communicated between nodes.
+	 * The message keeps its wire form; the parts are views into it.  The wire form is either a protocol version 1 text line or a version 2 binary frame
+	 * (see BINARY_FRAME).  The parts of a binary message read the same as the parts of the equivalent text message; they are rendered as text the first
+	 * time they are asked for as text.  The decode_part and decode_entry methods read binary parts without rendering them.
 	 */
 	class MESSAGE
 	{
@@ -53,6 +59,84 @@ namespace BBB_HVAC
 			 */
 			~MESSAGE();
 
+			/**
+			 * Turns the instance into a new message.  Reuses the storage of the previous message; used by MESSAGE_POOL.
+			 * \param _type Message type
+			 * \param _first First part of the new message.
+			 * \param _last One past the last part of the new message.
+			 */
+			void assign( const MESSAGE_TYPE& _type, vector<string>::const_iterator _first, vector<string>::const_iterator _last );
+
+			/**
+			 * \see assign(const MESSAGE_TYPE&,vector<string>::const_iterator,vector<string>::const_iterator)
+			 */
+			void assign( const MESSAGE_TYPE& _type, const vector<string>& _parts );
+
+			/**
+			 * Turns the instance into a message received from remote.  The buffer is copied once; the parts are kept as positions in the copy.
+			 * \param _type Message type
+			 * \param _buffer The message as it was received, terminating new line included.
+			 * \param _length Length of the buffer.
+			 * \param _parts Parts of the message.  Must point into _buffer.
+			 * \param _part_count Number of parts.
+			 */
+			void assign( const MESSAGE_TYPE& _type, const char* _buffer, size_t _length, const TEXT_VIEW* _parts, size_t _part_count );
+
+			/**
+			 * Turns the instance into an empty binary message.  The parts are added with the append_* methods; finish_frame completes the frame.
+			 * \param _type Message type
+			 */
+			void assign_frame( const MESSAGE_TYPE& _type );
+
+			/**
+			 * Turns the instance into a binary message received from remote.  The buffer is copied once; the parts are kept as positions in the copy.
+			 * \param _type Message type.  Must be the type in the frame header.
+			 * \param _buffer The frame as it was received.
+			 * \param _length Length of the frame.
+			 * \throws EXCEPTIONS::PROTOCOL_ERROR if the parts do not add up to the frame.
+			 */
+			void assign_frame( const MESSAGE_TYPE& _type, const char* _buffer, size_t _length );
+
+			/**
+			 * Appends a text part to a binary message.
+			 * \param _value Text.  At most UINT16_MAX bytes.
+			 */
+			void append_text( const string& _value );
+
+			/**
+			 * Appends an 8 bit cache entry to a binary message.  Reads like IOCOMM::CACHE_ENTRY_8BIT::to_string.
+			 * \param _value Entry value.
+			 * \param _time Entry timestamp.
+			 */
+			void append_entry( uint8_t _value, const timespec& _time );
+
+			/**
+			 * Appends a 16 bit cache entry to a binary message.  Reads like IOCOMM::CACHE_ENTRY_16BIT::to_string.
+			 * \param _value Entry value.
+			 * \param _time Entry timestamp.
+			 */
+			void append_entry( uint16_t _value, const timespec& _time );
+
+			/**
+			 * Appends a double to a binary message.  Reads like num_to_str(double).
+			 */
+			void append_double( double _value );
+
+			/**
+			 * Appends a boolean to a binary message.  Reads like num_to_str(bool).
+			 */
+			void append_bool( bool _value );
+
+			/**
+			 * Fills in the part count and length of a binary message.  Must be called after the last part was appended.
+			 */
+			void finish_frame( void );
+
+			/**
+			 * Tells whether the message is a binary frame.
+			 */
+			bool is_binary( void ) const;
+
 			/**
 			 * Returns the message type
 			 * \return Message type
@@ -77,10 +161,48 @@ namespace BBB_HVAC
 			const string& get_payload( void ) const;
 
 			/**
-			 * Returns the parsed message parts/payload.
-			 * \return Message parts/payload as a vector of strings.
+			 * Returns a message part without copying it.
+			 * \param _part Index of the part.
+			 * \return The part.  Points into the message and is valid as long as the message is not reused.  Throws an exception if the index is out of range.
+			 */
+			TEXT_VIEW get_part( size_t _part ) const;
+
+			/**
+			 * Converts a message part to an unsigned integer.  Does not throw.
+			 * \param _part Index of the part.
+			 * \param _value Set to the value on success.
+			 * \return False if the index is out of range or the part is not a number that fits.
+			 */
+			bool decode_part( size_t _part, uint16_t& _value ) const;
+
+			/**
+			 * \see decode_part(size_t,uint16_t&)
 			 */
-			const vector<string>& get_parts( void ) const;
+			bool decode_part( size_t _part, int16_t& _value ) const;
+
+			/**
+			 * \see decode_part(size_t,uint16_t&)
+			 */
+			bool decode_part( size_t _part, int& _value ) const;
+
+			/**
+			 * \see decode_part(size_t,uint16_t&)
+			 */
+			bool decode_part( size_t _part, unsigned long& _value ) const;
+
+			/**
+			 * \see decode_part(size_t,uint16_t&)
+			 */
+			bool decode_part( size_t _part, double& _value ) const;
+
+			/**
+			 * Reads a cache entry part.  Works for both the text form ([seconds.nanoseconds:value]) and the binary entry parts.  Does not throw.
+			 * \param _part Index of the part.
+			 * \param _value Set to the entry value on success.
+			 * \param _time Set to the entry timestamp on success.
+			 * \return False if the index is out of range or the part is not a cache entry.
+			 */
+			bool decode_entry( size_t _part, uint16_t& _value, timespec& _time ) const;
 
 			/**
 			 * Tags the message as being received.  Calling this method more than once will raise a runtime_exception
@@ -103,23 +225,23 @@ namespace BBB_HVAC
 			 * \param _part Index of the part to convert to a number.
 			 * \return Value of the part as an unsigned integer.  Throws an exception if the part payload can not be parsed into a numerical form.
 			 */
-			uint16_t get_part_as_ui( size_t _part ) ;
+			uint16_t get_part_as_ui( size_t _part ) const;
 			/**
 			 * Gets a message part as a signed integer.
 			 * \see get_par_as_ui(_part)
 			 */
-			int16_t get_part_as_si( size_t _part ) ;
+			int16_t get_part_as_si( size_t _part ) const;
 
 			/**
 			 * Gets a message part as a string
 			 * \return Part as a string.
 			 */
-			string get_part_as_s( size_t _part ) ;
+			string get_part_as_s( size_t _part ) const;
 			/**
 			 * Gets a message part as a double
 			 * \return Part as a string.
 			 */
-			double get_part_as_d( size_t _part ) ;
+			double get_part_as_d( size_t _part ) const;
 
 			/**
 			 * Gets the timestamp of when this message instance was sent to remote.
@@ -148,23 +270,27 @@ namespace BBB_HVAC
 
 			static void message_to_map( const MESSAGE_PTR& _message, std::map<std::string, std::string>& _dest_map ) ;
 
+			/**
+			 * Serializes a message into its wire form: the length prefix, the type label, and the parts, all separated by sep_char and terminated by a new line.
+			 * Makes a single pass over the parts.  The destination's storage is reused, so a caller that keeps the string around does not allocate once it is large enough.
+			 * \param _type Message type.
+			 * \param _parts Message parts.
+			 * \param _dest Replaced with the serialized message.
+			 */
+			static void serialize( const MESSAGE_TYPE& _type, const vector<string>& _parts, string& _dest );
+
 		protected:
 			/**
 			 * Checks to see if the supplied part index is valid (is in range)
 			 * \param _part Part index.
 			 */
-			void check_part_index( size_t _part ) ;
+			void check_part_index( size_t _part ) const;
 
 			/**
 			 * Protected initializer.  Zeros out and resets all of the classe's properties.
 			 */
 			void init( void );
 
-			/**
-			 * Builds the messages payload.
-			 */
-			void build_message( void );
-
 			/**
 			 * Message type.
 			 */
@@ -181,24 +307,84 @@ namespace BBB_HVAC
 			string payload;
 
 			/**
-			 * Parsed parts of the message.
+			 * Where a part is in the payload.
+			 */
+			typedef struct
+			{
+				size_t offset;
+				size_t length;
+
+				/**
+				 * BINARY_FRAME::ENUM_FIELD_TAG of a binary part, zero for a text part.
+				 */
+				unsigned char tag;
+			} PART_SPAN;
+
+			/**
+			 * Parts of the message, as positions in the payload.
+			 */
+			vector<PART_SPAN> parts;
+
+			/**
+			 * \see serialize(const MESSAGE_TYPE&,const vector<string>&,string&)
+			 * \param _spans If not null, set to the positions of the parts in _dest.
 			 */
-			vector<string> parts;
+			static void serialize( const MESSAGE_TYPE& _type, vector<string>::const_iterator _first, vector<string>::const_iterator _last, string& _dest, vector<PART_SPAN>* _spans );
 
 			/**
-			 * Timestamp of when the class was instantiated.
+			 * Set if the payload is a binary frame.
 			 */
-			struct timespec* class_created;
+			bool binary;
+
+			/**
+			 * Parts of a binary message rendered as text.  Filled in by render_text.
+			 */
+			mutable string text;
+
+			/**
+			 * Positions of the rendered parts in text.
+			 */
+			mutable vector<PART_SPAN> text_parts;
+
+			/**
+			 * Set once the parts of a binary message have been rendered.
+			 */
+			mutable bool text_rendered;
+
+			/**
+			 * Renders the parts of a binary message as text, unless that has been done already.
+			 */
+			void render_text( void ) const;
+
+			/**
+			 * Appends a binary part.
+			 * \param _tag Part tag.
+			 * \param _data Bytes after the tag.
+			 * \param _length Number of bytes after the tag.
+			 */
+			void append_field( BINARY_FRAME::ENUM_FIELD_TAG _tag, const char* _data, size_t _length );
+
+			/**
+			 * Tells whether a part is a binary number rather than text.
+			 * \param _part Index of the part.  Must be in range.
+			 * \param _value Set to the value of the part if it is a number.
+			 */
+			bool get_binary_number( size_t _part, double& _value ) const;
+
+			/**
+			 * Timestamp of when the message was created.
+			 */
+			struct timespec class_created;
 
 			/**
 			 * Timestamp of when this message was received from remote.
 			 */
-			struct timespec* message_received;
+			struct timespec message_received;
 
 			/**
 			 * Timestamp of when this message was sent to remote.
 			 */
-			struct timespec* message_sent;
+			struct timespec message_sent;
 
 			/**
 			 * Gets the current timestamp and places the supplied buffer.
@@ -206,6 +392,97 @@ namespace BBB_HVAC
 			 */
 			static void get_timestamp( timespec* _tm ) ;
 	};
+
+	/**
+	 * Recycles the messages of a single connection.  A message is handed out again once nothing but the pool holds a reference to it; its strings and
+	 * vectors keep their storage, so a connection that keeps sending the same kinds of messages stops allocating.
+	 * Every connection has its own pool.  The connection's thread creates the messages it parses, while client code creates the messages it sends from
+	 * its own threads, so creating a message takes the pool lock.  The messages the pool hands out may be released from any thread.
+	 */
+	class MESSAGE_POOL
+	{
+		public:
+			/**
+			 * Constructor
+			 * \param _max_size Most messages the pool keeps.  Messages created while all of them are in use are not pooled.
+			 */
+			MESSAGE_POOL( size_t _max_size );
+
+			/**
+			 * Destructor
+			 */
+			~MESSAGE_POOL();
+
+			/**
+			 * Creates a message.
+			 * \param _type Message type
+			 * \param _first First part of the message.
+			 * \param _last One past the last part of the message.
+			 * \return A recycled message if one is free, a new one otherwise.  A free message with as many parts is recycled first.
+			 */
+			MESSAGE_PTR create( const MESSAGE_TYPE& _type, vector<string>::const_iterator _first, vector<string>::const_iterator _last );
+
+			/**
+			 * \see create(const MESSAGE_TYPE&,vector<string>::const_iterator,vector<string>::const_iterator)
+			 */
+			MESSAGE_PTR create( const MESSAGE_TYPE& _type, const vector<string>& _parts );
+
+			/**
+			 * Creates a message from a line that has already been split into parts.
+			 * \see MESSAGE::assign(const MESSAGE_TYPE&,const char*,size_t,const TEXT_VIEW*,size_t)
+			 */
+			MESSAGE_PTR create( const MESSAGE_TYPE& _type, const char* _buffer, size_t _length, const TEXT_VIEW* _parts, size_t _part_count );
+
+			/**
+			 * Creates an empty binary message.
+			 * \param _type Message type
+			 * \param _part_count Number of parts the message is going to have.
+			 * \see MESSAGE::assign_frame(const MESSAGE_TYPE&)
+			 */
+			MESSAGE_PTR create_frame( const MESSAGE_TYPE& _type, size_t _part_count );
+
+			/**
+			 * Creates a binary message from a received frame.
+			 * \param _type Message type
+			 * \param _part_count Number of parts in the frame header.
+			 * \see MESSAGE::assign_frame(const MESSAGE_TYPE&,const char*,size_t)
+			 */
+			MESSAGE_PTR create_frame( const MESSAGE_TYPE& _type, size_t _part_count, const char* _buffer, size_t _length );
+
+			/**
+			 * Gets the number of messages in the pool, free or not.
+			 */
+			size_t get_size( void );
+
+		protected:
+			/**
+			 * Finds a free message, preferably one with as many parts, or creates one.  The message still has to be assigned.
+			 * \param _type Type of the message, used when a new message has to be created.
+			 * \param _part_count Number of parts the message is going to have.
+			 */
+			MESSAGE_PTR acquire( const MESSAGE_TYPE& _type, size_t _part_count );
+
+			/**
+			 * Pooled messages.
+			 */
+			MESSAGE_VECTOR messages;
+
+			/**
+			 * Most messages the pool keeps.
+			 */
+			size_t max_size;
+
+			/**
+			 * Where the search for a free message starts.  The search goes round robin from the message handed out last.
+			 */
+			size_t next;
+
+			/**
+			 * Guards messages and next.  Held while a free message is looked for and until the caller holds a reference to it, so that no other thread
+			 * can see the message as free.
+			 */
+			pthread_mutex_t mutex;
+	};
 }
 
 #endif /* SRC_INCLUDE_MESSAGE_LIB_HPP_ */
@@ -130,18 +130,71 @@ namespace BBB_HVAC
 			MESSAGE_PTR parse_message( const std::string& _buffer ) ;
 
 			/**
-			 * Sends a message to the remote endpoint.
-			 * \param _msg Message to send.
+			 * Parses a line and attempts to construct a message instance.  The line is split in place and checked against the schema of its type;
+			 * the message gets the only copy of it.  Binary frames are accepted once version 2 of the protocol has been negotiated.
+			 * \param _buffer Start of the line, including the trailing new line, or of the binary frame.
+			 * \param _length Length of the line or frame.
+			 * \return Valid message instance if the line was parsed successfully.
+			 */
+			MESSAGE_PTR parse_message( const char* _buffer, size_t _length ) ;
+
+			/**
+			 * Sends a message to the remote endpoint.  The message is appended to the output buffer of the connection and as much of the buffer is written
+			 * as the socket takes without blocking.  Whatever is left is written by flush_output once the socket is writable again.
+			 * \param _msg Message to send.  The buffer holds on to it until it has been written; the payload is not copied.
 			 * \param _fd File descriptor of the socket to which to write the message.
+			 * \throws EXCEPTIONS::CONNECTION_ERROR if the output buffer would grow past GC_OUTPUT_BUFFER_HIGH_WATER.  The remote is not keeping up and should be dropped.
+			 * \throws EXCEPTIONS::MESSAGE_ERROR if writing to the socket fails.
 			 */
 			void send_message( MESSAGE_PTR& _msg, int _fd ) ;
 
+			/**
+			 * Writes as much of the output buffer as the socket takes without blocking.  Up to GC_OUTPUT_IOV_COUNT messages go out in a single gather write.
+			 * \param _fd File descriptor of the socket to which to write.
+			 * \return True if the output buffer is empty.
+			 * \throws EXCEPTIONS::MESSAGE_ERROR if writing to the socket fails.
+			 */
+			bool flush_output( int _fd ) ;
+
+			/**
+			 * Returns the number of bytes in the output buffer that have not been written yet.
+			 * \return Number of bytes.
+			 */
+			inline size_t get_pending_output( void ) const {
+				return this->output_bytes;
+			}
+
+			/**
+			 * Creates a message out of the connection's message pool.
+			 * \param _type Message type.
+			 * \param _parts Message parts.
+			 * \return Valid message instance.
+			 */
+			MESSAGE_PTR create_message( ENUM_MESSAGE_TYPE _type, const vector<string>& _parts );
+
+			/**
+			 * Creates an empty binary frame out of the connection's message pool.  The caller appends the parts and finishes the frame.
+			 * \param _type Message type.
+			 * \param _part_count Number of parts the frame will have.  Only used to size the message.
+			 * \return Valid message instance.
+			 * \see use_binary
+			 */
+			MESSAGE_PTR create_frame( ENUM_MESSAGE_TYPE _type, size_t _part_count );
+
+			/**
+			 * Should messages of the type be sent to the remote as binary frames.
+			 * \param _type Message type.
+			 * \return True if version 2 of the protocol was negotiated and the schema of the type allows binary frames.
+			 */
+			bool use_binary( ENUM_MESSAGE_TYPE _type ) const;
 
 			/**
 			 * Creates a message of type HELLO
+			 * \param _version Protocol version to advertise.  A client offers get_max_protocol().  A server opens with 1, since v1 clients reject anything
+			 * higher, and answers the offer of the client with get_protocol_version() when process_hello_message asks it to.
 			 * \return Valid message instance.
 			 */
-			MESSAGE_PTR create_hello_message( void );
+			MESSAGE_PTR create_hello_message( unsigned int _version );
 
 			/**
 			 * Creates a message of type PING
@@ -173,6 +226,15 @@ namespace BBB_HVAC
 			 */
 			MESSAGE_PTR create_get_raw_adc_values( const std::string& _board_tag ) ;
 
+			/**
+			 * Creates a message of type READ_STATUS_RAW_ANALOG that requests the board's sample history.
+			 * \param _board_tag Board to query.
+			 * \param _window_ms How far back to go, in milliseconds.
+			 * \param _decimation Only every Nth sample is returned.
+			 * \return Valid message instance.
+			 */
+			MESSAGE_PTR create_get_raw_adc_history( const std::string& _board_tag, unsigned long _window_ms, unsigned long _decimation ) ;
+
 			/**
 			 * Creates a message of type READ_STATUS
 			 * \return Valid message instance.
@@ -214,9 +276,12 @@ namespace BBB_HVAC
 			MESSAGE_PTR create_set_sp( const std::string& _sp_name, double _value ) ;
 
 			/**
-			 * Processes an incoming message of type HELLO
+			 * Processes an incoming message of type HELLO.  Each end settles on the lower of the version in the first HELLO of the remote and its own maximum.
+			 * A second HELLO is accepted only as the answer of a server that opened with 1, and switches to the version it carries.
+			 * \return True if the remote has to be answered with a HELLO carrying the negotiated version.  That is the case when the first HELLO offered
+			 * more than 1 and we settled on more than 1.
 			 */
-			void process_hello_message( void ) ;
+			bool process_hello_message( void ) ;
 
 			/**
 			 * Gets the latest incoming message of type PONG.  If such a message does not exist a nullptr is returned.
@@ -238,6 +303,29 @@ namespace BBB_HVAC
 				return this->protocol_negotiated;
 			}
 
+			/**
+			 * Returns the protocol version in use.  1 until the HELLO of the remote has been processed.  On the client it rises once the answer of the server
+			 * to the offer arrives.
+			 * \return Protocol version.
+			 */
+			inline unsigned int get_protocol_version( void ) const {
+				return this->protocol_version;
+			}
+
+			/**
+			 * Caps the protocol version offered to the remote.  Has to be called before the HELLO message is created.
+			 * \param _version Highest version to offer.  Between 1 and MAX_SUPPORTED_PROTOCOL.
+			 */
+			void set_max_protocol( unsigned int _version );
+
+			/**
+			 * Returns the highest protocol version offered to the remote.
+			 * \return Protocol version.
+			 */
+			inline unsigned int get_max_protocol( void ) const {
+				return this->max_protocol;
+			}
+
 			string to_string( void ) const;
 
 			/**
@@ -245,6 +333,52 @@ namespace BBB_HVAC
 			 */
 			static unsigned int MAX_SUPPORTED_PROTOCOL;
 
+			/**
+			 * What a part of a message has to look like.
+			 */
+			enum class ENUM_FIELD_KIND : unsigned char
+			{
+				ANY = 0,	/// Anything goes.
+				UINT16,		/// Decimal number that fits a uint16_t.
+				INT32,		/// Decimal number that fits an int32_t, optionally signed.
+				DOUBLE		/// Floating point number.
+			} ;
+
+			/**
+			 * Shape of a message type.  Checked by parse_message before the message is handed out.
+			 */
+			typedef struct
+			{
+				/**
+				 * Least number of parts, the type excluded.
+				 */
+				size_t min_parts;
+
+				/**
+				 * Most number of parts, the type excluded.  SIZE_MAX if there is no limit.
+				 */
+				size_t max_parts;
+
+				/**
+				 * Number of leading parts that are checked against fields.
+				 */
+				size_t field_count;
+
+				/**
+				 * Kinds of the leading parts.
+				 */
+				ENUM_FIELD_KIND fields[4];
+
+				/**
+				 * Can the type be sent as a binary frame once version 2 of the protocol is in use.
+				 */
+				bool binary;
+			} MESSAGE_SCHEMA;
+
+			/**
+			 * Schemas of all message types, indexed by ENUM_MESSAGE_TYPE.
+			 */
+			static const MESSAGE_SCHEMA message_schemas[];
 
 		protected:
 
@@ -264,6 +398,76 @@ namespace BBB_HVAC
 			 */
 			bool protocol_negotiated;
 
+			/**
+			 * Protocol version in use.
+			 */
+			unsigned int protocol_version;
+
+			/**
+			 * Highest protocol version offered to the remote.
+			 */
+			unsigned int max_protocol;
+
+			/**
+			 * Number of HELLO messages received from the remote.  \see process_hello_message
+			 */
+			unsigned int hellos_received;
+
+			/**
+			 * Messages of this connection.  Every message the processor creates comes out of it.
+			 */
+			MESSAGE_POOL* message_pool;
+
+			/**
+			 * Output buffer.  Messages from output_head on have not been completely written yet.
+			 */
+			vector<MESSAGE_PTR> output_queue;
+
+			/**
+			 * Index of the first message in output_queue that has not been completely written.
+			 */
+			size_t output_head;
+
+			/**
+			 * Number of bytes of the message at output_head that have been written.
+			 */
+			size_t output_offset;
+
+			/**
+			 * Number of bytes in the output buffer that have not been written.
+			 */
+			size_t output_bytes;
+
+			/**
+			 * Parts of the message being parsed, the type included.  Kept between messages so that it keeps its storage.
+			 */
+			vector<TEXT_VIEW> parse_tokens;
+
+			/**
+			 * Checks the parts of a parsed message against the schema of its type.
+			 * \param _type Message type.
+			 * \param _parts Parts of the message, the type excluded.
+			 * \param _part_count Number of parts.
+			 * \throws EXCEPTIONS::PROTOCOL_ERROR if the message does not fit the schema.
+			 */
+			static void check_schema( const MESSAGE_TYPE& _type, const TEXT_VIEW* _parts, size_t _part_count );
+
+			/**
+			 * Checks the part count of a message against the schema of its type.
+			 * \param _type Message type.
+			 * \param _part_count Number of parts, the type excluded.
+			 * \throws EXCEPTIONS::PROTOCOL_ERROR if the count is out of range.
+			 */
+			static void check_part_count( const MESSAGE_TYPE& _type, size_t _part_count );
+
+			/**
+			 * Parses a binary frame.  SOCKET_READER has already checked that the frame is complete.
+			 * \param _buffer Start of the frame.
+			 * \param _length Length of the frame.
+			 * \return Valid message instance if the frame was parsed successfully.
+			 */
+			MESSAGE_PTR parse_frame( const char* _buffer, size_t _length );
+
 			/**
 			 * Hidden copy constructor
 			 */
@@ -23,18 +23,31 @@
 
 #include "lib/hvac_types.hpp"
 
+#include <stdint.h>
+
 #include <string>
 #include <memory>
 #include <map>
+#include <vector>
 #include <sstream>
 #include <ostream>
 
+/**
+ * Number of slots in the message type label hash table.  A power of two at least twice the number of message types keeps the search for a seed short.
+ */
+#define MESSAGE_TYPE_HASH_SLOTS 64
+
+/**
+ * Number of seeds tried before giving up on finding a perfect hash for the message type labels.
+ */
+#define MESSAGE_TYPE_HASH_MAX_SEED 65536
+
 namespace BBB_HVAC
 {
 
 	/**
 	 * Class representing a message type supported.
-	 * This class is not intended to be used directly.  It is intended to be wrapped in a std::shared_ptr template.
+	 * This class is not intended to be used directly.  The instances are owned by MESSAGE_TYPE_MAPPER and handed out as pointers.
 	 * \see MESSAGE_TYPE
 	 */
 	class __MESSAGE_TYPE
@@ -98,14 +111,27 @@ namespace BBB_HVAC
 	protected:
 
 		/**
-		 * An enum to message type map instance.
+		 * The message types, indexed by ENUM_MESSAGE_TYPE.  Filled in once by the constructor and never resized, so the pointers into it stay valid.
+		 */
+		std::vector<__MESSAGE_TYPE> types;
+
+		/**
+		 * Label hash table.  Every label has a slot of its own; the slots without a label are null.
 		 */
-		MAP_TYPE_TO_LABEL enum_to_type;
+		MESSAGE_TYPE hash_slots[MESSAGE_TYPE_HASH_SLOTS];
 
 		/**
-		 * A label to message type map instance.
+		 * Seed that makes hash_label place every label in a slot of its own.  Found by the constructor.
 		 */
-		MAP_LABEL_TO_TYPE label_to_type;
+		uint32_t hash_seed;
+
+		/**
+		 * Hashes a label.
+		 * \param _seed Hash seed.
+		 * \param _label Start of the label.
+		 * \param _length Length of the label.
+		 */
+		static uint32_t hash_label( uint32_t _seed, const char* _label, size_t _length );
 
 	};
 
@@ -124,16 +150,24 @@ namespace BBB_HVAC
 		static size_t get_message_type_count( void );
 
 		/**
-		 * Maps a label to a type.
+		 * Maps a label to a type.  Does not allocate and is safe to call from any thread.
 		 * \param _label Type label.
-		 * \return A MESSAGE_TYPE instance for the supplied label.
+		 * \return A MESSAGE_TYPE instance for the supplied label.  nullptr if there is no such type.
 		 */
 		static MESSAGE_TYPE get_message_type_by_label( const std::string& _label );
 
+		/**
+		 * Maps a label that is not null terminated to a type.
+		 * \param _label Start of the label.
+		 * \param _length Length of the label.
+		 * \return A MESSAGE_TYPE instance for the supplied label.  nullptr if there is no such type.
+		 */
+		static MESSAGE_TYPE get_message_type_by_label( const char* _label, size_t _length );
+
 		/**
 		 * Maps an enum to a type.
 		 * \param _enum Type enum.
-		 * \return A MESSAGE_TYPE instance for the supplied enum.
+		 * \return A MESSAGE_TYPE instance for the supplied enum.  nullptr if the enum is out of range.
 		 */
 		static MESSAGE_TYPE get_message_type_by_enum( const ENUM_MESSAGE_TYPE& _enum );
 
@@ -21,12 +21,12 @@
 #ifndef OUTGOING_MESSAGE_QUEUE_HPP
 #define OUTGOING_MESSAGE_QUEUE_HPP
 
-#include <queue>
+#include <deque>
 #include <string>
+#include <atomic>
 #include <cstdint>
-#include <pthread.h>
 
-#include "lib/threads/tprotect_base.hpp"
+#include "lib/config.hpp"
 #include "lib/exceptions.hpp"
 #include "lib/logger.hpp"
 
@@ -38,43 +38,97 @@ namespace BBB_HVAC
 	{
 		/**
 		 * A queue of outgoing messages waiting to be written to the wire.
+		 * A preallocated ring of GC_SERIAL_OUTGOING_QUEUE_SIZE inline message slots.  Any number of threads may add messages; only one thread, the writer, may take them.
+		 * Adding a message never allocates and never waits on a lock.  The writer is woken up through an eventfd doorbell that can be waited on directly or through epoll.
 		 */
-		class OUTGOING_MESSAGE_QUEUE : protected TPROTECT_BASE
+		class OUTGOING_MESSAGE_QUEUE
 		{
 			public:
 				OUTGOING_MESSAGE_QUEUE( const std::string& _tag );
 				virtual ~OUTGOING_MESSAGE_QUEUE();
 
-				bool add_message( const OUTGOING_MESSAGE& _msg );
-
-				bool wait_for_signal( void ) ;
-
-				bool has_more_messages( void ) const;
-				OUTGOING_MESSAGE get_message( void );
-				void put_lock( void ) ;
-
-				inline void swap_message_queue( std::queue<OUTGOING_MESSAGE>* _destination ) {
-					std::swap( this->message_queue, *_destination );
-					return;
-				}
-
-				inline void clear( void ) {
-					while ( !this->message_queue.empty() ) {
-						this->message_queue.pop();
-					}
+				/**
+				 * Copies a message into the next free slot and rings the doorbell.  Safe to call from any thread.
+				 * \param _buffer Message to add.
+				 * \param _length Length of the message.  Must not exceed GC_SERIAL_OUTGOING_MESSAGE_SIZE.
+				 * \return True if the message was queued, false if the queue is full or the message is too long.
+				 */
+				bool add_message( const unsigned char* _buffer, size_t _length );
+
+				/**
+				 * Waits for the doorbell to be rung.  Writer thread only.
+				 * \param _timeout Maximum number of milliseconds to wait.
+				 * \return True if the doorbell was rung, false if the wait timed out.
+				 */
+				bool wait_for_signal( int _timeout );
+
+				/**
+				 * Resets the doorbell and moves all of the queued messages to the end of the supplied queue.  Does not block waiting for messages.  Writer thread only.
+				 * \param _destination Queue to which to move the messages.
+				 */
+				void take_messages( std::deque<OUTGOING_MESSAGE>* _destination );
+
+				/**
+				 * Discards all of the messages added so far.  Safe to call from any thread.  The messages are dropped by the writer the next time it takes messages.
+				 */
+				void clear( void );
+
+				/**
+				 * Rings the doorbell without adding a message.  Used to wake the writer up.
+				 */
+				void wake( void );
+
+				/**
+				 * Returns the doorbell eventfd.
+				 */
+				inline int get_doorbell_fd( void ) const {
+					return this->doorbell_fd;
 				}
 			protected:
 
-				void signal( void );
-				void get_lock( void ) ;
-
-
-
-				pthread_cond_t conditional;
+				/**
+				 * Takes the oldest message from the ring.
+				 * \param _dest Receives the message.
+				 * \return False if the ring is empty.
+				 */
+				bool take_message( OUTGOING_MESSAGE& _dest );
+
+				/**
+				 * A message slot.  The sequence number tells producers and the consumer whose turn it is to touch the slot.
+				 */
+				struct SLOT
+				{
+					std::atomic<size_t> sequence;
+					OUTGOING_MESSAGE message;
+				};
 
 				std::string tag;
-				std::queue<OUTGOING_MESSAGE> message_queue;
-				uint_least32_t id_seq;
+
+				/**
+				 * GC_SERIAL_OUTGOING_QUEUE_SIZE slots.
+				 */
+				SLOT* slots;
+
+				/**
+				 * Position of the next message to be added.  Claimed by producers with compare-and-swap.
+				 */
+				std::atomic<size_t> enqueue_pos;
+
+				/**
+				 * Position of the next message to be taken.  Only touched by the writer.
+				 */
+				size_t dequeue_pos;
+
+				/**
+				 * Messages at positions before this one are discarded.
+				 * \see clear
+				 */
+				std::atomic<size_t> discard_pos;
+
+				/**
+				 * eventfd signaled when a message is added.
+				 */
+				int doorbell_fd;
 			private:
 
 				DEF_LOGGER;
@@ -83,4 +137,3 @@ namespace BBB_HVAC
 	}
 }
 #endif /* OUTGOING_MESSAGE_QUEUE_HPP */
-
@@ -0,0 +1,297 @@
+/*
+* This file is part of the software stack for Vic's IO board and its
+* associated projects.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+* Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+*/
+
+
+#ifndef SRC_INCLUDE_LIB_SERIAL_CAPTURE_HPP_
+#define SRC_INCLUDE_LIB_SERIAL_CAPTURE_HPP_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+#include "lib/config.hpp"
+#include "lib/threads/tprotect_base.hpp"
+#include "lib/logger.hpp"
+
+/**
+ \file Serial wire capture and replay.
+
+ A capture file is append only.  It starts with the eight byte magic SERIAL_CAPTURE_MAGIC and is followed by records, each a twelve byte header and the data:
+ 	- monotonic time stamp in microseconds, 64 bit little endian;
+ 	- data length, 16 bit little endian;
+ 	- direction, one byte;
+ 	- reserved byte, always zero.
+ A capture that is reopened is appended to; the time stamps of the new records simply continue from where the clock is.
+ */
+
+/**
+ * Magic bytes at the start of a capture file.
+ */
+#define SERIAL_CAPTURE_MAGIC "VIOBCAP1"
+
+/**
+ * Size of the magic.
+ */
+#define SERIAL_CAPTURE_MAGIC_SIZE 8
+
+/**
+ * Size of a record header.
+ */
+#define SERIAL_CAPTURE_RECORD_HEAD_SIZE 12
+
+namespace BBB_HVAC
+{
+	namespace IOCOMM
+	{
+		/**
+		 * Direction of the captured data.
+		 */
+		enum class ENUM_CAPTURE_DIRECTION : unsigned char
+		{
+			FROM_BOARD = 0,
+			TO_BOARD = 1
+		};
+
+		/**
+		 * Capture statistics.
+		 */
+		typedef struct
+		{
+			/**
+			 * Number of records handed to the capture.
+			 */
+			uint64_t records;
+
+			/**
+			 * Number of bytes written to the file, headers included.
+			 */
+			uint64_t bytes_written;
+
+			/**
+			 * Number of records dropped because the buffer was full or the file could not be written.
+			 */
+			uint64_t records_dropped;
+		} SERIAL_CAPTURE_STATS;
+
+		/**
+		 * Records the serial traffic of a board into a capture file.
+		 * The IO threads only copy the data into an in memory buffer; a flusher thread of the capture's own writes the buffer out.
+		 * Recording never waits on the file.
+		 */
+		class SERIAL_CAPTURE : public TPROTECT_BASE
+		{
+				/**
+				 * Shim function that's used to start the flusher thread.
+				 */
+				friend void* serial_capture_shim_func( void* );
+
+			public:
+				/**
+				 * Constructor.  Instantiating the class does not open the file.
+				 * \param _tag Tag destined for human consumption used for debugging purposes.
+				 */
+				SERIAL_CAPTURE( const string& _tag );
+
+				/**
+				 * Destructor.  Stops the capture if it is running.
+				 */
+				virtual ~SERIAL_CAPTURE();
+
+				/**
+				 * Opens, or creates, the capture file and starts the flusher thread.
+				 * \param _file Capture file name.
+				 * \return True on success, false otherwise.
+				 */
+				bool start( const string& _file );
+
+				/**
+				 * Writes out whatever is buffered and stops the flusher thread.
+				 */
+				void stop( void );
+
+				/**
+				 * Adds a record to the capture.  Safe to call from more than one thread.
+				 * \param _direction Which way the data went.
+				 * \param _data Data.
+				 * \param _length Length of the data.  Longer data is split into more than one record.
+				 */
+				void record( ENUM_CAPTURE_DIRECTION _direction, const unsigned char* _data, size_t _length );
+
+				/**
+				 * Copies the capture statistics.
+				 */
+				void get_stats( SERIAL_CAPTURE_STATS& _dest ) const;
+
+			protected:
+
+				/**
+				 * Flusher thread.  Writes the filled buffer out every GC_SERIAL_CAPTURE_FLUSH_INTERVAL microseconds.
+				 */
+				void flusher_thread_func( void );
+
+				/**
+				 * Swaps the buffers and writes out the one that was being filled.
+				 * \return False if the file could not be written.
+				 */
+				bool flush( void );
+
+				/**
+				 * Capture file.  -1 if the capture is not running.
+				 */
+				int fd;
+
+				/**
+				 * Buffer the IO threads fill.  Protected by the instance lock.
+				 */
+				unsigned char* fill_buffer;
+
+				/**
+				 * Number of bytes in the fill buffer.
+				 */
+				size_t fill_length;
+
+				/**
+				 * Buffer the flusher writes out.  Only touched by the flusher.
+				 */
+				unsigned char* flush_buffer;
+
+				/**
+				 * Flusher thread.
+				 */
+				pthread_t flusher_thread;
+
+				/**
+				 * Tells the flusher thread to finish.
+				 */
+				std::atomic<bool> stop_flag;
+
+				/**
+				 * Whether the flusher thread is running.
+				 */
+				bool running;
+
+				/**
+				 * \see SERIAL_CAPTURE_STATS
+				 */
+				std::atomic<uint64_t> stat_records;
+
+				/**
+				 * \see SERIAL_CAPTURE_STATS
+				 */
+				std::atomic<uint64_t> stat_bytes_written;
+
+				/**
+				 * \see SERIAL_CAPTURE_STATS
+				 */
+				std::atomic<uint64_t> stat_records_dropped;
+
+				DEF_LOGGER;
+		};
+
+		/**
+		 * One record of a capture file.  The data points into the memory map of the file.
+		 */
+		typedef struct
+		{
+			/**
+			 * Monotonic time stamp, in microseconds.
+			 */
+			uint64_t time_usec;
+
+			/**
+			 * Which way the data went.
+			 */
+			ENUM_CAPTURE_DIRECTION direction;
+
+			/**
+			 * Data.
+			 */
+			const unsigned char* data;
+
+			/**
+			 * Length of the data.
+			 */
+			size_t length;
+		} ST_CAPTURE_RECORD;
+
+		/**
+		 * Reads a capture file through a read only memory map.
+		 */
+		class SERIAL_CAPTURE_READER
+		{
+			public:
+				/**
+				 * Constructor.
+				 */
+				SERIAL_CAPTURE_READER();
+
+				/**
+				 * Destructor.  Unmaps the file.
+				 */
+				~SERIAL_CAPTURE_READER();
+
+				/**
+				 * Maps a capture file and checks its magic.
+				 * \param _file Capture file name.
+				 * \return True on success, false otherwise.
+				 */
+				bool open( const string& _file );
+
+				/**
+				 * Unmaps the file.
+				 */
+				void close( void );
+
+				/**
+				 * Returns the next record.  A record cut short by the end of the file, as left behind by a crash, ends the capture.
+				 * \param _dest Where the record is stored.
+				 * \return False at the end of the capture.
+				 */
+				bool next( ST_CAPTURE_RECORD& _dest );
+
+				/**
+				 * Goes back to the first record.
+				 */
+				void rewind( void );
+
+			protected:
+				/**
+				 * Start of the memory map.
+				 */
+				const unsigned char* map;
+
+				/**
+				 * Size of the memory map.
+				 */
+				size_t map_length;
+
+				/**
+				 * Offset of the next record.
+				 */
+				size_t offset;
+
+				DEF_LOGGER;
+		};
+	}
+}
+
+#endif /* SRC_INCLUDE_LIB_SERIAL_CAPTURE_HPP_ */
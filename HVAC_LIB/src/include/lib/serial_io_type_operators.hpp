@@ -37,23 +37,23 @@ namespace BBB_HVAC
 		/**
 		 * \brief Operator to dump a token into a stream.  Converts the token into a human-readable representation and dumps it into the output stream.
 		 * \param os Target output stream.
-		 * \param pair Source pair.
+		 * \param _token Source token.
 		 * \return A reference to the supplied output stream.
 		 */
-		inline std::ostream& operator<< ( std::ostream& os, const token& pair )
+		inline std::ostream& operator<< ( std::ostream& os, const TEXT_TOKEN& _token )
 		{
-			return os << "(" << pair.first << "," << pair.second << ")";
+			return os << "(" << _token.to_string() << ")";
 		}
 
 		/**
 		 * \brief An operator to concatenate a string and a string representation of a token.  Used for debugging and such.
 		 * \param _left  Thing left of the operator.
-		 * \param pair Thing right of the operator.
+		 * \param _token Thing right of the operator.
 		 * \return A string concatenation.
 		 */
-		inline std::string operator+ ( const char* _left, const token& pair )
+		inline std::string operator+ ( const char* _left, const TEXT_TOKEN& _token )
 		{
-			return std::string( _left ) + "(" + std::to_string( pair.first ) + "," + std::to_string( pair.second ) + ")";
+			return std::string( _left ) + "(" + _token.to_string() + ")";
 		}
 
 		/**
@@ -38,6 +38,8 @@
 #include "lib/string_lib.hpp"
 
 #include <string.h>
+#include <ctype.h>
+#include <sys/uio.h>
 
 
 /**
@@ -80,11 +82,23 @@ namespace BBB_HVAC
 				 */
 				explicit CACHE_ENTRY_BASE( const std::string& _source );
 
+				/**
+				 * Constructor that restores an instance with a previously recorded timestamp.
+				 * \param _time_spec Timestamp of the entry.
+				 */
+				explicit CACHE_ENTRY_BASE( const timespec& _time_spec );
+
 				/**
 				 * Converts the instance to a human readable string.  Used for debugging purposes and for serializing to the shims.
 				 */
 				std::string to_string( void ) const;
 
+				/**
+				 * Returns the timestamp of the entry.
+				 * \return Time the entry was created.
+				 */
+				const timespec& get_timestamp( void ) const;
+
 				/**
 				 * Provides a mechanism for the derived class to provide its value in string form.  Used for serializing and deserializing.
 				 * @return
@@ -129,6 +143,13 @@ namespace BBB_HVAC
 				 */
 				CACHE_ENTRY_16BIT( uint16_t _val );
 
+				/**
+				 * Constructor.
+				 * \param _val Value of the entry.
+				 * \param _time_spec Timestamp of the entry.
+				 */
+				CACHE_ENTRY_16BIT( uint16_t _val, const timespec& _time_spec );
+
 				/**
 				 * Constructor.
 				 * \param _source String representation of an instance.  The class will be desrialized from the string representation.
@@ -182,6 +203,13 @@ namespace BBB_HVAC
 				 */
 				CACHE_ENTRY_8BIT( uint8_t _val );
 
+				/**
+				 * Constructor.
+				 * \param _val Instances value.
+				 * \param _time_spec Timestamp of the entry.
+				 */
+				CACHE_ENTRY_8BIT( uint8_t _val, const timespec& _time_spec );
+
 				/**
 				 * Constructor.
 				 * @param _source String representation of the class.  Used in deserialization.
@@ -229,6 +257,7 @@ namespace BBB_HVAC
 			public:
 				DO_CACHE_ENTRY();
 				DO_CACHE_ENTRY( uint8_t _value );
+				DO_CACHE_ENTRY( uint8_t _value, const timespec& _time_spec );
 				DO_CACHE_ENTRY( const std::string& _source );
 		};
 
@@ -242,6 +271,7 @@ namespace BBB_HVAC
 			public:
 				PMIC_CACHE_ENTRY();
 				PMIC_CACHE_ENTRY( uint8_t _value );
+				PMIC_CACHE_ENTRY( uint8_t _value, const timespec& _time_spec );
 				PMIC_CACHE_ENTRY( const std::string& _source );
 		};
 
@@ -270,6 +300,13 @@ namespace BBB_HVAC
 				 * \param _val ADC value
 				 */
 				ADC_CACHE_ENTRY( uint16_t _val );
+
+				/**
+				 * Restores an entry with a previously recorded timestamp.
+				 * \param _val ADC value
+				 * \param _time_spec Time the value was read.
+				 */
+				ADC_CACHE_ENTRY( uint16_t _val, const timespec& _time_spec );
 		};
 
 		/**
@@ -280,6 +317,7 @@ namespace BBB_HVAC
 			public:
 				CAL_VALUE_ENTRY();
 				CAL_VALUE_ENTRY( uint16_t _val );
+				CAL_VALUE_ENTRY( uint16_t _val, const timespec& _time_spec );
 				explicit CAL_VALUE_ENTRY( const std::string& _source );
 		};
 
@@ -287,6 +325,7 @@ namespace BBB_HVAC
 		/**
 		 * Outgoing message.
 		 * Outgoing messages are not sent immediately.  They are queued and written out by a separate thread.
+		 * Board commands are small so the data is kept inline; copying a message never allocates.
 		 */
 		class OUTGOING_MESSAGE
 		{
@@ -294,13 +333,11 @@ namespace BBB_HVAC
 
 				OUTGOING_MESSAGE();
 				OUTGOING_MESSAGE( const unsigned char* _buffer, const size_t _length );
-				OUTGOING_MESSAGE( const OUTGOING_MESSAGE& _src );
-				~OUTGOING_MESSAGE();
 
 				/**
 				 * Data buffer.
 				 */
-				std::shared_ptr<unsigned char> message;
+				unsigned char message[GC_SERIAL_OUTGOING_MESSAGE_SIZE];
 
 				/**
 				 * Length of the data buffer.
@@ -313,7 +350,7 @@ namespace BBB_HVAC
 				bool is_new;
 
 				/**
-				 * Message ID.  A sequential number that is incremented with each message.
+				 * Message ID.  A sequential number that is incremented with each message.  The position of the message in the outgoing queue.
 				 */
 				unsigned long id;
 		};
@@ -332,92 +369,490 @@ namespace BBB_HVAC
 		};
 
 		/**
-		 * \brief A table that contains messages received from the board.
-		 * At this stage the messages have been individually identified from the incoming stream, but they have yet to be processed.
+		 * \brief State of the supervisor that recovers hung boards.
+		 * \see SER_IO_COMM::supervise_board
+		 */
+		enum class ENUM_BOARD_HEALTH
+			: unsigned int
+		{
+			HEALTHY = 0, /// Data is arriving from the board.
+			RESETTING, /// The port is open and the board was told to reset.  Waiting for it to announce that it is up.
+			PORT_CLOSED, /// The board hung.  The port is closed until the reopen backoff runs out.
+			ATTACHING /// Warm attach.  Listening for a board that is already streaming.  The board is reset if it is not.
+		};
+
+		/**
+		 * \brief A read-only view of a single frame sitting in the serial receive ring.
+		 * A frame that straddles the physical end of the ring is described by two segments; all other frames only use the first one.
+		 * The view does not own the data.  It is only valid until the ring space it points at is consumed.
+		 * \see SERIAL_RING_BUFFER
 		 */
-		class LINE_TABLE
+		class FRAME_VIEW
 		{
 			public:
 
+				/**
+				 * \brief Constructor.  Creates an empty view.
+				 */
+				inline FRAME_VIEW() {
+					this->head = nullptr;
+					this->head_length = 0;
+					this->tail = nullptr;
+					this->tail_length = 0;
+					return;
+				}
+
 				/**
 				 * \brief Constructor.
+				 * \param _head First segment of the frame.
+				 * \param _head_length Length of the first segment.
+				 * \param _tail Second segment of the frame.  Only used if the frame wraps around the end of the ring.
+				 * \param _tail_length Length of the second segment.
+				 */
+				inline FRAME_VIEW( const unsigned char* _head, size_t _head_length, const unsigned char* _tail, size_t _tail_length ) {
+					this->head = _head;
+					this->head_length = _head_length;
+					this->tail = _tail;
+					this->tail_length = _tail_length;
+					return;
+				}
+
+				/**
+				 * \brief Returns the total length of the frame.
 				 */
-				inline LINE_TABLE() {
-					this->table = ( unsigned char** ) malloc( sizeof( unsigned char* ) * GC_SERIAL_LINE_TABLE_ENTRIES );
+				inline size_t length( void ) const {
+					return this->head_length + this->tail_length;
+				}
 
-					for ( int i = 0; i < GC_SERIAL_LINE_TABLE_ENTRIES; i++ ) {
-						this->table[i] = ( unsigned char* ) malloc( GC_SERIAL_BUFF_SIZE * sizeof( unsigned char ) );
-						memset( this->table[i], 0xFF, GC_SERIAL_BUFF_SIZE * sizeof( unsigned char ) );
-					}
+				/**
+				 * \brief Returns the byte at the specified offset into the frame.  No bounds checking is done.
+				 */
+				inline unsigned char operator[]( size_t _idx ) const {
+					return ( _idx < this->head_length ? this->head[_idx] : this->tail[_idx - this->head_length] );
+				}
+
+				/**
+				 * \brief Returns the little endian 16 bit value starting at the specified offset into the frame.
+				 */
+				inline uint16_t get_uint16( size_t _idx ) const {
+					return ( uint16_t )( ( uint16_t )( *this )[_idx] | ( uint16_t )( ( uint16_t )( *this )[_idx + 1] << 8 ) );
+				}
+
+				/**
+				 * \brief Computes the one's complement checksum of the first _length bytes of the frame.
+				 * The frame is summed as little endian 16 bit words.  A trailing odd byte is ignored.
+				 * \return Inverted 16 bit sum.  Zero for a frame that carries a valid checksum.
+				 */
+				uint16_t checksum( size_t _length ) const;
+
+				/**
+				 * \brief Copies up to _max_length bytes of the frame into the supplied buffer.
+				 * \return Number of bytes copied.
+				 */
+				size_t copy_to( unsigned char* _dest, size_t _max_length ) const;
+
+				/**
+				 * \brief Converts the frame into a hex dump.  Used for error output.
+				 */
+				std::string to_hex( void ) const;
+
+				/**
+				 * First segment of the frame.
+				 */
+				const unsigned char* head;
+
+				/**
+				 * Length of the first segment.
+				 */
+				size_t head_length;
+
+				/**
+				 * Second segment of the frame.  nullptr unless the frame wraps around the end of the ring.
+				 */
+				const unsigned char* tail;
+
+				/**
+				 * Length of the second segment.
+				 */
+				size_t tail_length;
+		};
 
-					this->index = 0;
+		/**
+		 * \brief A queue of text lines received from the board.
+		 * At this stage the lines have been individually identified from the incoming stream, but they have yet to be processed.
+		 * Lines are stored back to back in one contiguous arena, each preceded by its length.  There are no fixed size rows and no blank markers.
+		 * Space is reclaimed all at once when the queue is drained.
+		 */
+		class FRAME_QUEUE
+		{
+			public:
+
+				/**
+				 * \brief Constructor.
+				 */
+				FRAME_QUEUE();
+
+				/**
+				 * \brief Destructor.
+				 */
+				~FRAME_QUEUE();
+
+				/**
+				 * \brief Appends a copy of the frame to the end of the queue.
+				 * \return True if the frame was queued, false if there is not enough room left in the queue.
+				 */
+				bool push( const FRAME_VIEW& _frame );
+
+				/**
+				 * \brief Removes the frame at the head of the queue.
+				 * \param _frame Set to a contiguous view of the removed frame.  The view is valid until the next push or clear.
+				 * \return True if a frame was removed, false if the queue is empty.
+				 */
+				bool pop( FRAME_VIEW& _frame );
+
+				/**
+				 * \brief Returns the number of frames in the queue.
+				 */
+				inline size_t get_count( void ) const {
+					return this->count;
 				}
 
+				/**
+				 * \brief Discards all of the frames in the queue.
+				 */
+				inline void clear( void ) {
+					this->read_pos = 0;
+					this->write_pos = 0;
+					this->count = 0;
+					return;
+				}
+
+			protected:
+
+				/**
+				 * Frame storage.  GC_SERIAL_FRAME_QUEUE_SIZE bytes.
+				 */
+				unsigned char* data;
+
+				/**
+				 * Offset of the length prefix of the frame at the head of the queue.
+				 */
+				size_t read_pos;
+
+				/**
+				 * Offset at which the next frame will be appended.
+				 */
+				size_t write_pos;
+
+				/**
+				 * Number of frames in the queue.
+				 */
+				size_t count;
+		};
+
+		/**
+		 * \brief Receive ring for the raw serial data.  All the raw data that is received from the board is read straight into the ring.
+		 * The data is never moved once it has been read.  Frames are handed out as views into the ring and the space is released once the frame is processed.
+		 * The read and write positions are free running counters.  The capacity (GC_SERIAL_BUFF_SIZE) must be a power of two.
+		 */
+		class SERIAL_RING_BUFFER
+		{
+			public:
+
+				/**
+				 * \brief Constructor.
+				 */
+				SERIAL_RING_BUFFER();
+
 				/**
 				 * \brief Destructor.
 				 */
-				inline ~LINE_TABLE() {
-					for ( int i = 0; i < GC_SERIAL_LINE_TABLE_ENTRIES; i++ ) {
-						free( this->table[i] );
-						this->table[i] = nullptr;
-					}
+				~SERIAL_RING_BUFFER();
+
+				/**
+				 * \brief Returns the number of bytes in the ring waiting to be consumed.
+				 */
+				inline size_t get_used( void ) const {
+					return this->write_pos - this->read_pos;
+				}
+
+				/**
+				 * \brief Returns the number of bytes that can be read into the ring.
+				 */
+				inline size_t get_free( void ) const {
+					return GC_SERIAL_BUFF_SIZE - this->get_used();
+				}
+
+				/**
+				 * \brief Returns the byte at the specified offset from the read position.  No bounds checking is done.
+				 */
+				inline unsigned char at( size_t _offset ) const {
+					return this->data[( this->read_pos + _offset ) & ( GC_SERIAL_BUFF_SIZE - 1 )];
+				}
 
-					free( this->table );
-					this->table = nullptr;
+				/**
+				 * \brief Fills in the description of the free space of the ring.
+				 * \param _iov Array of at least two entries.
+				 * \return Number of entries used.  Zero if the ring is full.
+				 */
+				int get_write_spans( struct iovec* _iov ) const;
+
+				/**
+				 * \brief Marks the specified number of bytes as written into the free space of the ring.
+				 */
+				inline void commit_write( size_t _length ) {
+					this->write_pos += _length;
+					return;
+				}
+
+				/**
+				 * \brief Creates a view of the ring data.
+				 * \param _offset Offset of the view from the read position.
+				 * \param _length Length of the view.
+				 */
+				FRAME_VIEW get_view( size_t _offset, size_t _length ) const;
+
+				/**
+				 * \brief Releases the specified number of bytes from the read position.
+				 */
+				inline void consume( size_t _length ) {
+					this->read_pos += _length;
+					return;
 				}
 
 				/**
-				 * Table entries.
+				 * \brief Discards all of the data in the ring.
 				 */
-				unsigned char** table;
+				inline void reset( void ) {
+					this->read_pos = 0;
+					this->write_pos = 0;
+					return;
+				}
+
+			protected:
 
 				/**
-				 * Index of the current entry.
-				 * XXX - management of this is ... interesting at best.
+				 * Ring storage.  GC_SERIAL_BUFF_SIZE bytes.
 				 */
-				size_t index;
+				unsigned char* data;
+
+				/**
+				 * Total number of bytes consumed from the ring.
+				 */
+				size_t read_pos;
+
+				/**
+				 * Total number of bytes written into the ring.
+				 */
+				size_t write_pos;
 		};
 
 		/**
-		 * \brief Current status of the serial holding buffer.  All the raw data that is received from the board is dumped into this buffer.
-		 * The idea is to drain the serial link as quickly as possible so as to avoid possibility of data loss.
-		 * XXX - on modern processors, where even the BBB is running in the GHz range, does this even matter?
+		 * \brief Current state of the frame assembler.  Offsets are relative to the read position of the receive ring.
+		 * Within the scope of the context rather than the method so that the method can stop and resume assembling the data as it becomes available.
+		 * \see SERIAL_RING_BUFFER
 		 */
 		typedef struct
 		{
 			/**
-			 * Current position within the buffer.  It is incremented every time a byte is read from the serial port and added to the read buffer.
-			 * It is the upper bound of how much data is in the buffer.
+			 * Offset of the next byte to be examined by the assembler.
 			 */
-			size_t buffer_idx;
+			size_t scan_index;
 
 			/**
-			 * Index within the buffer where assemble_serial_data is currently at.  It should always be less than buffer_index;
-			 * Within the scope of the context rather than the method so that the method can stop and resume assembling the data as it becomes available.
-			 * \see assemble_serial_data(void)
+			 * Set when the data at the read position is a binary message.
 			 */
-			size_t buffer_work_index;
+			bool in_bin_message;
+
+		} ST_SERIAL_BUFFER_CONTEXT;
 
+		/**
+		 * \brief Serial IO counters.  A copy of the live counters of a board.
+		 * \see SER_IO_COMM::get_io_stats
+		 */
+		typedef struct
+		{
 			/**
-			 * Used to skip past any leading line terminators.
-			 * If the first character in the buffer is a line terminator, buffer_start_index will be 1 so that we ignore the said line terminator.
+			 * Total number of microseconds the writer spent waiting for the board to become clear to send.
 			 */
-			size_t buffer_start_index;
-			size_t bin_msg_start_index;
-			bool in_bin_message;
+			uint64_t write_blocked_usec;
 
-		} ST_SERIAL_BUFFER_CONTEXT;
+			/**
+			 * Longest single wait, in microseconds.
+			 */
+			uint64_t write_blocked_max_usec;
+
+			/**
+			 * Number of writes that had to wait.
+			 */
+			uint64_t write_block_count;
+
+			/**
+			 * Number of waits that gave up after GC_SERIAL_CTS_WAIT_TIMEOUT microseconds.
+			 */
+			uint64_t write_timeouts;
+
+			/**
+			 * Number of outgoing commands dropped because a later command superseded them.
+			 */
+			uint64_t commands_coalesced;
+
+			/**
+			 * Number of bytes read from the serial port.
+			 */
+			uint64_t bytes_received;
+
+			/**
+			 * Number of binary messages that passed the checksum check and were processed.
+			 */
+			uint64_t frames_decoded;
+
+			/**
+			 * Number of binary messages dropped because of a bad checksum.
+			 */
+			uint64_t checksum_errors;
+
+			/**
+			 * Number of text lines processed.
+			 */
+			uint64_t lines_decoded;
+
+			/**
+			 * Number of binary message headers dropped before the checksum check because of an unknown command or a length the command does not allow.
+			 */
+			uint64_t frames_rejected;
+
+			/**
+			 * Number of binary messages that updated the board state cache.
+			 */
+			uint64_t state_updates;
+
+			/**
+			 * Number of times nothing was received from the board for GC_SERIAL_HUNG_BOARD_TIMEOUT microseconds.
+			 */
+			uint64_t hung_boards;
+
+			/**
+			 * Number of attempts to reopen the port of a hung board that failed.
+			 */
+			uint64_t reopen_failures;
+
+			/**
+			 * Number of resets the board did not come back up from within GC_SERIAL_RESET_TIMEOUT microseconds.
+			 */
+			uint64_t reset_timeouts;
+
+			/**
+			 * Number of times a hung board was brought back.
+			 */
+			uint64_t recoveries;
+
+			/**
+			 * Total number of microseconds from a board being found hung to it coming back up.
+			 */
+			uint64_t recover_usec;
+
+			/**
+			 * Longest single recovery, in microseconds.
+			 */
+			uint64_t recover_max_usec;
+
+			/**
+			 * Number of times a board that was already streaming was adopted without a reset.
+			 */
+			uint64_t warm_attaches;
+
+			/**
+			 * Number of warm attaches that fell back to a reset because the board was not streaming.
+			 */
+			uint64_t attach_fallbacks;
+
+			/**
+			 * Microseconds from the start of event processing until the board first had a complete state.  Zero until then.
+			 */
+			uint64_t attach_usec;
+
+		} SERIAL_IO_STATS;
 
 		/**
-		 * Protocol (P) message parsing token.  Contains start and end indexes of a token.
+		 * Protocol (P) message parsing token.  Points into the line it was parsed from; nothing is copied.
 		 * Its all part of my need to have both text and binary protocol on the same wire.
 		 */
-		typedef std::pair<size_t, size_t> token;
+		class TEXT_TOKEN
+		{
+			public:
+
+				/**
+				 * \brief Constructor.  Creates an empty token.
+				 */
+				inline TEXT_TOKEN() {
+					this->data = nullptr;
+					this->length = 0;
+					return;
+				}
+
+				/**
+				 * \brief Constructor.
+				 * \param _data Start of the token.
+				 * \param _length Length of the token.
+				 */
+				inline TEXT_TOKEN( const char* _data, size_t _length ) {
+					this->data = _data;
+					this->length = _length;
+					return;
+				}
+
+				/**
+				 * \brief Returns the token without leading and trailing white space.
+				 */
+				inline TEXT_TOKEN trimmed( void ) const {
+					const char* start = this->data;
+					const char* end = this->data + this->length;
+
+					while ( start < end && isspace( ( unsigned char ) *start ) ) {
+						start++;
+					}
+
+					while ( end > start && isspace( ( unsigned char ) * ( end - 1 ) ) ) {
+						end--;
+					}
+
+					return TEXT_TOKEN( start, ( size_t )( end - start ) );
+				}
+
+				/**
+				 * \brief Compares the token to a NUL terminated string.
+				 */
+				inline bool operator==( const char* _str ) const {
+					return strlen( _str ) == this->length && memcmp( this->data, _str, this->length ) == 0;
+				}
+
+				/**
+				 * \brief Copies the token into a string.  For logging.
+				 */
+				inline std::string to_string( void ) const {
+					return std::string( this->data, this->length );
+				}
+
+				/**
+				 * Start of the token.
+				 */
+				const char* data;
+
+				/**
+				 * Length of the token.
+				 */
+				size_t length;
+		};
 
 		/**
-		 * A list of protocol message tokens.  Basically a line tokenized.
+		 * The tokens of a protocol message.  Basically a line tokenized.  Tokens past GC_SERIAL_MAX_PROTOCOL_TOKENS are ignored.
 		 */
-		typedef std::vector<token> token_vector;
+		typedef struct
+		{
+			TEXT_TOKEN tokens[GC_SERIAL_MAX_PROTOCOL_TOKENS];
+			size_t count;
+		} PROTOCOL_TOKENS;
 	}
 }
 
@@ -23,8 +23,9 @@
 #define SRC_INCLUDE_LIB_SOCKET_READER_HPP_
 
 #include "exceptions.hpp"
+#include "text_view.hpp"
 
-#include <vector>
+#include <string>
 
 namespace BBB_HVAC
 {
@@ -32,6 +33,8 @@ namespace BBB_HVAC
 
 	/**
 	 * Reads data available in the supplied socket and turns it into lines delimited by a newline (\\n) character.
+	 * A line split across reads is kept in the buffer until the rest of it arrives.
+	 * Binary frames of protocol version 2 (see BINARY_FRAME) are handed out whole, like lines.
 	 */
 	class SOCKET_READER
 	{
@@ -47,17 +50,21 @@ namespace BBB_HVAC
 			~SOCKET_READER();
 
 			/**
-			 * Reads all available data from the supplied file descriptor.
+			 * Reads all available data from the supplied file descriptor.  Reads until the socket would block.
+			 * Invalidates the views returned by next_line.
 			 * \param _fd File descriptor to read from.
-			 * \return Number of lines available for processing.  Note:  This does not mean how many lines were read during this method invocation.  The returned number of lines may include number of lines stored in the internal buffer that have not yet been consumed.
+			 * \return Number of bytes read during this invocation.  The lines are not counted; next_line finds them as they are consumed.
 			 */
 			size_t read( int _fd ) ;
 
 			/**
-			 * Gets the number of lines in the internal buffer that are available for processing.
-			 * \return Number of lines in the internal buffer.
+			 * Consumes the first (oldest) line or binary frame in the internal buffer.
+			 * \param _line Set to the line, including the trailing new line character, or to the whole frame.  Points into the internal buffer and is only valid
+			 * until the next read call.
+			 * \return False if there are no complete lines in the buffer.
+			 * \throws EXCEPTIONS::PROTOCOL_ERROR if a binary frame header is corrupt.
 			 */
-			size_t get_line_count( void ) const;
+			bool next_line( TEXT_VIEW& _line );
 
 			/**
 			 * Returns the first (oldest) line from the internal buffer.  The line is then deleted from the buffer.
@@ -67,19 +74,43 @@ namespace BBB_HVAC
 
 		protected:
 			/**
-			 * Temporary read buffer.  Size determined by GC_BUFFER_SIZE.
+			 * Makes room for at least GC_BUFFER_SIZE more bytes at the end of the buffer.  Moves the unconsumed data to the start of the buffer and grows
+			 * the buffer up to GC_SOCKET_READER_MAX_LINE.  If the buffer is full of a single unterminated line, the line is discarded.
+			 */
+			void make_room( void );
+
+			/**
+			 * Read buffer.  Bytes [read_pos, fill_pos) have been read, but not consumed.
 			 */
 			char* read_buffer;
 
 			/**
-			 * Finds the next occurrence of a new line character in the read_buffer.
+			 * Size of read_buffer.
+			 */
+			size_t buffer_size;
+
+			/**
+			 * Start of the first unconsumed line.
+			 */
+			size_t read_pos;
+
+			/**
+			 * End of the read data.
+			 */
+			size_t fill_pos;
+
+			/**
+			 * Gets the length of the line or binary frame that starts at the supplied position.
+			 * \param _pos Position in read_buffer.
+			 * \param _length Set to the length if the line or frame is complete.
+			 * \return False if the line or frame is not complete yet.
 			 */
-			ssize_t find_nl_in_buffer( size_t _start, size_t _end );
+			bool record_length( size_t _pos, size_t& _length ) const;
 
 			/**
-			 * Line buffer.  Lines read, but not yet processed.
+			 * Set when the line at fill_pos was too long and its remainder is being thrown away up to and including its new line.
 			 */
-			vector<string> line_vector;
+			bool discarding;
 
 		private:
 	};
@@ -22,6 +22,9 @@
 #ifndef STRING_LIB_H_
 #define STRING_LIB_H_
 
+#include <stdint.h>
+#include <time.h>
+
 #include <vector>
 #include <list>
 #include <string>
@@ -115,6 +118,18 @@ std::string num_to_str( bool _i );
  */
 std::string get_iso_date_time( void );
 
+/**
+ * Returns the current time in microseconds off of CLOCK_MONOTONIC.
+ */
+uint64_t monotonic_usec( void );
+
+/**
+ * Converts a timespec to microseconds.
+ * \param _time Time to convert.  Usually off of CLOCK_MONOTONIC.
+ * \return _time in microseconds.  The sub microsecond part is dropped.
+ */
+uint64_t timespec_to_usec( const timespec& _time );
+
 /**
  * Trims the whitespace from the left side of the string.  Operation is done in place and supplied string is modified.
  * \param s String to be modified.
@@ -210,6 +225,10 @@ ssize_t find_index_of( const unsigned char* _str, const char _chr, const ssize_t
 void convert_vector_to_string( const std::vector<int>& _source, std::vector<std::string>& _dest );
 void convert_vector_to_string( const std::vector<uint16_t>& _source, std::vector<std::string>& _dest );
 
+/**
+ * Computes the inverted one's complement sum of _length little endian 16 bit words.  The buffer does not have to be aligned.
+ * \see BBB_HVAC::ones_complement_sum
+ */
 uint16_t checksum( const uint16_t* _buffer, size_t _length );
 
 void split_string_to_vector( const std::string& _string, char _split, std::vector<std::string>& _vector );
@@ -0,0 +1,175 @@
+/*
+* This file is part of the software stack for Vic's IO board and its
+* associated projects.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+* Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+*/
+
+
+
+#ifndef SRC_INCLUDE_LIB_TEXT_VIEW_HPP_
+#define SRC_INCLUDE_LIB_TEXT_VIEW_HPP_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+namespace BBB_HVAC
+{
+	/**
+	 * A piece of text in somebody else's buffer.  Nothing is copied; the view is only valid as long as the buffer is.
+	 * The numeric conversions are strict:  the whole view has to be the number.  None of them throw.
+	 */
+	class TEXT_VIEW
+	{
+		public:
+
+			/**
+			 * \brief Constructor.  Creates an empty view.
+			 */
+			inline TEXT_VIEW() {
+				this->data = nullptr;
+				this->length = 0;
+				return;
+			}
+
+			/**
+			 * \brief Constructor.
+			 * \param _data Start of the text.
+			 * \param _length Length of the text.
+			 */
+			inline TEXT_VIEW( const char* _data, size_t _length ) {
+				this->data = _data;
+				this->length = _length;
+				return;
+			}
+
+			/**
+			 * \brief Compares the text to a NUL terminated string.
+			 */
+			inline bool operator==( const char* _str ) const {
+				return strlen( _str ) == this->length && memcmp( this->data, _str, this->length ) == 0;
+			}
+
+			/**
+			 * \brief Compares the text to a string.
+			 */
+			inline bool operator==( const std::string& _str ) const {
+				return _str.length() == this->length && memcmp( this->data, _str.data(), this->length ) == 0;
+			}
+
+			/**
+			 * \brief Copies the text into a string.
+			 */
+			inline std::string to_string( void ) const {
+				return std::string( this->data, this->length );
+			}
+
+			/**
+			 * \brief Converts the text to an unsigned decimal number.
+			 * \param _max Largest acceptable value.
+			 * \param _value Set to the number on success.
+			 * \return False if the text is not a number or is larger than _max.
+			 */
+			inline bool to_unsigned( uint64_t _max, uint64_t& _value ) const {
+				if ( this->length == 0 ) {
+					return false;
+				}
+
+				uint64_t ret = 0;
+
+				for ( size_t i = 0; i < this->length; i++ ) {
+					unsigned int digit = ( unsigned int )( ( unsigned char ) this->data[i] - '0' );
+
+					if ( digit > 9 || ret > _max / 10 || digit > _max - ( ret * 10 ) ) {
+						return false;
+					}
+
+					ret = ( ret * 10 ) + digit;
+				}
+
+				_value = ret;
+				return true;
+			}
+
+			/**
+			 * \brief Converts the text to a signed decimal number.  A leading minus sign is allowed.
+			 * \param _min Smallest acceptable value.  Must not be positive.
+			 * \param _max Largest acceptable value.  Must not be negative.
+			 * \param _value Set to the number on success.
+			 * \return False if the text is not a number or is out of range.
+			 */
+			inline bool to_signed( int64_t _min, int64_t _max, int64_t& _value ) const {
+				uint64_t magnitude;
+
+				if ( this->length > 0 && this->data[0] == '-' ) {
+					if ( TEXT_VIEW( this->data + 1, this->length - 1 ).to_unsigned( ( uint64_t )( -( _min + 1 ) ) + 1, magnitude ) == false ) {
+						return false;
+					}
+
+					_value = ( magnitude == 0 ? 0 : -( int64_t )( magnitude - 1 ) - 1 );
+					return true;
+				}
+
+				if ( this->to_unsigned( ( uint64_t ) _max, magnitude ) == false ) {
+					return false;
+				}
+
+				_value = ( int64_t ) magnitude;
+				return true;
+			}
+
+			/**
+			 * \brief Converts the text to a floating point number.
+			 * \param _value Set to the number on success.
+			 * \return False if the text is not a number or is too long to be one.
+			 */
+			inline bool to_double( double& _value ) const {
+				char buffer[64];
+
+				if ( this->length == 0 || this->length >= sizeof( buffer ) ) {
+					return false;
+				}
+
+				memcpy( buffer, this->data, this->length );
+				buffer[this->length] = 0;
+
+				char* end = nullptr;
+				double ret = strtod( buffer, &end );
+
+				if ( end != buffer + this->length ) {
+					return false;
+				}
+
+				_value = ret;
+				return true;
+			}
+
+			/**
+			 * Start of the text.
+			 */
+			const char* data;
+
+			/**
+			 * Length of the text.
+			 */
+			size_t length;
+	};
+}
+
+#endif /* SRC_INCLUDE_LIB_TEXT_VIEW_HPP_ */
@@ -30,6 +30,7 @@
 #include "lib/configurator.hpp"
 #include "lib/serial_io_types.hpp"
 
+#include <atomic>
 #include <vector>
 #include <map>
 #include <string.h>
@@ -52,8 +53,56 @@ namespace BBB_HVAC
 		IOCOMM::PMIC_CACHE_ENTRY pmic_state;
 		IOCOMM::ADC_CACHE_ENTRY ai_state[GC_IO_AI_COUNT];
 		std::string board_tag;
+
+		/*
+		Generation of the board state snapshot the above was last refreshed from, and what changed in that refresh.
+		*/
+		uint64_t generation;
+		uint32_t changes;
 	} BOARD_STATE_STRUCT;
 
+	/**
+	Logic loop counters.  Copied out of the logic processor without taking its lock.
+	\see LOGIC_PROCESSOR_BASE::get_logic_stats
+	*/
+	typedef struct
+	{
+		/**
+		Number of completed logic iterations.
+		*/
+		uint64_t ticks;
+
+		/**
+		Duration of the last logic iteration in microseconds.  Measured while the lock is held; the sleep between iterations is not included.
+		*/
+		uint64_t tick_usec_last;
+
+		/**
+		Longest logic iteration in microseconds.
+		*/
+		uint64_t tick_usec_max;
+
+		/**
+		Sum of the durations of all logic iterations in microseconds.
+		*/
+		uint64_t tick_usec_total;
+
+		/**
+		Number of board state snapshots the ingest lag was measured on.
+		*/
+		uint64_t ingest_lag_samples;
+
+		/**
+		Longest time, in microseconds, between a board state snapshot being published by the serial IO thread and the logic loop picking it up.
+		*/
+		uint64_t ingest_lag_usec_max;
+
+		/**
+		Sum of all of the measured ingest lags in microseconds.
+		*/
+		uint64_t ingest_lag_usec_total;
+	} LOGIC_STATS;
+
 	class LOGIC_POINT_STATUS
 	{
 		public:
@@ -222,6 +271,12 @@ namespace BBB_HVAC
 
 			void set_sp_value( const string& _name, double _value ) ;
 
+			/**
+			 * Copies the logic loop counters into the supplied buffer.  Does not take the object lock.
+			 * \param _dest Reference to the destination buffer.
+			 */
+			void get_logic_stats( LOGIC_STATS& _dest ) const;
+
 		protected:
 			static double calculate_420_value( double _voltage, long _min, long _max );
 			static double calculate_ICTD_value( double _voltage );
@@ -281,6 +336,41 @@ namespace BBB_HVAC
 			size_t config_save_counter;
 
 			std::map<std::string, PMIC_RESET> pmic_reset_counters;
+
+			/**
+			\see LOGIC_STATS
+			*/
+			std::atomic<uint64_t> stat_ticks;
+
+			/**
+			\see LOGIC_STATS
+			*/
+			std::atomic<uint64_t> stat_tick_usec_last;
+
+			/**
+			\see LOGIC_STATS
+			*/
+			std::atomic<uint64_t> stat_tick_usec_max;
+
+			/**
+			\see LOGIC_STATS
+			*/
+			std::atomic<uint64_t> stat_tick_usec_total;
+
+			/**
+			\see LOGIC_STATS
+			*/
+			std::atomic<uint64_t> stat_ingest_lag_samples;
+
+			/**
+			\see LOGIC_STATS
+			*/
+			std::atomic<uint64_t> stat_ingest_lag_usec_max;
+
+			/**
+			\see LOGIC_STATS
+			*/
+			std::atomic<uint64_t> stat_ingest_lag_usec_total;
 		private:
 
 			DEF_LOGGER;
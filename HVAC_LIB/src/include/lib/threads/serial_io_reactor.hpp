@@ -0,0 +1,96 @@
+/*
+ * This file is part of the software stack for Vic's IO board and its
+ * associated projects.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+ */
+
+#ifndef SRC_INCLUDE_LIB_THREADS_SERIAL_IO_REACTOR_HPP_
+#define SRC_INCLUDE_LIB_THREADS_SERIAL_IO_REACTOR_HPP_
+
+#include <string>
+#include <vector>
+
+#include "lib/threads/thread_base.hpp"
+#include "lib/threads/serial_io_thread.hpp"
+#include "lib/logger.hpp"
+
+namespace BBB_HVAC
+{
+	namespace IOCOMM
+	{
+		/**
+		 * Services any number of serial IO boards from a single thread.  The reactor owns one epoll instance that watches the serial port, timer,
+		 * and outgoing queue of every attached board.  Each board keeps its own receive state and outgoing queue; the reactor only dispatches the events.
+		 * The boards are registered as IO threads but are never started as threads themselves.
+		 */
+		class SER_IO_REACTOR : public THREAD_BASE
+		{
+			public:
+				/**
+				 * Constructor.  Instantiating the class DOES NOT initialize it.
+				 * \param _tag Tag destined for human consumption used for debugging purposes.
+				 */
+				SER_IO_REACTOR( const string& _tag );
+				virtual ~SER_IO_REACTOR();
+
+				/**
+				 * Creates the epoll instance and the shutdown eventfd.  Must be called after instantiation.
+				 * \return True if everything was created, false otherwise.
+				 */
+				bool init( void );
+
+				/**
+				 * Adds a board to the reactor.  The board must be initialized and must not be started as a thread.  Boards can only be added before the reactor thread is started.
+				 * The reactor takes over the board; it is deleted through the thread registry.
+				 * \param _board Board to service.
+				 */
+				void add_board( SER_IO_COMM* _board );
+
+				/**
+				 * Flags the thread to stop and wakes up the event loop.
+				 */
+				virtual void flag_for_stop( void );
+			protected:
+				bool thread_func( void );
+
+				/**
+				 * Removes a board from the reactor and hands it to the thread registry for deletion.  Unless the program is shutting down the IO thread death listener will restart it.
+				 * \param _board Board to remove.
+				 */
+				void drop_board( SER_IO_COMM* _board );
+			private:
+				/**
+				 * Boards serviced by the reactor.
+				 */
+				std::vector<SER_IO_COMM*> boards;
+
+				/**
+				 * epoll instance shared by all of the boards.
+				 */
+				int epoll_fd;
+
+				/**
+				 * eventfd used to wake the event loop up when the thread is asked to stop.  Registered with a null data pointer.
+				 */
+				int shutdown_fd;
+
+				DEF_LOGGER;
+		};
+	}
+}
+
+#endif /* SRC_INCLUDE_LIB_THREADS_SERIAL_IO_REACTOR_HPP_ */
@@ -23,6 +23,9 @@
 #define BBB_HVAC_IOCOMM_HPP_
 
 #include <string>
+#include <deque>
+#include <atomic>
+#include <algorithm>
 #include "lib/config.hpp"
 
 using namespace std;
@@ -31,6 +34,7 @@ using namespace std;
 
 #include "lib/logger.hpp"
 #include "lib/serial_io_types.hpp"
+#include "lib/serial_capture.hpp"
 #include "lib/exceptions.hpp"
 #include "lib/threads/thread_base.hpp"
 
@@ -104,6 +108,11 @@ namespace BBB_HVAC
 				 */
 				friend void serial_io_shim_func( void* );
 
+				/**
+				 * The reactor drives the event handling of the boards attached to it.
+				 */
+				friend class SER_IO_REACTOR;
+
 			public:
 
 				/**
@@ -131,13 +140,82 @@ namespace BBB_HVAC
 					CMD_ID_SYS_FAILURE = 0xFF
 				} ;
 
+				/**
+				Descriptors that the event loop waits on.
+				*/
+				enum ENUM_EVENT_SOURCES : unsigned char
+				{
+					EVENT_SOURCE_SERIAL = 0,		// Serial port
+					EVENT_SOURCE_TIMER,				// Output confirmation timer
+					EVENT_SOURCE_SHUTDOWN,			// Shutdown eventfd
+					EVENT_SOURCE_OUTGOING,			// Outgoing message queue doorbell.  Only used when attached to a reactor.
+
+					EVENT_SOURCE_COUNT
+				} ;
+
+				/**
+				What the epoll_event data pointer of a board descriptor points at.  Lets a single epoll instance serve more than one board.
+				*/
+				struct ST_EVENT_SOURCE
+				{
+					SER_IO_COMM* board;
+					ENUM_EVENT_SOURCES type;
+				} ;
+
+				/**
+				Method that consumes a binary response.  Returns true if the response was accepted.
+				*/
+				typedef bool ( SER_IO_COMM::*BINARY_HANDLER_PTR )( const FRAME_VIEW& _frame );
+
+				/**
+				Describes the response the board sends for a command.  Lengths are the header length field, which covers the payload and the checksum word.
+				*/
+				struct ST_BINARY_COMMAND
+				{
+					/**
+					Command the response is for.  Also the index of the descriptor in the command table.
+					*/
+					unsigned char command;
+
+					/**
+					Smallest acceptable length.
+					*/
+					uint16_t min_length;
+
+					/**
+					Largest acceptable length.  Never more than GC_SERIAL_MAX_BINARY_PAYLOAD.
+					*/
+					uint16_t max_length;
+
+					/**
+					Whether the payload is made up of 16 bit words.
+					*/
+					bool word_payload;
+
+					/**
+					Whether an accepted response updates the board state cache.
+					*/
+					bool updates_cache;
+
+					/**
+					Method that consumes the response.  nullptr if there is nothing to do with it.
+					*/
+					BINARY_HANDLER_PTR handler;
+
+					/**
+					Human readable name for the logs.
+					*/
+					const char* name;
+				} ;
+
 				/**
 				 * Constructor.  Instantiating the class DOES NOT initialize it.
 				 * \see init(void)
 				 * \param _tty  Device to communicate through.  Just the name.  No /dev prefix.  ttyS0, for example.  Not /dev/ttyS0
 				 * \param _tag Tag destined for human consumption used for debugging purposes.
+				 * \param _history_depth Number of samples kept in the board's sample history.
 				 */
-				SER_IO_COMM( const char* _tty, const string& _tag, bool _debug );
+				SER_IO_COMM( const char* _tty, const string& _tag, bool _debug, size_t _history_depth = GC_IO_HISTORY_DEPTH );
 
 				/**
 				 * Initializes the instance.  Must be called after instantiation.
@@ -181,27 +259,48 @@ namespace BBB_HVAC
 				bool get_pmic_cache( PMIC_CACHE_ENTRY( & _dest ) [GC_IO_STATE_BUFFER_DEPTH] );
 
 				/**
-				 * Copies the latest ADC values to the supplied buffer.
+				 * Copies the latest published board state into the supplied buffer.  Does not take the object lock and never waits on the serial IO thread.
 				 * \param _dest Reference to the destination buffer.
 				 */
-				bool get_latest_adc_values( ADC_CACHE_ENTRY( & _dest ) [GC_IO_AI_COUNT] );
+				void get_state_snapshot( BOARD_STATE_SNAPSHOT& _dest ) const;
+
+				/**
+				 * Copies the latest published board state into the supplied buffer and reports what changed since the caller last looked.  Does not take the object lock.
+				 * \param _generation Generation of the snapshot the caller last processed.  Zero for the first call.
+				 * \param _dest Reference to the destination buffer.  _dest.generation is what the caller should pass in next time.
+				 * \return Change mask.  Zero if nothing changed.
+				 * \see BOARD_STATE_CACHE::get_changes_since
+				 */
+				uint32_t get_state_changes( uint64_t _generation, BOARD_STATE_SNAPSHOT& _dest ) const;
 
 				/**
-				 * Copies the latest DO statuses to the supplied buffer.
+				 * Copies samples out of the board's sample history.  Takes the object lock.
+				 * \param _from_usec Start of the time range in microseconds off of CLOCK_MONOTONIC, inclusive.
+				 * \param _to_usec End of the time range, inclusive.
+				 * \param _decimation Only every Nth sample in the range is returned.
+				 * \param _dest Samples are appended to this vector, oldest first.
+				 * \return Number of samples appended.
+				 * \see BOARD_STATE_HISTORY::get_samples
+				 */
+				size_t get_history( uint64_t _from_usec, uint64_t _to_usec, size_t _decimation, std::vector<BOARD_HISTORY_SAMPLE>& _dest );
+
+				/**
+				 * Copies the latest ADC values to the supplied buffer.  Served from the published snapshot.
 				 * \param _dest Reference to the destination buffer.
 				 */
-				bool get_latest_do_status( DO_CACHE_ENTRY& _dest );
+				bool get_latest_adc_values( ADC_CACHE_ENTRY( & _dest ) [GC_IO_AI_COUNT] );
 
 				/**
-				 * Copies the latest PMIC statuses to the supplied buffer.
+				 * Copies the latest DO statuses to the supplied buffer.  Served from the published snapshot.
 				 * \param _dest Reference to the destination buffer.
 				 */
-				bool get_latest_pmic_status( PMIC_CACHE_ENTRY& _dest );
+				bool get_latest_do_status( DO_CACHE_ENTRY& _dest );
 
 				/**
-				 * Copies all of latest values into the supplied buffers.
+				 * Copies the latest PMIC statuses to the supplied buffer.  Served from the published snapshot.
+				 * \param _dest Reference to the destination buffer.
 				 */
-				bool get_latest_state_values( BOARD_STATE_CACHE& _target );
+				bool get_latest_pmic_status( PMIC_CACHE_ENTRY& _dest );
 
 				/**
 				 * Creates and sends a command to the board to set the digital outputs to specified states.
@@ -225,10 +324,150 @@ namespace BBB_HVAC
 				*/
 				bool cmd_set_l2_calibration_values( const CAL_VALUE_ARRAY& _values );
 
+				/**
+				 * Forces an analog input to a value.  Takes the object lock and publishes a new snapshot.
+				 * \param _x_index Index of the analog input.
+				 * \param _value Value to force the input to.
+				 */
 				bool force_ai_value( size_t _x_index, uint16_t _value );
+
+				/**
+				 * Releases a forced analog input.  Takes the object lock and publishes a new snapshot.
+				 * \param _x_index Index of the analog input.
+				 */
 				bool unforce_ai_value( size_t _x_index );
+
+				/**
+				 * Copies the serial IO counters into the supplied buffer.  Does not take the object lock.
+				 * \param _dest Reference to the destination buffer.
+				 */
+				void get_io_stats( SERIAL_IO_STATS& _dest ) const;
+
+				/**
+				 * Starts recording the traffic in both directions into a capture file.  Must be called before the thread is started.
+				 * \param _file Capture file name.  An existing capture is appended to.
+				 * \return True on success, false otherwise.
+				 * \see SERIAL_CAPTURE
+				 */
+				bool start_capture( const string& _file );
+
+				/**
+				 * Copies the capture counters into the supplied buffer.  All zeros if there is no capture.
+				 * \param _dest Reference to the destination buffer.
+				 */
+				void get_capture_stats( SERIAL_CAPTURE_STATS& _dest ) const;
+
+				/**
+				 * Turns warm attach on or off.  Must be called before the thread is started.
+				 * A warm attaching instance does not reset the board on start.  It listens for GC_SERIAL_ATTACH_TIMEOUT microseconds and,
+				 * if the board is already streaming valid frames, adopts the DO and PMIC state the board reports.  Otherwise the board is reset as usual.
+				 * Boards in debug mode are never reset either way.
+				 * \param _warm True to adopt a streaming board, false to always reset it.
+				 */
+				void set_warm_attach( bool _warm );
+
+				/**
+				 * Has the board delivered a complete state: analog inputs, DO status, and PMIC status since it was attached or last reset.
+				 * Cleared while a hung board is being recovered.  Safe to call from any thread.
+				 */
+				inline bool has_valid_state( void ) const
+				{
+					return this->state_valid;
+				}
+
+				/**
+				 * Feeds data received from the board through the decoder as if it had been read from the port.  Used to replay captures.
+				 * Takes the object lock.  The instance must not be running a thread of its own.
+				 * \param _data Data as received.
+				 * \param _length Length of the data.
+				 */
+				void replay_input( const unsigned char* _data, size_t _length );
+
+				/**
+				 * Flags the thread to stop and wakes up the main event loop.
+				 */
+				virtual void flag_for_stop( void );
 			protected:
 
+				/**
+				 * Reads, assembles, and processes all of the data available on the serial port.  Invoked when the port becomes readable.
+				 * Takes the object lock only for the processing of the assembled data.
+				 */
+				void handle_serial_input( void );
+
+				/**
+				 * Handles the expiration of the output confirmation timer.  Confirms the output state and starts the stream if the board has reset.
+				 * The timer also guarantees that the hung board supervisor runs at least every GC_SERIAL_THREAD_UPDATE_INTERVAL microseconds.
+				 */
+				void handle_update_timer( void );
+
+				/**
+				 * Handles an event signaled by epoll on one of the board descriptors.
+				 * \param _type Which of the board descriptors the event is for.
+				 * \param _events epoll event flags.
+				 */
+				void dispatch_event( ENUM_EVENT_SOURCES _type, uint32_t _events );
+
+				/**
+				 * Resets the board, unless in debug mode, and arms the output confirmation timer.  Called once before the events start being handled.
+				 * \return True if everything went as expected, false otherwise.
+				 */
+				bool start_event_processing( void );
+
+				/**
+				 * Runs the hung board supervisor.  Invoked after every wake up of the event loop.  Never blocks.
+				 * A board that has been silent for GC_SERIAL_HUNG_BOARD_TIMEOUT microseconds has its port closed.  The port is reopened once the backoff runs out
+				 * and the board is reset.  A failed reopen, or a reset the board does not come back up from within GC_SERIAL_RESET_TIMEOUT microseconds,
+				 * closes the port again for twice as long, up to GC_SERIAL_REOPEN_BACKOFF_MAX.
+				 * All of the deadlines are off of CLOCK_MONOTONIC.  Nothing is done in debug mode.
+				 * \see ENUM_BOARD_HEALTH
+				 */
+				void supervise_board( void );
+
+				/**
+				 * Registers a board descriptor with the epoll instance.
+				 * \param _type Which of the board descriptors is being registered.
+				 * \param _fd The descriptor.
+				 * \return True if the descriptor was registered, false otherwise.
+				 */
+				bool add_event_source( ENUM_EVENT_SOURCES _type, int _fd );
+
+				/**
+				 * Hands the board over to a reactor.  The board's own epoll instance is closed and the descriptors are registered with the reactor's instead.
+				 * Outgoing messages are written by the reactor thread rather than a writer sub-thread.
+				 * \param _epoll_fd The reactor's epoll instance.
+				 * \return True if the board was attached and started, false otherwise.
+				 */
+				bool attach_to_reactor( int _epoll_fd );
+
+				/**
+				 * Removes the board descriptors from the reactor's epoll instance.
+				 */
+				void detach_from_reactor( void );
+
+				/**
+				 * Writes as much of the pending output as the port will take without blocking.  Only used when attached to a reactor.
+				 */
+				void flush_pending_output( void );
+
+				/**
+				 * Is there output waiting to be written to the port.
+				 */
+				inline bool has_pending_output( void ) const {
+					return !this->pending_output.empty();
+				}
+
+				/**
+				 * Creates the epoll instance, the shutdown eventfd, and the output confirmation timerfd used by the main event loop.
+				 * \return True if everything was created, false otherwise.
+				 */
+				bool event_fds_open( void );
+
+				/**
+				 * Closes the descriptors created by event_fds_open.
+				 */
+				void event_fds_close( void );
+
 				/**
 				Sends calibration values to the board.
 				\param _cmd Command (L1 or L2) to utilize when sending to board.
@@ -295,20 +534,52 @@ namespace BBB_HVAC
 				bool try_lock_serial( void );
 
 				/**
-				 * Sends out all pending messages to the IO board
+				 * Sends out all pending messages to the IO board.  The messages are gathered into as few writes as possible.  Blocks until done or until the thread is flagged to stop.
 				 * \return True if everything went as expected, false if an error was encountered.
 				 */
-				bool write_buffer( const unsigned char* _buffer, size_t _length );
+				bool write_buffer( void );
+
+				/**
+				 * Points the supplied spans at the unwritten part of the pending output.
+				 * \param _spans Spans to fill.
+				 * \param _max_spans Number of entries in _spans.
+				 * \return Number of spans filled.
+				 */
+				size_t fill_output_spans( struct iovec* _spans, size_t _max_spans ) const;
+
+				/**
+				 * Releases the specified number of written bytes from the front of the pending output.
+				 */
+				void consume_output( size_t _length );
 
 				/**
-				 * Parses and assembles the data in the input buffer.  The method is invoked whenever there is a lull in the
-				 * receipt of serial data i.e. when the poll call times out.
+				 * Drops the pending commands that are superseded by a later command of the same kind.  Only the latest digital output, PMIC, and calibration
+				 * values are sent, and only one output confirmation.  Commands are never folded across a board reset.
+				 */
+				void coalesce_pending_output( void );
+
+				/**
+				 * Is the command one whose latest instance supersedes all of the earlier ones.
+				 * \param _cmd Call index.
+				 */
+				static bool is_superseding_command( unsigned char _cmd );
+
+				/**
+				 * Looks up the descriptor of a binary response.
+				 * \param _cmd Command byte of the response header.
+				 * \return Descriptor of the response, nullptr if the command is not one the board sends.
+				 */
+				static const ST_BINARY_COMMAND* find_binary_command( unsigned char _cmd );
+
+				/**
+				 * Parses and assembles the data in the receive ring.  Binary messages are decoded in place as soon as they are complete.  Text lines are added to the frame queue.
+				 * Processed data is released from the ring.  Incomplete messages are left in the ring until more data arrives.
 				 * \return True if everything went as expected, false if an error was encountered.
 				 */
 				int assemble_serial_data( void );
 
 				/**
-				 * Reads all of the available serial data from the port and shoves it into the holding buffer.
+				 * Reads all of the available serial data from the port, or as much as will fit, and shoves it into the receive ring.
 				 * \param _discard If set to true discard all of th read data.  Used on board reset to clear any pre-existing output from board waiting to be read.
 				 * \return True is everything was handled without drama, false otherwise.
 				 */
@@ -324,155 +595,201 @@ namespace BBB_HVAC
 				bool send_message( const unsigned char* _message, size_t length );
 
 				/**
-				 * Compacts the incoming message line table to ensure that there are no gaps.
-				 * As the lines are processed they are removed from the line table which leaves gaps.  This method removes the gaps and compacts the table.
+				 * Processes all of the text lines waiting in the frame queue.  The queue is empty when the method returns.
 				 * \return True if everything went as expected, false otherwise.
 				 */
-				bool digest_line_table( void );
+				bool digest_frame_queue( void );
 
 				/**
-				 * Swaps the active line tables around.  There are two line tables for each instance.  An active and a passive.  The passive contains data from the previously sent command.
-				 * The active table contains (or is waiting for) results/output from the command most recently sent to the IO board.  The tables are switched around every time a message is
-				 * sent out to the board.
+				 * Publishes the current contents of the state cache if its generation moved.  Must be called with the object lock held.
 				 */
-				void swap_tables( void );
+				void publish_state_snapshot( void );
 
 				/**
 				 * Adds an analog input (ADC) result to the cache.
-				 * \param _line_index Line index in the active line table from which to assemble the data.
+				 * \param _frame Binary message from which to assemble the data.
 				 * \return True if everything went as expected, false otherwise.
 				 */
-				bool add_ai_result( size_t _line_index );
+				bool add_ai_result( const FRAME_VIEW& _frame );
 
 				/**
 				 * Adds a digital output status result to the cache.
-				 * \param _line_index Line index in the active line table from which to assemble the data.
+				 * \param _frame Binary message from which to assemble the data.
 				 * \return True if everything went as expected, false otherwise.
 				 */
-				bool add_do_status( size_t _idx );
+				bool add_do_status( const FRAME_VIEW& _frame );
 
 				/**
 				 * Adds a PMIC status result to the cache.
-				 * \param _line_index Line index in the active line table from which to assemble the data.
+				 * \param _frame Binary message from which to assemble the data.
 				 * \return True if everything went as expected, false otherwise.
 				 */
-				bool add_pmic_status( size_t _idx );
+				bool add_pmic_status( const FRAME_VIEW& _frame );
 
 				/**
 				Adds calibration values to the state cache.
 				*/
-				bool add_calibration_values( size_t _idx, unsigned char _level );
+				bool add_calibration_values( const FRAME_VIEW& _frame, unsigned char _level );
+
+				/**
+				Adds level 1 calibration values to the state cache.
+				*/
+				bool add_l1_calibration_values( const FRAME_VIEW& _frame );
+
+				/**
+				Adds level 2 calibration values to the state cache.
+				*/
+				bool add_l2_calibration_values( const FRAME_VIEW& _frame );
 
 				/**
 				Adds boot count to the state cache.
 				*/
-				bool add_boot_count( size_t _idx );
+				bool add_boot_count( const FRAME_VIEW& _frame );
+
+				/**
+				Logs a response the board should never send.
+				*/
+				bool log_unexpected_response( const FRAME_VIEW& _frame );
+
+				/**
+				Logs a hard error reported by the board.
+				*/
+				bool log_board_failure( const FRAME_VIEW& _frame );
 
 
 
 				/**
-				 * Adds data to the line table.
-				 * \param _buffer Source of the data
-				 * \param _length Length of the data to be copied.
+				 * Adds a text line to the frame queue.
+				 * \param _frame Text line sans the line terminator.
 				 */
-				void add_to_active_table( const unsigned char* _buffer, size_t _length );
+				void add_to_frame_queue( const FRAME_VIEW& _frame );
 
 				/**
-				Compacts the line table by purging processed lines.
+				Processes a binary message.  The message is decoded straight out of the receive ring.
+				\param _command Descriptor of the message.  The length of the message has already been checked against it.
+				\param _frame Complete binary message, including the header.
 				*/
-				void compact_line_table( void );
+				void process_binary_message( const ST_BINARY_COMMAND& _command, const FRAME_VIEW& _frame );
 
 				/**
-				Returns true if the specified line is blank.
-				\param _idx index of the line to inquire about.
+				Process a line as a text message.
+				\param _line Line to process as a text message.  Must be contiguous.
 				*/
-				bool is_line_table_line_blank( size_t _idx ) const;
+				void process_text_message( const FRAME_VIEW& _line );
 
 				/**
-				Returns the index of the next non-blank line.
-				\param _start_index Starting point of the search.
+				Processes a line as a protocol text message.
+				\param _line Line to process as a protocol message.  Must be contiguous.
 				*/
-				size_t find_next_nonblank_line_table_line( size_t _start_idx ) const;
+				void process_protocol_message( const FRAME_VIEW& _line );
 
 				/**
-				Swaps to table lines.
+				Tokenizes a line.  The line is expected to be a protocol line.  The tokens are trimmed views into the line; nothing is allocated.
+				\param _line Line to tokenize.  Must be contiguous.
+				\param _dest Where the tokens are stored.
+				\return Number of tokens.
 				*/
-				bool swap_two_line_table_lines( size_t _target_idx, size_t _source_idx );
+				size_t tokenize_protocol_line( const FRAME_VIEW& _line, PROTOCOL_TOKENS& _dest );
 
 				/**
-				Marks the current table line as blank.
+				Thread entry function for general operations.
 				*/
-				void clear_active_table_current_line( void );
+				bool thread_func( void );
 
 				/**
-				Marks the line at index as blank.
-				\param _idx Index of the line to mark as blank.
+				Thread entry function for write operations
 				*/
-				void set_active_table_line_blank( size_t _idx );
+				void writer_thread_func( void );
 
 				/**
-				Processes a line as a binary message.
-				\param _idx Index of the line to process as a binary message.
+				Closes the serial port associated with the IO thread.  Does not unlock the port.
 				*/
-				void process_binary_message( size_t _idx );
+				void serial_port_close( void );
 
 				/**
-				Process a line as a text message.
-				\param _idx Index of the line to process as a text message.
+				Opens the serial port associated with the IO thread.  Does try to lock the port and fails if it can not.
 				*/
-				void process_text_message( size_t _idx );
+				ENUM_ERRORS serial_port_open( void );
 
 				/**
-				Processes a line as a protocol text message.
-				\param _idx Index of the line to process as a protocol message.
+				Closes the port of a board that is deemed to be locked/wedged and schedules the first attempt to reopen it.
+				\param _now Current time in microseconds off of CLOCK_MONOTONIC.
 				*/
-				void process_protocol_message( size_t _idx );
+				void handle_hung_board( uint64_t _now );
 
 				/**
-				Tokenizes a line.  The line is expected to be a protocol line.
-				\param _idx Index of the line to tokenize.
-				\return A vector of indexes of token starts in the protocol line.
+				Closes the port, if open, and drops everything queued for the board.  The port is reopened after the current backoff, which is then doubled.
+				If the writer does not let go of the port in time the port stays open until a later supervisor tick manages to close it.
+				\param _now Current time in microseconds off of CLOCK_MONOTONIC.
 				*/
-				token_vector tokenize_protocol_line( size_t _idx );
+				void close_for_recovery( uint64_t _now );
 
 				/**
-				Turns a a vector of token indexes into a vector of string tokens.
-				\param _vect Token index vector.
-				\param _idx Line index to which to apply the token vector.
+				Waits for the writer thread to let go of the port and closes the port.  Gives up after GC_SERIAL_WRITER_RELEASE_TIMEOUT.
+				Only to be called once the board is in PORT_CLOSED state so that the writer does not claim the port again.
+				\return False if the writer still holds the port.  The port is left open in that case.
 				*/
-				vector<string> create_protocol_line_tokens( const token_vector& _vect, size_t _idx );
+				bool release_port( void );
 
 				/**
-				Thread entry function for general operations.
+				Reopens the port and resets the board.  Closes the port again if the reopen fails.
+				\param _now Current time in microseconds off of CLOCK_MONOTONIC.
 				*/
-				bool thread_func( void );
+				void reopen_hung_board( uint64_t _now );
 
 				/**
-				Thread entry function for write operations
+				Marks the board as healthy and records the time it took to recover.
+				\param _now Current time in microseconds off of CLOCK_MONOTONIC.
 				*/
-				void writer_thread_func( void );
+				void handle_board_recovered( uint64_t _now );
 
 				/**
-				Closes the serial port associated with the IO thread.  Does not unlock the port.
+				Decides the fate of a warm attaching board.  Adopts it if it delivered a complete state, resets it once GC_SERIAL_ATTACH_TIMEOUT runs out.
+				\param _now Current time in microseconds off of CLOCK_MONOTONIC.
 				*/
-				void serial_port_close( void );
+				void handle_attaching_board( uint64_t _now );
 
 				/**
-				Opens the serial port associated with the IO thread.  Does try to lock the port and fails if it can not.
+				Resets the board and waits for it to come back up for GC_SERIAL_RESET_TIMEOUT microseconds.
+				\param _now Current time in microseconds off of CLOCK_MONOTONIC.
 				*/
-				ENUM_ERRORS serial_port_open( void );
+				void start_board_reset( uint64_t _now );
 
 				/**
-				Handles a board that is deemed to be locked/wedged.
+				Is the port open.  False while the supervisor keeps the port of a hung board closed.  Safe to call from the writer thread.
 				*/
-				void handle_hung_board( void );
+				inline bool port_is_open( void ) const
+				{
+					return ( this->board_health != ENUM_BOARD_HEALTH::PORT_CLOSED );
+				}
+
+				/**
+				Drops the messages taken from the outgoing queue but not yet written.  Only to be called by the owner of pending_output.
+				*/
+				void discard_pending_output( void );
 
 				/**
 				Determines if it's ok to send data board.  This should be filed under ugly hacks.
 				It checks to see if outgoing serial port queue is empty and the CTS line is high.  If both of those conditions are true it is determined that it's OK to write data to port.
+				A port without modem control lines, a pseudo terminal for example, is treated as having CTS permanently high.
+				\param _output_queue If not null receives the number of bytes in the outgoing serial port queue.
 				\return 0 - not clear to send data.  1 - clear to send data.  >1 error condition.
 				*/
-				unsigned char clear_to_send( void ) const;
+				unsigned char clear_to_send( unsigned int* _output_queue = nullptr );
+
+				/**
+				Waits, without spinning, for the board to become clear to send.  Sleeps for the estimated drain time of the outgoing serial port queue,
+				and blocks in TIOCMIWAIT while CTS is low.  Ports that can not wait on the modem lines are polled with an exponentially growing interval instead.
+				Gives up after GC_SERIAL_CTS_WAIT_TIMEOUT or when the thread is flagged to stop.  The time spent waiting is added to the IO counters.
+				\return Same as clear_to_send.  0 if the wait timed out.
+				*/
+				unsigned char wait_for_clear_to_send( void );
+
+				/**
+				Interrupts whatever system call the writer thread is blocked in with GC_SERIAL_WRITER_WAKE_SIGNAL.  Only to be called from the thread that runs the
+				main event loop since that is the one that joins the writer.
+				*/
+				void wake_writer( void );
 			private:
 
 				/**
@@ -481,11 +798,29 @@ namespace BBB_HVAC
 				OUTGOING_MESSAGE_QUEUE* outgoing_messages;
 
 				/**
-				 * Temporary holding buffer.  Filled with incoming serial data and read by assemble_serial_data.
+				 * Wire capture.  nullptr unless start_capture was called.
+				 */
+				SERIAL_CAPTURE* capture;
+
+				/**
+				 * Adds the first _length bytes described by the spans to the capture, if there is one.
+				 */
+				inline void capture_spans( ENUM_CAPTURE_DIRECTION _direction, const struct iovec* _spans, size_t _length ) {
+					for ( const struct iovec* i = _spans; this->capture != nullptr && _length > 0; ++i ) {
+						size_t chunk = std::min( _length, i->iov_len );
+						this->capture->record( _direction, ( const unsigned char* ) i->iov_base, chunk );
+						_length -= chunk;
+					}
+
+					return;
+				}
+
+				/**
+				 * Receive ring.  Filled with incoming serial data and read by assemble_serial_data.
 				 * Size is determined by GC_SERIAL_BUFF_SIZE.
 				 * \see assemble_serial_data
 				 */
-				unsigned char* buffer;
+				SERIAL_RING_BUFFER rx_ring;
 
 				/**
 				Serial buffer context.
@@ -493,35 +828,16 @@ namespace BBB_HVAC
 				ST_SERIAL_BUFFER_CONTEXT buffer_context;
 
 				/**
-				Resets the serial buffer context.
+				Resets the serial buffer context and discards the contents of the receive ring.
 				*/
 				void reset_buffer_context( void );
 
 				/**
-				 * Line table.  Filled by assemble_serial_data with data parsed from buffer.
-				 * \see assemble_serial_data
-				 * \see buffer
-				 */
-				LINE_TABLE table_a;
-
-				/**
-				 * Alternate line table
+				 * Text lines waiting to be processed.  Filled by assemble_serial_data with text lines parsed from the receive ring.
 				 * \see assemble_serial_data
-				 * \see table_a
-				 */
-				LINE_TABLE table_b;
-
-				/**
-				 * The active line table.
-				 * \see swap_tables(void);
-				 */
-				LINE_TABLE* active_table;
-
-				/**
-				 * The passive line table.
-				 * \see swap_tables(void);
+				 * \see rx_ring
 				 */
-				LINE_TABLE* passive_table;
+				FRAME_QUEUE frame_queue;
 
 				/**
 				 * Full path to the tty devices.
@@ -544,15 +860,26 @@ namespace BBB_HVAC
 				struct termios current_tio;
 
 				/**
-				 * File descriptor of the open serial port.
+				 * File descriptor of the open serial port.  Only changed by the thread that runs the main event loop, and only while the writer does not have
+				 * the port claimed.  \see writer_on_port
 				 */
-				int serial_fd;
+				std::atomic<int> serial_fd;
 
 				/**
 				Board state cache.
 				*/
 				BOARD_STATE_CACHE* state_cache;
 
+				/**
+				Lock free copy of the latest state cache values for the readers.
+				*/
+				BOARD_STATE_PUBLISHER state_publisher;
+
+				/**
+				Generation of the state cache at the time of the last publish.  Used to skip publishing when nothing was added to the cache.
+				*/
+				uint64_t published_generation;
+
 				/**
 				Has the board reset.  True if it has, false otherwise.  We use this to make sure that the board is in a known state.
 				*/
@@ -568,6 +895,221 @@ namespace BBB_HVAC
 				*/
 				bool stream_started;
 
+				/**
+				epoll instance the main event loop waits on.  Watches the serial port, the timer, and the shutdown eventfd.
+				*/
+				int epoll_fd;
+
+				/**
+				eventfd used to wake the main event loop up when the thread is asked to stop.
+				*/
+				int shutdown_fd;
+
+				/**
+				timerfd that fires every GC_SERIAL_THREAD_UPDATE_INTERVAL microseconds.
+				*/
+				int timer_fd;
+
+				/**
+				Time, off of CLOCK_MONOTONIC, data was last received from the board.
+				*/
+				uint64_t last_rx_usec;
+
+				/**
+				State of the hung board supervisor.  Read by the writer thread to tell whether the port is open.
+				*/
+				std::atomic<ENUM_BOARD_HEALTH> board_health;
+
+				/**
+				When the supervisor acts next if nothing changes in the meantime.  Not used in the HEALTHY state.
+				*/
+				uint64_t supervisor_deadline;
+
+				/**
+				How long the port will be kept closed after the next failed recovery attempt.
+				*/
+				uint64_t reopen_backoff;
+
+				/**
+				Time the board was found hung.  Zero if the board is not being recovered.
+				*/
+				uint64_t hung_since;
+
+				/**
+				Adopt a board that is already streaming rather than reset it.
+				*/
+				bool warm_attach;
+
+				/**
+				Time the event processing started.  The attach time is measured from here.
+				*/
+				uint64_t attach_started;
+
+				/**
+				Board state fields received in a valid frame since the board was attached or last reset.  Bits of ENUM_BOARD_STATE_FIELDS.
+				*/
+				uint32_t received_fields;
+
+				/**
+				\see has_valid_state
+				*/
+				std::atomic<bool> state_valid;
+
+				/**
+				Targets of the epoll_event data pointers.  One per ENUM_EVENT_SOURCES entry.
+				*/
+				ST_EVENT_SOURCE event_sources[EVENT_SOURCE_COUNT];
+
+				/**
+				Is the board attached to a reactor.  If it is the epoll instance belongs to the reactor.
+				*/
+				bool reactor_mode;
+
+				/**
+				Messages taken from the outgoing queue but not yet fully written.  Belongs to the writer thread, or to the reactor when attached to one.
+				*/
+				std::deque<OUTGOING_MESSAGE> pending_output;
+
+				/**
+				Number of bytes of the first pending message that have already been written.
+				*/
+				size_t pending_offset;
+
+				/**
+				Does the port have modem control lines.  Cleared the first time TIOCMGET is rejected by the port.
+				*/
+				bool has_modem_lines;
+
+				/**
+				Can the port block until a modem line changes.  Cleared the first time TIOCMIWAIT is rejected by the port.
+				*/
+				bool has_modem_wait;
+
+				/**
+				When the supervisor wakes the writer out of TIOCMIWAIT, in microseconds off of CLOCK_MONOTONIC.  0 while the writer is not waiting for CTS.
+				*/
+				std::atomic<uint64_t> cts_wait_deadline;
+
+				/**
+				The writer thread.  Only valid in threaded mode.
+				*/
+				pthread_t writer_thread;
+
+				/**
+				Is the writer thread running.  Cleared by the writer on its way out.
+				*/
+				std::atomic<bool> writer_running;
+
+				/**
+				Set by the writer thread while it uses the port descriptor.  The supervisor does not close the port until the writer lets go of it.
+				*/
+				std::atomic<bool> writer_on_port;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_write_blocked_usec;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_write_blocked_max_usec;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_write_block_count;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_write_timeouts;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_commands_coalesced;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_bytes_received;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_frames_decoded;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_checksum_errors;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_lines_decoded;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_frames_rejected;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_state_updates;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_hung_boards;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_reopen_failures;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_reset_timeouts;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_recoveries;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_recover_usec;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_recover_max_usec;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_warm_attaches;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_attach_fallbacks;
+
+				/**
+				\see SERIAL_IO_STATS
+				*/
+				std::atomic<uint64_t> stat_attach_usec;
+
+				/**
+				Descriptors of the binary responses, indexed by command.  The last entry is CMD_ID_SYS_FAILURE.
+				*/
+				static const ST_BINARY_COMMAND binary_commands[];
+
 				DEF_LOGGER;
 		} ;
 
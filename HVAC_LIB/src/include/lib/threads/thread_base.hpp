@@ -26,6 +26,10 @@ using std::string;
 
 #include <pthread.h>
 #include <time.h>
+#include <stdint.h>
+
+#include <atomic>
+
 #include "lib/exceptions.hpp"
 #include "lib/threads/tprotect_base.hpp"
 #include "lib/logger.hpp"
@@ -45,7 +49,10 @@ namespace BBB_HVAC
 			void start_thread( void );
 			void stop_thread( bool _self_delete = false );
 
-			inline void flag_for_stop( void ) {
+			/**
+			 * Flags the thread to stop during its next iteration.  Derived classes that block waiting for events should override this in order to wake the thread up.
+			 */
+			inline virtual void flag_for_stop( void ) {
 				this->abort_thread = true;
 			}
 
@@ -56,8 +63,22 @@ namespace BBB_HVAC
 			inline bool get_is_io_thread( void ) const {
 				return this->is_io_thread;
 			}
+
+			/**
+			 * Returns the CPU time, user plus system, the thread had used as of its last call to sample_cpu_usage.  Safe to call from any thread.
+			 * \return Microseconds of CPU time.
+			 */
+			inline uint64_t get_cpu_usec( void ) const {
+				return this->cpu_usec;
+			}
 		protected:
 
+			/**
+			 * Records the CPU time used by the calling thread so far.  RUSAGE_THREAD only works on the calling thread so each thread samples itself at its own convenient points.
+			 * Must only be called from the thread this instance represents.
+			 */
+			void sample_cpu_usage( void );
+
 			void pthread_func( void );
 			virtual bool thread_func( void ) = 0;
 			string thread_tag;
@@ -71,6 +92,11 @@ namespace BBB_HVAC
 			bool do_not_self_delete;
 			bool is_io_thread;
 
+			/**
+			 * \see get_cpu_usec
+			 */
+			std::atomic<uint64_t> cpu_usec;
+
 			DEF_LOGGER;
 		private:
 
@@ -62,6 +62,21 @@ void LOGGER::log_warning( const string& _msg, const string& _file, int _line, co
 {
 	this->log( ENUM_LOG_LEVEL::WARNING, _msg, _file, _line, _function );
 }
+bool LOGGER::is_enabled( ENUM_LOG_LEVEL _level ) const
+{
+	LOG_CONFIGURATOR* log_configurator = LOG_CONFIGURATOR::get_root_configurator();
+
+	/*
+	Without a configurator the message is passed on so that log() gets to complain about it.
+	*/
+	if ( log_configurator == nullptr )
+	{
+		return true;
+	}
+
+	return ( _level >= this->level && _level >= log_configurator->get_level() );
+}
+
 static bool nag_flag = true;
 
 void LOGGER::log( const ENUM_LOG_LEVEL& _level, const string& _msg, const string& _file, int _line, const string& _function )
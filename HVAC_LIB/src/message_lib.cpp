@@ -24,6 +24,11 @@
 #include "lib/hvac_types.hpp"
 
 #include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <limits>
 #include <sstream>
 #include <iostream>
 
@@ -33,24 +38,62 @@ const char MESSAGE::sep_char = '|';
 
 const timespec* MESSAGE::get_message_sent_timestamp( void ) const
 {
-	return this->message_sent;
+	return & ( this->message_sent );
 }
 const timespec* MESSAGE::get_message_created_timestamp( void ) const
 {
-	return this->class_created;
+	return & ( this->class_created );
 }
 const timespec* MESSAGE::get_message_received_timestamp( void ) const
 {
-	return this->message_received;
+	return & ( this->message_received );
 }
 
 MESSAGE::MESSAGE( const MESSAGE_TYPE& _type, const vector<string>& _payload )
 {
 	init();
+	this->assign( _type, _payload );
+}
+
+void MESSAGE::assign( const MESSAGE_TYPE& _type, vector<string>::const_iterator _first, vector<string>::const_iterator _last )
+{
+	this->message_type = _type;
+	this->binary = false;
+	this->text_rendered = false;
+	MESSAGE::serialize( _type, _first, _last, this->payload, & ( this->parts ) );
+	this->length = this->payload.length();
+	memset( & ( this->message_received ), 0, sizeof( struct timespec ) );
+	memset( & ( this->message_sent ), 0, sizeof( struct timespec ) );
+	get_timestamp( & ( this->class_created ) );
+	return;
+}
+
+void MESSAGE::assign( const MESSAGE_TYPE& _type, const vector<string>& _parts )
+{
+	this->assign( _type, _parts.cbegin(), _parts.cend() );
+	return;
+}
+
+void MESSAGE::assign( const MESSAGE_TYPE& _type, const char* _buffer, size_t _length, const TEXT_VIEW* _parts, size_t _part_count )
+{
 	this->message_type = _type;
-	this->parts = _payload;
-	this->build_message();
-	get_timestamp( this->class_created );
+	this->binary = false;
+	this->text_rendered = false;
+	this->payload.assign( _buffer, _length );
+	this->length = _length;
+	this->parts.resize( _part_count );
+
+	for ( size_t i = 0; i < _part_count; i++ )
+	{
+		this->parts[i].offset = ( size_t )( _parts[i].data - _buffer );
+		this->parts[i].length = _parts[i].length;
+		this->parts[i].tag = 0;
+	}
+
+	memset( & ( this->message_received ), 0, sizeof( struct timespec ) );
+	memset( & ( this->message_sent ), 0, sizeof( struct timespec ) );
+	get_timestamp( & ( this->class_created ) );
+	return;
 }
 
 void MESSAGE::get_timestamp( timespec* _tm )
@@ -62,33 +105,101 @@ void MESSAGE::get_timestamp( timespec* _tm )
 
 	return;
 }
-void MESSAGE::build_message( void )
-{
-	vector<string> v;
-	v.push_back( this->message_type->label );
-	v.insert( v.end(), this->parts.begin(), this->parts.end() );
-	string pld = join_vector( v, MESSAGE::sep_char );
-	size_t pld_length = pld.length();
-	std::stringstream ret;
-	ret << pld_length; //Get the length of the payload without the 'size|' preamble.
-	size_t pld_length_length = ret.str().length();
-	ret.str( "" );
-	ret.clear();
-	ret.seekp( std::ios_base::beg );
-	ret << ( pld_length + pld_length_length );
-	pld_length_length = ret.str().length();
-	ret.str( "" );
-	ret.clear();
-	ret.seekp( std::ios_base::beg );
+/**
+ * Number of decimal digits in a number.
+ */
+static inline size_t decimal_digits( size_t _value )
+{
+	size_t ret = 1;
+
+	while ( _value >= 10 )
+	{
+		_value /= 10;
+		ret += 1;
+	}
+
+	return ret;
+}
+
+/**
+ * Writes a number in decimal into the buffer.
+ * \param _dest Destination buffer.  Must have room for _digits characters.
+ * \param _value Number to write.
+ * \param _digits Number of digits in _value.
+ * \return Pointer past the last written character.
+ */
+static inline char* write_decimal( char* _dest, size_t _value, size_t _digits )
+{
+	char* ret = _dest + _digits;
+	char* p = ret;
+
+	do
+	{
+		*--p = ( char )( '0' + ( _value % 10 ) );
+		_value /= 10;
+	}
+	while ( p > _dest );
+
+	return ret;
+}
+
+void MESSAGE::serialize( const MESSAGE_TYPE& _type, const vector<string>& _parts, string& _dest )
+{
+	MESSAGE::serialize( _type, _parts.cbegin(), _parts.cend(), _dest, nullptr );
+	return;
+}
+
+void MESSAGE::serialize( const MESSAGE_TYPE& _type, vector<string>::const_iterator _first, vector<string>::const_iterator _last, string& _dest, vector<PART_SPAN>* _spans )
+{
+	size_t body_length = _type->label.length();
+
+	for ( auto i = _first; i != _last; ++i )
+	{
+		body_length += 1 + i->length();
+	}
+
 	/*
-	 * Plus 2 because:
-	 * +1 - the separator after length
-	 * +1 - the new line at the end of message
+	 * The length prefix counts itself, the separator after it, and the new line at the end of message.
+	 * Adding the prefix can carry the total into another digit, so settle the digit count first.
 	 */
-	ret << ( pld_length_length + pld_length + 2 );
-	ret << MESSAGE::sep_char << pld << std::endl;
-	this->payload = ret.str();
-	this->length = payload.length();
+	size_t prefix_digits = decimal_digits( body_length + 2 );
+
+	while ( decimal_digits( body_length + 2 + prefix_digits ) != prefix_digits )
+	{
+		prefix_digits += 1;
+	}
+
+	size_t total_length = prefix_digits + body_length + 2;
+
+	_dest.resize( total_length );
+
+	char* p = write_decimal( &_dest[0], total_length, prefix_digits );
+	*p++ = MESSAGE::sep_char;
+	memcpy( p, _type->label.data(), _type->label.length() );
+	p += _type->label.length();
+
+	if ( _spans != nullptr )
+	{
+		_spans->resize( ( size_t )( _last - _first ) );
+	}
+
+	for ( auto i = _first; i != _last; ++i )
+	{
+		*p++ = MESSAGE::sep_char;
+
+		if ( _spans != nullptr )
+		{
+			PART_SPAN& span = ( *_spans )[( size_t )( i - _first )];
+			span.offset = ( size_t )( p - _dest.data() );
+			span.length = i->length();
+			span.tag = 0;
+		}
+
+		memcpy( p, i->data(), i->length() );
+		p += i->length();
+	}
+
+	*p = '\n';
 	return;
 }
 
@@ -104,62 +215,487 @@ const string& MESSAGE::get_payload( void ) const
 {
 	return this->payload;
 }
-const vector<string>& MESSAGE::get_parts( void ) const
+bool MESSAGE::is_binary( void ) const
 {
-	return this->parts;
+	return this->binary;
 }
 
-uint16_t MESSAGE::get_part_as_ui( size_t _part )
+TEXT_VIEW MESSAGE::get_part( size_t _part ) const
 {
 	this->check_part_index( _part );
+	const PART_SPAN& span = this->parts[_part];
 
-	try
+	if ( span.tag == 0 )
 	{
-		return ( ( uint16_t ) stoi( this->parts[_part] ) );
+		return TEXT_VIEW( this->payload.data() + span.offset, span.length );
 	}
-	catch ( const exception& e )
+
+	if ( static_cast<BINARY_FRAME::ENUM_FIELD_TAG>( span.tag ) == BINARY_FRAME::ENUM_FIELD_TAG::TEXT )
 	{
-		throw runtime_error( string( "Failed to parse part " ) + this->parts[_part] + " to an unsigned integer: " + e.what() );
+		/*
+		 * Skip the length.
+		 */
+		return TEXT_VIEW( this->payload.data() + span.offset + 2, span.length - 2 );
 	}
+
+	this->render_text();
+	return TEXT_VIEW( this->text.data() + this->text_parts[_part].offset, this->text_parts[_part].length );
 }
-int16_t MESSAGE::get_part_as_si( size_t _part )
+
+bool MESSAGE::get_binary_number( size_t _part, double& _value ) const
 {
-	this->check_part_index( _part );
+	const PART_SPAN& span = this->parts[_part];
+	const char* data = this->payload.data() + span.offset;
+
+	switch ( static_cast<BINARY_FRAME::ENUM_FIELD_TAG>( span.tag ) )
+	{
+		case BINARY_FRAME::ENUM_FIELD_TAG::ENTRY8:
+			_value = ( unsigned char ) data[0];
+			return true;
+
+		case BINARY_FRAME::ENUM_FIELD_TAG::ENTRY16:
+			_value = BINARY_FRAME::get_u16( data );
+			return true;
+
+		case BINARY_FRAME::ENUM_FIELD_TAG::DOUBLE:
+			_value = BINARY_FRAME::get_double( data );
+			return true;
+
+		case BINARY_FRAME::ENUM_FIELD_TAG::BOOL:
+			_value = ( data[0] != 0 ? 1 : 0 );
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+/**
+ * Converts a binary number part to an integer type.  Only whole numbers in the range of the type convert.
+ */
+template <typename T> static bool number_to_integer( double _number, T& _value )
+{
+	if ( !( _number >= ( double ) numeric_limits<T>::min() && _number <= ( double ) numeric_limits<T>::max() ) || _number != ( double )( int64_t ) _number )
+	{
+		return false;
+	}
+
+	_value = ( T ) _number;
+	return true;
+}
+
+bool MESSAGE::decode_part( size_t _part, uint16_t& _value ) const
+{
+	uint64_t value;
+	double number;
+
+	if ( _part >= this->parts.size() )
+	{
+		return false;
+	}
+
+	if ( this->get_binary_number( _part, number ) )
+	{
+		return number_to_integer( number, _value );
+	}
+
+	if ( this->get_part( _part ).to_unsigned( UINT16_MAX, value ) == false )
+	{
+		return false;
+	}
+
+	_value = ( uint16_t ) value;
+	return true;
+}
+
+bool MESSAGE::decode_part( size_t _part, int16_t& _value ) const
+{
+	int64_t value;
+	double number;
+
+	if ( _part >= this->parts.size() )
+	{
+		return false;
+	}
+
+	if ( this->get_binary_number( _part, number ) )
+	{
+		return number_to_integer( number, _value );
+	}
+
+	if ( this->get_part( _part ).to_signed( INT16_MIN, INT16_MAX, value ) == false )
+	{
+		return false;
+	}
+
+	_value = ( int16_t ) value;
+	return true;
+}
+
+bool MESSAGE::decode_part( size_t _part, int& _value ) const
+{
+	int64_t value;
+	double number;
+
+	if ( _part >= this->parts.size() )
+	{
+		return false;
+	}
+
+	if ( this->get_binary_number( _part, number ) )
+	{
+		return number_to_integer( number, _value );
+	}
+
+	if ( this->get_part( _part ).to_signed( INT_MIN, INT_MAX, value ) == false )
+	{
+		return false;
+	}
+
+	_value = ( int ) value;
+	return true;
+}
+
+bool MESSAGE::decode_part( size_t _part, unsigned long& _value ) const
+{
+	uint64_t value;
+	double number;
+
+	if ( _part >= this->parts.size() )
+	{
+		return false;
+	}
+
+	if ( this->get_binary_number( _part, number ) )
+	{
+		return number_to_integer( number, _value );
+	}
+
+	if ( this->get_part( _part ).to_unsigned( ULONG_MAX, value ) == false )
+	{
+		return false;
+	}
+
+	_value = ( unsigned long ) value;
+	return true;
+}
+
+bool MESSAGE::decode_part( size_t _part, double& _value ) const
+{
+	if ( _part >= this->parts.size() )
+	{
+		return false;
+	}
+
+	if ( this->get_binary_number( _part, _value ) )
+	{
+		return true;
+	}
+
+	return this->get_part( _part ).to_double( _value );
+}
+
+bool MESSAGE::decode_entry( size_t _part, uint16_t& _value, timespec& _time ) const
+{
+	if ( _part >= this->parts.size() )
+	{
+		return false;
+	}
+
+	const PART_SPAN& span = this->parts[_part];
+	const char* data = this->payload.data() + span.offset;
+
+	switch ( static_cast<BINARY_FRAME::ENUM_FIELD_TAG>( span.tag ) )
+	{
+		case BINARY_FRAME::ENUM_FIELD_TAG::ENTRY8:
+			_value = ( unsigned char ) data[0];
+			_time.tv_sec = ( time_t ) BINARY_FRAME::get_u32( data + 1 );
+			_time.tv_nsec = ( long ) BINARY_FRAME::get_u32( data + 5 );
+			return true;
+
+		case BINARY_FRAME::ENUM_FIELD_TAG::ENTRY16:
+			_value = BINARY_FRAME::get_u16( data );
+			_time.tv_sec = ( time_t ) BINARY_FRAME::get_u32( data + 2 );
+			_time.tv_nsec = ( long ) BINARY_FRAME::get_u32( data + 6 );
+			return true;
+
+		default:
+			if ( span.tag != 0 && static_cast<BINARY_FRAME::ENUM_FIELD_TAG>( span.tag ) != BINARY_FRAME::ENUM_FIELD_TAG::TEXT )
+			{
+				return false;
+			}
+
+			break;
+	}
+
+	/*
+	 * [seconds.nanoseconds:value]
+	 */
+	TEXT_VIEW part = this->get_part( _part );
+
+	if ( part.length < 2 || part.data[0] != '[' || part.data[part.length - 1] != ']' )
+	{
+		return false;
+	}
+
+	const char* dot = ( const char* ) memchr( part.data, '.', part.length );
+	const char* colon = ( const char* ) memchr( part.data, ':', part.length );
+	uint64_t sec;
+	uint64_t nsec;
+	uint64_t value;
+
+	if ( dot == nullptr || colon == nullptr || colon < dot ||
+			TEXT_VIEW( part.data + 1, ( size_t )( dot - part.data - 1 ) ).to_unsigned( UINT32_MAX, sec ) == false ||
+			TEXT_VIEW( dot + 1, ( size_t )( colon - dot - 1 ) ).to_unsigned( 999999999, nsec ) == false ||
+			TEXT_VIEW( colon + 1, ( size_t )( part.data + part.length - 1 - colon - 1 ) ).to_unsigned( UINT16_MAX, value ) == false )
+	{
+		return false;
+	}
+
+	_value = ( uint16_t ) value;
+	_time.tv_sec = ( time_t ) sec;
+	_time.tv_nsec = ( long ) nsec;
+	return true;
+}
+
+void MESSAGE::render_text( void ) const
+{
+	if ( this->text_rendered )
+	{
+		return;
+	}
+
+	char buffer[64];
+
+	this->text.clear();
+	this->text_parts.resize( this->parts.size() );
+
+	for ( size_t i = 0; i < this->parts.size(); i++ )
+	{
+		const PART_SPAN& span = this->parts[i];
+		const char* data = this->payload.data() + span.offset;
+		int rc = 0;
+
+		switch ( static_cast<BINARY_FRAME::ENUM_FIELD_TAG>( span.tag ) )
+		{
+			case BINARY_FRAME::ENUM_FIELD_TAG::TEXT:
+				this->text_parts[i].offset = this->text.length();
+				this->text_parts[i].length = span.length - 2;
+				this->text.append( data + 2, span.length - 2 );
+				continue;
+
+			case BINARY_FRAME::ENUM_FIELD_TAG::ENTRY8:
+				rc = snprintf( buffer, sizeof( buffer ), "[%u.%u:%u]", BINARY_FRAME::get_u32( data + 1 ), BINARY_FRAME::get_u32( data + 5 ), ( unsigned int )( unsigned char ) data[0] );
+				break;
+
+			case BINARY_FRAME::ENUM_FIELD_TAG::ENTRY16:
+				rc = snprintf( buffer, sizeof( buffer ), "[%u.%u:%u]", BINARY_FRAME::get_u32( data + 2 ), BINARY_FRAME::get_u32( data + 6 ), ( unsigned int ) BINARY_FRAME::get_u16( data ) );
+				break;
+
+			case BINARY_FRAME::ENUM_FIELD_TAG::DOUBLE:
+				/*
+				 * The default formatting of a stream, which is what num_to_str uses.
+				 */
+				rc = snprintf( buffer, sizeof( buffer ), "%g", BINARY_FRAME::get_double( data ) );
+				break;
+
+			case BINARY_FRAME::ENUM_FIELD_TAG::BOOL:
+				rc = snprintf( buffer, sizeof( buffer ), "%s", ( data[0] != 0 ? "TRUE" : "FALSE" ) );
+				break;
+		}
+
+		this->text_parts[i].offset = this->text.length();
+		this->text_parts[i].length = ( size_t ) rc;
+		this->text.append( buffer, ( size_t ) rc );
+	}
+
+	this->text_rendered = true;
+	return;
+}
+
+void MESSAGE::assign_frame( const MESSAGE_TYPE& _type )
+{
+	this->message_type = _type;
+	this->binary = true;
+	this->text_rendered = false;
+	this->parts.clear();
+	this->payload.assign( BINARY_FRAME::header_size, 0 );
+	this->payload[0] = ( char ) BINARY_FRAME::marker;
+	this->payload[BINARY_FRAME::type_offset] = ( char ) static_cast<unsigned int>( _type->type );
+	this->length = 0;
+	memset( & ( this->message_received ), 0, sizeof( struct timespec ) );
+	memset( & ( this->message_sent ), 0, sizeof( struct timespec ) );
+	get_timestamp( & ( this->class_created ) );
+	return;
+}
+
+void MESSAGE::assign_frame( const MESSAGE_TYPE& _type, const char* _buffer, size_t _length )
+{
+	this->message_type = _type;
+	this->binary = true;
+	this->text_rendered = false;
+	this->payload.assign( _buffer, _length );
+	this->length = _length;
+
+	size_t part_count = BINARY_FRAME::get_u16( _buffer + BINARY_FRAME::part_count_offset );
+	size_t pos = BINARY_FRAME::header_size;
 
-	try
+	this->parts.resize( part_count );
+
+	for ( size_t i = 0; i < part_count; i++ )
 	{
-		return ( ( int16_t ) stoi( this->parts[_part] ) );
+		size_t field_length;
+
+		if ( pos >= _length || BINARY_FRAME::field_length( ( unsigned char ) _buffer[pos], _buffer + pos + 1, _length - pos - 1, field_length ) == false )
+		{
+			throw EXCEPTIONS::PROTOCOL_ERROR( "Binary frame part " + num_to_str( ( unsigned long ) i ) + " is corrupt or runs past the end of the frame." );
+		}
+
+		this->parts[i].tag = ( unsigned char ) _buffer[pos];
+		this->parts[i].offset = pos + 1;
+		this->parts[i].length = field_length;
+		pos += 1 + field_length;
 	}
-	catch ( const exception& e )
+
+	if ( pos != _length )
 	{
-		throw runtime_error( string( "Failed to parse part " ) + this->parts[_part] + " to a signed integer: " + e.what() );
+		throw EXCEPTIONS::PROTOCOL_ERROR( "Binary frame has " + num_to_str( ( unsigned long )( _length - pos ) ) + " bytes past its last part." );
 	}
+
+	memset( & ( this->message_received ), 0, sizeof( struct timespec ) );
+	memset( & ( this->message_sent ), 0, sizeof( struct timespec ) );
+	get_timestamp( & ( this->class_created ) );
+	return;
 }
 
-double MESSAGE::get_part_as_d( size_t _part )
+void MESSAGE::append_field( BINARY_FRAME::ENUM_FIELD_TAG _tag, const char* _data, size_t _length )
 {
+	PART_SPAN span;
+	span.tag = static_cast<unsigned char>( _tag );
+	span.offset = this->payload.length() + 1;
+	span.length = _length;
+	this->payload += ( char ) span.tag;
+	this->payload.append( _data, _length );
+	this->parts.push_back( span );
+	return;
+}
+
+void MESSAGE::append_text( const string& _value )
+{
+	if ( _value.length() > UINT16_MAX )
+	{
+		throw runtime_error( "Binary message part is longer than " + num_to_str( ( unsigned int ) UINT16_MAX ) + " bytes." );
+	}
+
+	char length[2];
+	BINARY_FRAME::put_u16( length, ( uint16_t ) _value.length() );
+	this->payload += ( char ) BINARY_FRAME::ENUM_FIELD_TAG::TEXT;
+
+	PART_SPAN span;
+	span.tag = static_cast<unsigned char>( BINARY_FRAME::ENUM_FIELD_TAG::TEXT );
+	span.offset = this->payload.length();
+	span.length = 2 + _value.length();
+	this->payload.append( length, 2 );
+	this->payload.append( _value );
+	this->parts.push_back( span );
+	return;
+}
+
+void MESSAGE::append_entry( uint8_t _value, const timespec& _time )
+{
+	char data[9];
+	data[0] = ( char ) _value;
+	BINARY_FRAME::put_u32( data + 1, ( uint32_t ) _time.tv_sec );
+	BINARY_FRAME::put_u32( data + 5, ( uint32_t ) _time.tv_nsec );
+	this->append_field( BINARY_FRAME::ENUM_FIELD_TAG::ENTRY8, data, sizeof( data ) );
+	return;
+}
+
+void MESSAGE::append_entry( uint16_t _value, const timespec& _time )
+{
+	char data[10];
+	BINARY_FRAME::put_u16( data, _value );
+	BINARY_FRAME::put_u32( data + 2, ( uint32_t ) _time.tv_sec );
+	BINARY_FRAME::put_u32( data + 6, ( uint32_t ) _time.tv_nsec );
+	this->append_field( BINARY_FRAME::ENUM_FIELD_TAG::ENTRY16, data, sizeof( data ) );
+	return;
+}
+
+void MESSAGE::append_double( double _value )
+{
+	char data[8];
+	BINARY_FRAME::put_double( data, _value );
+	this->append_field( BINARY_FRAME::ENUM_FIELD_TAG::DOUBLE, data, sizeof( data ) );
+	return;
+}
+
+void MESSAGE::append_bool( bool _value )
+{
+	char data = ( _value ? 1 : 0 );
+	this->append_field( BINARY_FRAME::ENUM_FIELD_TAG::BOOL, &data, 1 );
+	return;
+}
+
+void MESSAGE::finish_frame( void )
+{
+	if ( this->parts.size() > UINT16_MAX )
+	{
+		throw runtime_error( "Binary message has more than " + num_to_str( ( unsigned int ) UINT16_MAX ) + " parts." );
+	}
+
+	this->length = this->payload.length();
+	BINARY_FRAME::put_u16( & ( this->payload[BINARY_FRAME::part_count_offset] ), ( uint16_t ) this->parts.size() );
+	BINARY_FRAME::put_u32( & ( this->payload[BINARY_FRAME::length_offset] ), ( uint32_t ) this->length );
+	return;
+}
+
+uint16_t MESSAGE::get_part_as_ui( size_t _part ) const
+{
+	uint16_t ret;
 	this->check_part_index( _part );
 
-	try
+	if ( this->decode_part( _part, ret ) == false )
 	{
-		return ( ( double ) stod( this->parts[_part] ) );
+		throw runtime_error( string( "Failed to parse part " ) + this->get_part_as_s( _part ) + " to an unsigned integer." );
 	}
-	catch ( const exception& e )
+
+	return ret;
+}
+int16_t MESSAGE::get_part_as_si( size_t _part ) const
+{
+	int16_t ret;
+	this->check_part_index( _part );
+
+	if ( this->decode_part( _part, ret ) == false )
 	{
-		throw runtime_error( string( "Failed to parse part " ) + this->parts[_part] + " to a double: " + e.what() );
+		throw runtime_error( string( "Failed to parse part " ) + this->get_part_as_s( _part ) + " to a signed integer." );
 	}
+
+	return ret;
 }
-string MESSAGE::get_part_as_s( size_t _part )
+
+double MESSAGE::get_part_as_d( size_t _part ) const
 {
+	double ret;
 	this->check_part_index( _part );
-	return this->parts[_part];
+
+	if ( this->decode_part( _part, ret ) == false )
+	{
+		throw runtime_error( string( "Failed to parse part " ) + this->get_part_as_s( _part ) + " to a double." );
+	}
+
+	return ret;
+}
+string MESSAGE::get_part_as_s( size_t _part ) const
+{
+	return this->get_part( _part ).to_string();
 }
 
 size_t MESSAGE::get_part_count( void ) const
 {
 	return this->parts.size();
 }
-void MESSAGE::check_part_index( size_t _idx )
+void MESSAGE::check_part_index( size_t _idx ) const
 {
 	if ( this->parts.size() == 0 || _idx >= this->parts.size() )
 	{
@@ -169,38 +705,30 @@ void MESSAGE::check_part_index( size_t _idx )
 
 void MESSAGE::tag_received( void )
 {
-	if ( this->message_received->tv_sec != 0 )
+	if ( this->message_received.tv_sec != 0 )
 	{
 		throw runtime_error( "Attempt was made to tag a message instance as received more than once." );
 	}
 
-	get_timestamp( this->message_received );
+	get_timestamp( & ( this->message_received ) );
 	return;
 }
 
 void MESSAGE::tag_sent( void )
 {
-	if ( this->message_sent->tv_sec != 0 )
+	if ( this->message_sent.tv_sec != 0 )
 	{
 		throw runtime_error( "Attempt was made to tag a message instance as sent more than once." );
 	}
 
-	get_timestamp( this->message_sent );
+	get_timestamp( & ( this->message_sent ) );
 	return;
 }
 
 MESSAGE::~MESSAGE()
 {
 	this->length = 0;
-	this->message_type = MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::INVALID );
-	this->payload.clear();
-	this->parts.clear();
-	memset( this->class_created, 0, sizeof( struct timespec ) );
-	memset( this->message_received, 0, sizeof( struct timespec ) );
-	memset( this->message_sent, 0, sizeof( struct timespec ) );
-	delete this->class_created;
-	delete this->message_received;
-	delete this->message_sent;
+	this->message_type = nullptr;
 }
 void MESSAGE::init( void )
 {
@@ -208,12 +736,11 @@ void MESSAGE::init( void )
 	this->message_type = MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::INVALID );
 	this->payload.clear();
 	this->parts.clear();
-	this->class_created = new timespec();
-	this->message_received = new timespec();
-	this->message_sent = new timespec();
-	memset( this->class_created, 0, sizeof( struct timespec ) );
-	memset( this->message_received, 0, sizeof( struct timespec ) );
-	memset( this->message_sent, 0, sizeof( struct timespec ) );
+	this->binary = false;
+	this->text_rendered = false;
+	memset( & ( this->class_created ), 0, sizeof( struct timespec ) );
+	memset( & ( this->message_received ), 0, sizeof( struct timespec ) );
+	memset( & ( this->message_sent ), 0, sizeof( struct timespec ) );
 	return;
 }
 
@@ -235,22 +762,34 @@ string MESSAGE::to_string( void ) const
 	string received_ts;
 	string sent_ts;
 	stringstream ss;
-	ss << this->class_created->tv_sec << "." << this->class_created->tv_nsec;
+	ss << this->class_created.tv_sec << "." << this->class_created.tv_nsec;
 	created_ts = ss.str();
 	ss.str( "" );
 	ss.clear();
 	ss.seekp( ios_base::beg );
-	ss << this->message_received->tv_sec << "." << this->message_received->tv_nsec;
+	ss << this->message_received.tv_sec << "." << this->message_received.tv_nsec;
 	received_ts = ss.str();
 	ss.str( "" );
 	ss.clear();
 	ss.seekp( ios_base::beg );
-	ss << this->message_sent->tv_sec << "." << this->message_sent->tv_nsec;
+	ss << this->message_sent.tv_sec << "." << this->message_sent.tv_nsec;
 	sent_ts = ss.str();
 	ss.str( "" );
 	ss.clear();
 	ss.seekp( ios_base::beg );
-	string p = join_vector( this->parts, ':' );
+	string p;
+
+	for ( size_t i = 0; i < this->parts.size(); i++ )
+	{
+		if ( i > 0 )
+		{
+			p += ':';
+		}
+
+		TEXT_VIEW part = this->get_part( i );
+		p.append( part.data, part.length );
+	}
+
 	ret = "(MSG:" + this->message_type->label + "; c:" + created_ts + "; r:" + received_ts + "; s:" + sent_ts + "; (" + p + "))";
 	return ret;
 }
@@ -273,4 +812,134 @@ void MESSAGE::message_to_map( const MESSAGE_PTR& _message, std::map<std::string,
 	}
 
 	return;
-}
\ No newline at end of file
+}
+
+MESSAGE_POOL::MESSAGE_POOL( size_t _max_size )
+{
+	this->max_size = _max_size;
+	this->next = 0;
+	this->messages.reserve( _max_size );
+
+	if ( pthread_mutex_init( &this->mutex, nullptr ) != 0 )
+	{
+		throw runtime_error( create_perror_string( "Failed to initialize message pool mutex." ) );
+	}
+
+	return;
+}
+
+MESSAGE_POOL::~MESSAGE_POOL()
+{
+	this->messages.clear();
+	pthread_mutex_destroy( &this->mutex );
+	return;
+}
+
+MESSAGE_PTR MESSAGE_POOL::acquire( const MESSAGE_TYPE& _type, size_t _part_count )
+{
+	MESSAGE_PTR ret;
+
+	pthread_mutex_lock( &this->mutex );
+
+	size_t count = this->messages.size();
+	size_t free_idx = count;
+	bool exact = false;
+
+	for ( size_t i = 0; i < count; i++ )
+	{
+		size_t idx = ( this->next + i ) % count;
+
+		/*
+		 * The pool's own reference is the only one left; nobody can get hold of the message but us.
+		 * A message with as many parts has the storage for them already, so it is preferred; requests and responses differ a lot in size.
+		 */
+		if ( this->messages[idx].use_count() == 1 )
+		{
+			if ( this->messages[idx]->get_part_count() == _part_count )
+			{
+				free_idx = idx;
+				exact = true;
+				break;
+			}
+
+			if ( free_idx == count )
+			{
+				free_idx = idx;
+			}
+		}
+	}
+
+	/*
+	 * Reshaping a message of another size frees and allocates its storage all over again.  Rather grow the pool while it may.
+	 */
+	if ( free_idx < count && ( exact || count >= this->max_size ) )
+	{
+		/*
+		 * The last reference may have been dropped by another thread; a client context hands its messages to the thread waiting for them.
+		 * Make sure whatever that thread did to the message is visible before the message is overwritten.
+		 */
+		std::atomic_thread_fence( std::memory_order_acquire );
+		this->next = ( free_idx + 1 ) % count;
+		ret = this->messages[free_idx];
+		pthread_mutex_unlock( &this->mutex );
+		return ret;
+	}
+
+	pthread_mutex_unlock( &this->mutex );
+
+	/*
+	 * Allocate without the lock.  Another thread may have filled the pool in the meantime; the storage for max_size messages is reserved, so
+	 * pushing a message can not throw.
+	 */
+	ret.reset( new MESSAGE( _type ) );
+	pthread_mutex_lock( &this->mutex );
+
+	if ( this->messages.size() < this->max_size )
+	{
+		this->messages.push_back( ret );
+	}
+
+	pthread_mutex_unlock( &this->mutex );
+	return ret;
+}
+
+MESSAGE_PTR MESSAGE_POOL::create( const MESSAGE_TYPE& _type, vector<string>::const_iterator _first, vector<string>::const_iterator _last )
+{
+	MESSAGE_PTR ret = this->acquire( _type, ( size_t )( _last - _first ) );
+	ret->assign( _type, _first, _last );
+	return ret;
+}
+
+MESSAGE_PTR MESSAGE_POOL::create( const MESSAGE_TYPE& _type, const vector<string>& _parts )
+{
+	return this->create( _type, _parts.cbegin(), _parts.cend() );
+}
+
+MESSAGE_PTR MESSAGE_POOL::create( const MESSAGE_TYPE& _type, const char* _buffer, size_t _length, const TEXT_VIEW* _parts, size_t _part_count )
+{
+	MESSAGE_PTR ret = this->acquire( _type, _part_count );
+	ret->assign( _type, _buffer, _length, _parts, _part_count );
+	return ret;
+}
+
+MESSAGE_PTR MESSAGE_POOL::create_frame( const MESSAGE_TYPE& _type, size_t _part_count )
+{
+	MESSAGE_PTR ret = this->acquire( _type, _part_count );
+	ret->assign_frame( _type );
+	return ret;
+}
+
+MESSAGE_PTR MESSAGE_POOL::create_frame( const MESSAGE_TYPE& _type, size_t _part_count, const char* _buffer, size_t _length )
+{
+	MESSAGE_PTR ret = this->acquire( _type, _part_count );
+	ret->assign_frame( _type, _buffer, _length );
+	return ret;
+}
+
+size_t MESSAGE_POOL::get_size( void )
+{
+	pthread_mutex_lock( &this->mutex );
+	size_t ret = this->messages.size();
+	pthread_mutex_unlock( &this->mutex );
+	return ret;
+}
@@ -26,7 +26,11 @@
 #include "lib/globals.hpp"
 
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <sstream>
 #include <vector>
@@ -38,14 +42,53 @@ using namespace std;
 using namespace BBB_HVAC;
 using namespace BBB_HVAC::MSG_PROC;
 
-unsigned int MESSAGE_PROCESSOR::MAX_SUPPORTED_PROTOCOL = 1;
+unsigned int MESSAGE_PROCESSOR::MAX_SUPPORTED_PROTOCOL = 2;
+
+/*
+ * Indexed by ENUM_MESSAGE_TYPE.  Types that are not listed with any constraints are passed through as they are.
+ * All of the board messages require a board tag as their first part since we can have more than board attached to the system.
+ * Only the bulky status responses go out as binary frames; everything else stays text so that it can be typed into a socket by hand.
+ */
+const MESSAGE_PROCESSOR::MESSAGE_SCHEMA MESSAGE_PROCESSOR::message_schemas[] =
+{
+	{ 0, SIZE_MAX, 0, { }, false },	// INVALID
+	{ 0, 0, 0, { }, false },	// PING
+	{ 0, 0, 0, { }, false },	// PONG
+	{ 2, 2, 2, { ENUM_FIELD_KIND::ANY, ENUM_FIELD_KIND::UINT16 }, false },	// HELLO - VERSION|X
+	{ 1, SIZE_MAX, 0, { }, true },	// READ_STATUS
+	{ 1, SIZE_MAX, 0, { }, true },	// READ_STATUS_RAW_ANALOG
+	{ 2, 2, 2, { ENUM_FIELD_KIND::ANY, ENUM_FIELD_KIND::UINT16 }, false },	// SET_STATUS
+	{ 2, 2, 2, { ENUM_FIELD_KIND::ANY, ENUM_FIELD_KIND::UINT16 }, false },	// SET_PMIC_STATUS
+	{ 2, SIZE_MAX, 0, { }, false },	// GET_LABELS - XX|YY where XX is the type DO, DI, etc and YY is either RESP or REQ
+	{ 0, SIZE_MAX, 0, { }, false },	// SET_POINT
+	{ 2, SIZE_MAX, 2, { ENUM_FIELD_KIND::INT32, ENUM_FIELD_KIND::ANY }, false },	// ERROR
+	{ 0, SIZE_MAX, 0, { }, false },	// GET_L1_CAL_VALS
+	{ 0, SIZE_MAX, 0, { }, false },	// GET_L2_CAL_VALS
+	{ 0, SIZE_MAX, 0, { }, false },	// SET_L1_CAL_VALS
+	{ 0, SIZE_MAX, 0, { }, false },	// SET_L2_CAL_VALS
+	{ 0, SIZE_MAX, 0, { }, false },	// GET_BOOT_COUNT
+	{ 0, SIZE_MAX, 0, { }, true },	// READ_LOGIC_STATUS
+	{ 3, SIZE_MAX, 3, { ENUM_FIELD_KIND::ANY, ENUM_FIELD_KIND::UINT16, ENUM_FIELD_KIND::UINT16 }, false },	// FORCE_AI_VALUE
+	{ 2, SIZE_MAX, 2, { ENUM_FIELD_KIND::ANY, ENUM_FIELD_KIND::UINT16 }, false },	// UNFORCE_AI_VALUE
+	{ 2, 2, 2, { ENUM_FIELD_KIND::ANY, ENUM_FIELD_KIND::DOUBLE }, false },	// SET_SP
+};
+
+static_assert( sizeof( MESSAGE_PROCESSOR::message_schemas ) / sizeof( MESSAGE_PROCESSOR::message_schemas[0] ) == static_cast<size_t>( ENUM_MESSAGE_TYPE::__MSG_END__ ), "Every message type needs a schema." );
 
 MESSAGE_PROCESSOR::MESSAGE_PROCESSOR()
 {
 	INIT_LOGGER( "BBB_HVAC::MESSAGE_PROCESSOR" );
 	this->incomming_message_queue = new MSG_PROC::MESSAGE_QUEUE( GC_INCOMMING_MESSAGE_QUEUE_SIZE );
 	this->outgoing_message_queue = new MSG_PROC::MESSAGE_QUEUE( GC_OUTGOING_MESSAGE_QUEUE_SIZE );
+	this->message_pool = new MESSAGE_POOL( GC_MESSAGE_POOL_SIZE );
 	this->protocol_negotiated = false;
+	this->protocol_version = 1;
+	this->hellos_received = 0;
+	this->max_protocol = MESSAGE_PROCESSOR::MAX_SUPPORTED_PROTOCOL;
+	this->output_queue.reserve( GC_OUTGOING_MESSAGE_QUEUE_SIZE );
+	this->output_head = 0;
+	this->output_offset = 0;
+	this->output_bytes = 0;
 }
 
 MESSAGE_PROCESSOR::~MESSAGE_PROCESSOR()
@@ -54,222 +97,326 @@ MESSAGE_PROCESSOR::~MESSAGE_PROCESSOR()
 	delete this->outgoing_message_queue;
 	this->incomming_message_queue = nullptr;
 	this->outgoing_message_queue = nullptr;
+	this->output_queue.clear();
+	/*
+	 * Queues first; messages handed out to the callers outlive the pool on their own.
+	 */
+	delete this->message_pool;
+	this->message_pool = nullptr;
 	this->protocol_negotiated = false;
 }
 
 void MESSAGE_PROCESSOR::send_message( MESSAGE_PTR& _msg, int _fd )
 {
-	const string& payload = _msg->get_payload();
-	unique_ptr<char[] > buffer( new char[payload.length()] );
-	memset( buffer.get(), 0, payload.length() );
-	strncpy( buffer.get(), payload.data(), payload.length() );
-	ssize_t rc = 0;
-	ssize_t bytes_written = 0;
-	unsigned int attempts = 0;
+	size_t length = _msg->get_payload().length();
 
-	do
+	/*
+	 * A single message larger than the mark still goes out as long as nothing else is waiting.
+	 */
+	if ( this->output_bytes > 0 && this->output_bytes + length > GC_OUTPUT_BUFFER_HIGH_WATER )
 	{
-		rc = write( _fd, buffer.get(),  payload.length() );
+		throw EXCEPTIONS::CONNECTION_ERROR( "Remote is not keeping up.  " + num_to_str( ( unsigned long ) this->output_bytes ) + " bytes are waiting to be written." );
+	}
+
+	if ( this->output_head > 0 )
+	{
+		/*
+		 * Written messages are only left at the front while the buffer is backed up.
+		 */
+		this->output_queue.erase( this->output_queue.begin(), this->output_queue.begin() + this->output_head );
+		this->output_head = 0;
+	}
+
+	this->output_queue.push_back( _msg );
+	this->output_bytes += length;
+
+	_msg->tag_sent();
+	this->outgoing_message_queue->add_message( _msg, ENUM_APPEND_MODE::LOSE_OVERFLOW );
+
+	this->flush_output( _fd );
+	return;
+}
+
+bool MESSAGE_PROCESSOR::flush_output( int _fd )
+{
+	struct iovec iov[GC_OUTPUT_IOV_COUNT];
+	struct msghdr header;
+
+	while ( this->output_bytes > 0 )
+	{
+		size_t count = 0;
+
+		for ( size_t i = this->output_head; i < this->output_queue.size() && count < GC_OUTPUT_IOV_COUNT; i++ )
+		{
+			const string& payload = this->output_queue[i]->get_payload();
+			size_t skip = ( i == this->output_head ? this->output_offset : 0 );
+			iov[count].iov_base = ( void* )( payload.data() + skip );
+			iov[count].iov_len = payload.length() - skip;
+			count += 1;
+		}
+
+		/*
+		 * sendmsg rather than writev so that the write does not block and a closed socket does not raise SIGPIPE, same as the reads in SOCKET_READER.
+		 */
+		memset( &header, 0, sizeof( header ) );
+		header.msg_iov = iov;
+		header.msg_iovlen = count;
+		ssize_t rc = sendmsg( _fd, &header, MSG_DONTWAIT | MSG_NOSIGNAL );
 
 		if ( rc == -1 )
 		{
+			if ( errno == EINTR )
+			{
+				continue;
+			}
+
+			if ( errno == EAGAIN || errno == EWOULDBLOCK )
+			{
+				return false;
+			}
+
 			throw EXCEPTIONS::MESSAGE_ERROR( create_perror_string( "Failed to write to client socket:" ) );
 		}
 
-		bytes_written += rc;
-		attempts += 1;
+		size_t written = ( size_t ) rc;
+		this->output_bytes -= written;
 
-		if ( attempts > GC_WRITE_ATTEMPTS )
+		while ( written > 0 )
 		{
-			if ( ( size_t ) bytes_written != payload.length() )
+			size_t left = this->output_queue[this->output_head]->get_payload().length() - this->output_offset;
+
+			if ( written < left )
 			{
-				throw EXCEPTIONS::MESSAGE_ERROR( "Failed to write complete message after " + num_to_str( GC_WRITE_ATTEMPTS ) + "." );
+				this->output_offset += written;
+				break;
 			}
+
+			written -= left;
+			this->output_queue[this->output_head].reset();
+			this->output_head += 1;
+			this->output_offset = 0;
 		}
 	}
-	while ( ( size_t ) bytes_written < payload.length() );
 
-	_msg->tag_sent();
-	this->outgoing_message_queue->add_message( _msg, ENUM_APPEND_MODE::LOSE_OVERFLOW );
+	this->output_queue.clear();
+	this->output_head = 0;
+	this->output_offset = 0;
+	return true;
+}
+
+MESSAGE_PTR MESSAGE_PROCESSOR::create_message( ENUM_MESSAGE_TYPE _type, const vector<string>& _parts )
+{
+	return this->message_pool->create( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( _type ), _parts );
+}
+
+MESSAGE_PTR MESSAGE_PROCESSOR::create_frame( ENUM_MESSAGE_TYPE _type, size_t _part_count )
+{
+	return this->message_pool->create_frame( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( _type ), _part_count );
+}
+
+bool MESSAGE_PROCESSOR::use_binary( ENUM_MESSAGE_TYPE _type ) const
+{
+	return ( this->protocol_version >= 2 && message_schemas[static_cast<size_t>( _type )].binary );
+}
+
+void MESSAGE_PROCESSOR::set_max_protocol( unsigned int _version )
+{
+	if ( _version < 1 || _version > MESSAGE_PROCESSOR::MAX_SUPPORTED_PROTOCOL )
+	{
+		THROW_EXCEPTION( runtime_error, "Protocol version " + num_to_str( _version ) + " is not supported." );
+	}
+
+	this->max_protocol = _version;
 	return;
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::parse_message( const std::string& _buffer )
 {
-	size_t sep_idx = 0;
-	sep_idx = _buffer.find_first_of( MESSAGE::sep_char );
+	return this->parse_message( _buffer.data(), _buffer.length() );
+}
 
-	if ( sep_idx == string::npos )
+MESSAGE_PTR MESSAGE_PROCESSOR::parse_message( const char* _buffer, size_t _length )
+{
+	if ( _length > 0 && ( unsigned char ) _buffer[0] == BINARY_FRAME::marker )
 	{
-		throw ( EXCEPTIONS::PROTOCOL_ERROR( "Failed to find separator character in message buffer." ) );
+		return this->parse_frame( _buffer, _length );
 	}
 
-	string tstr = _buffer.substr( 0, sep_idx );
-	ssize_t msg_length = -1;
+	const char* sep = ( const char* ) memchr( _buffer, MESSAGE::sep_char, _length );
 
-	try
+	if ( sep == nullptr )
 	{
-		msg_length = stoi( tstr );
+		throw ( EXCEPTIONS::PROTOCOL_ERROR( "Failed to find separator character in message buffer." ) );
 	}
-	catch ( const exception& e )
+
+	TEXT_VIEW prefix( _buffer, ( size_t )( sep - _buffer ) );
+	uint64_t msg_length = 0;
+
+	if ( prefix.to_unsigned( UINT32_MAX, msg_length ) == false )
 	{
-		throw ( EXCEPTIONS::PROTOCOL_ERROR( string( "Failed to convert [" + tstr + "] to a number:" + e.what() ) ) );
+		throw ( EXCEPTIONS::PROTOCOL_ERROR( "Failed to convert [" + prefix.to_string() + "] to a number." ) );
 	}
 
-	if ( msg_length != ( ssize_t )_buffer.length() )
+	if ( msg_length != _length )
 	{
-		throw ( EXCEPTIONS::PROTOCOL_ERROR( string( "Supplied length parameter [" + tstr + "] is not the length of the buffer [" + num_to_str( ( unsigned int ) _buffer.length() ) + "] [" + _buffer + "]" ) ) );
+		throw ( EXCEPTIONS::PROTOCOL_ERROR( "Supplied length parameter [" + prefix.to_string() + "] is not the length of the buffer [" + num_to_str( ( unsigned int ) _length ) + "] [" + string( _buffer, _length ) + "]" ) );
 	}
 
 	/*
 	 *
 	 * Basic integrity checks out of the way.
+	 * Split the rest of the line into views of the buffer.  The last part ends before the trailing new line.  Empty parts are skipped.
 	 *
 	 */
-	vector<string> parts;
-	size_t prev_idx = sep_idx + 1;
-	bool b = false;
+	const char* p = sep + 1;
+	const char* body_end = _buffer + _length - 1;
+	size_t count = 0;
 
-	while ( 1 )
+	while ( p <= body_end )
 	{
-		sep_idx = _buffer.find( MESSAGE::sep_char, prev_idx );
+		const char* next = ( const char* ) memchr( p, MESSAGE::sep_char, ( size_t )( body_end - p ) );
 
-		if ( sep_idx == string::npos )
+		if ( next == nullptr )
 		{
-			sep_idx = _buffer.length() - 1;  //-1 to get rid of trailing new line.
-			b = true;
+			next = body_end;
 		}
 
-		if ( sep_idx - prev_idx > 0 )
+		if ( next > p )
 		{
-			parts.push_back( _buffer.substr( prev_idx, sep_idx - prev_idx ) );
-		}
+			if ( count == this->parse_tokens.size() )
+			{
+				this->parse_tokens.push_back( TEXT_VIEW() );
+			}
 
-		if ( b )
-		{
-			break;
+			this->parse_tokens[count] = TEXT_VIEW( p, ( size_t )( next - p ) );
+			count += 1;
 		}
 
-		prev_idx = sep_idx + 1;
+		p = next + 1;
 	}
 
 	/*
-	 * At this point we're expecting at least one element in the parts vector - the message type.
+	 * At this point we're expecting at least one element - the message type.
 	 */
 
-	if ( parts.size() < 1 )
+	if ( count < 1 )
 	{
 		throw ( EXCEPTIONS::PROTOCOL_ERROR( "Could not parse buffer into a valid message.  No message type specified." ) );
 	}
 
-	const string message_type = parts.front();
-	/*
-	 * We don't count the message type as a part
-	 */
-	parts.erase( parts.begin() );
-	MESSAGE_TYPE mt = MESSAGE_TYPE_MAPPER::get_message_type_by_label( message_type );
+	const TEXT_VIEW& message_type = this->parse_tokens[0];
+	MESSAGE_TYPE mt = MESSAGE_TYPE_MAPPER::get_message_type_by_label( message_type.data, message_type.length );
 
-	if ( mt.get() == nullptr )
+	if ( mt == nullptr )
 	{
-		throw EXCEPTIONS::PROTOCOL_ERROR( "Invalid message type: [" + message_type + "]" );
+		throw EXCEPTIONS::PROTOCOL_ERROR( "Invalid message type: [" + message_type.to_string() + "]" );
 	}
 
-	if ( mt->type == ENUM_MESSAGE_TYPE::HELLO )
-	{
-		/*
-		 * The HELLO message should have two parts - VERSION|X
-		 */
-		if ( parts.size() != 2 )
-		{
-			throw EXCEPTIONS::PROTOCOL_ERROR( "Invalid number of parts for a HELLO message.  Expecting 1, received " + num_to_str( ( unsigned int ) parts.size() ) + "." );
-		}
-	}
-	else if ( mt->type == ENUM_MESSAGE_TYPE::PING || mt->type == ENUM_MESSAGE_TYPE::PONG )
-	{
-		if ( parts.size() != 0 )
-		{
-			throw EXCEPTIONS::PROTOCOL_ERROR( "Invalid number of parts for a PING or PONG message.  Expecting 0, received " + num_to_str( ( unsigned int ) parts.size() ) + "." );
-		}
-	}
-	else if ( mt->type == ENUM_MESSAGE_TYPE::GET_LABELS )
-	{
-		/*
-		 * The GET_LABELS message should have at least two parts - XX|YY where XX is the type DO, DI, etc and YY is either RESP or REQ
-		 */
-		if ( parts.size() < 2 )
-		{
-			THROW_EXCEPTION( EXCEPTIONS::PROTOCOL_ERROR, "Invalid number of parts for a GET_LABEL messages.  Expecting >=2, received < 2" );
-		}
-	}
 	/*
-	All of the messages bellow require a board tag since we can have more than board attached to the system
-	*/
-	else if ( mt->type == ENUM_MESSAGE_TYPE::SET_STATUS )
-	{
-		if ( parts.size() != 2 )
-		{
-			THROW_EXCEPTION( EXCEPTIONS::PROTOCOL_ERROR, "Invalid number of parts for a SET_STATUS message.  Expecting 2, received: " + num_to_str( ( unsigned int ) parts.size() ) + "." );
-		}
-	}
-	else if ( mt->type == ENUM_MESSAGE_TYPE::SET_PMIC_STATUS )
+	 * We don't count the message type as a part
+	 */
+	MESSAGE_PROCESSOR::check_schema( mt, this->parse_tokens.data() + 1, count - 1 );
+
+	MESSAGE_PTR ret = this->message_pool->create( mt, _buffer, _length, this->parse_tokens.data() + 1, count - 1 );
+	ret->tag_received();
+	this->incomming_message_queue->add_message( ret, ENUM_APPEND_MODE::LOSE_OVERFLOW );
+	return ret;
+}
+
+MESSAGE_PTR MESSAGE_PROCESSOR::parse_frame( const char* _buffer, size_t _length )
+{
+	if ( this->protocol_version < 2 )
 	{
-		if ( parts.size() != 2 )
-		{
-			THROW_EXCEPTION( EXCEPTIONS::PROTOCOL_ERROR, "Invalid number of parts for a SET_PMIC_STATUS message.  Expecting 2, received: " + num_to_str( ( unsigned int ) parts.size() ) + "." );
-		}
+		THROW_EXCEPTION( EXCEPTIONS::PROTOCOL_ERROR, "Received a binary frame before protocol version 2 was negotiated." );
 	}
-	else if ( mt->type == ENUM_MESSAGE_TYPE::READ_STATUS )
+
+	if ( _length < BINARY_FRAME::header_size || BINARY_FRAME::get_u32( _buffer + BINARY_FRAME::length_offset ) != _length )
 	{
-		if ( parts.size() < 1 )
-		{
-			THROW_EXCEPTION( EXCEPTIONS::PROTOCOL_ERROR, "Invalid number of parts for a READ_STATUS message.  Expecting >1, received: " + num_to_str( ( unsigned int ) parts.size() ) + "." );
-		}
+		THROW_EXCEPTION( EXCEPTIONS::PROTOCOL_ERROR, "Binary frame length does not match the length of the buffer [" + num_to_str( ( unsigned int ) _length ) + "]." );
 	}
-	else if ( mt->type == ENUM_MESSAGE_TYPE::READ_STATUS_RAW_ANALOG )
+
+	size_t type = ( unsigned char ) _buffer[BINARY_FRAME::type_offset];
+
+	if ( type == 0 || type >= static_cast<size_t>( ENUM_MESSAGE_TYPE::__MSG_END__ ) || message_schemas[type].binary == false )
 	{
-		if ( parts.size() < 1 )
-		{
-			THROW_EXCEPTION( EXCEPTIONS::PROTOCOL_ERROR, "Invalid number of parts for a READ_STATUS_RAW_ANALOG message.  Expecting >1, received: " + num_to_str( ( unsigned int ) parts.size() ) + "." );
-		}
+		THROW_EXCEPTION( EXCEPTIONS::PROTOCOL_ERROR, "Message type " + num_to_str( ( unsigned int ) type ) + " can not be sent as a binary frame." );
 	}
-	else if ( mt->type == ENUM_MESSAGE_TYPE::ERROR )
+
+	MESSAGE_TYPE mt = MESSAGE_TYPE_MAPPER::get_message_type_by_enum( static_cast<ENUM_MESSAGE_TYPE>( type ) );
+	size_t part_count = BINARY_FRAME::get_u16( _buffer + BINARY_FRAME::part_count_offset );
+	MESSAGE_PROCESSOR::check_part_count( mt, part_count );
+
+	MESSAGE_PTR ret = this->message_pool->create_frame( mt, part_count, _buffer, _length );
+	ret->tag_received();
+	this->incomming_message_queue->add_message( ret, ENUM_APPEND_MODE::LOSE_OVERFLOW );
+	return ret;
+}
+
+void MESSAGE_PROCESSOR::check_part_count( const MESSAGE_TYPE& _type, size_t _part_count )
+{
+	const MESSAGE_SCHEMA& schema = message_schemas[static_cast<size_t>( _type->type )];
+
+	if ( _part_count < schema.min_parts || _part_count > schema.max_parts )
 	{
-		if ( parts.size() < 2 )
+		string expected = num_to_str( ( unsigned int ) schema.min_parts );
+
+		if ( schema.max_parts == SIZE_MAX )
 		{
-			THROW_EXCEPTION( EXCEPTIONS::PROTOCOL_ERROR, "Invalid number of parts for an ERROR message.  Expecting >2, received: " + num_to_str( ( unsigned int ) parts.size() ) + "." );
+			expected = ">=" + expected;
 		}
-	}
-	else if ( mt->type == ENUM_MESSAGE_TYPE::FORCE_AI_VALUE )
-	{
-		if ( parts.size() < 3 )
+		else if ( schema.max_parts != schema.min_parts )
 		{
-			THROW_EXCEPTION( EXCEPTIONS::PROTOCOL_ERROR, "Invalid number of parts for an FORCE_IN_VALUE message.  Expecting >3, received: " + num_to_str( ( unsigned int ) parts.size() ) + "." );
+			expected += ".." + num_to_str( ( unsigned int ) schema.max_parts );
 		}
+
+		THROW_EXCEPTION( EXCEPTIONS::PROTOCOL_ERROR, "Invalid number of parts for a " + _type->label + " message.  Expecting " + expected + ", received: " + num_to_str( ( unsigned int ) _part_count ) + "." );
 	}
-	else if ( mt->type == ENUM_MESSAGE_TYPE::UNFORCE_AI_VALUE )
+
+	return;
+}
+
+void MESSAGE_PROCESSOR::check_schema( const MESSAGE_TYPE& _type, const TEXT_VIEW* _parts, size_t _part_count )
+{
+	const MESSAGE_SCHEMA& schema = message_schemas[static_cast<size_t>( _type->type )];
+	MESSAGE_PROCESSOR::check_part_count( _type, _part_count );
+
+	for ( size_t i = 0; i < schema.field_count && i < _part_count; i++ )
 	{
-		if ( parts.size() < 2 )
+		bool valid = true;
+		uint64_t u;
+		int64_t si;
+		double d;
+
+		switch ( schema.fields[i] )
 		{
-			THROW_EXCEPTION( EXCEPTIONS::PROTOCOL_ERROR, "Invalid number of parts for an UNFORCE_IN_VALUE message.  Expecting >2, received: " + num_to_str( ( unsigned int ) parts.size() ) + "." );
+			case ENUM_FIELD_KIND::ANY:
+				break;
+
+			case ENUM_FIELD_KIND::UINT16:
+				valid = _parts[i].to_unsigned( UINT16_MAX, u );
+				break;
+
+			case ENUM_FIELD_KIND::INT32:
+				valid = _parts[i].to_signed( INT32_MIN, INT32_MAX, si );
+				break;
+
+			case ENUM_FIELD_KIND::DOUBLE:
+				valid = _parts[i].to_double( d );
+				break;
 		}
-	}
-	else if ( mt->type == ENUM_MESSAGE_TYPE::SET_SP )
-	{
-		if ( parts.size() != 2 )
+
+		if ( valid == false )
 		{
-			THROW_EXCEPTION( EXCEPTIONS::PROTOCOL_ERROR, "Invalid number of parts for a SET_TP message.  Expecting 2, received: " + num_to_str( ( unsigned int ) parts.size() ) + "." );
+			THROW_EXCEPTION( EXCEPTIONS::PROTOCOL_ERROR, "Invalid value [" + _parts[i].to_string() + "] of part " + num_to_str( ( unsigned int ) i ) + " of a " + _type->label + " message." );
 		}
 	}
 
-	MESSAGE_PTR ret( new MESSAGE( mt, parts ) );
-	ret->tag_received();
-	this->incomming_message_queue->add_message( ret, ENUM_APPEND_MODE::LOSE_OVERFLOW );
-	return ret;
+	return;
 }
 
-void MESSAGE_PROCESSOR::process_hello_message( void )
+bool MESSAGE_PROCESSOR::process_hello_message( void )
 {
-	if ( this->incomming_message_queue->get_message_count() > 1 )
+	if ( this->hellos_received == 0 && this->incomming_message_queue->get_message_count() > 1 )
 	{
 		/*
 		 * The hello message is expected to be the first  message received.
@@ -277,7 +424,7 @@ void MESSAGE_PROCESSOR::process_hello_message( void )
 		throw EXCEPTIONS::PROTOCOL_ERROR( "Protocol sequence error.  Expecting HELLO message to be the first message received." );
 	}
 
-	MESSAGE_PTR msg = this->incomming_message_queue->get_message( 0 );
+	MESSAGE_PTR msg = this->get_latest_incomming_of_type( ENUM_MESSAGE_TYPE::HELLO );
 	unsigned int requested_protocol;
 
 	try
@@ -289,13 +436,34 @@ void MESSAGE_PROCESSOR::process_hello_message( void )
 		throw EXCEPTIONS::PROTOCOL_ERROR( "Failed to get message part: " + string( e.what() ) );
 	}
 
-	if ( requested_protocol > MESSAGE_PROCESSOR::MAX_SUPPORTED_PROTOCOL )
+	if ( requested_protocol < 1 )
 	{
-		throw EXCEPTIONS::PROTOCOL_ERROR( "Protocol error.  Requested protocol version is higher than what we support.  Requested: " + num_to_str( requested_protocol ) + ".  We support: " + num_to_str( MESSAGE_PROCESSOR::MAX_SUPPORTED_PROTOCOL ) + "." );
+		throw EXCEPTIONS::PROTOCOL_ERROR( "Protocol error.  Requested protocol version " + num_to_str( requested_protocol ) + " is not valid." );
 	}
 
-	this->protocol_negotiated = true;
-	return;
+	this->hellos_received += 1;
+
+	if ( this->hellos_received == 1 )
+	{
+		/*
+		 * A remote that offers more than we do gets talked down to our version.  If we settle on more than 1 the remote has to be told, since it
+		 * may be a server that opened with 1 for the sake of v1 clients.
+		 */
+		this->protocol_version = std::min( requested_protocol, this->max_protocol );
+		this->protocol_negotiated = true;
+		return ( this->protocol_version > 1 );
+	}
+
+	/*
+	 * The only HELLO that may follow is the answer of a server that opened with 1 to our offer.  It carries the version the server settled on.
+	 */
+	if ( this->hellos_received > 2 || this->protocol_version != 1 || requested_protocol > this->max_protocol )
+	{
+		throw EXCEPTIONS::PROTOCOL_ERROR( "Protocol sequence error.  Unexpected HELLO message for version " + num_to_str( requested_protocol ) + "." );
+	}
+
+	this->protocol_version = requested_protocol;
+	return false;
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::create_get_labels_message_response( ENUM_CONFIG_TYPES _type )
@@ -342,7 +510,7 @@ MESSAGE_PTR MESSAGE_PROCESSOR::create_get_labels_message_response( ENUM_CONFIG_T
 		parts.push_back( *i );
 	}
 
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::GET_LABELS ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::GET_LABELS, parts );
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::create_get_labels_message_request( ENUM_CONFIG_TYPES _type )
@@ -350,7 +518,7 @@ MESSAGE_PTR MESSAGE_PROCESSOR::create_get_labels_message_request( ENUM_CONFIG_TY
 	vector<string> parts;
 	parts.push_back( CONFIG_ENTRY::type_to_string( _type ) );
 	parts.push_back( "REQ" );
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::GET_LABELS ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::GET_LABELS, parts );
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::create_set_pmic_status( const std::string& _board_tag, uint8_t _status )
@@ -358,7 +526,7 @@ MESSAGE_PTR MESSAGE_PROCESSOR::create_set_pmic_status( const std::string& _board
 	vector<string> parts;
 	parts.push_back( _board_tag );
 	parts.push_back( num_to_str( _status ) );
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::SET_PMIC_STATUS ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::SET_PMIC_STATUS, parts );
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::create_set_status( const std::string& _board_tag, uint8_t _status )
@@ -366,62 +534,71 @@ MESSAGE_PTR MESSAGE_PROCESSOR::create_set_status( const std::string& _board_tag,
 	vector<string> parts;
 	parts.push_back( _board_tag );
 	parts.push_back( num_to_str( _status ) );
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::SET_STATUS ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::SET_STATUS, parts );
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::create_get_raw_adc_values( const std::string& _board_tag )
 {
 	vector<string> parts;
 	parts.push_back( _board_tag );
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::READ_STATUS_RAW_ANALOG ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::READ_STATUS_RAW_ANALOG, parts );
+}
+
+MESSAGE_PTR MESSAGE_PROCESSOR::create_get_raw_adc_history( const std::string& _board_tag, unsigned long _window_ms, unsigned long _decimation )
+{
+	vector<string> parts;
+	parts.push_back( _board_tag );
+	parts.push_back( num_to_str( _window_ms ) );
+	parts.push_back( num_to_str( _decimation ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::READ_STATUS_RAW_ANALOG, parts );
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::create_get_status( const std::string& _board_tag )
 {
 	vector<string> parts;
 	parts.push_back( _board_tag );
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::READ_STATUS ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::READ_STATUS, parts );
 }
 
-MESSAGE_PTR MESSAGE_PROCESSOR::create_hello_message( void )
+MESSAGE_PTR MESSAGE_PROCESSOR::create_hello_message( unsigned int _version )
 {
 	vector<string> parts;
 	parts.push_back( "VERSION" );
-	parts.push_back( num_to_str( MESSAGE_PROCESSOR::MAX_SUPPORTED_PROTOCOL ) );
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::HELLO ), parts ) );
+	parts.push_back( num_to_str( _version ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::HELLO, parts );
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::create_ping_message( void )
 {
 	vector<string> parts;
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::PING ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::PING, parts );
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::create_pong_message( void )
 {
 	vector<string> parts;
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::PONG ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::PONG, parts );
 }
 MESSAGE_PTR MESSAGE_PROCESSOR::create_error( int _code, const std::string& _message )
 {
 	vector<string> parts;
 	parts.push_back( num_to_str( _code ) );
 	parts.push_back( _message );
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::ERROR ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::ERROR, parts );
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::create_get_l1_cal_vals( const std::string& _board_tag )
 {
 	vector<string> parts;
 	parts.push_back( _board_tag );
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::GET_L1_CAL_VALS ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::GET_L1_CAL_VALS, parts );
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::create_get_l2_cal_vals( const std::string& _board_tag )
 {
 	vector<string> parts;
 	parts.push_back( _board_tag );
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::GET_L2_CAL_VALS ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::GET_L2_CAL_VALS, parts );
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::create_set_l1_cal_vals( const std::string& _board_tag, const CAL_VALUE_ARRAY& _vals )
@@ -434,7 +611,7 @@ MESSAGE_PTR MESSAGE_PROCESSOR::create_set_l1_cal_vals( const std::string& _board
 	vector<string> parts;
 	parts.push_back( _board_tag );
 	convert_vector_to_string( _vals, parts );
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::SET_L1_CAL_VALS ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::SET_L1_CAL_VALS, parts );
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::create_set_sp( const std::string& _sp_name, double _value )
@@ -444,7 +621,7 @@ MESSAGE_PTR MESSAGE_PROCESSOR::create_set_sp( const std::string& _sp_name, doubl
 	parts.push_back( _sp_name );
 	parts.push_back( num_to_str( _value ) );
 
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::SET_SP ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::SET_SP, parts );
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::create_set_l2_cal_vals( const std::string& _board_tag, const CAL_VALUE_ARRAY& _vals )
@@ -457,14 +634,14 @@ MESSAGE_PTR MESSAGE_PROCESSOR::create_set_l2_cal_vals( const std::string& _board
 	vector<string> parts;
 	parts.push_back( _board_tag );
 	convert_vector_to_string( _vals, parts );
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::SET_L2_CAL_VALS ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::SET_L2_CAL_VALS, parts );
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::create_get_boot_count( const std::string& _board_tag )
 {
 	vector<string> parts;
 	parts.push_back( _board_tag );
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::GET_BOOT_COUNT ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::GET_BOOT_COUNT, parts );
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::create_force_ai( const std::string& _board_tag, uint8_t _input, uint16_t _value )
@@ -473,14 +650,14 @@ MESSAGE_PTR MESSAGE_PROCESSOR::create_force_ai( const std::string& _board_tag, u
 	parts.push_back( _board_tag );
 	parts.push_back( num_to_str( _input ) );
 	parts.push_back( num_to_str( _value ) );
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::FORCE_AI_VALUE ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::FORCE_AI_VALUE, parts );
 }
 MESSAGE_PTR MESSAGE_PROCESSOR::create_unforce_ai( const std::string& _board_tag, uint8_t _input )
 {
 	vector<string> parts;
 	parts.push_back( _board_tag );
 	parts.push_back( num_to_str( _input ) );
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::UNFORCE_AI_VALUE ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::UNFORCE_AI_VALUE, parts );
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::get_latest_outgoing_ping( void )
@@ -499,7 +676,7 @@ MESSAGE_PTR MESSAGE_PROCESSOR::get_latest_outgoing_ping( void )
 MESSAGE_PTR MESSAGE_PROCESSOR::create_read_logic_status( void )
 {
 	vector<string> parts;
-	return MESSAGE_PTR( new MESSAGE( MESSAGE_TYPE_MAPPER::get_message_type_by_enum( ENUM_MESSAGE_TYPE::READ_LOGIC_STATUS ), parts ) );
+	return this->create_message( ENUM_MESSAGE_TYPE::READ_LOGIC_STATUS, parts );
 }
 
 MESSAGE_PTR MESSAGE_PROCESSOR::get_latest_incomming_of_type( ENUM_MESSAGE_TYPE _type )
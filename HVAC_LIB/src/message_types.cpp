@@ -21,6 +21,8 @@
 #include "lib/message_types.hpp"
 
 #include <string>
+#include <stdexcept>
+#include <string.h>
 
 static std::string __message_type_list[] = { "INVALID", \
 											 "PING", \
@@ -44,6 +46,9 @@ static std::string __message_type_list[] = { "INVALID", \
 											 "SET_SP" \
 										   };
 
+static_assert( sizeof( __message_type_list ) / sizeof( __message_type_list[0] ) == static_cast<size_t>( BBB_HVAC::ENUM_MESSAGE_TYPE::__MSG_END__ ), "Every message type needs a label." );
+static_assert( MESSAGE_TYPE_HASH_SLOTS >= static_cast<size_t>( BBB_HVAC::ENUM_MESSAGE_TYPE::__MSG_END__ ) * 2, "Too few message type hash slots." );
+
 using namespace BBB_HVAC;
 
 __MESSAGE_TYPE::__MESSAGE_TYPE( ENUM_MESSAGE_TYPE _type, const std::string& _label )
@@ -55,30 +60,101 @@ __MESSAGE_TYPE::__MESSAGE_TYPE( ENUM_MESSAGE_TYPE _type, const std::string& _lab
 
 __MESSAGE_TYPES_INT::__MESSAGE_TYPES_INT()
 {
+	this->types.reserve( static_cast<size_t>( ENUM_MESSAGE_TYPE::__MSG_END__ ) );
+
 	for ( unsigned int i = 0; i != static_cast<unsigned int>( ENUM_MESSAGE_TYPE::__MSG_END__ ); i++ )
 	{
-		MESSAGE_TYPE mt( new __MESSAGE_TYPE( static_cast<ENUM_MESSAGE_TYPE>( i ), __message_type_list[i] ) );
-		this->enum_to_type[static_cast<ENUM_MESSAGE_TYPE> ( i )] = mt;
-		this->label_to_type[mt->label] = mt;
+		this->types.push_back( __MESSAGE_TYPE( static_cast<ENUM_MESSAGE_TYPE>( i ), __message_type_list[i] ) );
 	}
 
-	return;
+	/*
+	 * Look for a seed that puts every label in a slot of its own.  A lookup is then a single hash, a single slot, and a single compare.
+	 * The table is never written to again, so any number of threads can read it without locking.
+	 */
+	for ( this->hash_seed = 0; this->hash_seed < MESSAGE_TYPE_HASH_MAX_SEED; this->hash_seed++ )
+	{
+		bool collision = false;
+
+		memset( this->hash_slots, 0, sizeof( this->hash_slots ) );
+
+		for ( auto i = this->types.cbegin(); i != this->types.cend(); ++i )
+		{
+			MESSAGE_TYPE& slot = this->hash_slots[hash_label( this->hash_seed, i->label.data(), i->label.length() ) % MESSAGE_TYPE_HASH_SLOTS];
+
+			if ( slot != nullptr )
+			{
+				collision = true;
+				break;
+			}
+
+			slot = & ( *i );
+		}
+
+		if ( collision == false )
+		{
+			return;
+		}
+	}
+
+	throw std::logic_error( "Failed to find a perfect hash for the message type labels.  Increase MESSAGE_TYPE_HASH_SLOTS." );
+}
+
+uint32_t __MESSAGE_TYPES_INT::hash_label( uint32_t _seed, const char* _label, size_t _length )
+{
+	/*
+	 * FNV-1a with the seed mixed into the offset basis.  The low bits of FNV only depend on the low bits of the input, so the high bits are folded
+	 * into them at the end; the table is indexed by the low bits.
+	 */
+	uint32_t ret = 2166136261u ^ ( _seed * 16777619u );
+
+	for ( size_t i = 0; i < _length; i++ )
+	{
+		ret ^= ( unsigned char ) _label[i];
+		ret *= 16777619u;
+	}
+
+	ret ^= ret >> 16;
+	ret *= 0x85ebca6bu;
+	ret ^= ret >> 13;
+	return ret;
 }
 
 __MESSAGE_TYPES_INT MESSAGE_TYPE_MAPPER::__internal_mapper;
 
 size_t MESSAGE_TYPE_MAPPER::get_message_type_count( void )
 {
-	return __internal_mapper.enum_to_type.size();
+	return __internal_mapper.types.size();
 }
 
 MESSAGE_TYPE MESSAGE_TYPE_MAPPER::get_message_type_by_label( const std::string& _label )
 {
-	return __internal_mapper.label_to_type[_label];
+	return MESSAGE_TYPE_MAPPER::get_message_type_by_label( _label.data(), _label.length() );
+}
+
+MESSAGE_TYPE MESSAGE_TYPE_MAPPER::get_message_type_by_label( const char* _label, size_t _length )
+{
+	MESSAGE_TYPE ret = __internal_mapper.hash_slots[__MESSAGE_TYPES_INT::hash_label( __internal_mapper.hash_seed, _label, _length ) % MESSAGE_TYPE_HASH_SLOTS];
+
+	/*
+	 * The slot only tells us which label it could be.
+	 */
+	if ( ret == nullptr || ret->label.length() != _length || memcmp( ret->label.data(), _label, _length ) != 0 )
+	{
+		return nullptr;
+	}
+
+	return ret;
 }
 MESSAGE_TYPE MESSAGE_TYPE_MAPPER::get_message_type_by_enum( const ENUM_MESSAGE_TYPE& _enum )
 {
-	return __internal_mapper.enum_to_type[_enum];
+	size_t idx = static_cast<size_t>( _enum );
+
+	if ( idx >= __internal_mapper.types.size() )
+	{
+		return nullptr;
+	}
+
+	return & ( __internal_mapper.types[idx] );
 }
 
 void MESSAGE_TYPE_MAPPER::dump_supported_messages( std::ostream& out )
@@ -0,0 +1,375 @@
+/*
+* This file is part of the software stack for Vic's IO board and its
+* associated projects.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Affero General Public License for more details.
+*
+* You should have received a copy of the GNU Affero General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+* Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+*/
+
+
+#include "lib/serial_capture.hpp"
+#include "lib/string_lib.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+namespace BBB_HVAC
+{
+	namespace IOCOMM
+	{
+		/**
+		 * Writes the whole buffer, retrying short writes.
+		 */
+		static bool write_fully( int _fd, const unsigned char* _data, size_t _length )
+		{
+			while ( _length > 0 )
+			{
+				ssize_t rc = write( _fd, _data, _length );
+
+				if ( rc < 0 )
+				{
+					if ( errno == EINTR )
+					{
+						continue;
+					}
+
+					return false;
+				}
+
+				_data += rc;
+				_length -= ( size_t ) rc;
+			}
+
+			return true;
+		}
+
+		void* serial_capture_shim_func( void* _parm )
+		{
+			( ( SERIAL_CAPTURE* ) _parm )->flusher_thread_func();
+			return nullptr;
+		}
+
+		/************************************************************************
+		 *
+		 * SERIAL_CAPTURE
+		 *
+		 ************************************************************************/
+
+		SERIAL_CAPTURE::SERIAL_CAPTURE( const string& _tag ) : TPROTECT_BASE( _tag )
+		{
+			INIT_LOGGER( "BBB_HVAC::IOCOMM::SERIAL_CAPTURE[" + _tag + "]" );
+			this->fd = -1;
+			this->fill_buffer = new unsigned char[GC_SERIAL_CAPTURE_BUFFER_SIZE];
+			this->fill_length = 0;
+			this->flush_buffer = new unsigned char[GC_SERIAL_CAPTURE_BUFFER_SIZE];
+			this->stop_flag = false;
+			this->running = false;
+			this->stat_records = 0;
+			this->stat_bytes_written = 0;
+			this->stat_records_dropped = 0;
+			return;
+		}
+
+		SERIAL_CAPTURE::~SERIAL_CAPTURE()
+		{
+			this->stop();
+			delete[] this->fill_buffer;
+			delete[] this->flush_buffer;
+			return;
+		}
+
+		bool SERIAL_CAPTURE::start( const string& _file )
+		{
+			struct stat st;
+
+			if ( this->running )
+			{
+				LOG_ERROR( "Capture is already running." );
+				return false;
+			}
+
+			if ( ( this->fd = ::open( _file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 ) ) < 0 )
+			{
+				LOG_ERROR( create_perror_string( "Failed to open capture file " + _file ) );
+				return false;
+			}
+
+			if ( fstat( this->fd, &st ) != 0 || ( st.st_size == 0 && !write_fully( this->fd, ( const unsigned char* ) SERIAL_CAPTURE_MAGIC, SERIAL_CAPTURE_MAGIC_SIZE ) ) )
+			{
+				LOG_ERROR( create_perror_string( "Failed to initialize capture file " + _file ) );
+				::close( this->fd );
+				this->fd = -1;
+				return false;
+			}
+
+			this->stop_flag = false;
+
+			if ( pthread_create( &this->flusher_thread, nullptr, serial_capture_shim_func, this ) != 0 )
+			{
+				LOG_ERROR( create_perror_string( "Failed to start capture flusher thread" ) );
+				::close( this->fd );
+				this->fd = -1;
+				return false;
+			}
+
+			this->running = true;
+			LOG_INFO( "Capturing serial traffic to " + _file );
+			return true;
+		}
+
+		void SERIAL_CAPTURE::stop( void )
+		{
+			if ( !this->running )
+			{
+				return;
+			}
+
+			this->stop_flag = true;
+			pthread_join( this->flusher_thread, nullptr );
+			this->running = false;
+
+			pthread_mutex_lock( &this->mutex );
+			::close( this->fd );
+			this->fd = -1;
+			pthread_mutex_unlock( &this->mutex );
+			return;
+		}
+
+		void SERIAL_CAPTURE::record( ENUM_CAPTURE_DIRECTION _direction, const unsigned char* _data, size_t _length )
+		{
+			uint64_t now = monotonic_usec();
+
+			/*
+			 * The critical section is a copy.  A plain blocking lock is cheaper here than the retrying lock of the base class.
+			 */
+			pthread_mutex_lock( &this->mutex );
+
+			do
+			{
+				size_t chunk = std::min( _length, ( size_t ) UINT16_MAX );
+				unsigned char* head = this->fill_buffer + this->fill_length;
+
+				this->stat_records += 1;
+
+				if ( this->fd < 0 || this->fill_length + SERIAL_CAPTURE_RECORD_HEAD_SIZE + chunk > GC_SERIAL_CAPTURE_BUFFER_SIZE )
+				{
+					this->stat_records_dropped += 1;
+				}
+				else
+				{
+					for ( size_t i = 0; i < 8; i++ )
+					{
+						head[i] = ( unsigned char )( ( now >> ( i * 8 ) ) & 0xFF );
+					}
+
+					head[8] = ( unsigned char )( chunk & 0xFF );
+					head[9] = ( unsigned char )( ( chunk >> 8 ) & 0xFF );
+					head[10] = ( unsigned char ) _direction;
+					head[11] = 0;
+					memcpy( head + SERIAL_CAPTURE_RECORD_HEAD_SIZE, _data, chunk );
+					this->fill_length += SERIAL_CAPTURE_RECORD_HEAD_SIZE + chunk;
+				}
+
+				_data += chunk;
+				_length -= chunk;
+			}
+			while ( _length > 0 );
+
+			pthread_mutex_unlock( &this->mutex );
+			return;
+		}
+
+		bool SERIAL_CAPTURE::flush( void )
+		{
+			size_t length;
+
+			pthread_mutex_lock( &this->mutex );
+			std::swap( this->fill_buffer, this->flush_buffer );
+			length = this->fill_length;
+			this->fill_length = 0;
+			pthread_mutex_unlock( &this->mutex );
+
+			if ( length == 0 )
+			{
+				return true;
+			}
+
+			if ( !write_fully( this->fd, this->flush_buffer, length ) )
+			{
+				LOG_ERROR( create_perror_string( "Failed to write capture file" ) );
+				return false;
+			}
+
+			this->stat_bytes_written += length;
+			return true;
+		}
+
+		void SERIAL_CAPTURE::flusher_thread_func( void )
+		{
+			timespec ts;
+
+			while ( !this->stop_flag )
+			{
+				ts.tv_sec = GC_SERIAL_CAPTURE_FLUSH_INTERVAL / 1000000;
+				ts.tv_nsec = ( GC_SERIAL_CAPTURE_FLUSH_INTERVAL % 1000000 ) * 1000;
+				this->nsleep( &ts );
+
+				if ( !this->flush() )
+				{
+					/*
+					 * Keep draining the buffer so that the IO threads are not affected.  The lost data shows up in the stats.
+					 */
+					this->stat_records_dropped += 1;
+				}
+			}
+
+			this->flush();
+			return;
+		}
+
+		void SERIAL_CAPTURE::get_stats( SERIAL_CAPTURE_STATS& _dest ) const
+		{
+			_dest.records = this->stat_records;
+			_dest.bytes_written = this->stat_bytes_written;
+			_dest.records_dropped = this->stat_records_dropped;
+			return;
+		}
+
+		/************************************************************************
+		 *
+		 * SERIAL_CAPTURE_READER
+		 *
+		 ************************************************************************/
+
+		SERIAL_CAPTURE_READER::SERIAL_CAPTURE_READER()
+		{
+			INIT_LOGGER( "BBB_HVAC::IOCOMM::SERIAL_CAPTURE_READER" );
+			this->map = nullptr;
+			this->map_length = 0;
+			this->offset = 0;
+			return;
+		}
+
+		SERIAL_CAPTURE_READER::~SERIAL_CAPTURE_READER()
+		{
+			this->close();
+			return;
+		}
+
+		bool SERIAL_CAPTURE_READER::open( const string& _file )
+		{
+			struct stat st;
+			int fd;
+			void* map_ptr;
+
+			this->close();
+
+			if ( ( fd = ::open( _file.c_str(), O_RDONLY | O_CLOEXEC ) ) < 0 )
+			{
+				LOG_ERROR( create_perror_string( "Failed to open capture file " + _file ) );
+				return false;
+			}
+
+			if ( fstat( fd, &st ) != 0 || ( size_t ) st.st_size < SERIAL_CAPTURE_MAGIC_SIZE )
+			{
+				LOG_ERROR( "Not a capture file: " + _file );
+				::close( fd );
+				return false;
+			}
+
+			map_ptr = mmap( nullptr, ( size_t ) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+			::close( fd );
+
+			if ( map_ptr == MAP_FAILED )
+			{
+				LOG_ERROR( create_perror_string( "Failed to map capture file " + _file ) );
+				return false;
+			}
+
+			/*
+			 * The capture is read front to back exactly once per pass.
+			 */
+			madvise( map_ptr, ( size_t ) st.st_size, MADV_SEQUENTIAL );
+
+			this->map = ( const unsigned char* ) map_ptr;
+			this->map_length = ( size_t ) st.st_size;
+
+			if ( memcmp( this->map, SERIAL_CAPTURE_MAGIC, SERIAL_CAPTURE_MAGIC_SIZE ) != 0 )
+			{
+				LOG_ERROR( "Not a capture file: " + _file );
+				this->close();
+				return false;
+			}
+
+			this->rewind();
+			return true;
+		}
+
+		void SERIAL_CAPTURE_READER::close( void )
+		{
+			if ( this->map != nullptr )
+			{
+				munmap( ( void* ) this->map, this->map_length );
+				this->map = nullptr;
+				this->map_length = 0;
+			}
+
+			return;
+		}
+
+		void SERIAL_CAPTURE_READER::rewind( void )
+		{
+			this->offset = SERIAL_CAPTURE_MAGIC_SIZE;
+			return;
+		}
+
+		bool SERIAL_CAPTURE_READER::next( ST_CAPTURE_RECORD& _dest )
+		{
+			if ( this->map == nullptr || this->map_length - this->offset < SERIAL_CAPTURE_RECORD_HEAD_SIZE )
+			{
+				return false;
+			}
+
+			const unsigned char* head = this->map + this->offset;
+			size_t length = ( size_t )( head[8] | ( head[9] << 8 ) );
+
+			if ( this->map_length - this->offset - SERIAL_CAPTURE_RECORD_HEAD_SIZE < length )
+			{
+				return false;
+			}
+
+			_dest.time_usec = 0;
+
+			for ( size_t i = 0; i < 8; i++ )
+			{
+				_dest.time_usec |= ( ( uint64_t ) head[i] ) << ( i * 8 );
+			}
+
+			_dest.direction = static_cast<ENUM_CAPTURE_DIRECTION>( head[10] );
+			_dest.data = head + SERIAL_CAPTURE_RECORD_HEAD_SIZE;
+			_dest.length = length;
+			this->offset += SERIAL_CAPTURE_RECORD_HEAD_SIZE + length;
+			return true;
+		}
+	}
+}
@@ -22,8 +22,15 @@
 #include <stdlib.h>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
+
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
 #include "lib/serial_io_types.hpp"
+#include "lib/checksum.hpp"
 #include "lib/logger.hpp"
 #include "lib/memory_management.hpp"
 
@@ -40,127 +47,178 @@ namespace BBB_HVAC
 		 *
 		 ************************************************************************/
 
-		OUTGOING_MESSAGE_QUEUE::OUTGOING_MESSAGE_QUEUE( const std::string& _tag ) : TPROTECT_BASE( _tag )
+		static_assert( ( GC_SERIAL_OUTGOING_QUEUE_SIZE & ( GC_SERIAL_OUTGOING_QUEUE_SIZE - 1 ) ) == 0, "GC_SERIAL_OUTGOING_QUEUE_SIZE must be a power of two." );
+
+		OUTGOING_MESSAGE_QUEUE::OUTGOING_MESSAGE_QUEUE( const std::string& _tag )
 		{
+			this->tag = _tag;
 			INIT_LOGGER( "BBB_HVAC::IOCOMM::OUTGOING_MESSAGE_QUEUE[" + this->tag + "]" );
 
-			if ( pthread_cond_init( &this->conditional, nullptr ) != 0 )
+			this->slots = new SLOT[GC_SERIAL_OUTGOING_QUEUE_SIZE];
+
+			for ( size_t i = 0; i < GC_SERIAL_OUTGOING_QUEUE_SIZE; i++ )
+			{
+				this->slots[i].sequence.store( i, std::memory_order_relaxed );
+			}
+
+			this->enqueue_pos.store( 0, std::memory_order_relaxed );
+			this->dequeue_pos = 0;
+			this->discard_pos.store( 0, std::memory_order_relaxed );
+
+			if ( ( this->doorbell_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) < 0 )
 			{
-				LOG_ERROR( "Failed to initializer conditional." );
+				THROW_EXCEPTION( runtime_error, create_perror_string( "Failed to create doorbell eventfd" ) );
 			}
 
-			this->id_seq = 0;
 			return;
 		}
 
 		OUTGOING_MESSAGE_QUEUE::~OUTGOING_MESSAGE_QUEUE()
 		{
-			if ( pthread_cond_destroy( &this->conditional ) != 0 )
-			{
-				LOG_ERROR( "Failed to destroy conditional." );
-			}
+			delete [] this->slots;
+			this->slots = nullptr;
 
-			while ( !this->message_queue.empty() )
+			if ( this->doorbell_fd >= 0 )
 			{
-				this->message_queue.pop();
+				close( this->doorbell_fd );
+				this->doorbell_fd = -1;
 			}
 
 			return;
 		}
 
-		void OUTGOING_MESSAGE_QUEUE::signal( void )
+		bool OUTGOING_MESSAGE_QUEUE::add_message( const unsigned char* _buffer, size_t _length )
 		{
-			/*
-			 * We're assuming that we hold the lock right now.
-			 */
-			if ( pthread_cond_signal( &this->conditional ) != 0 )
+			if ( _length > GC_SERIAL_OUTGOING_MESSAGE_SIZE )
 			{
-				LOG_ERROR( "Failed to signal conditional." );
+				LOG_ERROR( "Outgoing message is too long: " + num_to_str( _length ) );
+				return false;
 			}
 
-			this->release_lock();
-			return;
+			size_t pos = this->enqueue_pos.load( std::memory_order_relaxed );
+			SLOT* slot;
+
+			while ( 1 )
+			{
+				slot = &this->slots[pos & ( GC_SERIAL_OUTGOING_QUEUE_SIZE - 1 )];
+				size_t seq = slot->sequence.load( std::memory_order_acquire );
+				intptr_t dif = ( intptr_t ) seq - ( intptr_t ) pos;
+
+				if ( dif == 0 )
+				{
+					/*
+					 * Slot is free.  Try to claim it.  On failure pos is reloaded with the current value.
+					 */
+					if ( this->enqueue_pos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+					{
+						break;
+					}
+				}
+				else if ( dif < 0 )
+				{
+					/*
+					 * The writer has not gotten around to this slot yet.
+					 */
+					LOG_ERROR( "Outgoing message queue is full." );
+					return false;
+				}
+				else
+				{
+					/*
+					 * Another producer got here first.
+					 */
+					pos = this->enqueue_pos.load( std::memory_order_relaxed );
+				}
+			}
+
+			memcpy( slot->message.message, _buffer, _length );
+			slot->message.message_length = _length;
+			slot->message.is_new = true;
+			slot->message.id = pos;
+			slot->sequence.store( pos + 1, std::memory_order_release );
+
+			this->wake();
+			return true;
 		}
 
-		bool OUTGOING_MESSAGE_QUEUE::add_message( const OUTGOING_MESSAGE& _msg )
+		bool OUTGOING_MESSAGE_QUEUE::take_message( OUTGOING_MESSAGE& _dest )
 		{
-			bool ret = true;
-			this->obtain_lock_ex();
+			SLOT* slot = &this->slots[this->dequeue_pos & ( GC_SERIAL_OUTGOING_QUEUE_SIZE - 1 )];
+			size_t seq = slot->sequence.load( std::memory_order_acquire );
 
-			if ( this->message_queue.size() >= GC_OUTGOING_MESSAGE_QUEUE_SIZE )
-			{
-				this->release_lock();
-				ret = false;
-				LOG_ERROR( "Outgoing message queue is full." );
-			}
-			else
+			if ( ( intptr_t ) seq - ( intptr_t )( this->dequeue_pos + 1 ) < 0 )
 			{
-				OUTGOING_MESSAGE msg = _msg;
-				msg.id = this->id_seq;
-				this->id_seq += 1;
-				this->message_queue.push( _msg );
-				this->signal();
+				return false;
 			}
 
-			return ret;
+			_dest = slot->message;
+			slot->sequence.store( this->dequeue_pos + GC_SERIAL_OUTGOING_QUEUE_SIZE, std::memory_order_release );
+			this->dequeue_pos += 1;
+			return true;
 		}
 
-		bool OUTGOING_MESSAGE_QUEUE::has_more_messages( void ) const
+		void OUTGOING_MESSAGE_QUEUE::take_messages( std::deque<OUTGOING_MESSAGE>* _destination )
 		{
-			return !this->message_queue.empty();
-		}
+			uint64_t counter;
+			OUTGOING_MESSAGE msg;
 
-		OUTGOING_MESSAGE OUTGOING_MESSAGE_QUEUE::get_message( void )
-		{
-			OUTGOING_MESSAGE ret = this->message_queue.front();
-			this->message_queue.pop();
-			return ret;
-		}
+			/*
+			 * Reset the doorbell before draining the ring so that a message added while we drain rings it again.
+			 * Nonblocking.  Fails with EAGAIN if the doorbell has not been rung since the last time.
+			 */
+			if ( read( this->doorbell_fd, &counter, sizeof( counter ) ) < 0 && errno != EAGAIN )
+			{
+				LOG_ERROR( create_perror_string( "Failed to reset doorbell eventfd" ) );
+			}
+
+			size_t discard = this->discard_pos.load( std::memory_order_acquire );
+
+			while ( this->take_message( msg ) )
+			{
+				if ( ( intptr_t )( msg.id - discard ) < 0 )
+				{
+					continue;
+				}
+
+				_destination->push_back( msg );
+			}
 
-		void OUTGOING_MESSAGE_QUEUE::get_lock( void )
-		{
-			this->obtain_lock_ex();
 			return;
 		}
 
-		void OUTGOING_MESSAGE_QUEUE::put_lock( void )
+		bool OUTGOING_MESSAGE_QUEUE::wait_for_signal( int _timeout )
 		{
-			if ( this->release_lock() == false )
+			struct pollfd pfd;
+			pfd.fd = this->doorbell_fd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+
+			int rc = poll( &pfd, 1, _timeout );
+
+			if ( rc < 0 && errno != EINTR )
 			{
-				THROW_EXCEPTION( LOCK_ERROR, "Failed to release lock.  Check logs." );
+				LOG_ERROR( create_perror_string( "Failed to wait on doorbell eventfd" ) );
 			}
 
+			return ( rc > 0 );
+		}
+
+		void OUTGOING_MESSAGE_QUEUE::clear( void )
+		{
+			this->discard_pos.store( this->enqueue_pos.load( std::memory_order_acquire ), std::memory_order_release );
 			return;
 		}
 
-		bool OUTGOING_MESSAGE_QUEUE::wait_for_signal( void )
+		void OUTGOING_MESSAGE_QUEUE::wake( void )
 		{
-			this->get_lock();
-			timespec timeout_time;
-			timeout_time.tv_nsec = 0;
-			timeout_time.tv_sec = 0;
-			timeout_time.tv_sec = time( nullptr ) + 2;
-			int rc = pthread_cond_timedwait( & ( this->conditional ), & ( this->mutex ), &timeout_time );
+			uint64_t one = 1;
 
-			if ( rc != 0 )
-			{
-				if ( rc == ETIMEDOUT )
-				{
-					/*
-					 * Apparently even when a wait for a conditional times out the mutex is still acquired by us.
-					 */
-					this->release_lock();
-					return false;
-				}
-				else
-				{
-					THROW_EXCEPTION( LOCK_ERROR, "Failed to obtain lock for reasons other than timeout." );
-				}
-			}
-			else
+			if ( write( this->doorbell_fd, &one, sizeof( one ) ) != sizeof( one ) )
 			{
-				return true;
+				LOG_ERROR( create_perror_string( "Failed to ring doorbell eventfd" ) );
 			}
+
+			return;
 		}
 
 		/************************************************************************
@@ -181,6 +239,12 @@ namespace BBB_HVAC
 			return;
 		}
 
+		CACHE_ENTRY_BASE::CACHE_ENTRY_BASE( const timespec& _time_spec )
+		{
+			this->time_spec = _time_spec;
+			return;
+		}
+
 		CACHE_ENTRY_BASE::~CACHE_ENTRY_BASE()
 		{
 			this->time_spec.tv_sec = 0;
@@ -249,6 +313,11 @@ namespace BBB_HVAC
 			return out.str();
 		}
 
+		const timespec& CACHE_ENTRY_BASE::get_timestamp( void ) const
+		{
+			return this->time_spec;
+		}
+
 		void CACHE_ENTRY_BASE::from_string( const std::string& _source )
 		{
 			size_t col_sep_idx = _source.find_last_of( ':' );
@@ -288,6 +357,12 @@ namespace BBB_HVAC
 			return;
 		}
 
+		CACHE_ENTRY_16BIT::CACHE_ENTRY_16BIT( uint16_t _val, const timespec& _time_spec ) : CACHE_ENTRY_BASE( _time_spec )
+		{
+			this->value = _val;
+			return;
+		}
+
 		CACHE_ENTRY_16BIT::CACHE_ENTRY_16BIT( const std::string& _source ) : CACHE_ENTRY_BASE( _source )
 		{
 			this->from_string( _source );
@@ -335,6 +410,12 @@ namespace BBB_HVAC
 			return;
 		}
 
+		CACHE_ENTRY_8BIT::CACHE_ENTRY_8BIT( uint8_t _val, const timespec& _time_spec ) : CACHE_ENTRY_BASE( _time_spec )
+		{
+			this->value = _val;
+			return;
+		}
+
 		CACHE_ENTRY_8BIT::CACHE_ENTRY_8BIT( const std::string& _source ) : CACHE_ENTRY_BASE( _source )
 		{
 			this->from_string( _source );
@@ -377,6 +458,11 @@ namespace BBB_HVAC
 			return;
 		}
 
+		ADC_CACHE_ENTRY::ADC_CACHE_ENTRY( uint16_t _val, const timespec& _time_spec ) : CACHE_ENTRY_16BIT( _val, _time_spec )
+		{
+			return;
+		}
+
 		/************************************************************************
 		 *
 		 * DO_CACHE_ENTRY
@@ -393,6 +479,11 @@ namespace BBB_HVAC
 			return;
 		}
 
+		DO_CACHE_ENTRY::DO_CACHE_ENTRY( uint8_t _value, const timespec& _time_spec ) : CACHE_ENTRY_8BIT( _value, _time_spec )
+		{
+			return;
+		}
+
 		DO_CACHE_ENTRY::DO_CACHE_ENTRY( const std::string& _source ) : CACHE_ENTRY_8BIT( _source )
 		{
 			return;
@@ -415,6 +506,11 @@ namespace BBB_HVAC
 			return;
 		}
 
+		PMIC_CACHE_ENTRY::PMIC_CACHE_ENTRY( uint8_t _value, const timespec& _time_spec ) : CACHE_ENTRY_8BIT( _value, _time_spec )
+		{
+			return;
+		}
+
 		PMIC_CACHE_ENTRY::PMIC_CACHE_ENTRY( const std::string& _source ) : CACHE_ENTRY_8BIT( _source )
 		{
 			return;
@@ -434,6 +530,10 @@ namespace BBB_HVAC
 		{
 			return;
 		}
+		CAL_VALUE_ENTRY::CAL_VALUE_ENTRY( uint16_t _val, const timespec& _time_spec ) : CACHE_ENTRY_16BIT( _val, _time_spec )
+		{
+			return;
+		}
 		CAL_VALUE_ENTRY::CAL_VALUE_ENTRY( const std::string& _source ) : CACHE_ENTRY_16BIT( _source )
 		{
 			return;
@@ -449,7 +549,6 @@ namespace BBB_HVAC
 
 		OUTGOING_MESSAGE::OUTGOING_MESSAGE()
 		{
-			this->message.reset();
 			this->message_length = 0;
 			this->is_new = false;
 			this->id = 0;
@@ -458,39 +557,194 @@ namespace BBB_HVAC
 
 		OUTGOING_MESSAGE::OUTGOING_MESSAGE( const unsigned char* _buffer, const size_t _length )
 		{
+			this->message_length = std::min<size_t>( _length, GC_SERIAL_OUTGOING_MESSAGE_SIZE );
+			memcpy( this->message, _buffer, this->message_length );
+			this->is_new = true;
+			this->id = 0;
+			return;
+		}
+
+		/************************************************************************
+		 *
+		 * FRAME_VIEW
+		 *
+		 ************************************************************************/
+
+		uint16_t FRAME_VIEW::checksum( size_t _length ) const
+		{
+			uint32_t sum;
+			size_t head_sum_length;
+
+			if ( _length > this->length() )
+			{
+				_length = this->length();
+			}
+
 			/*
-			 * This is fucking brain dead
+			 * The frame can start anywhere within the ring and can be split in two.  Each segment goes through the kernel on its own.
+			 * If the first segment has an odd length, the word that straddles the split is added by hand and the second segment is summed from its second byte.
 			 */
-			/*
-			this->message.reset( new unsigned char [_length], []( unsigned char * p )
+			head_sum_length = std::min( _length, this->head_length );
+			sum = ones_complement_sum( this->head, head_sum_length );
+
+			if ( head_sum_length < _length )
 			{
-				delete [] p;
-			} );
+				size_t tail_start = 0;
 
-			 */
-			this->message.reset( new unsigned char [_length], deleter_char_array );
-			this->message_length = _length;
-			memcpy( this->message.get(), _buffer, _length );
-			this->is_new = true;
+				if ( head_sum_length % 2 != 0 )
+				{
+					sum += this->get_uint16( head_sum_length - 1 );
+					tail_start = 1;
+				}
+
+				sum += ones_complement_sum( this->tail + tail_start, _length - head_sum_length - tail_start );
+			}
+
+			sum = ( sum >> 16 ) + ( sum & 0xFFFF );
+			sum += sum >> 16;
+			return ( ( uint16_t ) ~sum );
+		}
+
+		size_t FRAME_VIEW::copy_to( unsigned char* _dest, size_t _max_length ) const
+		{
+			size_t head_copy = std::min( this->head_length, _max_length );
+			size_t tail_copy = std::min( this->tail_length, _max_length - head_copy );
+
+			memcpy( _dest, this->head, head_copy );
+
+			if ( tail_copy > 0 )
+			{
+				memcpy( _dest + head_copy, this->tail, tail_copy );
+			}
+
+			return head_copy + tail_copy;
+		}
+
+		std::string FRAME_VIEW::to_hex( void ) const
+		{
+			unsigned char local_buffer[GC_SERIAL_BUFF_SIZE];
+			size_t length = this->copy_to( local_buffer, GC_SERIAL_BUFF_SIZE );
+			return buffer_to_hex( local_buffer, length );
+		}
+
+		/************************************************************************
+		 *
+		 * FRAME_QUEUE
+		 *
+		 ************************************************************************/
+
+		FRAME_QUEUE::FRAME_QUEUE()
+		{
+			this->data = ( unsigned char* ) calloc( GC_SERIAL_FRAME_QUEUE_SIZE, sizeof( unsigned char ) );
+			this->clear();
 			return;
 		}
 
-		OUTGOING_MESSAGE::OUTGOING_MESSAGE( const OUTGOING_MESSAGE& _src )
+		FRAME_QUEUE::~FRAME_QUEUE()
 		{
-			this->message = _src.message;
-			this->is_new = _src.is_new;
-			this->id = _src.id;
-			this->message_length = _src.message_length;
+			free( this->data );
+			this->data = nullptr;
 			return;
 		}
 
-		OUTGOING_MESSAGE::~OUTGOING_MESSAGE()
+		bool FRAME_QUEUE::push( const FRAME_VIEW& _frame )
 		{
-			this->message.reset();
-			this->message_length = 0;
-			this->is_new = false;
-			this->id = 0;
+			size_t length = _frame.length();
+
+			if ( this->count == 0 )
+			{
+				/*
+				 * Queue has been drained.  Start over at the beginning of the arena.
+				 */
+				this->clear();
+			}
+
+			if ( length > 0xFFFF || this->write_pos + 2 + length > GC_SERIAL_FRAME_QUEUE_SIZE )
+			{
+				return false;
+			}
+
+			this->data[this->write_pos] = ( unsigned char )( length & 0x00FF );
+			this->data[this->write_pos + 1] = ( unsigned char )( ( length >> 8 ) & 0x00FF );
+			_frame.copy_to( this->data + this->write_pos + 2, length );
+			this->write_pos += 2 + length;
+			this->count += 1;
+			return true;
+		}
+
+		bool FRAME_QUEUE::pop( FRAME_VIEW& _frame )
+		{
+			if ( this->count == 0 )
+			{
+				return false;
+			}
+
+			size_t length = ( size_t )this->data[this->read_pos] | ( ( size_t )this->data[this->read_pos + 1] << 8 );
+			_frame = FRAME_VIEW( this->data + this->read_pos + 2, length, nullptr, 0 );
+			this->read_pos += 2 + length;
+			this->count -= 1;
+			return true;
+		}
+
+		/************************************************************************
+		 *
+		 * SERIAL_RING_BUFFER
+		 *
+		 ************************************************************************/
+
+		static_assert( ( GC_SERIAL_BUFF_SIZE & ( GC_SERIAL_BUFF_SIZE - 1 ) ) == 0, "GC_SERIAL_BUFF_SIZE must be a power of two." );
+
+		SERIAL_RING_BUFFER::SERIAL_RING_BUFFER()
+		{
+			this->data = ( unsigned char* ) calloc( GC_SERIAL_BUFF_SIZE, sizeof( unsigned char ) );
+			this->read_pos = 0;
+			this->write_pos = 0;
+			return;
+		}
+
+		SERIAL_RING_BUFFER::~SERIAL_RING_BUFFER()
+		{
+			free( this->data );
+			this->data = nullptr;
 			return;
 		}
+
+		int SERIAL_RING_BUFFER::get_write_spans( struct iovec* _iov ) const
+		{
+			size_t free_space = this->get_free();
+
+			if ( free_space == 0 )
+			{
+				return 0;
+			}
+
+			size_t start = this->write_pos & ( GC_SERIAL_BUFF_SIZE - 1 );
+			size_t first = std::min( free_space, ( size_t )GC_SERIAL_BUFF_SIZE - start );
+
+			_iov[0].iov_base = this->data + start;
+			_iov[0].iov_len = first;
+
+			if ( first == free_space )
+			{
+				return 1;
+			}
+
+			_iov[1].iov_base = this->data;
+			_iov[1].iov_len = free_space - first;
+			return 2;
+		}
+
+		FRAME_VIEW SERIAL_RING_BUFFER::get_view( size_t _offset, size_t _length ) const
+		{
+			size_t start = ( this->read_pos + _offset ) & ( GC_SERIAL_BUFF_SIZE - 1 );
+			size_t first = std::min( _length, ( size_t )GC_SERIAL_BUFF_SIZE - start );
+
+			if ( first == _length )
+			{
+				return FRAME_VIEW( this->data + start, _length, nullptr, 0 );
+			}
+
+			return FRAME_VIEW( this->data + start, first, this->data, _length - first );
+		}
 	}
 }
@@ -21,90 +21,239 @@
 
 #include "lib/socket_reader.hpp"
 #include "lib/config.hpp"
-
-#include <iostream>
+#include "lib/binary_frame.hpp"
+#include "lib/string_lib.hpp"
+#include "lib/logger.hpp"
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <string.h>
+#include <errno.h>
 
 using namespace BBB_HVAC;
 
+DEF_LOGGER_STAT( "BBB_HVAC::SOCKET_READER" );
+
 SOCKET_READER::SOCKET_READER()
 {
-	this->read_buffer = ( char* ) malloc( GC_BUFFER_SIZE );
-	memset( this->read_buffer, 0, GC_BUFFER_SIZE );
+	this->buffer_size = GC_BUFFER_SIZE;
+	this->read_buffer = ( char* ) malloc( this->buffer_size );
+	memset( this->read_buffer, 0, this->buffer_size );
+	this->read_pos = 0;
+	this->fill_pos = 0;
+	this->discarding = false;
 	return;
 }
 SOCKET_READER::~SOCKET_READER()
 {
-	memset( this->read_buffer, 0, GC_BUFFER_SIZE );
+	memset( this->read_buffer, 0, this->buffer_size );
 	free( this->read_buffer );
 	this->read_buffer = nullptr;
 }
 
 size_t SOCKET_READER::read( int _fd )
 {
-	ssize_t rc = recv( _fd, this->read_buffer, GC_BUFFER_SIZE, MSG_DONTWAIT );
+	size_t total = 0;
 
-	if ( rc == -1 )
+	while ( 1 )
 	{
-		throw ( EXCEPTIONS::CONNECTION_ERROR( create_perror_string( "Failed to read from client:" ) ) );
+		this->make_room();
+
+		size_t space = this->buffer_size - this->fill_pos;
+
+		if ( space == 0 )
+		{
+			/*
+			 * Buffer is full of lines that have not been consumed yet.  The rest stays in the socket until they are.
+			 */
+			break;
+		}
+
+		ssize_t rc = recv( _fd, this->read_buffer + this->fill_pos, space, MSG_DONTWAIT );
+
+		if ( rc == -1 )
+		{
+			if ( errno == EINTR )
+			{
+				continue;
+			}
+
+			if ( errno == EAGAIN || errno == EWOULDBLOCK )
+			{
+				break;
+			}
+
+			throw ( EXCEPTIONS::CONNECTION_ERROR( create_perror_string( "Failed to read from client:" ) ) );
+		}
+
+		if ( rc == 0 )
+		{
+			if ( total > 0 )
+			{
+				/*
+				 * Hand out what was sent before the disconnect.  The next read will see the disconnect again.
+				 */
+				break;
+			}
+
+			/*
+			 * Client has disconnected
+			 */
+			throw ( EXCEPTIONS::CONNECTION_ERROR( "Client connection closed." ) );
+		}
+
+		total += ( size_t )rc;
+
+		char* start = this->read_buffer + this->fill_pos;
+		size_t length = ( size_t )rc;
+
+		if ( this->discarding )
+		{
+			char* nl = ( char* ) memchr( start, '\n', length );
+
+			if ( nl == nullptr )
+			{
+				continue;
+			}
+
+			length -= ( size_t )( nl + 1 - start );
+			memmove( start, nl + 1, length );
+			this->discarding = false;
+		}
+
+		this->fill_pos += length;
 	}
 
-	if ( rc == 0 )
+	return total;
+}
+
+bool SOCKET_READER::next_line( TEXT_VIEW& _line )
+{
+	size_t length;
+
+	if ( this->record_length( this->read_pos, length ) == false )
 	{
-		/*
-		 * Client has disconnected
-		 */
-		throw ( EXCEPTIONS::CONNECTION_ERROR( "Client connection closed." ) );
+		return false;
 	}
 
-	size_t start = 0;
-	ssize_t nl_idx = 0;
-	size_t last_nl = 0;
+	_line = TEXT_VIEW( this->read_buffer + this->read_pos, length );
+	this->read_pos += length;
+	return true;
+}
 
-	while ( ( nl_idx = this->find_nl_in_buffer( start, ( size_t )rc ) ) !=  - 1 )
+bool SOCKET_READER::record_length( size_t _pos, size_t& _length ) const
+{
+	const char* start = this->read_buffer + _pos;
+	size_t available = this->fill_pos - _pos;
+
+	if ( available == 0 )
 	{
-		this->line_vector.push_back( string( this->read_buffer, start, ( ( ( size_t )nl_idx ) - start ) + 1 ) );
-		last_nl = ( size_t )nl_idx;
-		start = ( size_t )nl_idx + 1;
+		return false;
+	}
+
+	if ( ( unsigned char ) start[0] == BINARY_FRAME::marker )
+	{
+		if ( available < BINARY_FRAME::header_size )
+		{
+			return false;
+		}
+
+		size_t frame_length = BINARY_FRAME::get_u32( start + BINARY_FRAME::length_offset );
+
+		if ( frame_length < BINARY_FRAME::header_size || frame_length > GC_SOCKET_READER_MAX_LINE )
+		{
+			/*
+			 * There is no new line to resynchronize on in binary data.
+			 */
+			throw ( EXCEPTIONS::PROTOCOL_ERROR( "Invalid binary frame length: " + num_to_str( ( unsigned long ) frame_length ) ) );
+		}
+
+		if ( frame_length > available )
+		{
+			return false;
+		}
+
+		_length = frame_length;
+		return true;
 	}
 
-	if ( last_nl < ( size_t )( rc - 1 ) )
+	const char* nl = ( const char* ) memchr( start, '\n', available );
+
+	if ( nl == nullptr )
 	{
-		cerr << "Failed to find last NL in read buffer (" << last_nl << "|" << rc << ")" << endl;
+		return false;
 	}
 
-	return this->line_vector.size();
+	_length = ( size_t )( nl - start ) + 1;
+	return true;
 }
 
-size_t SOCKET_READER::get_line_count( void ) const
-{
-	return this->line_vector.size();
-}
 string SOCKET_READER::pop_first_line( void )
 {
-	if ( this->get_line_count() < 1 )
+	TEXT_VIEW line;
+
+	if ( this->next_line( line ) == false )
 	{
 		throw ( runtime_error( "Line vector is empty." ) );
 	}
 
-	string ret = this->line_vector[0];
-	this->line_vector.erase( this->line_vector.begin() );
-	return ret;
+	return line.to_string();
 }
 
-ssize_t SOCKET_READER::find_nl_in_buffer( size_t _start, size_t _end )
+void SOCKET_READER::make_room( void )
 {
-	for ( size_t i = _start; i < _end; i++ )
+	if ( this->read_pos == this->fill_pos )
+	{
+		this->read_pos = 0;
+		this->fill_pos = 0;
+	}
+
+	if ( this->buffer_size - this->fill_pos >= GC_BUFFER_SIZE )
+	{
+		return;
+	}
+
+	if ( this->read_pos > 0 )
 	{
-		if ( read_buffer[i] == '\n' )
+		memmove( this->read_buffer, this->read_buffer + this->read_pos, this->fill_pos - this->read_pos );
+		this->fill_pos -= this->read_pos;
+		this->read_pos = 0;
+
+		if ( this->buffer_size - this->fill_pos >= GC_BUFFER_SIZE )
 		{
-			return ( ssize_t )i;
+			return;
 		}
 	}
 
-	return -1;
-}
+	if ( this->buffer_size < GC_SOCKET_READER_MAX_LINE )
+	{
+		size_t new_size = this->buffer_size * 2;
+
+		if ( new_size > GC_SOCKET_READER_MAX_LINE )
+		{
+			new_size = GC_SOCKET_READER_MAX_LINE;
+		}
+
+		char* new_buffer = ( char* ) realloc( this->read_buffer, new_size );
+
+		if ( new_buffer == nullptr )
+		{
+			throw ( runtime_error( "Failed to grow the socket read buffer." ) );
+		}
+
+		this->read_buffer = new_buffer;
+		this->buffer_size = new_size;
+		return;
+	}
 
+	size_t length;
+
+	if ( this->fill_pos == this->buffer_size && this->record_length( this->read_pos, length ) == false )
+	{
+		LOG_WARNING( "Discarding a line longer than " + num_to_str( ( unsigned long ) GC_SOCKET_READER_MAX_LINE ) + " bytes." );
+		this->fill_pos = 0;
+		this->discarding = true;
+	}
+
+	return;
+}
@@ -20,6 +20,7 @@
 
 
 #include "lib/string_lib.hpp"
+#include "lib/checksum.hpp"
 
 #include <stdlib.h>
 #include <string.h>
@@ -238,6 +239,18 @@ std::string get_iso_date_time( void )
 	return ret.str();
 }
 
+uint64_t monotonic_usec( void )
+{
+	timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return timespec_to_usec( ts );
+}
+
+uint64_t timespec_to_usec( const timespec& _time )
+{
+	return ( ( uint64_t ) _time.tv_sec * 1000000 ) + ( ( uint64_t ) _time.tv_nsec / 1000 );
+}
+
 // trim from start (in place)
 
 void ltrim( std::string& s )
@@ -411,25 +424,10 @@ void convert_vector_to_string( const std::vector<uint16_t>& _source, std::vector
 
 uint16_t checksum( const uint16_t* _buffer, size_t _length )
 {
-	uint32_t sum = 0;
-
-	/*
-	 * IP headers always contain an even number of bytes.
-	 */
-	while ( _length -- > 0 )
-	{
-		sum += * ( _buffer++ );
-	}
-
-	/*
-	 * Use carries to compute 1's complement sum.
-	 */
-	sum = ( sum >> 16 ) + ( sum & 0xFFFF );
-	sum += sum >> 16;
 	/*
-	 * Return the inverted 16-bit result.
+	 * IP headers always contain an even number of bytes.  The words are read as bytes; the buffer does not have to be aligned.
 	 */
-	return ( ( uint16_t ) ~sum );
+	return ( ( uint16_t ) ~BBB_HVAC::ones_complement_sum( ( const unsigned char* ) _buffer, _length * 2 ) );
 }
 
 void split_string_to_vector( const std::string& _string, char _split, std::vector<std::string>& _vector )
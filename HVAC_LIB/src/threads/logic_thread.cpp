@@ -48,6 +48,14 @@ LOGIC_PROCESSOR_BASE::LOGIC_PROCESSOR_BASE( CONFIGURATOR* _config ) :
 	this->configurator = _config;
 	this->config_save_counter = 0;
 
+	this->stat_ticks = 0;
+	this->stat_tick_usec_last = 0;
+	this->stat_tick_usec_max = 0;
+	this->stat_tick_usec_total = 0;
+	this->stat_ingest_lag_samples = 0;
+	this->stat_ingest_lag_usec_max = 0;
+	this->stat_ingest_lag_usec_total = 0;
+
 	/*
 	Populate the logic fluff stuff.  Logic fluff is used by user-facing stuffs to extract operational information out of the logic processor
 	*/
@@ -148,6 +156,18 @@ void LOGIC_PROCESSOR_BASE::get_logic_status_fluff( LOGIC_STATUS_FLUFF& _dest ) c
 	_dest = this->logic_status_fluff;
 }
 
+void LOGIC_PROCESSOR_BASE::get_logic_stats( LOGIC_STATS& _dest ) const
+{
+	_dest.ticks = this->stat_ticks;
+	_dest.tick_usec_last = this->stat_tick_usec_last;
+	_dest.tick_usec_max = this->stat_tick_usec_max;
+	_dest.tick_usec_total = this->stat_tick_usec_total;
+	_dest.ingest_lag_samples = this->stat_ingest_lag_samples;
+	_dest.ingest_lag_usec_max = this->stat_ingest_lag_usec_max;
+	_dest.ingest_lag_usec_total = this->stat_ingest_lag_usec_total;
+	return;
+}
+
 string LOGIC_STATUS_CORE::to_string( void )
 {
 	string ret;
@@ -168,6 +188,8 @@ bool LOGIC_PROCESSOR_BASE::inner_thread_func( void )
 		GLOBALS::watchdog->reset_counter();
 		this->obtain_lock( true );
 
+		uint64_t tick_start = monotonic_usec();
+
 		/*
 		 At this point we have the mutex lock.
 
@@ -211,13 +233,50 @@ bool LOGIC_PROCESSOR_BASE::inner_thread_func( void )
 				}
 
 				BOARD_STATE_STRUCT* board_state_ptr = &board_state_iterator->second;
-				BBB_HVAC::IOCOMM::BOARD_STATE_CACHE board_state_cache( board_id + "[t]" );
-				thread_handle->get_latest_state_values( board_state_cache );
+				BBB_HVAC::IOCOMM::BOARD_STATE_SNAPSHOT board_snapshot;
+
+				/*
+				Lock free.  The IO thread is never held up by the logic loop.
+				Only the fields that changed since the last pass are converted.
+				*/
+				uint32_t changes = thread_handle->get_state_changes( board_state_ptr->generation, board_snapshot );
+				board_state_ptr->generation = board_snapshot.generation;
+				board_state_ptr->changes = changes;
+
+				if ( board_snapshot.generation != 0 )
+				{
+					/*
+					How long the freshest data of the board sat around before we got to it.
+					*/
+					uint64_t published = timespec_to_usec( board_snapshot.published );
+					uint64_t lag = ( tick_start > published ? tick_start - published : 0 );
+
+					this->stat_ingest_lag_samples += 1;
+					this->stat_ingest_lag_usec_total += lag;
+
+					if ( lag > this->stat_ingest_lag_usec_max )
+					{
+						this->stat_ingest_lag_usec_max = lag;
+					}
+				}
+
+				if ( changes & ( 1u << IOCOMM::BOARD_STATE_FIELD_DO ) )
+				{
+					board_state_ptr->do_state = IOCOMM::DO_CACHE_ENTRY( board_snapshot.do_status, board_snapshot.do_timestamp );
+				}
 
-				board_state_cache.get_latest_do_status( board_state_ptr->do_state );
-				board_state_cache.get_latest_do_status( board_state_ptr->do_state );
-				board_state_cache.get_latest_pmic_status( board_state_ptr->pmic_state );
-				board_state_cache.get_latest_adc_values( board_state_ptr->ai_state );
+				if ( changes & ( 1u << IOCOMM::BOARD_STATE_FIELD_PMIC ) )
+				{
+					board_state_ptr->pmic_state = IOCOMM::PMIC_CACHE_ENTRY( board_snapshot.pmic_status, board_snapshot.pmic_timestamp );
+				}
+
+				for ( size_t ai_idx = 0; ai_idx < GC_IO_AI_COUNT; ai_idx++ )
+				{
+					if ( changes & ( 1u << ( IOCOMM::BOARD_STATE_FIELD_AI + ai_idx ) ) )
+					{
+						board_state_ptr->ai_state[ai_idx] = IOCOMM::ADC_CACHE_ENTRY( board_snapshot.ai_values[ai_idx], board_snapshot.ai_timestamps[ai_idx] );
+					}
+				}
 
 				/*
 				Get PMIC status bits.  Writing the PMIC status to the board will reset both PMICs if they have the error flag set.
@@ -333,6 +392,15 @@ bool LOGIC_PROCESSOR_BASE::inner_thread_func( void )
 			const BOARD_POINT& board_point = map_iterator->second;
 			const auto& board_state_iterator = this->logic_status_core.current_state_map.find( board_point.get_board_tag() );
 			const BOARD_STATE_STRUCT& board_state = board_state_iterator->second;
+
+			if ( ( board_state.changes & ( 1u << ( IOCOMM::BOARD_STATE_FIELD_AI + board_point.get_point_id() ) ) ) == 0 && this->logic_status_core.calculated_adc_values.count( point_name ) != 0 )
+			{
+				/*
+				Raw value did not change since the last pass.
+				*/
+				continue;
+			}
+
 			uint16_t val = board_state.ai_state[board_point.get_point_id()].get_value();
 			double volt_value = ( double )val * this->logic_status_core.adc_step_val;
 			double calculated_value = 0;
@@ -410,6 +478,21 @@ bool LOGIC_PROCESSOR_BASE::inner_thread_func( void )
 		}
 
 
+		{
+			uint64_t tick_usec = monotonic_usec() - tick_start;
+
+			this->stat_ticks += 1;
+			this->stat_tick_usec_last = tick_usec;
+			this->stat_tick_usec_total += tick_usec;
+
+			if ( tick_usec > this->stat_tick_usec_max )
+			{
+				this->stat_tick_usec_max = tick_usec;
+			}
+
+			this->sample_cpu_usage();
+		}
+
 		/*
 		 * Done with the logic processing.  Unlock the mutex so that some other thread may get the status.
 		 */
@@ -0,0 +1,268 @@
+/*
+ * This file is part of the software stack for Vic's IO board and its
+ * associated projects.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2016,2017,2018 Vidas Simkus (vic.simkus@gmail.com)
+ */
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "lib/threads/serial_io_reactor.hpp"
+#include "lib/threads/thread_registry.hpp"
+#include "lib/config.hpp"
+#include "lib/string_lib.hpp"
+#include "lib/exceptions.hpp"
+
+using namespace BBB_HVAC;
+using namespace BBB_HVAC::IOCOMM;
+
+SER_IO_REACTOR::SER_IO_REACTOR( const string& _tag ) : THREAD_BASE( _tag )
+{
+	INIT_LOGGER( "BBB_HVAC::SERIAL_IO_REACTOR[" + _tag + "]" );
+	this->epoll_fd = -1;
+	this->shutdown_fd = -1;
+	return;
+}
+
+SER_IO_REACTOR::~SER_IO_REACTOR()
+{
+	/*
+	 * The boards are not ours to delete.  They belong to the thread registry.
+	 */
+	if ( this->shutdown_fd >= 0 )
+	{
+		close( this->shutdown_fd );
+		this->shutdown_fd = -1;
+	}
+
+	if ( this->epoll_fd >= 0 )
+	{
+		close( this->epoll_fd );
+		this->epoll_fd = -1;
+	}
+
+	return;
+}
+
+bool SER_IO_REACTOR::init( void )
+{
+	struct epoll_event ev;
+
+	if ( ( this->epoll_fd = epoll_create1( EPOLL_CLOEXEC ) ) < 0 )
+	{
+		LOG_ERROR( create_perror_string( "epoll_create1" ) );
+		return false;
+	}
+
+	if ( ( this->shutdown_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) < 0 )
+	{
+		LOG_ERROR( create_perror_string( "eventfd" ) );
+		return false;
+	}
+
+	memset( &ev, 0, sizeof( ev ) );
+	ev.events = EPOLLIN;
+	ev.data.ptr = nullptr;
+
+	if ( epoll_ctl( this->epoll_fd, EPOLL_CTL_ADD, this->shutdown_fd, &ev ) != 0 )
+	{
+		LOG_ERROR( create_perror_string( "Failed to add shutdown eventfd to epoll" ) );
+		return false;
+	}
+
+	return true;
+}
+
+void SER_IO_REACTOR::add_board( SER_IO_COMM* _board )
+{
+	if ( this->is_running )
+	{
+		THROW_EXCEPTION( runtime_error, "Tried to add board [" + _board->get_tag() + "] to a running reactor." );
+	}
+
+	this->boards.push_back( _board );
+	return;
+}
+
+void SER_IO_REACTOR::flag_for_stop( void )
+{
+	THREAD_BASE::flag_for_stop();
+
+	if ( this->shutdown_fd >= 0 )
+	{
+		uint64_t one = 1;
+
+		if ( write( this->shutdown_fd, &one, sizeof( one ) ) != sizeof( one ) )
+		{
+			LOG_ERROR( create_perror_string( "Failed to signal shutdown eventfd" ) );
+		}
+	}
+
+	return;
+}
+
+void SER_IO_REACTOR::drop_board( SER_IO_COMM* _board )
+{
+	auto i = std::find( this->boards.begin(), this->boards.end(), _board );
+
+	if ( i != this->boards.end() )
+	{
+		this->boards.erase( i );
+	}
+
+	LOG_DEBUG( "Dropping board: " + _board->get_tag() );
+	_board->detach_from_reactor();
+	THREAD_REGISTRY::delete_thread( _board );
+	return;
+}
+
+bool SER_IO_REACTOR::thread_func( void )
+{
+	std::vector<SER_IO_COMM*> failed_boards;
+	std::vector<struct epoll_event> events( ( this->boards.size() * SER_IO_COMM::EVENT_SOURCE_COUNT ) + 1 );
+	uint64_t counter;
+
+	/*
+	 * The boards are never started as threads so they have to be registered by hand.  Same as THREAD_BASE::pthread_func would have done.
+	 */
+	for ( auto i = this->boards.begin(); i != this->boards.end(); ++i )
+	{
+		THREAD_REGISTRY::register_thread( *i, THREAD_TYPES_ENUM::IO_THREAD );
+
+		if ( !( *i )->attach_to_reactor( this->epoll_fd ) )
+		{
+			LOG_ERROR( "Failed to attach board: " + ( *i )->get_tag() );
+			failed_boards.push_back( *i );
+		}
+	}
+
+	for ( auto i = failed_boards.begin(); i != failed_boards.end(); ++i )
+	{
+		this->drop_board( *i );
+	}
+
+	LOG_DEBUG( "Servicing " + num_to_str( this->boards.size() ) + " board(s)." );
+
+	while ( this->abort_thread == false && !this->boards.empty() )
+	{
+		int timeout = -1;
+		bool timer_fired = false;
+
+		/*
+		 * There's no event for the CTS line so output that the board was not ready for is retried on a short timeout.
+		 */
+		for ( auto i = this->boards.begin(); i != this->boards.end(); ++i )
+		{
+			if ( ( *i )->has_pending_output() )
+			{
+				timeout = GC_SERIAL_REACTOR_RETRY_INTERVAL;
+				break;
+			}
+		}
+
+		int fds_ready_num = epoll_wait( this->epoll_fd, events.data(), ( int ) events.size(), timeout );
+
+		if ( fds_ready_num < 0 )
+		{
+			if ( errno != EINTR )
+			{
+				LOG_ERROR( create_perror_string( "epoll_wait" ) );
+			}
+
+			continue;
+		}
+
+		for ( int i = 0; i < fds_ready_num; i++ )
+		{
+			const SER_IO_COMM::ST_EVENT_SOURCE* source = ( const SER_IO_COMM::ST_EVENT_SOURCE* ) events[i].data.ptr;
+
+			if ( source == nullptr )
+			{
+				if ( read( this->shutdown_fd, &counter, sizeof( counter ) ) < 0 )
+				{
+					LOG_ERROR( create_perror_string( "Failed to read shutdown eventfd" ) );
+				}
+
+				continue;
+			}
+
+			if ( source->type == SER_IO_COMM::EVENT_SOURCE_TIMER )
+			{
+				timer_fired = true;
+			}
+
+			try
+			{
+				source->board->dispatch_event( source->type, events[i].events );
+			}
+			catch ( const exception& _e )
+			{
+				/*
+				 * Same as an unhandled exception in a board thread.  The board dies and the rest carry on.
+				 */
+				LOG_ERROR( "Caught an unhandled exception from board [" + source->board->get_tag() + "]: " + string( _e.what() ) );
+				source->board->flag_for_stop();
+			}
+		}
+
+		if ( timer_fired )
+		{
+			/*
+			 * The board timers are the only periodic event so the CPU time is sampled on them rather than on every wake up.
+			 */
+			this->sample_cpu_usage();
+		}
+
+		failed_boards.clear();
+
+		for ( auto i = this->boards.begin(); i != this->boards.end(); ++i )
+		{
+			if ( ( *i )->has_pending_output() )
+			{
+				( *i )->flush_pending_output();
+			}
+
+			( *i )->supervise_board();
+
+			if ( ( *i )->abort_thread )
+			{
+				failed_boards.push_back( *i );
+			}
+		}
+
+		for ( auto i = failed_boards.begin(); i != failed_boards.end(); ++i )
+		{
+			this->drop_board( *i );
+		}
+	}
+
+	/*
+	 * Unless the whole program is stopping the registry will hand the boards to the IO thread death listener.
+	 */
+	while ( !this->boards.empty() )
+	{
+		this->drop_board( this->boards.back() );
+	}
+
+	return true;
+}
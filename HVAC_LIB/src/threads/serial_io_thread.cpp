@@ -26,8 +26,17 @@ using namespace std;
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 #include <termios.h>
 #include <stdio.h>
 #include <string.h>
@@ -49,8 +58,6 @@ using namespace std;
 #include "lib/globals.hpp"
 #include "lib/memory_management.hpp"
 
-#include <poll.h>
-
 using namespace BBB_HVAC;
 using namespace BBB_HVAC::IOCOMM;
 
@@ -73,8 +80,46 @@ Byte 6 - Length MSB
 #define RESP_HEAD_LEN_LSB_IDX	4
 #define RESP_HEAD_LEN_MSB_IDX	5
 
+/*
+Byte 1 - '@'
+Byte 2 - Length MSB
+Byte 3 - Length LSB
+Byte 4 - Call index
+*/
+#define CMD_FRAME_CI_IDX		3
+
+/**
+Sleeps for _usec microseconds.  Unlike TPROTECT_BASE::nsleep it does not go back to sleep when interrupted so the supervisor can wake the writer.
+*/
+static inline void interruptible_sleep( uint64_t _usec )
+{
+	timespec sleep_time;
+	sleep_time.tv_sec = ( time_t )( _usec / 1000000 );
+	sleep_time.tv_nsec = ( long )( ( _usec % 1000000 ) * 1000 );
+	nanosleep( &sleep_time, nullptr );
+	return;
+}
+
+/**
+Handler of GC_SERIAL_WRITER_WAKE_SIGNAL.  Only there so that the signal interrupts the system call the writer is blocked in.
+*/
+static void writer_wake_handler( int )
+{
+	return;
+}
+
+/**
+Board state fields a board has to deliver before its state is considered complete.
+*/
+static const uint32_t complete_state_fields = ( 1u << BOARD_STATE_FIELD_AI ) | ( 1u << BOARD_STATE_FIELD_DO ) | ( 1u << BOARD_STATE_FIELD_PMIC );
+
 void SER_IO_COMM::serial_port_close( void )
 {
+	if ( this->epoll_fd >= 0 )
+	{
+		epoll_ctl( this->epoll_fd, EPOLL_CTL_DEL, this->serial_fd, nullptr );
+	}
+
 	tcflush( this->serial_fd, TCIOFLUSH );
 	tcflow( this->serial_fd, TCOOFF );
 	tcsetattr( this->serial_fd, TCSANOW, &this->old_tio );
@@ -94,38 +139,81 @@ SER_IO_COMM::~SER_IO_COMM()
 	delete this->state_cache;
 	this->state_cache = nullptr;
 
-	unlink( this->lock_file.data() );
+	this->event_fds_close();
 
-	free( this->buffer );
-	this->buffer = nullptr;
+	unlink( this->lock_file.data() );
 
 	delete this->outgoing_messages;
 	this->outgoing_messages = nullptr;
 
-	this->active_table = nullptr;
-	this->passive_table = nullptr;
+	delete this->capture;
+	this->capture = nullptr;
 
 	return;
 }
 
-SER_IO_COMM::SER_IO_COMM( const char* _tty, const string& _tag, bool _debug ) :
+SER_IO_COMM::SER_IO_COMM( const char* _tty, const string& _tag, bool _debug, size_t _history_depth ) :
 	IO_COMM_BASE( _tag )
 {
 	INIT_LOGGER( "BBB_HVAC::SERIAL_IO[" + _tag + "]" );
 
 	this->tty_dev = generate_port_device_file_name( _tty );
 	this->lock_file = generate_lock_file_name( _tty );
-	this->buffer = ( unsigned char* ) calloc( GC_SERIAL_BUFF_SIZE, sizeof( unsigned char ) );
 	this->serial_fd = 0;
-	this->active_table = &this->table_a;
-	this->passive_table = &this->table_b;
 	this->outgoing_messages = new OUTGOING_MESSAGE_QUEUE( this->tag + "/" + "OUT_QUEUE" );
+	this->capture = nullptr;
 	this->reset_buffer_context();
 	this->board_has_reset = false;
+	this->stream_started = false;
 	this->in_debug_mode = _debug;
-	memset( this->buffer, 0xFF, GC_SERIAL_BUFF_SIZE );
+	this->epoll_fd = -1;
+	this->shutdown_fd = -1;
+	this->timer_fd = -1;
+	this->last_rx_usec = 0;
+	this->board_health = ENUM_BOARD_HEALTH::HEALTHY;
+	this->supervisor_deadline = 0;
+	this->reopen_backoff = GC_SERIAL_REOPEN_BACKOFF_MIN;
+	this->hung_since = 0;
+	this->warm_attach = false;
+	this->attach_started = 0;
+	this->received_fields = 0;
+	this->state_valid = false;
+	this->reactor_mode = false;
+	this->pending_offset = 0;
+	this->has_modem_lines = true;
+	this->has_modem_wait = true;
+	this->cts_wait_deadline = 0;
+	this->writer_running = false;
+	this->writer_on_port = false;
+	this->stat_write_blocked_usec = 0;
+	this->stat_write_blocked_max_usec = 0;
+	this->stat_write_block_count = 0;
+	this->stat_write_timeouts = 0;
+	this->stat_commands_coalesced = 0;
+	this->stat_bytes_received = 0;
+	this->stat_frames_decoded = 0;
+	this->stat_checksum_errors = 0;
+	this->stat_lines_decoded = 0;
+	this->stat_frames_rejected = 0;
+	this->stat_state_updates = 0;
+	this->stat_hung_boards = 0;
+	this->stat_reopen_failures = 0;
+	this->stat_reset_timeouts = 0;
+	this->stat_recoveries = 0;
+	this->stat_recover_usec = 0;
+	this->stat_recover_max_usec = 0;
+	this->stat_warm_attaches = 0;
+	this->stat_attach_fallbacks = 0;
+	this->stat_attach_usec = 0;
+
+	for ( size_t i = 0; i < EVENT_SOURCE_COUNT; i++ )
+	{
+		this->event_sources[i].board = this;
+		this->event_sources[i].type = static_cast<ENUM_EVENT_SOURCES>( i );
+	}
 
-	this->state_cache = new BOARD_STATE_CACHE( _tag );
+	this->state_cache = new BOARD_STATE_CACHE( _tag, _history_depth );
+	this->published_generation = 0;
 	return;
 }
 
@@ -139,22 +227,37 @@ void SER_IO_COMM::writer_thread_func( void )
 	}
 
 	LOG_DEBUG( "Write event loop thread ending." );
+	this->writer_running = false;
 	//pthread_exit( nullptr );
 	return;
 }
 
 bool SER_IO_COMM::thread_func( void )
 {
-	pthread_t writer_thread_id ;
-	pthread_create( &writer_thread_id, nullptr, ( void* ( * )( void* ) ) serial_io_shim_func, this );
+	struct sigaction sa;
+	memset( &sa, 0, sizeof( struct sigaction ) );
+	sa.sa_handler = writer_wake_handler;
+
+	/*
+	 * No SA_RESTART.  The wake up has to break the writer out of TIOCMIWAIT, poll and nanosleep.
+	 */
+	if ( sigaction( GC_SERIAL_WRITER_WAKE_SIGNAL, &sa, nullptr ) != 0 )
+	{
+		LOG_ERROR( create_perror_string( "Failed to install the writer wake up signal handler" ) );
+	}
+
+	this->writer_running = true;
+	bool writer_started = ( pthread_create( &this->writer_thread, nullptr, ( void* ( * )( void* ) ) serial_io_shim_func, this ) == 0 );
+
+	if ( !writer_started )
+	{
+		LOG_ERROR( "Failed to create the writer thread." );
+		this->writer_running = false;
+	}
+
 	/*
-	 * This delay is needed.  Otherwise the writer thread doesn't get started before the main even loop thread
-	 * and the board reset goes missing since the write thread is not there to wait for the conditional.
+	 * No need to wait for the writer.  The doorbell eventfd stays signaled until it takes the messages so the board reset can not go missing.
 	 */
-	timespec ts;
-	ts.tv_sec = 0;
-	ts.tv_nsec = 250000000;	// quarter second
-	this->nsleep( &ts );
 	LOG_DEBUG( "Main event loop thread starting." );
 
 	if ( !this->main_event_loop() )
@@ -163,7 +266,21 @@ bool SER_IO_COMM::thread_func( void )
 	}
 
 	LOG_DEBUG( "Main event loop thread ending." );
-	pthread_join( writer_thread_id, nullptr );
+
+	/*
+	 * The writer may be blocked waiting for CTS.  A wake up that lands before it enters the wait is lost, so keep at it until the writer is out.
+	 */
+	while ( this->writer_running )
+	{
+		this->wake_writer();
+		interruptible_sleep( GC_SERIAL_CTS_POLL_INTERVAL );
+	}
+
+	if ( writer_started )
+	{
+		pthread_join( this->writer_thread, nullptr );
+	}
+
 	//pthread_exit( nullptr );
 	return true;
 }
@@ -204,7 +321,12 @@ bool SER_IO_COMM::is_process_alive( const string& _pid )
 
 string SER_IO_COMM::generate_lock_file_name( const char* _tty )
 {
-	return string( "/var/lock/LCK.." ) + _tty;
+	/*
+	 * Pseudo terminals live in a sub-directory (pts/N).  The lock file has to stay in /var/lock.
+	 */
+	string name( _tty );
+	std::replace( name.begin(), name.end(), '/', '_' );
+	return string( "/var/lock/LCK.." ) + name;
 }
 
 string SER_IO_COMM::generate_port_device_file_name( const char* _tty )
@@ -269,17 +391,29 @@ bool SER_IO_COMM::drain_serial( bool _discard )
 {
 	bool rc = true;
 	long int bytes_read = 0;
-	//long int start_index = this->buffer_context.buffer_idx;
+	struct iovec spans[2];
 
-	while ( bytes_read < GC_SERIAL_BUFF_SIZE )
+	if ( _discard )
 	{
+		this->reset_buffer_context();
+	}
+
+	while ( 1 )
+	{
+		int span_count = this->rx_ring.get_write_spans( spans );
+
+		if ( span_count == 0 )
+		{
+			/*
+			 * Ring is full.  Leave the rest of the data in the port until the assembler frees up some space.
+			 */
+			break;
+		}
+
 		/*
 		 * If I make the type ssize_t arithmetic with size_t fails
 		 */
-		long int read_count = read( this->serial_fd, buffer + this->buffer_context.buffer_idx, GC_SERIAL_BUFF_SIZE - this->buffer_context.buffer_idx );
-
-		// DEBUG SET A.1.  Also enable DEBUG SET A.2 at the same time.
-		//long int rc = read( this->serial_fd, buffer + this->buffer_context.buffer_idx, 1 );
+		long int read_count = readv( this->serial_fd, spans, span_count );
 
 		if ( read_count == 0 )
 		{
@@ -291,59 +425,77 @@ bool SER_IO_COMM::drain_serial( bool _discard )
 		}
 		else if ( read_count < 0 )
 		{
+			if ( errno == EAGAIN || errno == EWOULDBLOCK )
+			{
+				rc = true;
+				break;
+			}
+
 			LOG_ERROR( create_perror_string( "Serial read" ) );
 			rc = false;
 			break;
 		}
-		else
-		{
-			bytes_read += read_count;
-		}
-
-		if ( _discard )
-		{
-			continue;
-		}
 
-		// DEBUG SET A.2
-		//cerr << "[" << this->buffer_context.buffer_idx << "] -- 0x" << char_to_hex( buffer[this->buffer_context.buffer_idx]) << " -- " <<  (buffer[this->buffer_context.buffer_idx] != 0x0A ? char(buffer[this->buffer_context.buffer_idx]) : (char)' ')   << endl;
-		this->buffer_context.buffer_idx = this->buffer_context.buffer_idx + ( unsigned long )read_count;
+		bytes_read += read_count;
+		this->capture_spans( ENUM_CAPTURE_DIRECTION::FROM_BOARD, spans, ( size_t ) read_count );
 
-		if ( this->buffer_context.buffer_idx >= GC_SERIAL_BUFF_SIZE )
+		if ( _discard )
 		{
 			/*
-			 * Overflow
+			 * The data is left where it is and overwritten by the next read.
 			 */
-			LOG_ERROR( "Serial receive buffer overflowed. Bytes read: " + num_to_str( bytes_read ) +  ".  Buffer index: " + num_to_str( this->buffer_context.buffer_idx ) + ". Buffer size: " + num_to_str( GC_SERIAL_BUFF_SIZE ) + ". Data has been lost." );
-			this->reset_buffer_context();
-			memset( this->buffer, 0x00, GC_SERIAL_BUFF_SIZE );
+			continue;
 		}
+
+		this->rx_ring.commit_write( ( size_t ) read_count );
 	}
 
 	if ( bytes_read > 0 )
 	{
 		//LOG_DEBUG_P("Read " + num_to_str(bytes_read) + " from serial port.  Discard: " + num_to_str(_discard));
+		this->stat_bytes_received += ( uint64_t ) bytes_read;
 	}
 
-	//LOG_DEBUG_P( "\n" + buffer_to_hex( this->active_table->table[_idx], length  + RESP_HEAD_SIZE ) );
 	return rc;
 }
 
-unsigned char SER_IO_COMM::clear_to_send( void ) const
+unsigned char SER_IO_COMM::clear_to_send( unsigned int* _output_queue )
 {
-	unsigned int flow_ctrl_status;
+	unsigned int flow_ctrl_status = TIOCM_CTS;
 	unsigned int output_queue;
 
+	if ( !this->port_is_open() )
+	{
+		/*
+		 * The supervisor has closed the port of a hung board.
+		 */
+		return 0;
+	}
+
 	if ( ioctl( this->serial_fd, TIOCOUTQ, &output_queue ) != 0 )
 	{
 		LOG_ERROR( create_perror_string( "Failed get IOCTL port queue" ) );
 		return 2;
 	}
 
-	if ( ioctl( this->serial_fd, TIOCMGET, &flow_ctrl_status ) != 0 )
+	if ( _output_queue != nullptr )
+	{
+		*_output_queue = output_queue;
+	}
+
+	if ( this->has_modem_lines && ioctl( this->serial_fd, TIOCMGET, &flow_ctrl_status ) != 0 )
 	{
-		LOG_ERROR( create_perror_string( "Failed get IOCTL port status" ) );
-		return 3;
+		if ( errno == ENOTTY || errno == EINVAL )
+		{
+			LOG_INFO( "Port has no modem control lines.  Assuming CTS is always high." );
+			this->has_modem_lines = false;
+			flow_ctrl_status = TIOCM_CTS;
+		}
+		else
+		{
+			LOG_ERROR( create_perror_string( "Failed get IOCTL port status" ) );
+			return 3;
+		}
 	}
 
 	if ( output_queue == 0 && ( flow_ctrl_status & TIOCM_CTS ) )
@@ -424,975 +576,1492 @@ ENUM_ERRORS SER_IO_COMM::serial_port_open( void )
 		return ENUM_ERRORS::ERR_ATTRIBUTES;
 	}
 
-	return ENUM_ERRORS::ERR_NONE;
-}
-
-ENUM_ERRORS SER_IO_COMM::init( void )
-{
-	LOG_INFO( "Operating on serial port:" + this->tty_dev );
-
-	if ( !this->try_lock_serial() )
-	{
-		LOG_ERROR( "Failed to obtain lock on serial port." );
-		return ENUM_ERRORS::ERR_FAIL_LOCK;
-	}
-
-	ENUM_ERRORS rc;
+	/*
+	 * serial_port_close suspends the output.  The suspension outlives the descriptor when the port is reopened to recover a hung board.
+	 */
+	tcflow( this->serial_fd, TCOON );
 
-	if ( ( rc = this->serial_port_open() ) != ENUM_ERRORS::ERR_NONE )
+	if ( this->epoll_fd >= 0 )
 	{
-		LOG_ERROR( "Failed to open serial port." );
-		return rc;
+		if ( !this->add_event_source( EVENT_SOURCE_SERIAL, this->serial_fd ) )
+		{
+			return ENUM_ERRORS::ERR_COMM;
+		}
 	}
 
-	LOG_DEBUG( "Init successful" );
 	return ENUM_ERRORS::ERR_NONE;
 }
 
-bool SER_IO_COMM::write_buffer( const unsigned char* _buffer, size_t _length )
+bool SER_IO_COMM::add_event_source( ENUM_EVENT_SOURCES _type, int _fd )
 {
-	ssize_t bytes_written = 0;
-	ssize_t rc;
-	unsigned char cts_res = 0;
+	struct epoll_event ev;
+	memset( &ev, 0, sizeof( ev ) );
+	ev.events = EPOLLIN;
+	ev.data.ptr = &this->event_sources[_type];
 
-	while ( this->abort_thread == false )
+	if ( epoll_ctl( this->epoll_fd, EPOLL_CTL_ADD, _fd, &ev ) != 0 )
 	{
-		cts_res = this->clear_to_send();
-
-		if ( cts_res == 0 )
-		{
-			continue;
-		}
-		else if ( cts_res == 1 )
-		{
-			/*
-			Normal clear to continue
-			*/
-		}
-		else
-		{
-			/*
-			Error condition.
-			*/
-			return false;
-		}
-
-		rc = write( this->serial_fd, _buffer + bytes_written, _length - ( size_t )bytes_written );
-
-		if ( rc < 0 )
-		{
-			LOG_ERROR( create_perror_string( this->tag + ": Failed to write message to IO board. rc < 0" ) );
-			return false;
-		}
+		LOG_ERROR( create_perror_string( "Failed to add event source " + num_to_str( ( unsigned int )_type ) + " to epoll" ) );
+		return false;
+	}
 
-		bytes_written += rc;
+	return true;
+}
 
-		if ( ( size_t ) bytes_written == _length )
-		{
-			break;
-		}
+bool SER_IO_COMM::event_fds_open( void )
+{
+	if ( ( this->epoll_fd = epoll_create1( EPOLL_CLOEXEC ) ) < 0 )
+	{
+		LOG_ERROR( create_perror_string( "epoll_create1" ) );
+		return false;
 	}
 
-	if ( _length != ( size_t ) bytes_written )
+	if ( ( this->shutdown_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) < 0 )
 	{
-		LOG_ERROR( "(1/2) Write loop aborted before writing full buffer." )
-		LOG_ERROR( "(2/2) Bytes written: " + num_to_str( bytes_written ) + "; buffer length: " + num_to_str( _length ) );
+		LOG_ERROR( create_perror_string( "eventfd" ) );
+		return false;
+	}
 
+	if ( ( this->timer_fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC ) ) < 0 )
+	{
+		LOG_ERROR( create_perror_string( "timerfd_create" ) );
 		return false;
 	}
-	else
+
+	if ( !this->add_event_source( EVENT_SOURCE_SHUTDOWN, this->shutdown_fd ) )
 	{
-		return true;
+		return false;
 	}
-}
 
-bool SER_IO_COMM::add_do_status( size_t _idx )
-{
-	this->state_cache->add_do_status( this->active_table->table[_idx][RESP_HEAD_SIZE] );
-	return true;
-}
+	if ( !this->add_event_source( EVENT_SOURCE_TIMER, this->timer_fd ) )
+	{
+		return false;
+	}
 
-bool SER_IO_COMM::add_pmic_status( size_t _idx )
-{
-	this->state_cache->add_pmic_status( this->active_table->table[_idx][RESP_HEAD_SIZE] );
 	return true;
 }
 
-bool SER_IO_COMM::add_calibration_values( size_t _idx, unsigned char _level )
+void SER_IO_COMM::event_fds_close( void )
 {
-	BOARD_STATE_CACHE::CAL_VALUE_ADDER_PTR adder_ptr;
-	unsigned char* line = this->active_table->table[_idx];
-	uint16_t length = ASSEMBLE_16INT( line[RESP_HEAD_LEN_LSB_IDX], line[RESP_HEAD_LEN_MSB_IDX] );
-	size_t result_index = 0;
-
-	/*
-	XXX - Need to reimplement
-	if(length != GC_IO_AI_COUNT * 2)
+	if ( this->timer_fd >= 0 )
 	{
-		LOG_ERROR_P("Invalid payload length for cache value response.  Expecting: " + num_to_str(GC_IO_AI_COUNT * 2) + ", received: " + num_to_str(length));
-		return false;
+		close( this->timer_fd );
+		this->timer_fd = -1;
 	}
-	*/
 
-	if ( _level == 1 )
-	{
-		adder_ptr = &BOARD_STATE_CACHE::add_l1_cal_value;
-	}
-	else if ( _level == 2 )
-	{
-		adder_ptr = &BOARD_STATE_CACHE::add_l2_cal_value;
-	}
-	else
+	if ( this->shutdown_fd >= 0 )
 	{
-		LOG_ERROR( "Invalid cache level parameter supplied." );
-		return false;
+		close( this->shutdown_fd );
+		this->shutdown_fd = -1;
 	}
 
-	for ( size_t i = 0; ( i < length && result_index < GC_IO_AI_COUNT ); i += 2 )
+	if ( this->epoll_fd >= 0 && !this->reactor_mode )
 	{
-		adder_ptr( *( this->state_cache ), result_index, ASSEMBLE_16INT( line[RESP_HEAD_SIZE + i], line[RESP_HEAD_SIZE + i + 1] ) );
-		result_index += 1;
+		close( this->epoll_fd );
 	}
 
-	return true;
+	this->epoll_fd = -1;
+	return;
 }
 
-bool SER_IO_COMM::add_boot_count( size_t _idx )
+bool SER_IO_COMM::attach_to_reactor( int _epoll_fd )
 {
-	unsigned char* line = this->active_table->table[_idx];
-	uint16_t length = ASSEMBLE_16INT( line[RESP_HEAD_LEN_LSB_IDX], line[RESP_HEAD_LEN_MSB_IDX] );
+	/*
+	 * Closing our own epoll instance drops the registrations made in init.
+	 */
+	if ( this->epoll_fd >= 0 && !this->reactor_mode )
+	{
+		close( this->epoll_fd );
+	}
 
-	if ( length != 4 )
+	this->epoll_fd = _epoll_fd;
+	this->reactor_mode = true;
+
+	if ( !this->add_event_source( EVENT_SOURCE_SERIAL, this->serial_fd ) ||
+			!this->add_event_source( EVENT_SOURCE_TIMER, this->timer_fd ) ||
+			!this->add_event_source( EVENT_SOURCE_SHUTDOWN, this->shutdown_fd ) ||
+			!this->add_event_source( EVENT_SOURCE_OUTGOING, this->outgoing_messages->get_doorbell_fd() ) )
 	{
-		LOG_ERROR( "Invalid payload length received for boot count response: " + num_to_str( length ) );
 		return false;
 	}
 
-	this->state_cache->set_boot_count( ASSEMBLE_16INT( line[RESP_HEAD_SIZE], line[RESP_HEAD_SIZE + 1] ) );
-	return true;
+	return this->start_event_processing();
 }
 
-bool SER_IO_COMM::add_ai_result( size_t _line_index )
+void SER_IO_COMM::detach_from_reactor( void )
 {
-	unsigned char* line = this->active_table->table[_line_index];
-	uint16_t length = ASSEMBLE_16INT( line[RESP_HEAD_LEN_LSB_IDX], line[RESP_HEAD_LEN_MSB_IDX] );
-	length = ( uint16_t )( length - 3 ); 	// This is goddamn ridiculous
-	size_t result_index = 0;
+	if ( !this->reactor_mode || this->epoll_fd < 0 )
+	{
+		return;
+	}
 
 	/*
-	We're expecting RESP_HEAD_SIZE of header, 16 bytes of payload, and 2 bytes of checksum
-	*/
-
-	for ( size_t i = 0; ( i < length && result_index < GC_IO_AI_COUNT ); i += 2 )
+	 * Failures are of no consequence.  Not all of the descriptors are guaranteed to have been registered.
+	 */
+	if ( this->serial_fd > 0 )
 	{
-		this->state_cache->add_adc_value( result_index, ASSEMBLE_16INT( line[RESP_HEAD_SIZE + i], line[RESP_HEAD_SIZE + i + 1] ) );
-		result_index = result_index + 1;
+		epoll_ctl( this->epoll_fd, EPOLL_CTL_DEL, this->serial_fd, nullptr );
 	}
 
-	return true;
-}
+	epoll_ctl( this->epoll_fd, EPOLL_CTL_DEL, this->timer_fd, nullptr );
+	epoll_ctl( this->epoll_fd, EPOLL_CTL_DEL, this->shutdown_fd, nullptr );
+	epoll_ctl( this->epoll_fd, EPOLL_CTL_DEL, this->outgoing_messages->get_doorbell_fd(), nullptr );
 
-void SER_IO_COMM::set_active_table_line_blank( size_t _idx )
-{
-	this->active_table->table[_idx][0] = 0xFF;
-	this->active_table->table[_idx][1] = 0xFF;
+	this->epoll_fd = -1;
 	return;
 }
 
-void SER_IO_COMM::process_binary_message( size_t _idx )
+void SER_IO_COMM::flush_pending_output( void )
 {
-	//uint8_t cmd = this->active_table->table[_idx][1];
-	ENUM_BOARD_COMMANDS cmd = static_cast < ENUM_BOARD_COMMANDS >( this->active_table->table[_idx][1] );
-	//uint8_t status = this->active_table->table[i][2];
-	uint16_t length = ASSEMBLE_16INT( this->active_table->table[_idx][RESP_HEAD_LEN_LSB_IDX], this->active_table->table[_idx][RESP_HEAD_LEN_MSB_IDX] );
-	uint16_t* data_ptr = ( uint16_t* ) this->active_table->table[_idx];
-	uint16_t chksum = checksum( data_ptr, ( length  + RESP_HEAD_SIZE ) / 2 );
+	struct iovec spans[GC_SERIAL_MAX_WRITE_SPANS];
 
-	if ( chksum != 0 )
+	if ( !this->port_is_open() )
 	{
-		LOG_ERROR( "Message failed checksum check: " + num_to_str( chksum ) + ", in message: " + num_to_str( data_ptr[4] ) );
-		LOG_ERROR( "Message length: " + num_to_str( length ) );
-		LOG_ERROR( "\n" + buffer_to_hex( this->active_table->table[_idx], length  + RESP_HEAD_SIZE ) );
-		goto _end;
+		this->discard_pending_output();
+		return;
 	}
 
-	//LOG_DEBUG_P("Command: " + to_string(cmd) + ", status: " + to_string(status) + ", length: " + to_string(length));
-
-	switch ( cmd )
+	while ( !this->pending_output.empty() )
 	{
-		case CMD_ID_RESET_BOARD:
+		unsigned char cts_res = this->clear_to_send();
+
+		if ( cts_res == 0 )
 		{
-			// This should never happen.
-			LOG_ERROR( "We received a response of type CMD_ID_RESET_BOARD??  How is that possible?" )
-			LOG_ERROR( buffer_to_hex( this->active_table->table[_idx], RESP_HEAD_SIZE + length ) );
-			this->set_active_table_line_blank( _idx );
-			break;
+			/*
+			 * The reactor will try again shortly.
+			 */
+			return;
+		}
+		else if ( cts_res != 1 )
+		{
+			/*
+			Error condition.
+			*/
+			this->abort_thread = true;
+			return;
 		}
 
-		case CMD_ID_GET_AI_STATUS:
+		size_t span_count = this->fill_output_spans( spans, GC_SERIAL_MAX_WRITE_SPANS );
+		ssize_t rc = writev( this->serial_fd, spans, ( int ) span_count );
+
+		if ( rc < 0 )
 		{
-			if ( length % 2 != 0 )
+			if ( errno == EAGAIN || errno == EWOULDBLOCK )
 			{
-				LOG_ERROR( "Payload length for response to CMD_ID_GET_AI_SATATUS is not a multiple of two [" + num_to_str( length ) + "].  Clearing offending line." );
-				this->set_active_table_line_blank( _idx );
 				return;
 			}
 
-			this->add_ai_result( _idx );
-			break;
+			LOG_ERROR( create_perror_string( this->tag + ": Failed to write message to IO board. rc < 0" ) );
+			this->abort_thread = true;
+			return;
 		}
 
-		case CMD_ID_GET_DO_STATUS:
-		{
-			this->add_do_status( _idx );
-			break;
-		}
+		this->capture_spans( ENUM_CAPTURE_DIRECTION::TO_BOARD, spans, ( size_t ) rc );
+		this->consume_output( ( size_t ) rc );
+	}
 
-		case CMD_ID_SET_DO_STATUS:
-		{
-			//LOG_ERROR_P( "Accepting response to CMD_ID_SET_DO_STATUS is not yet implemented." );
-			/*
-			 * There's really nothing for us to do with a response.
-			 */
-			this->set_active_table_line_blank( _idx );
-			break;
-		}
+	return;
+}
 
-		case CMD_ID_GET_PMIC_STATUS:
-		{
-			//LOG_ERROR_P( "Accepting response to CMD_ID_GET_PMIC_STATUS is not yet implemented." );
-			/*
-			 * What can we possibly do about a response.
-			 */
-			this->add_pmic_status( _idx );
-			break;
-		}
+void SER_IO_COMM::flag_for_stop( void )
+{
+	IO_COMM_BASE::flag_for_stop();
 
-		case CMD_ID_SET_PMIC_STATUS:
-		{
-			//LOG_ERROR_P( "Accepting response to CMD_ID_SET_PMIC_STATUS is not yet implemented." );
-			this->set_active_table_line_blank( _idx );
-			break;
-		}
+	/*
+	 * Wakes up the writer thread.
+	 */
+	this->outgoing_messages->wake();
 
-		case CMD_ID_GET_L1_CAL_VALS:
-		{
-			this->add_calibration_values( _idx, 1 );
-			break;
-		}
+	if ( this->shutdown_fd >= 0 )
+	{
+		uint64_t one = 1;
 
-		case CMD_ID_GET_L2_CAL_VALS:
+		if ( write( this->shutdown_fd, &one, sizeof( one ) ) != sizeof( one ) )
 		{
-			this->add_calibration_values( _idx, 2 );
-			break;
+			LOG_ERROR( create_perror_string( "Failed to signal shutdown eventfd" ) );
 		}
+	}
 
-		case CMD_ID_SET_L1_CAL_VALS:
+	return;
+}
+
+ENUM_ERRORS SER_IO_COMM::init( void )
+{
+	LOG_INFO( "Operating on serial port:" + this->tty_dev );
+
+	if ( !this->try_lock_serial() )
+	{
+		LOG_ERROR( "Failed to obtain lock on serial port." );
+		return ENUM_ERRORS::ERR_FAIL_LOCK;
+	}
+
+	ENUM_ERRORS rc;
+
+	if ( !this->event_fds_open() )
+	{
+		LOG_ERROR( "Failed to create event loop descriptors." );
+		return ENUM_ERRORS::ERR_COMM;
+	}
+
+	if ( ( rc = this->serial_port_open() ) != ENUM_ERRORS::ERR_NONE )
+	{
+		LOG_ERROR( "Failed to open serial port." );
+		return rc;
+	}
+
+	LOG_DEBUG( "Init successful" );
+	return ENUM_ERRORS::ERR_NONE;
+}
+
+unsigned char SER_IO_COMM::wait_for_clear_to_send( void )
+{
+	unsigned int output_queue = 0;
+	unsigned char cts_res = this->clear_to_send( &output_queue );
+
+	if ( cts_res != 0 )
+	{
+		return cts_res;
+	}
+
+	uint64_t wait_start = monotonic_usec();
+	uint64_t waited = 0;
+	uint64_t poll_interval = GC_SERIAL_CTS_POLL_INTERVAL;
+
+	while ( cts_res == 0 && this->abort_thread == false && this->port_is_open() )
+	{
+		if ( waited >= GC_SERIAL_CTS_WAIT_TIMEOUT )
 		{
-			//LOG_ERROR_P( "Accepting response to CMD_ID_SET_L1_CAL_VALS is not yet implemented." );
+			this->stat_write_timeouts += 1;
 			break;
 		}
 
-		case CMD_ID_SET_L2_CAL_VALS:
+		if ( output_queue > 0 )
 		{
-			//LOG_ERROR_P("Accepting response to CMD_ID_SET_L2_CAL_VALS is not yet implemented.");
-			break;
+			/*
+			If there's data queued up the CTS line is irrelevant until the port drains.
+			*/
+			interruptible_sleep( std::min<uint64_t>( ( uint64_t ) output_queue * GC_SERIAL_CHAR_TIME, GC_SERIAL_CTS_WAIT_TIMEOUT - waited ) );
 		}
+		else if ( this->has_modem_wait )
+		{
+			/*
+			The board is holding CTS low.  TIOCMIWAIT has no timeout of its own; the supervisor interrupts it once the deadline passes.
+			A CTS edge that lands between the check above and the wait is only noticed at the deadline.
+			*/
+			this->cts_wait_deadline = wait_start + GC_SERIAL_CTS_WAIT_TIMEOUT;
+			int rc = ioctl( this->serial_fd, TIOCMIWAIT, TIOCM_CTS );
+			this->cts_wait_deadline = 0;
 
-		case CMD_ID_GET_BOOT_COUNT:
+			if ( rc != 0 && errno != EINTR )
+			{
+				if ( errno == ENOTTY || errno == EINVAL )
+				{
+					LOG_INFO( "Port can not wait for modem line changes.  Polling CTS instead." );
+					this->has_modem_wait = false;
+				}
+				else
+				{
+					LOG_ERROR( create_perror_string( "Failed to wait for CTS" ) );
+					return 3;
+				}
+			}
+		}
+		else
 		{
-			this->add_boot_count( _idx );
-			break;
+			/*
+			Fallback for drivers without TIOCMIWAIT.  The interval doubles on every check so a board that holds CTS low for long is not polled at full rate.
+			*/
+			interruptible_sleep( std::min<uint64_t>( poll_interval, GC_SERIAL_CTS_WAIT_TIMEOUT - waited ) );
+			poll_interval = std::min<uint64_t>( poll_interval * 2, GC_SERIAL_CTS_POLL_INTERVAL_MAX );
 		}
 
-		case CMD_ID_GET_CONFIRM_OUTPUT:
+		cts_res = this->clear_to_send( &output_queue );
+		waited = monotonic_usec() - wait_start;
+	}
+
+	this->stat_write_blocked_usec += waited;
+	this->stat_write_block_count += 1;
+
+	if ( waited > this->stat_write_blocked_max_usec )
+	{
+		this->stat_write_blocked_max_usec = waited;
+	}
+
+	return cts_res;
+}
+
+void SER_IO_COMM::wake_writer( void )
+{
+	if ( this->writer_running )
+	{
+		pthread_kill( this->writer_thread, GC_SERIAL_WRITER_WAKE_SIGNAL );
+	}
+
+	return;
+}
+
+void SER_IO_COMM::get_io_stats( SERIAL_IO_STATS& _dest ) const
+{
+	_dest.write_blocked_usec = this->stat_write_blocked_usec;
+	_dest.write_blocked_max_usec = this->stat_write_blocked_max_usec;
+	_dest.write_block_count = this->stat_write_block_count;
+	_dest.write_timeouts = this->stat_write_timeouts;
+	_dest.commands_coalesced = this->stat_commands_coalesced;
+	_dest.bytes_received = this->stat_bytes_received;
+	_dest.frames_decoded = this->stat_frames_decoded;
+	_dest.checksum_errors = this->stat_checksum_errors;
+	_dest.lines_decoded = this->stat_lines_decoded;
+	_dest.frames_rejected = this->stat_frames_rejected;
+	_dest.state_updates = this->stat_state_updates;
+	_dest.hung_boards = this->stat_hung_boards;
+	_dest.reopen_failures = this->stat_reopen_failures;
+	_dest.reset_timeouts = this->stat_reset_timeouts;
+	_dest.recoveries = this->stat_recoveries;
+	_dest.recover_usec = this->stat_recover_usec;
+	_dest.recover_max_usec = this->stat_recover_max_usec;
+	_dest.warm_attaches = this->stat_warm_attaches;
+	_dest.attach_fallbacks = this->stat_attach_fallbacks;
+	_dest.attach_usec = this->stat_attach_usec;
+	return;
+}
+
+size_t SER_IO_COMM::fill_output_spans( struct iovec* _spans, size_t _max_spans ) const
+{
+	size_t span_count = 0;
+	size_t offset = this->pending_offset;
+
+	for ( auto i = this->pending_output.begin(); i != this->pending_output.end() && span_count < _max_spans; ++i )
+	{
+		_spans[span_count].iov_base = ( void* )( i->message + offset );
+		_spans[span_count].iov_len = i->message_length - offset;
+		span_count += 1;
+		offset = 0;
+	}
+
+	return span_count;
+}
+
+void SER_IO_COMM::consume_output( size_t _length )
+{
+	while ( _length > 0 && !this->pending_output.empty() )
+	{
+		size_t remaining = this->pending_output.front().message_length - this->pending_offset;
+
+		if ( _length < remaining )
 		{
-			// Do nothing
+			this->pending_offset += _length;
 			break;
 		}
 
-		case CMD_ID_START_STREAM:
+		_length -= remaining;
+		this->pending_output.pop_front();
+		this->pending_offset = 0;
+	}
+
+	return;
+}
+
+void SER_IO_COMM::coalesce_pending_output( void )
+{
+	if ( this->pending_output.size() < 2 )
+	{
+		return;
+	}
+
+	/*
+	 * Walk backwards remembering which commands have a later instance.  A reset wipes the slate clean; a command that precedes a reset is never folded into
+	 * one that follows it.  A partially written first message is left alone.  Superseded messages are marked with a zero length and squeezed out in place
+	 * afterwards so that nothing is allocated on the way to the port.
+	 */
+	bool superseded[256];
+	memset( superseded, 0, sizeof( superseded ) );
+	size_t first = ( this->pending_offset > 0 ) ? 1 : 0;
+	size_t dropped = 0;
+
+	for ( size_t i = this->pending_output.size(); i > first; i-- )
+	{
+		OUTGOING_MESSAGE& msg = this->pending_output[i - 1];
+
+		if ( msg.message_length <= CMD_FRAME_CI_IDX )
 		{
-			// Do nothing
-			break;
+			continue;
 		}
 
-		case CMD_ID_GET_BOARD_STATS:
+		unsigned char cmd = msg.message[CMD_FRAME_CI_IDX];
+
+		if ( cmd == CMD_ID_RESET_BOARD )
 		{
-			// do nothing
-			/*
-			XXX - Need to implement
-			*/
-			break;
+			memset( superseded, 0, sizeof( superseded ) );
+			continue;
 		}
 
-		case CMD_ID_SYS_FAILURE:
+		if ( !is_superseding_command( cmd ) )
 		{
-			LOG_ERROR( "Board returned a hard error.  Buffer output bellow:" );
-			LOG_ERROR( "\n" + buffer_to_hex( this->active_table->table[_idx], length  + RESP_HEAD_SIZE ) );
-			break;
+			continue;
 		}
 
-		default:
+		if ( superseded[cmd] )
 		{
-			LOG_ERROR( "Unrecognized command: " + to_string( cmd ) );
-			break;
+			msg.message_length = 0;
+			dropped += 1;
 		}
+
+		superseded[cmd] = true;
+	}
+
+	if ( dropped > 0 )
+	{
+		auto end = std::remove_if( this->pending_output.begin() + ( std::ptrdiff_t ) first, this->pending_output.end(), []( const OUTGOING_MESSAGE & _msg )
+		{
+			return _msg.message_length == 0;
+		} );
+		this->pending_output.erase( end, this->pending_output.end() );
+		this->stat_commands_coalesced += dropped;
 	}
 
-_end:
-	this->set_active_table_line_blank( _idx );
 	return;
 }
 
-token_vector SER_IO_COMM::tokenize_protocol_line( size_t _line_index )
+/*
+ * Indexed by command, starting with CMD_ID_GET_AI_STATUS.  CMD_ID_SYS_FAILURE is kept past the end of the contiguous range.
+ * Lengths include the checksum word.  Single byte payloads come padded to a whole word, but a bare byte is accepted too.
+ */
+constexpr SER_IO_COMM::ST_BINARY_COMMAND SER_IO_COMM::binary_commands[] =
 {
-	token_vector ret;
-	const unsigned char* line = this->active_table->table[_line_index];
-	ssize_t str_len = ( ssize_t )strlen( ( const char* ) line );
-	ssize_t left_idx = find_last_index_of( line, '|', str_len );
-	ssize_t right_idx = 0;
+	{ CMD_ID_GET_AI_STATUS, 4, 2 + ( GC_IO_AI_COUNT * 2 ), true, true, &SER_IO_COMM::add_ai_result, "CMD_ID_GET_AI_STATUS" },
+	{ CMD_ID_GET_DO_STATUS, 3, 4, false, true, &SER_IO_COMM::add_do_status, "CMD_ID_GET_DO_STATUS" },
+	{ CMD_ID_GET_PMIC_STATUS, 3, 4, false, true, &SER_IO_COMM::add_pmic_status, "CMD_ID_GET_PMIC_STATUS" },
+	{ CMD_ID_GET_L1_CAL_VALS, 2, 2 + ( GC_IO_AI_COUNT * 2 ), true, true, &SER_IO_COMM::add_l1_calibration_values, "CMD_ID_GET_L1_CAL_VALS" },
+	{ CMD_ID_GET_L2_CAL_VALS, 2, 2 + ( GC_IO_AI_COUNT * 2 ), true, true, &SER_IO_COMM::add_l2_calibration_values, "CMD_ID_GET_L2_CAL_VALS" },
+	{ CMD_ID_GET_BOOT_COUNT, 4, 4, true, true, &SER_IO_COMM::add_boot_count, "CMD_ID_GET_BOOT_COUNT" },
+	/*
+	XXX - Need to implement.  Firmware commands get a row here and a handler; the dispatch does not change.
+	*/
+	{ CMD_ID_GET_BOARD_STATS, 2, GC_SERIAL_MAX_BINARY_PAYLOAD, false, false, nullptr, "CMD_ID_GET_BOARD_STATS" },
+	/*
+	 * There's really nothing for us to do with the responses to the set commands.  The new state comes in with the next status response.
+	 */
+	{ CMD_ID_SET_DO_STATUS, 2, GC_SERIAL_MAX_BINARY_PAYLOAD, false, false, nullptr, "CMD_ID_SET_DO_STATUS" },
+	{ CMD_ID_SET_PMIC_STATUS, 2, GC_SERIAL_MAX_BINARY_PAYLOAD, false, false, nullptr, "CMD_ID_SET_PMIC_STATUS" },
+	{ CMD_ID_SET_L1_CAL_VALS, 2, GC_SERIAL_MAX_BINARY_PAYLOAD, false, false, nullptr, "CMD_ID_SET_L1_CAL_VALS" },
+	{ CMD_ID_SET_L2_CAL_VALS, 2, GC_SERIAL_MAX_BINARY_PAYLOAD, false, false, nullptr, "CMD_ID_SET_L2_CAL_VALS" },
+	{ CMD_ID_GET_CONFIRM_OUTPUT, 2, GC_SERIAL_MAX_BINARY_PAYLOAD, false, false, nullptr, "CMD_ID_GET_CONFIRM_OUTPUT" },
+	{ CMD_ID_START_STREAM, 2, GC_SERIAL_MAX_BINARY_PAYLOAD, false, false, nullptr, "CMD_ID_START_STREAM" },
+	{ CMD_ID_RESET_BOARD, 2, GC_SERIAL_MAX_BINARY_PAYLOAD, false, false, &SER_IO_COMM::log_unexpected_response, "CMD_ID_RESET_BOARD" },
+	{ CMD_ID_SYS_FAILURE, 2, GC_SERIAL_MAX_BINARY_PAYLOAD, false, false, &SER_IO_COMM::log_board_failure, "CMD_ID_SYS_FAILURE" }
+};
+
+/**
+ * Checks that every descriptor of the command table sits at the index of its command and stays within the receive limits.
+ */
+static constexpr bool binary_commands_valid( const SER_IO_COMM::ST_BINARY_COMMAND* _table, size_t _count, size_t _idx )
+{
+	return ( _idx == _count ) || (
+			   ( _idx + 1 == _count ? _table[_idx].command == SER_IO_COMM::CMD_ID_SYS_FAILURE : _table[_idx].command == SER_IO_COMM::CMD_ID_GET_AI_STATUS + _idx ) &&
+			   _table[_idx].min_length >= 2 &&
+			   _table[_idx].min_length <= _table[_idx].max_length &&
+			   _table[_idx].max_length <= GC_SERIAL_MAX_BINARY_PAYLOAD &&
+			   binary_commands_valid( _table, _count, _idx + 1 ) );
+}
+
+const SER_IO_COMM::ST_BINARY_COMMAND* SER_IO_COMM::find_binary_command( unsigned char _cmd )
+{
+	static constexpr size_t count = sizeof( binary_commands ) / sizeof( binary_commands[0] );
+	static_assert( count == ( CMD_ID_RESET_BOARD - CMD_ID_GET_AI_STATUS ) + 2, "Binary command table does not cover every command." );
+	static_assert( binary_commands_valid( binary_commands, count, 0 ), "Binary command table is out of order or exceeds GC_SERIAL_MAX_BINARY_PAYLOAD." );
+
+	if ( _cmd >= CMD_ID_GET_AI_STATUS && _cmd <= CMD_ID_RESET_BOARD )
+	{
+		return &binary_commands[_cmd - CMD_ID_GET_AI_STATUS];
+	}
+	else if ( _cmd == CMD_ID_SYS_FAILURE )
+	{
+		return &binary_commands[count - 1];
+	}
+	else
+	{
+		return nullptr;
+	}
+}
 
-	if ( left_idx < 0 )
+bool SER_IO_COMM::is_superseding_command( unsigned char _cmd )
+{
+	switch ( _cmd )
 	{
-		LOG_ERROR( "Malformed protocol message: " + string( ( const char* ) line ) );
-		return ret;
+		case CMD_ID_SET_DO_STATUS:
+		case CMD_ID_SET_PMIC_STATUS:
+		case CMD_ID_SET_L1_CAL_VALS:
+		case CMD_ID_SET_L2_CAL_VALS:
+		case CMD_ID_GET_CONFIRM_OUTPUT:
+			return true;
+
+		default:
+			return false;
 	}
+}
 
-	right_idx = find_index_of( line, '.', left_idx + 1, str_len );
+bool SER_IO_COMM::write_buffer( void )
+{
+	struct iovec spans[GC_SERIAL_MAX_WRITE_SPANS];
+	ssize_t rc;
+	unsigned char cts_res = 0;
 
-	while ( 1 )
+	/*
+	Claim the port before looking at its state.  The supervisor changes the state before it looks at the claim and waits for the claim to be released
+	before it closes the port, so the descriptor can not change under us.
+	*/
+	this->writer_on_port = true;
+
+	while ( this->abort_thread == false && !this->pending_output.empty() )
 	{
-		if ( left_idx + 1 != right_idx )
-		{
-			ret.push_back( token( left_idx + 1, right_idx ) );
-		}
-		else
+		if ( !this->port_is_open() )
 		{
+			/*
+			 * The supervisor has closed the port of a hung board.  Whatever is pending was meant for the board as it was before it hung.
+			 */
+			this->discard_pending_output();
 			break;
 		}
 
-		left_idx = right_idx;
+		cts_res = this->wait_for_clear_to_send();
 
-		if ( left_idx == str_len )
+		if ( cts_res == 0 && !this->port_is_open() )
 		{
-			break;
+			continue;
+		}
+		else if ( cts_res == 0 )
+		{
+			LOG_ERROR( "Timed out waiting for board to become clear to send.  Total time blocked: " + num_to_str( ( unsigned long )this->stat_write_blocked_usec ) + " usec." );
+			continue;
+		}
+		else if ( cts_res == 1 )
+		{
+			/*
+			Normal clear to continue
+			*/
+		}
+		else
+		{
+			/*
+			Error condition.
+			*/
+			this->writer_on_port = false;
+			return false;
 		}
 
-		right_idx = find_index_of( line, '.', right_idx + 1, str_len );
+		size_t span_count = this->fill_output_spans( spans, GC_SERIAL_MAX_WRITE_SPANS );
+		rc = writev( this->serial_fd, spans, ( int ) span_count );
 
-		if ( right_idx < 0 )
+		if ( rc < 0 )
 		{
-			right_idx = str_len;
+			if ( errno == EINTR )
+			{
+				/*
+				Woken up by the supervisor.
+				*/
+				continue;
+			}
+			else if ( errno == EAGAIN || errno == EWOULDBLOCK )
+			{
+				/*
+				Port buffer is full.  Wait for room, but not forever, so that we notice if we're asked to stop.
+				*/
+				struct pollfd pfd;
+				pfd.fd = this->serial_fd;
+				pfd.events = POLLOUT;
+				pfd.revents = 0;
+				poll( &pfd, 1, GC_SERIAL_CTS_WAIT_TIMEOUT / 1000 );
+				continue;
+			}
+
+			LOG_ERROR( create_perror_string( this->tag + ": Failed to write message to IO board. rc < 0" ) );
+			this->writer_on_port = false;
+			return false;
 		}
+
+		this->capture_spans( ENUM_CAPTURE_DIRECTION::TO_BOARD, spans, ( size_t ) rc );
+		this->consume_output( ( size_t ) rc );
 	}
 
-	return ret;
+	this->writer_on_port = false;
+
+	if ( !this->pending_output.empty() )
+	{
+		LOG_ERROR( "Write loop aborted before writing all pending messages.  Messages left: " + num_to_str( this->pending_output.size() ) );
+		return false;
+	}
+	else
+	{
+		return true;
+	}
+}
+
+bool SER_IO_COMM::add_do_status( const FRAME_VIEW& _frame )
+{
+	this->state_cache->add_do_status( _frame[RESP_HEAD_SIZE] );
+	this->received_fields |= ( 1u << BOARD_STATE_FIELD_DO );
+	return true;
 }
 
-vector<string> SER_IO_COMM::create_protocol_line_tokens( const token_vector& _vect, size_t _idx )
+bool SER_IO_COMM::add_pmic_status( const FRAME_VIEW& _frame )
 {
-	const unsigned char* _line = this->active_table->table[_idx];
-	const string line( ( const char* ) _line );
-	vector<string>ret;
+	this->state_cache->add_pmic_status( _frame[RESP_HEAD_SIZE] );
+	this->received_fields |= ( 1u << BOARD_STATE_FIELD_PMIC );
+	return true;
+}
+
+bool SER_IO_COMM::add_calibration_values( const FRAME_VIEW& _frame, unsigned char _level )
+{
+	BOARD_STATE_CACHE::CAL_VALUE_ADDER_PTR adder_ptr;
+	uint16_t length = _frame.get_uint16( RESP_HEAD_LEN_LSB_IDX );
+	size_t result_index = 0;
+
+	/*
+	XXX - Need to reimplement
+	if(length != GC_IO_AI_COUNT * 2)
+	{
+		LOG_ERROR_P("Invalid payload length for cache value response.  Expecting: " + num_to_str(GC_IO_AI_COUNT * 2) + ", received: " + num_to_str(length));
+		return false;
+	}
+	*/
+
+	if ( _level == 1 )
+	{
+		adder_ptr = &BOARD_STATE_CACHE::add_l1_cal_value;
+	}
+	else if ( _level == 2 )
+	{
+		adder_ptr = &BOARD_STATE_CACHE::add_l2_cal_value;
+	}
+	else
+	{
+		LOG_ERROR( "Invalid cache level parameter supplied." );
+		return false;
+	}
 
-	for ( token_vector::const_iterator i = _vect.begin(); i != _vect.end(); ++i )
+	for ( size_t i = 0; ( i < length && result_index < GC_IO_AI_COUNT ); i += 2 )
 	{
-		string s = line.substr( i->first, i->second - i->first );
-		trim( s );
-		ret.push_back( s );
+		adder_ptr( *( this->state_cache ), result_index, _frame.get_uint16( RESP_HEAD_SIZE + i ) );
+		result_index += 1;
 	}
 
-	return ret;
+	return true;
 }
 
-void SER_IO_COMM::process_protocol_message( size_t _idx )
+bool SER_IO_COMM::add_l1_calibration_values( const FRAME_VIEW& _frame )
 {
-	token_vector token_indexes = this->tokenize_protocol_line( _idx );
+	return this->add_calibration_values( _frame, 1 );
+}
+
+bool SER_IO_COMM::add_l2_calibration_values( const FRAME_VIEW& _frame )
+{
+	return this->add_calibration_values( _frame, 2 );
+}
 
-	if ( token_indexes.size() < 1 )
+bool SER_IO_COMM::add_boot_count( const FRAME_VIEW& _frame )
+{
+	this->state_cache->set_boot_count( _frame.get_uint16( RESP_HEAD_SIZE ) );
+	return true;
+}
+
+bool SER_IO_COMM::log_unexpected_response( const FRAME_VIEW& _frame )
+{
+	// This should never happen.
+	LOG_ERROR( "We received a response of type " + string( find_binary_command( _frame[RESP_HEAD_CI_IDX] )->name ) + "??  How is that possible?" );
+	LOG_ERROR( _frame.to_hex() );
+	return false;
+}
+
+bool SER_IO_COMM::log_board_failure( const FRAME_VIEW& _frame )
+{
+	LOG_ERROR( "Board returned a hard error.  Buffer output bellow:" );
+	LOG_ERROR( "\n" + _frame.to_hex() );
+	return false;
+}
+
+bool SER_IO_COMM::add_ai_result( const FRAME_VIEW& _frame )
+{
+	uint16_t length = _frame.get_uint16( RESP_HEAD_LEN_LSB_IDX );
+	length = ( uint16_t )( length - 3 ); 	// This is goddamn ridiculous
+	size_t result_index = 0;
+
+	/*
+	We're expecting RESP_HEAD_SIZE of header, 16 bytes of payload, and 2 bytes of checksum
+	*/
+
+	for ( size_t i = 0; ( i < length && result_index < GC_IO_AI_COUNT ); i += 2 )
+	{
+		this->state_cache->add_adc_value( result_index, _frame.get_uint16( RESP_HEAD_SIZE + i ) );
+		result_index = result_index + 1;
+	}
+
+	this->received_fields |= ( 1u << BOARD_STATE_FIELD_AI );
+	return true;
+}
+
+void SER_IO_COMM::process_binary_message( const ST_BINARY_COMMAND& _command, const FRAME_VIEW& _frame )
+{
+	//uint8_t status = _frame[RESP_HEAD_STAT_LSB_IDX];
+	uint16_t length = _frame.get_uint16( RESP_HEAD_LEN_LSB_IDX );
+	uint16_t chksum = _frame.checksum( length  + RESP_HEAD_SIZE );
+
+	if ( chksum != 0 )
+	{
+		/*
+		 * The length is known to cover the checksum word.
+		 */
+		LOG_ERROR( "Message failed checksum check: " + num_to_str( chksum ) + ", in message: " + num_to_str( _frame.get_uint16( RESP_HEAD_SIZE + length - 2 ) ) );
+		LOG_ERROR( "Message length: " + num_to_str( length ) );
+		LOG_ERROR( "\n" + _frame.to_hex() );
+		this->stat_checksum_errors += 1;
+		return;
+	}
+
+	this->stat_frames_decoded += 1;
+
+	//LOG_DEBUG_P("Command: " + string(_command.name) + ", status: " + to_string(status) + ", length: " + to_string(length));
+
+	if ( _command.handler == nullptr )
 	{
 		return;
 	}
 
+	if ( ( this->*_command.handler )( _frame ) && _command.updates_cache )
+	{
+		this->stat_state_updates += 1;
+	}
+
+	return;
+}
+
+size_t SER_IO_COMM::tokenize_protocol_line( const FRAME_VIEW& _line, PROTOCOL_TOKENS& _dest )
+{
+	const char* line = ( const char* ) _line.head;
+	size_t length = _line.head_length;
+	size_t start = length;
+
+	_dest.count = 0;
+
+	/*
+	 * The tokens follow the last '|'.
+	 */
+	while ( start > 0 && line[start - 1] != '|' )
+	{
+		start -= 1;
+	}
+
+	if ( start == 0 )
+	{
+		LOG_ERROR( "Malformed protocol message: " + string( line, length ) );
+		return 0;
+	}
+
 	/*
-	 * XXX - crash on malformed messages here
+	 * Tokens are separated by '.'.  No separator means the whole remainder of the line is a single token.  An empty token ends the list.
 	 */
-	vector<string> tokens = this->create_protocol_line_tokens( token_indexes, _idx );
+	while ( start < length && _dest.count < GC_SERIAL_MAX_PROTOCOL_TOKENS )
+	{
+		const char* separator = ( const char* ) memchr( line + start, '.', length - start );
+		size_t end = ( separator == nullptr ? length : ( size_t )( separator - line ) );
+
+		if ( end == start )
+		{
+			break;
+		}
+
+		_dest.tokens[_dest.count] = TEXT_TOKEN( line + start, end - start ).trimmed();
+		_dest.count += 1;
+		start = end + 1;
+	}
+
+	return _dest.count;
+}
+
+void SER_IO_COMM::process_protocol_message( const FRAME_VIEW& _line )
+{
+	PROTOCOL_TOKENS tokens;
 
-	if ( ( tokens[0] == "F CC" && tokens[1] == "CC UP" ) )
+	if ( this->tokenize_protocol_line( _line, tokens ) < 2 )
+	{
+		return;
+	}
+
+	if ( ( tokens.tokens[0] == "F CC" && tokens.tokens[1] == "CC UP" ) )
 	{
 		LOG_DEBUG( "Board reset: communication controller up." );
 		this->board_has_reset = false;
 		this->stream_started = false;
+		this->received_fields = 0;
 	}
 
-	if ( ( tokens[0] == "F IC" && tokens[1] == "IC UP" ) )
+	if ( ( tokens.tokens[0] == "F IC" && tokens.tokens[1] == "IC UP" ) )
 	{
 		LOG_DEBUG( "Board reset: input controller up." );
 		LOG_DEBUG( "Complete board reset sensed." );
 		this->board_has_reset = true;
 		this->stream_started = false;
+		this->received_fields = 0;
 	}
 
 	return;
 }
 
-void SER_IO_COMM::process_text_message( size_t _idx )
+void SER_IO_COMM::process_text_message( const FRAME_VIEW& _line )
 {
-	LOG_DEBUG( string( ( char* )( this->active_table->table[_idx] ) ) );
+	LOG_DEBUG( string( ( const char* ) _line.head, _line.head_length ) );
 
-	if ( this->active_table->table[_idx][2] == '9' )
+	if ( _line.head_length > 2 && _line.head[2] == '9' )
 	{
-		this->process_protocol_message( _idx );
+		this->process_protocol_message( _line );
 	}
 
-	this->set_active_table_line_blank( _idx );
 	return;
 }
 
-bool SER_IO_COMM::digest_line_table( void )
+bool SER_IO_COMM::digest_frame_queue( void )
 {
-	for ( size_t i = 0; i < this->active_table->index; i++ )
+	FRAME_VIEW line;
+
+	while ( this->frame_queue.pop( line ) )
 	{
-		if ( this->active_table->table[i][0] == 0xFF && this->active_table->table[i][1] == 0xFF )
+		if ( line.head_length > 0 && line.head[0] >= 32 && line.head[0] <= 126 )
 		{
-			/*
-			 * Blank line
-			 */
-			continue;
+			this->stat_lines_decoded += 1;
+			this->process_text_message( line );
 		}
-		else if ( this->active_table->table[i][0] == 0x10 )
+		else
 		{
+			LOG_ERROR( "Unrecognized line dropped: " + line.to_hex() );
+		}
+	}
+
+	return true;
+}
+
+int SER_IO_COMM::assemble_serial_data( void )
+{
+	while ( this->buffer_context.scan_index < this->rx_ring.get_used() )
+	{
+		if ( this->buffer_context.in_bin_message == true )
+		{
+			/*
+			 * The binary message marker is at the read position of the ring.
+			 */
+			if ( this->rx_ring.get_used() < RESP_HEAD_SIZE )
+			{
+				/*
+				 * If we don't have enough data for the preamble.  Wait for more data.
+				 */
+				break;
+			}
+
+			unsigned char cmd = this->rx_ring.at( RESP_HEAD_CI_IDX );
+			uint16_t length = ASSEMBLE_16INT( this->rx_ring.at( RESP_HEAD_LEN_LSB_IDX ), this->rx_ring.at( RESP_HEAD_LEN_MSB_IDX ) );
+			const ST_BINARY_COMMAND* command = find_binary_command( cmd );
+
+			/*
+			XXX - There's a weird bug in here somewhere.  The size gets misinterpreted on an unexpected board reset.
+			*/
+			if ( command == nullptr || length < command->min_length || length > command->max_length || ( command->word_payload && length % 2 != 0 ) )
+			{
+				/*
+				 * Drop the marker and resynchronize on whatever follows it.  No point waiting for the rest of a message we would not accept.
+				 */
+				if ( command == nullptr )
+				{
+					LOG_ERROR( "Unrecognized command: " + num_to_str( ( unsigned int ) cmd ) + "; dropping binary marker." );
+				}
+				else
+				{
+					LOG_ERROR( "Weird message size for " + string( command->name ) + ": " + num_to_str( length ) + "; dropping binary marker." );
+				}
+
+				this->stat_frames_rejected += 1;
+				this->rx_ring.consume( 1 );
+				this->buffer_context.scan_index = 0;
+				this->buffer_context.in_bin_message = false;
+				continue;
+			}
+
+			if ( this->rx_ring.get_used() < ( size_t )( RESP_HEAD_SIZE + length ) )
+			{
+				/*
+				 * If we don't have enough data for the whole record.  Wait for more data.
+				 */
+				break;
+			}
+
 			/*
-			 * Binary message
+			 * The message is decoded straight out of the ring.  The space is released once it has been processed.
 			 */
-			this->process_binary_message( i );
+			this->process_binary_message( *command, this->rx_ring.get_view( 0, RESP_HEAD_SIZE + length ) );
+			this->rx_ring.consume( RESP_HEAD_SIZE + length );
+			this->buffer_context.scan_index = 0;
+			this->buffer_context.in_bin_message = false;
+			continue;
 		}
-		else if ( this->active_table->table[i][0] >= 32 && this->active_table->table[i][0] <= 126 )
+
+		unsigned char work_char = this->rx_ring.at( this->buffer_context.scan_index );
+
+		if ( work_char == 0x10 ) // begin of binary marker record.
 		{
-			this->process_text_message( i );
+			/*
+			Once we have the marker of the binary message, we enter enter binary message mode.
+			Any unterminated text in front of the marker is garbage.
+			*/
+			if ( this->buffer_context.scan_index > 0 )
+			{
+				LOG_DEBUG( "Discarding " + num_to_str( this->buffer_context.scan_index ) + " bytes of unterminated text in front of a binary message." );
+				this->rx_ring.consume( this->buffer_context.scan_index );
+				this->buffer_context.scan_index = 0;
+			}
+
+			this->buffer_context.in_bin_message = true;
+			continue;
 		}
-		else
+		else if ( work_char ==  '\n' || work_char == '\r' )
 		{
-			LOG_ERROR( "Line at index " + to_string( i ) + " was unrecognized.  Clearing offending line." );
-			//LOG_DEBUG_P( "\n" + buffer_to_hex( this->active_table->table[i], 16 ) );
-			this->set_active_table_line_blank( i );
+			/*
+			 * Text data.  Line terminators are not passed on.  Empty lines are skipped.
+			 */
+			if ( this->buffer_context.scan_index > 0 )
+			{
+				this->add_to_frame_queue( this->rx_ring.get_view( 0, this->buffer_context.scan_index ) );
+			}
+
+			this->rx_ring.consume( this->buffer_context.scan_index + 1 );
+			this->buffer_context.scan_index = 0;
+			continue;
 		}
+
+		this->buffer_context.scan_index += 1;
 	}
 
-	this->compact_line_table();
-	return true;
+	if ( this->rx_ring.get_free() == 0 )
+	{
+		/*
+		 * The ring is full and none of it could be consumed.
+		 */
+		LOG_ERROR( "Serial receive ring is full of unterminated data.  Data has been lost." );
+		this->reset_buffer_context();
+	}
+
+	return 1;
 }
 
-bool SER_IO_COMM::swap_two_line_table_lines( size_t _target_idx, size_t _source_idx )
+void SER_IO_COMM::add_to_frame_queue( const FRAME_VIEW& _frame )
 {
-	if ( _target_idx >= GC_SERIAL_LINE_TABLE_ENTRIES || _source_idx >= GC_SERIAL_LINE_TABLE_ENTRIES )
+	if ( !this->frame_queue.push( _frame ) )
 	{
-		LOG_ERROR( "One of the supplied indexes is >= GC_SERIAL_LINE_TABLE_ENTRIES." );
-		return false;
+		LOG_ERROR( "Frame queue is full.  Line of " + num_to_str( _frame.length() ) + " bytes has been dropped." );
 	}
 
-	unsigned char* temp = this->active_table->table[_target_idx];
-	this->active_table->table[_target_idx] = this->active_table->table[_source_idx];
-	this->active_table->table[_source_idx] = temp;
-	return true;
+	return;
+}
+
+void SER_IO_COMM::discard_pending_output( void )
+{
+	this->pending_output.clear();
+	this->pending_offset = 0;
+	return;
+}
+
+void SER_IO_COMM::handle_hung_board( uint64_t _now )
+{
+	LOG_WARNING( "Nothing received from the board for " + num_to_str( ( unsigned long )( _now - this->last_rx_usec ) ) + " usec.  Closing the port." );
+	this->stat_hung_boards += 1;
+	this->hung_since = _now;
+	this->reopen_backoff = GC_SERIAL_REOPEN_BACKOFF_MIN;
+	this->close_for_recovery( _now );
+	return;
 }
 
-size_t SER_IO_COMM::find_next_nonblank_line_table_line( size_t _start_idx ) const
+void SER_IO_COMM::close_for_recovery( uint64_t _now )
 {
-	if ( _start_idx >= GC_SERIAL_LINE_TABLE_ENTRIES )
+	/*
+	 * The writer claims the port before it checks the state so the state changes first.  \see write_buffer
+	 */
+	this->board_health = ENUM_BOARD_HEALTH::PORT_CLOSED;
+	this->board_has_reset = false;
+	this->stream_started = false;
+	this->received_fields = 0;
+	this->state_valid = false;
+	this->outgoing_messages->clear();
+
+	if ( this->reactor_mode )
 	{
-		LOG_ERROR( "Supplied line index >= GC_SERIAL_LINE_TABLE_ENTRIES." );
-		return _start_idx;
+		/*
+		 * In threaded mode the pending output belongs to the writer thread.  It drops it as soon as it sees the port closed.
+		 */
+		this->discard_pending_output();
 	}
 
-	for ( size_t i = _start_idx; i < GC_SERIAL_LINE_TABLE_ENTRIES; i++ )
+	if ( !this->release_port() )
 	{
-		if ( this->is_line_table_line_blank( _start_idx ) )
-		{
-			return i;
-		}
+		LOG_WARNING( "Writer did not let go of the port within " + num_to_str( ( unsigned long ) GC_SERIAL_WRITER_RELEASE_TIMEOUT ) + " usec.  Closing it later." );
 	}
 
-	/*
-	 * Did not find a next blank line.
-	 */
-	return _start_idx;
+	if ( this->hung_since == 0 )
+	{
+		/*
+		 * The board never came up after the initial reset.  The recovery is timed from here.
+		 */
+		this->hung_since = _now;
+	}
+
+	this->supervisor_deadline = _now + this->reopen_backoff;
+	this->reopen_backoff = std::min<uint64_t>( this->reopen_backoff * 2, GC_SERIAL_REOPEN_BACKOFF_MAX );
+	LOG_DEBUG( "Port closed.  Reopening in " + num_to_str( ( unsigned long )( this->supervisor_deadline - _now ) ) + " usec." );
+	return;
 }
 
-bool SER_IO_COMM::is_line_table_line_blank( size_t _idx ) const
+bool SER_IO_COMM::release_port( void )
 {
-	if ( _idx >= GC_SERIAL_LINE_TABLE_ENTRIES )
+	if ( !this->reactor_mode )
 	{
-		LOG_ERROR( "Supplied line index >= GC_SERIAL_LINE_TABLE_ENTRIES." );
-		return false;
+		/*
+		 * The writer may be in the middle of a write or blocked waiting for CTS.  Wake it up and wait for it to let go of the port.  It drops what it has
+		 * pending as soon as it sees the port closed.  Whatever it is stuck in, the supervisor has other boards and timers to look after.
+		 */
+		uint64_t deadline = monotonic_usec() + GC_SERIAL_WRITER_RELEASE_TIMEOUT;
+
+		while ( this->writer_on_port )
+		{
+			if ( monotonic_usec() >= deadline )
+			{
+				return false;
+			}
+
+			this->wake_writer();
+			interruptible_sleep( GC_SERIAL_CTS_POLL_INTERVAL );
+		}
 	}
 
-	if ( this->active_table->table[_idx][0] == 0xFF && this->active_table->table[_idx][1] == 0xFF )
+	if ( this->serial_fd > 0 )
 	{
-		return true;
+		this->serial_port_close();
 	}
 	else
 	{
-		return false;
+		/*
+		 * The last reopen did not get as far as opening the device.
+		 */
+		this->serial_fd = 0;
+		this->reset_buffer_context();
 	}
+
+	return true;
 }
 
-void SER_IO_COMM::compact_line_table( void )
+void SER_IO_COMM::reopen_hung_board( uint64_t _now )
 {
-	size_t non_blank_lines = 0;
-	size_t current_line_index = this->active_table->index;
-
-	for ( size_t i = 0; i < GC_SERIAL_LINE_TABLE_ENTRIES; i++ )
+	/*
+	 * No need to wait for the writer here.  It does not touch the descriptor until start_board_reset moves the board out of PORT_CLOSED.
+	 */
+	if ( this->serial_port_open() != ENUM_ERRORS::ERR_NONE )
 	{
-		if ( this->is_line_table_line_blank( i ) )
-		{
-			//LOG_DEBUG_P( "Found blank line @ " + to_string( i ) );
-			if ( i != GC_SERIAL_LINE_TABLE_ENTRIES - 1 )
-			{
-				size_t nb_idx = this->find_next_nonblank_line_table_line( i + 1 );
-
-				if ( nb_idx == i )
-				{
-					/*
-					 * Failed to find next nonblank line?  All lines after this one are blank?
-					 */
-					break;
-				}
-				else
-				{
-					/*
-					 * Found a next non blank line.
-					 */
-					if ( !this->swap_two_line_table_lines( i, nb_idx ) )
-					{
-						LOG_ERROR( "Failed to swap lines. Target: " + to_string( i ) + ", source: " + to_string( nb_idx ) );
-					}
-				}
-			}
-		}
-		else
-		{
-			non_blank_lines += 1;
-		}
+		this->stat_reopen_failures += 1;
+		this->close_for_recovery( _now );
+		return;
 	}
 
-	this->active_table->index = non_blank_lines;
+	LOG_DEBUG( "Port reopened.  Resetting the board." );
+	this->start_board_reset( _now );
+	return;
+}
+
+void SER_IO_COMM::start_board_reset( uint64_t _now )
+{
+	this->board_health = ENUM_BOARD_HEALTH::RESETTING;
+	this->supervisor_deadline = _now + GC_SERIAL_RESET_TIMEOUT;
+	this->received_fields = 0;
+	this->cmd_reset_board();
+	return;
+}
 
-	if ( this->active_table->index == GC_SERIAL_LINE_TABLE_ENTRIES )
+void SER_IO_COMM::handle_attaching_board( uint64_t _now )
+{
+	if ( ( this->received_fields & complete_state_fields ) == complete_state_fields )
 	{
 		/*
-		 * All line entries are full.
+		 * Valid frames of every kind.  The board is streaming and the state cache holds its DO and PMIC state as the board reports them.
 		 */
-		this->active_table->index = current_line_index;
+		LOG_INFO( "Board is already streaming.  Attached without a reset." );
+		this->stat_warm_attaches += 1;
+		this->board_has_reset = true;
+		this->stream_started = true;
+		this->board_health = ENUM_BOARD_HEALTH::HEALTHY;
+		this->last_rx_usec = _now;
+	}
+	else if ( this->board_has_reset )
+	{
+		/*
+		 * The board happened to come up on its own while we were listening.  The update timer starts the stream.
+		 */
+		this->board_health = ENUM_BOARD_HEALTH::HEALTHY;
+		this->last_rx_usec = _now;
+	}
+	else if ( _now >= this->supervisor_deadline )
+	{
+		LOG_INFO( "Board is not streaming.  Resetting it." );
+		this->stat_attach_fallbacks += 1;
+		this->start_board_reset( _now );
 	}
 
 	return;
 }
 
-int SER_IO_COMM::assemble_serial_data( void )
+void SER_IO_COMM::handle_board_recovered( uint64_t _now )
 {
-	size_t copy_len = 0;
+	this->board_health = ENUM_BOARD_HEALTH::HEALTHY;
+	this->last_rx_usec = _now;
+	this->reopen_backoff = GC_SERIAL_REOPEN_BACKOFF_MIN;
 
-	for ( ; this->buffer_context.buffer_work_index < this->buffer_context.buffer_idx; this->buffer_context.buffer_work_index++ )
+	if ( this->hung_since != 0 )
 	{
-		unsigned char work_char = this->buffer[this->buffer_context.buffer_work_index];
+		uint64_t elapsed = _now - this->hung_since;
 
-		//LOG_DEBUG_P("in loop: work_index: " + num_to_str(this->buffer_context.buffer_work_index) + ", buffer_index: " + num_to_str(this->buffer_context.buffer_idx));
+		LOG_INFO( "Board recovered after " + num_to_str( ( unsigned long ) elapsed ) + " usec." );
+		this->stat_recoveries += 1;
+		this->stat_recover_usec += elapsed;
 
-		if ( work_char == 0x10 ) // begin of binary marker record.
-		{
-			/*
-			Once we have the marker of the binary message, we enter enter binary message mode.
-			*/
-			this->buffer_context.bin_msg_start_index = this->buffer_context.buffer_work_index;
-			this->buffer_context.in_bin_message = true;
-			//LOG_DEBUG_P("Binary marker @ " + num_to_str(this->buffer_context.buffer_work_index));
-			continue;
-		}	// end of binary message marker
-		else if ( this->buffer_context.in_bin_message == true )
+		if ( elapsed > this->stat_recover_max_usec )
 		{
-			/*
-			 *
-			 */
-			size_t expected_index = this->buffer_context.bin_msg_start_index + RESP_HEAD_SIZE;
+			this->stat_recover_max_usec = elapsed;
+		}
 
-			if ( this->buffer_context.buffer_idx + this->buffer_context.bin_msg_start_index >= expected_index ) // make sure we have enough data in the buffer for the standard preamble
-			{
-				uint16_t length = ASSEMBLE_16INT( this->buffer[this->buffer_context.bin_msg_start_index + RESP_HEAD_LEN_LSB_IDX], this->buffer[this->buffer_context.bin_msg_start_index + RESP_HEAD_LEN_MSB_IDX] );
+		this->hung_since = 0;
+	}
 
-				//LOG_DEBUG_P(buffer_to_hex(this->buffer + this->buffer_context.bin_msg_start_index,8));
-				//LOG_DEBUG_P("Expected message length: " + num_to_str(length));
+	return;
+}
 
-				/*
-				XXX - There's a weird bug in here somewhere.  The size gets misinterpreted on an unexpected board reset.
-				*/
-				if ( length >= GC_SERIAL_BUFF_SIZE || length > 32 )
-				{
-					LOG_ERROR( "Weird message size: " + num_to_str( length ) + "; nuking context" );
-					//LOG_DEBUG_P( "\n" + buffer_to_hex( this->buffer + this->buffer_context.bin_msg_start_index , 8 ) );
-					this->reset_buffer_context();
-					memset( this->buffer, 0x00, GC_SERIAL_BUFF_SIZE );
-					break;
-				}
+void SER_IO_COMM::supervise_board( void )
+{
+	uint64_t now = monotonic_usec();
+	uint64_t cts_deadline = this->cts_wait_deadline;
 
-				//LOG_DEBUG_P("Expected message length: " + num_to_str(length));
+	if ( cts_deadline != 0 && now >= cts_deadline )
+	{
+		/*
+		 * The writer is stuck in TIOCMIWAIT past its timeout.
+		 */
+		this->wake_writer();
+	}
 
-				if ( ( this->buffer_context.bin_msg_start_index +  RESP_HEAD_SIZE + length ) == GC_SERIAL_BUFF_SIZE )
-				{
-					LOG_ERROR( "Possible buffer overflow.  Record length: " + to_string( this->buffer_context.buffer_work_index + RESP_HEAD_SIZE + length ) + ", GC_SERIAL_BUFF_SIZE: " + to_string( GC_SERIAL_BUFF_SIZE ) + ".  Nuking context." );
-					this->reset_buffer_context();
-					memset( this->buffer, 0x00, GC_SERIAL_BUFF_SIZE );
-					break;
-				}
+	if ( !this->state_valid && this->board_health == ENUM_BOARD_HEALTH::HEALTHY && ( this->received_fields & complete_state_fields ) == complete_state_fields )
+	{
+		this->state_valid = true;
 
-				expected_index = this->buffer_context.bin_msg_start_index + RESP_HEAD_SIZE + length;
+		if ( this->stat_attach_usec == 0 )
+		{
+			this->stat_attach_usec = std::max<uint64_t>( 1, now - this->attach_started );
+		}
+	}
 
-				/*
-				Expected index is the end index in the buffer after we account for the header size plus expected message length.
-				*/
+	if ( this->in_debug_mode )
+	{
+		return;
+	}
 
-				if ( this->buffer_context.buffer_idx >= expected_index )
-				{
-					//LOG_DEBUG_P("Message start index: " + num_to_str(this->buffer_context.bin_msg_start_index) + ", message end index: " + num_to_str(expected_index) + ", buffer index: " + num_to_str(this->buffer_context.buffer_idx));
-					//LOG_DEBUG_P("\n" + buffer_to_hex(this->buffer,this->buffer_context.buffer_idx,false));
-					this->add_to_active_table( this->buffer + this->buffer_context.bin_msg_start_index, length + RESP_HEAD_SIZE ); // the binary record marker, preamble, and data
-					//this->buffer_context.buffer_work_index = this->buffer_context.bin_msg_start_index + length + 4;
-					/*
-					We just processed a binary message.
-					Need to remove the chunk of data from the buffer and adjust the buffer_work_index accordingly.
-					*/
-					unsigned char* source_ptr = this->buffer + expected_index;
-					unsigned char* dest_ptr = this->buffer + this->buffer_context.bin_msg_start_index;
-					size_t move_length = this->buffer_context.buffer_idx - expected_index;
-
-					if ( source_ptr < this->buffer || source_ptr > ( this->buffer + GC_SERIAL_BUFF_SIZE ) )
-					{
-						LOG_ERROR( "Source pointer weirdness.  Nuking context." );
-						this->reset_buffer_context();
-						memset( this->buffer, 0x00, GC_SERIAL_BUFF_SIZE );
-						break;
-					}
-
-					if ( dest_ptr < this->buffer || ( dest_ptr + move_length ) > ( this->buffer + GC_SERIAL_BUFF_SIZE ) || move_length > GC_SERIAL_BUFF_SIZE )
-					{
-						LOG_ERROR( "Destination pointer weirdness.  Nuking context." );
-						this->reset_buffer_context();
-						memset( this->buffer, 0x00, GC_SERIAL_BUFF_SIZE );
-						break;
-					}
-
-					//LOG_DEBUG_P("Offset: " + num_to_str(expected_index) + ", buffer index: " + num_to_str(this->buffer_context.buffer_idx));
-					//LOG_DEBUG_P("Move length: " + num_to_str(move_length));
-
-					if ( move_length > 0 )
-					{
-						memmove( dest_ptr, source_ptr, move_length );
-					}
-
-					//this->buffer_context.buffer_idx = this->buffer_context.bin_msg_start_index + move_length;
-					this->buffer_context.buffer_idx = ( this->buffer_context.buffer_idx - expected_index );
-					//LOG_DEBUG_P("Buffer index after move: " + num_to_str(this->buffer_context.buffer_idx));
-					this->buffer_context.buffer_work_index = 0 ;
-					this->buffer_context.in_bin_message = false;
-					this->buffer_context.bin_msg_start_index = 0;
-					//LOG_DEBUG_P( "**************************************" );
-					/*
-					* This is due to the buffer_work_index getting incremented at next iteration.  We can't prevent it without doing gymnastics
-					*/
-					this->buffer_context.buffer_work_index -= 1;
-				}
-				else
-				{
-					/*
-					 * If we don't have enough data for the whole record.  Wait for more data.
-					 */
-					//LOG_DEBUG_P("Don't have enough data for complete message.  Breaking loop.");
-					break;
-				}
-			}
-			else
+	switch ( this->board_health )
+	{
+		case ENUM_BOARD_HEALTH::HEALTHY:
+		{
+			if ( now - this->last_rx_usec >= GC_SERIAL_HUNG_BOARD_TIMEOUT )
 			{
-				/*
-				 * If we don't have enough data for the preamble.  Wait for more data.
-				 */
-				//LOG_DEBUG_P("Don't have enough data for complete preamble.  Breaking loop.");
-				break;
+				this->handle_hung_board( now );
 			}
 
-			if ( this->buffer_context.buffer_work_index == this->buffer_context.buffer_idx )
+			break;
+		}
+
+		case ENUM_BOARD_HEALTH::RESETTING:
+		{
+			if ( this->board_has_reset )
 			{
-				/*
-				 * Whole buffer has been consumed.  Reset all of the indexes.
-				 */
-				this->reset_buffer_context();
-				break;
+				this->handle_board_recovered( now );
 			}
-			else
+			else if ( now >= this->supervisor_deadline )
 			{
-				//LOG_DEBUG_P( "work_index = " + to_string(this->buffer_context.buffer_work_index) + " buffer_idx = " + to_string(this->buffer_context.buffer_idx));
+				LOG_WARNING( "Board did not come back up within " + num_to_str( ( unsigned long ) GC_SERIAL_RESET_TIMEOUT ) + " usec of a reset." );
+				this->stat_reset_timeouts += 1;
+				this->close_for_recovery( now );
 			}
 
-			continue;
-		} // we're inside a binary message
-		else if ( work_char ==  '\n' || work_char == '\r' )
+			break;
+		}
+
+		case ENUM_BOARD_HEALTH::PORT_CLOSED:
 		{
-			/*
-			 * Text data
-			 *
-			 * This block has to be second because \n and \r are valid in binary message bytes
-			 */
-			if ( this->buffer_context.buffer_work_index == 0 )
-			{
-				this->buffer_context.buffer_start_index += 1;
-				continue;
-			}
-			else if ( this->buffer_context.buffer_start_index == 0 )
+			if ( this->serial_fd > 0 && !this->release_port() )
 			{
 				/*
-				 * A \n or \r are not the very first character, but no previous instances have been encountered.
+				 * The writer still had the port when it was closed for recovery, and still has it.
 				 */
-				copy_len = this->buffer_context.buffer_work_index;
+				LOG_DEBUG( "Writer is still on the port.  Trying again on the next tick." );
 			}
-			else
+			else if ( now >= this->supervisor_deadline )
 			{
-				/*
-				 * Number of characters is current character minus previous start minus one to skip the current terminator.
-				 */
-				copy_len = this->buffer_context.buffer_work_index - this->buffer_context.buffer_start_index;
+				this->reopen_hung_board( now );
 			}
 
-			if ( copy_len > 0 )
-			{
-				if ( copy_len >= GC_SERIAL_BUFF_SIZE )
-				{
-					LOG_ERROR( "Text message length (" + num_to_str( copy_len ) + ") is greater than GC_SERIAL_BUFF_SIZE.  Nuking context." );
-					this->reset_buffer_context();
-					memset( this->buffer, 0x00, GC_SERIAL_BUFF_SIZE );
-					break;
-				}
+			break;
+		}
 
-				this->add_to_active_table( buffer + this->buffer_context.buffer_start_index, copy_len );
-				this->buffer_context.buffer_start_index = this->buffer_context.buffer_work_index + 1; // Advance past the current line terminator
-			}
+		case ENUM_BOARD_HEALTH::ATTACHING:
+		{
+			this->handle_attaching_board( now );
+			break;
+		}
+	}
 
-			if ( this->buffer_context.buffer_start_index == this->buffer_context.buffer_idx )
-			{
-				/*
-				 * Whole buffer has been consumed.  Reset all of the indexes.
-				 */
-				this->reset_buffer_context();
-				break;
-			}
-			else
-			{
-				//LOG_DEBUG_P( "buffer_work_index = " + to_string( this->buffer_context.buffer_work_index ) + ", buffer_index = " + to_string( this->buffer_context.buffer_idx ) + ", start_index = " + to_string(this->buffer_context.buffer_start_index));
-			}
+	return;
+}
+
+void SER_IO_COMM::handle_serial_input( void )
+{
+	this->last_rx_usec = monotonic_usec();
+	/*
+	 * The receive ring belongs to this thread alone.  The lock is only needed once we start touching the state cache.
+	 */
+	this->drain_serial();
+	this->obtain_lock( true );
+	this->assemble_serial_data();
+	this->digest_frame_queue();
+	this->publish_state_snapshot();
+	this->release_lock();
+	return;
+}
+
+void SER_IO_COMM::replay_input( const unsigned char* _data, size_t _length )
+{
+	struct iovec spans[2];
+
+	this->obtain_lock( true );
+
+	/*
+	 * Same as handle_serial_input except that the data is copied into the ring.  The ring is processed whenever it fills up.
+	 */
+	while ( _length > 0 )
+	{
+		int span_count = this->rx_ring.get_write_spans( spans );
+		size_t copied = 0;
+
+		for ( int i = 0; i < span_count && copied < _length; i++ )
+		{
+			size_t chunk = std::min( _length - copied, spans[i].iov_len );
+			memcpy( spans[i].iov_base, _data + copied, chunk );
+			copied += chunk;
 		}
+
+		this->rx_ring.commit_write( copied );
+		this->stat_bytes_received += copied;
+		_data += copied;
+		_length -= copied;
+
+		this->assemble_serial_data();
+		this->digest_frame_queue();
 	}
 
-	//LOG_DEBUG_P("loop exit: work_index: " + num_to_str(this->buffer_context.buffer_work_index) + ", buffer_index: " + num_to_str(this->buffer_context.buffer_idx));
-	return 1;
+	this->publish_state_snapshot();
+	this->release_lock();
+	return;
 }
 
-void SER_IO_COMM::clear_active_table_current_line( void )
+void SER_IO_COMM::set_warm_attach( bool _warm )
 {
-	memset( this->active_table->table[this->active_table->index], 0, GC_SERIAL_BUFF_SIZE );
+	this->warm_attach = _warm;
 	return;
 }
 
-void SER_IO_COMM::add_to_active_table( const unsigned char* _buffer, size_t _length )
+bool SER_IO_COMM::start_capture( const string& _file )
 {
-	this->clear_active_table_current_line();
-	memcpy( this->active_table->table[this->active_table->index], _buffer, _length );
-	//std::string b = buffer_to_hex(this->active_table->table[this->active_table->index],_length);
-	//LOG_DEBUG_P(b);
-	this->active_table->index += 1;
+	if ( this->capture == nullptr )
+	{
+		this->capture = new SERIAL_CAPTURE( this->tag );
+	}
 
-	if ( this->active_table->index == GC_SERIAL_LINE_TABLE_ENTRIES )
+	return this->capture->start( _file );
+}
+
+void SER_IO_COMM::get_capture_stats( SERIAL_CAPTURE_STATS& _dest ) const
+{
+	if ( this->capture == nullptr )
 	{
-		LOG_DEBUG( "Active table wrap around" );
-		this->active_table->index = 0;
+		memset( &_dest, 0, sizeof( _dest ) );
+		return;
 	}
 
+	this->capture->get_stats( _dest );
 	return;
 }
 
-void SER_IO_COMM::handle_hung_board()
+void SER_IO_COMM::handle_update_timer( void )
 {
-	LOG_DEBUG( "Handling hung board." );
-	this->board_has_reset = false;
-	this->stream_started = false;
-	this->reset_buffer_context();
-	this->outgoing_messages->clear();
-	this->serial_port_close();
-	/*
-	timespec ts;
-	ts.tv_sec = 2;
-	ts.tv_nsec = 0;
-	this->nsleep(&ts);
-	 */
-	this->serial_port_open();
-	unsigned int port_status;
-	timespec sleep_time;
+	if ( !this->reactor_mode )
+	{
+		/*
+		 * In reactor mode this is the reactor's thread.  It samples itself.
+		 */
+		this->sample_cpu_usage();
+	}
 
-	while ( !this->abort_thread )
+	if ( this->board_has_reset )
 	{
-		if ( ioctl( this->serial_fd, TIOCMGET, &port_status ) == 0 )
-		{
-			/*
-			Port successfully reset.
-			*/
-			LOG_DEBUG( "Port is available." );
-			break;
-		}
-		else
+		this->cmd_confirm_output_state();
+
+		if ( !this->stream_started )
 		{
-			LOG_DEBUG( "Waiting for port to become available." );
+			this->cmd_start_stream();
+			this->stream_started = true;
 		}
-
-		sleep_time.tv_nsec = 100000000;	//100 miliseconds
-		this->nsleep( &sleep_time );
 	}
 
-	this->cmd_reset_board();
 	return;
 }
 
-bool SER_IO_COMM::main_event_loop( void )
+bool SER_IO_COMM::start_event_processing( void )
 {
-	size_t zero_fd_counter = 0;
-	struct pollfd fds;
-	this->reset_sleep_timespec( GC_SERIAL_THREAD_SLEEP );
-	/*
-	 * Reset board as a first order of business so that we can be sure of its state.
-	 */
+	struct itimerspec timer_spec;
+
+	uint64_t now = monotonic_usec();
+
+	this->last_rx_usec = now;
+	this->attach_started = now;
 
 	if ( this->in_debug_mode )
 	{
 		this->board_has_reset = true;
+		this->board_health = ENUM_BOARD_HEALTH::HEALTHY;
+	}
+	else if ( this->warm_attach )
+	{
+		/*
+		 * Leave the board and its outputs alone unless it turns out not to be streaming.
+		 */
+		this->board_health = ENUM_BOARD_HEALTH::ATTACHING;
+		this->supervisor_deadline = now + GC_SERIAL_ATTACH_TIMEOUT;
 	}
 	else
 	{
-		this->cmd_reset_board();
+		/*
+		 * Reset board as a first order of business so that we can be sure of its state.  Same as recovering a hung board except that there is nothing to time.
+		 */
+		this->start_board_reset( now );
 	}
 
-	/*
-	Timevalues for determining when output confirmation
-	*/
-	struct timeval refresh_loop_time_trigger;
-	struct timeval refresh_loop_time_now;
-	struct timeval refresh_loop_time_offset;
-	refresh_loop_time_offset.tv_sec = 0;
-	refresh_loop_time_offset.tv_usec = GC_SERIAL_THREAD_UPDATE_INTERVAL;
+	timer_spec.it_interval.tv_sec = GC_SERIAL_THREAD_UPDATE_INTERVAL / 1000000;
+	timer_spec.it_interval.tv_nsec = ( GC_SERIAL_THREAD_UPDATE_INTERVAL % 1000000 ) * 1000;
+	timer_spec.it_value = timer_spec.it_interval;
 
-	if ( gettimeofday( &refresh_loop_time_now, nullptr ) )
+	if ( timerfd_settime( this->timer_fd, 0, &timer_spec, nullptr ) != 0 )
 	{
-		LOG_ERROR( create_perror_string( "gettimeofday" ) );
+		LOG_ERROR( create_perror_string( "timerfd_settime" ) );
 		this->abort_thread = true;
 		return false;
 	}
 
-	timeradd( &refresh_loop_time_now, &refresh_loop_time_offset, &refresh_loop_time_trigger );
+	return true;
+}
 
-	while ( this->abort_thread == false )
-	{
-		this->obtain_lock( true );
-		fds.fd = this->serial_fd;
-		fds.events = POLLIN;
-		int fds_ready_num = poll( &fds, 1, GC_SERIAL_THREAD_POLL_TIMEOUT );
+void SER_IO_COMM::dispatch_event( ENUM_EVENT_SOURCES _type, uint32_t _events )
+{
+	uint64_t counter;
 
-		if ( fds_ready_num == 0 )
+	switch ( _type )
+	{
+		case EVENT_SOURCE_SHUTDOWN:
 		{
-			/*
-			 * Timeout while waiting for the serial file descriptor to get data
-			 */
-			zero_fd_counter += 1;
-			gettimeofday( &refresh_loop_time_now, nullptr );
-
-			if ( timercmp( &refresh_loop_time_now, &refresh_loop_time_trigger, > ) )
+			if ( read( this->shutdown_fd, &counter, sizeof( counter ) ) < 0 )
 			{
-				if ( this->board_has_reset )
-				{
-					this->cmd_confirm_output_state();
-
-					if ( !this->stream_started )
-					{
-						this->cmd_start_stream();
-						this->stream_started = true;
-					}
-				}
-
-				gettimeofday( &refresh_loop_time_now, nullptr );
-				timeradd( &refresh_loop_time_now, &refresh_loop_time_offset, &refresh_loop_time_trigger );
+				LOG_ERROR( create_perror_string( "Failed to read shutdown eventfd" ) );
 			}
+
+			break;
 		}
-		else if ( fds_ready_num < 0 )
-		{
-			/*
-			 * Error encountered by 'poll'
-			 * XXX - What do we do here?  Ignore?
-			 */
-			LOG_ERROR( create_perror_string( "Poll" ) );
-		}
-		else
-		{
-			/*
-			 * A file descriptor is ready for action
-			 */
-			zero_fd_counter = 0;
 
-			if ( fds.revents & POLLIN )
-			{
-				this->drain_serial();
-				this->assemble_serial_data();
-				this->digest_line_table();
-			}
-			else
+		case EVENT_SOURCE_TIMER:
+		{
+			if ( read( this->timer_fd, &counter, sizeof( counter ) ) == sizeof( counter ) )
 			{
-				/*
-				 * We don't know how to handle anything other than incomming data.
-				 */
-				LOG_ERROR( "Don't know what to do when poll.revents is not POLLIN" );
+				this->handle_update_timer();
 			}
 
-			if ( fds.revents & POLLERR )
+			break;
+		}
+
+		case EVENT_SOURCE_SERIAL:
+		{
+			if ( _events & EPOLLIN )
 			{
-				LOG_ERROR( "POLLERR flag is set." );
+				this->handle_serial_input();
 			}
 
-			if ( fds.revents & POLLHUP )
+			if ( _events & EPOLLERR )
 			{
-				LOG_ERROR( "POLLHUP flag is set." );
+				LOG_ERROR( "EPOLLERR flag is set." );
 			}
 
-			if ( fds.revents & POLLNVAL )
+			if ( _events & EPOLLHUP )
 			{
-				LOG_ERROR( "POLLNVAL flag is set." );
+				LOG_ERROR( "EPOLLHUP flag is set." );
 			}
+
+			break;
+		}
+
+		case EVENT_SOURCE_OUTGOING:
+		{
+			this->outgoing_messages->take_messages( &this->pending_output );
+			this->coalesce_pending_output();
+			this->flush_pending_output();
+			break;
 		}
 
-		if ( !this->release_lock() )
+		default:
 		{
+			LOG_ERROR( "Unknown event source: " + num_to_str( ( unsigned int )_type ) );
 			break;
 		}
+	}
+
+	return;
+}
+
+bool SER_IO_COMM::main_event_loop( void )
+{
+	struct epoll_event events[EVENT_SOURCE_COUNT];
+
+	if ( !this->start_event_processing() )
+	{
+		return false;
+	}
+
+	while ( this->abort_thread == false )
+	{
+		/*
+		 * No locks are held while we wait.
+		 */
+		int fds_ready_num = epoll_wait( this->epoll_fd, events, EVENT_SOURCE_COUNT, -1 );
 
-		if ( zero_fd_counter == 1000 )
+		if ( fds_ready_num < 0 )
 		{
-			if ( !this->in_debug_mode )
+			if ( errno != EINTR )
 			{
-				this->handle_hung_board();
+				LOG_ERROR( create_perror_string( "epoll_wait" ) );
 			}
 
-			zero_fd_counter = 0;
+			continue;
 		}
 
-		/*
-		 * Sleep for 10 microseconds to give other threads a chance to get at the data.
-		 */
-		this->reset_sleep_timespec( GC_SERIAL_THREAD_SLEEP );
-		this->nsleep( nullptr );
+		for ( int i = 0; i < fds_ready_num; i++ )
+		{
+			const ST_EVENT_SOURCE* source = ( const ST_EVENT_SOURCE* ) events[i].data.ptr;
+			this->dispatch_event( source->type, events[i].events );
+		}
+
+		this->supervise_board();
 	}
 
 	return true;
@@ -1400,47 +2069,30 @@ bool SER_IO_COMM::main_event_loop( void )
 
 bool SER_IO_COMM::write_event_loop( void )
 {
-	std::queue<OUTGOING_MESSAGE> work_queue;
-
 	/*
 	 * This event loop runs in a different thread than main_event_loop
 	 */
 	while ( this->abort_thread == false )
 	{
-		if ( this->outgoing_messages->wait_for_signal() == false )
+		if ( this->outgoing_messages->wait_for_signal( 2000 ) == false )
 		{
 			/*
-			 * Timed out on conditional.
+			 * Timed out waiting for the doorbell.
 			 * We time and loop again in order to be able to sense the global exit and abort thread flags.
 			 */
 			continue;
 		}
 
-		/*
-		 * Conditional was triggered.  We have the mutex
-		 */
-		this->outgoing_messages->swap_message_queue( &work_queue );
-		/*
-		 * We only need the lock long enough to copy the message queue.
-		 * We release the lock as fast as we can so that other threads may continue to add messages to the queue.
-		 */
-		this->outgoing_messages->put_lock();
+		this->outgoing_messages->take_messages( &this->pending_output );
+		this->coalesce_pending_output();
 
-		while ( !work_queue.empty() )
+		if ( !this->write_buffer() )
 		{
-			const OUTGOING_MESSAGE& msg = work_queue.front();
-
-			if ( !this->write_buffer( msg.message.get(), msg.message_length ) )
-			{
-				/*
-				XXX - Do not kill thread
-				*/
-				LOG_ERROR( "Failed to write whole message." );
-				this->abort_thread = true;
-				break;
-			}
-
-			work_queue.pop();
+			/*
+			XXX - Do not kill thread
+			*/
+			LOG_ERROR( "Failed to write whole message." );
+			this->abort_thread = true;
 		}
 	}
 
@@ -1451,41 +2103,16 @@ bool SER_IO_COMM::send_message( const unsigned char* _message, size_t _length )
 {
 	/*
 	 * We don't need the main lock for this method since there's a separate writer thread.
+	 * The message is copied straight into the outgoing queue.  Nothing is allocated and nothing waits on the writer.
 	 */
-	if ( _length >= GC_SERIAL_BUFF_SIZE )
-	{
-		LOG_ERROR( "Tried to send message that would overflow buffer." );
-		return false;
-	}
-
-	OUTGOING_MESSAGE msg( ( const unsigned char* ) _message, _length );
-	this->outgoing_messages->add_message( msg );
-	return true;
-}
-
-void SER_IO_COMM::swap_tables( void )
-{
-	/*
-	 * We're making an assumption that the object is locked when this is invoked.
-	 */
-	if ( this->active_table == & ( this->table_a ) )
-	{
-		this->active_table = & ( this->table_b );
-		this->passive_table = & ( this->table_a );
-	}
-	else
-	{
-		this->active_table = & ( this->table_a );
-		this->passive_table = & ( this->table_b );
-	}
-
-	this->active_table->index = 0;
-	return;
+	return this->outgoing_messages->add_message( _message, _length );
 }
 
 void SER_IO_COMM::reset_buffer_context( void )
 {
 	memset( &this->buffer_context, 0, sizeof( ST_SERIAL_BUFFER_CONTEXT ) );
+	this->rx_ring.reset();
+	this->frame_queue.clear();
 	return;
 }
 
@@ -1513,35 +2140,68 @@ bool SER_IO_COMM::get_pmic_cache( PMIC_CACHE_ENTRY( & _dest ) [GC_IO_STATE_BUFFE
 	return true;
 }
 
-bool SER_IO_COMM::get_latest_state_values( BOARD_STATE_CACHE& _target )
+void SER_IO_COMM::publish_state_snapshot( void )
+{
+	BOARD_STATE_SNAPSHOT snapshot;
+
+	if ( this->state_cache->get_generation() == this->published_generation )
+	{
+		return;
+	}
+
+	this->state_cache->fill_snapshot( snapshot );
+	this->state_publisher.publish( snapshot );
+	this->published_generation = snapshot.generation;
+	return;
+}
+
+void SER_IO_COMM::get_state_snapshot( BOARD_STATE_SNAPSHOT& _dest ) const
+{
+	this->state_publisher.read( _dest );
+	return;
+}
+
+uint32_t SER_IO_COMM::get_state_changes( uint64_t _generation, BOARD_STATE_SNAPSHOT& _dest ) const
+{
+	this->state_publisher.read( _dest );
+	return BOARD_STATE_CACHE::get_changes_since( _dest, _generation );
+}
+
+size_t SER_IO_COMM::get_history( uint64_t _from_usec, uint64_t _to_usec, size_t _decimation, std::vector<BOARD_HISTORY_SAMPLE>& _dest )
 {
+	size_t ret;
 	this->obtain_lock( true );
-	_target = *( this->state_cache );
+	ret = this->state_cache->get_history().get_samples( _from_usec, _to_usec, _decimation, _dest );
 	this->release_lock();
-	return true;
+	return ret;
 }
 
 bool SER_IO_COMM::get_latest_adc_values( ADC_CACHE_ENTRY( & _dest ) [GC_IO_AI_COUNT] )
 {
-	this->obtain_lock( true );
-	this->state_cache->get_latest_adc_values( _dest );
-	this->release_lock();
+	BOARD_STATE_SNAPSHOT snapshot;
+	this->state_publisher.read( snapshot );
+
+	for ( size_t i = 0; i < GC_IO_AI_COUNT; i++ )
+	{
+		_dest[i] = ADC_CACHE_ENTRY( snapshot.ai_values[i], snapshot.ai_timestamps[i] );
+	}
+
 	return true;
 }
 
 bool SER_IO_COMM::get_latest_do_status( DO_CACHE_ENTRY& _dest )
 {
-	this->obtain_lock( true );
-	this->state_cache->get_latest_do_status( _dest );
-	this->release_lock();
+	BOARD_STATE_SNAPSHOT snapshot;
+	this->state_publisher.read( snapshot );
+	_dest = DO_CACHE_ENTRY( snapshot.do_status, snapshot.do_timestamp );
 	return true;
 }
 
 bool SER_IO_COMM::get_latest_pmic_status( PMIC_CACHE_ENTRY& _dest )
 {
-	this->obtain_lock( true );
-	this->state_cache->get_latest_pmic_status( _dest );
-	this->release_lock();
+	BOARD_STATE_SNAPSHOT snapshot;
+	this->state_publisher.read( snapshot );
+	_dest = PMIC_CACHE_ENTRY( snapshot.pmic_status, snapshot.pmic_timestamp );
 	return true;
 }
 
@@ -1634,9 +2294,19 @@ bool SER_IO_COMM::cmd_start_stream( void )
 
 bool SER_IO_COMM::force_ai_value( size_t _x_index, uint16_t _value )
 {
-	return this->state_cache->force_ai_value( _x_index, _value );
+	bool ret;
+	this->obtain_lock( true );
+	ret = this->state_cache->force_ai_value( _x_index, _value );
+	this->publish_state_snapshot();
+	this->release_lock();
+	return ret;
 }
 bool SER_IO_COMM::unforce_ai_value( size_t _x_index )
 {
-	return this->state_cache->unforce_ai_value( _x_index );
+	bool ret;
+	this->obtain_lock( true );
+	ret = this->state_cache->unforce_ai_value( _x_index );
+	this->publish_state_snapshot();
+	this->release_lock();
+	return ret;
 }
@@ -27,6 +27,7 @@
 
 #include <sys/types.h>
 #include <sys/syscall.h>
+#include <sys/resource.h>
 
 #ifdef __FreeBSD__
 	#define gettid() 	(unsigned long)pthread_self()
@@ -43,6 +44,7 @@ THREAD_BASE::THREAD_BASE( const string& _tag ) : TPROTECT_BASE( _tag )
 	this->thread_tag = _tag;
 	this->do_not_self_delete = false;
 	this->is_io_thread = false;
+	this->cpu_usec = 0;
 	INIT_LOGGER( "BBB_HVAC::THREAD_BASE[" + this->thread_tag + "]" );
 }
 
@@ -105,6 +107,8 @@ void THREAD_BASE::pthread_func( void )
 		LOG_ERROR( "Aborting." );
 	}
 
+	this->sample_cpu_usage();
+
 	if ( !this->do_not_self_delete )
 	{
 		THREAD_REGISTRY::delete_thread( this );
@@ -123,6 +127,19 @@ void THREAD_BASE::start_thread( void )
 	return;
 }
 
+void THREAD_BASE::sample_cpu_usage( void )
+{
+	struct rusage ru;
+
+	if ( getrusage( RUSAGE_THREAD, &ru ) != 0 )
+	{
+		return;
+	}
+
+	this->cpu_usec = ( ( uint64_t ) ru.ru_utime.tv_sec * 1000000 ) + ( uint64_t ) ru.ru_utime.tv_usec + ( ( uint64_t ) ru.ru_stime.tv_sec * 1000000 ) + ( uint64_t ) ru.ru_stime.tv_usec;
+	return;
+}
+
 string THREAD_BASE::get_thread_tag( void ) const
 {
 	return this->thread_tag;
@@ -139,7 +156,7 @@ void THREAD_BASE::stop_thread( bool _self_delete )
 	}
 
 	this->do_not_self_delete = true;
-	this->abort_thread = true;
+	this->flag_for_stop();
 	timespec st;
 
 	int attempt_count = 0;
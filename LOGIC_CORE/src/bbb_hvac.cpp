@@ -33,6 +33,7 @@
 #include "lib/threads/serial_io_thread.hpp"
 #include "lib/threads/shim_listener_thread.hpp"
 #include "lib/threads/serial_io_thread.hpp"
+#include "lib/threads/serial_io_reactor.hpp"
 #include "lib/threads/thread_registry.hpp"
 #include "lib/log_configurator.hpp"
 #include "lib/globals.hpp"
@@ -52,6 +53,7 @@
 
 #include <memory>
 #include <iostream>
+#include <vector>
 
 using namespace BBB_HVAC;
 using namespace BBB_HVAC::SERVER;
@@ -60,8 +62,66 @@ DEF_LOGGER_STAT( "BBB_HVAC(MAIN)" );
 
 static CONFIGURATOR* config = nullptr;
 
+/**
+Command line parameter that selects how the IO boards are serviced.
+*/
+#define CMDP_IO_MODE "--io_mode"
 
-bool start_board_io_thread( const CONFIG_ENTRY& _board_config )
+/**
+One thread per board.  The default.
+*/
+#define IO_MODE_THREAD "THREAD"
+
+/**
+One reactor thread for all of the boards.
+*/
+#define IO_MODE_REACTOR "REACTOR"
+
+/**
+Command line parameter that sets the number of samples kept in each board's sample history.
+*/
+#define CMDP_HISTORY_DEPTH "--history_depth"
+
+/**
+Number of samples kept in each board's sample history.  Kept around so that restarted boards get the same depth.
+*/
+static size_t history_depth = GC_IO_HISTORY_DEPTH;
+
+/**
+Command line parameter that turns on serial wire capture.  Each board is captured to <directory>/<board name>.cap.
+*/
+#define CMDP_CAPTURE_DIR "--capture_dir"
+
+/**
+Directory the serial wire captures go to.  Empty if capture is off.  Kept around so that restarted boards keep appending to their captures.
+*/
+static string capture_dir;
+
+/**
+Command line parameter that selects what is done with boards that are already running when LOGIC_CORE starts.
+*/
+#define CMDP_BOARD_ATTACH "--board_attach"
+
+/**
+Reset every board on start.  The default.
+*/
+#define BOARD_ATTACH_RESET "RESET"
+
+/**
+Adopt the state of boards that are already streaming.  Boards that are not are reset.
+*/
+#define BOARD_ATTACH_WARM "WARM"
+
+/**
+Adopt boards that are already streaming rather than reset them.  Kept around so that restarted boards are attached the same way.
+*/
+static bool warm_attach = false;
+
+/**
+Creates and initializes the serial IO instance for a board.
+\return The instance or nullptr on failure.
+*/
+IOCOMM::SER_IO_COMM* create_board_io( const CONFIG_ENTRY& _board_config )
 {
 	const string board_name = _board_config.get_part_as_string( 0 );
 	const string board_dev = _board_config.get_part_as_string( 1 );
@@ -76,21 +136,146 @@ bool start_board_io_thread( const CONFIG_ENTRY& _board_config )
 		}
 	}
 
-	LOG_DEBUG( "Starting thread for board: " + board_name );
-	IOCOMM::SER_IO_COMM* ser_comm	= new IOCOMM::SER_IO_COMM( board_dev.data(), board_name, debug );
+	IOCOMM::SER_IO_COMM* ser_comm	= new IOCOMM::SER_IO_COMM( board_dev.data(), board_name, debug, history_depth );
+	ser_comm->set_warm_attach( warm_attach );
 
 	if ( ser_comm->init() != IOCOMM::ENUM_ERRORS::ERR_NONE )
 	{
 		LOG_ERROR( "Failed to initialized serial IO for board:" + board_name );
+		delete ser_comm;
+		return nullptr;
+	}
+
+	if ( !capture_dir.empty() && !ser_comm->start_capture( capture_dir + "/" + board_name + ".cap" ) )
+	{
+		LOG_ERROR( "Failed to start serial wire capture for board:" + board_name );
+		delete ser_comm;
+		return nullptr;
+	}
+
+	return ser_comm;
+}
+
+bool start_board_io_thread( const CONFIG_ENTRY& _board_config )
+{
+	LOG_DEBUG( "Starting thread for board: " + _board_config.get_part_as_string( 0 ) );
+	IOCOMM::SER_IO_COMM* ser_comm = create_board_io( _board_config );
+
+	if ( ser_comm == nullptr )
+	{
 		return false;
 	}
 
 	ser_comm->start_thread();
 	return true;
 }
-bool start_io_threads( CONFIGURATOR* config )
+
+/**
+Starts a single reactor thread that services all of the boards.
+If the reactor dies the IO thread death listener restarts the boards each in its own thread.
+*/
+bool start_io_reactor( CONFIGURATOR* config )
+{
+	const CONFIG_TYPE_INDEX_TYPE& board_config = config->get_board_index();
+	IOCOMM::SER_IO_REACTOR* reactor = new IOCOMM::SER_IO_REACTOR( "SERIAL_IO_REACTOR" );
+
+	if ( !reactor->init() )
+	{
+		LOG_ERROR( "Failed to initialize serial IO reactor." );
+		delete reactor;
+		return false;
+	}
+
+	std::vector<IOCOMM::SER_IO_COMM*> boards;
+
+	for ( CONFIG_TYPE_INDEX_TYPE::const_iterator i = board_config.begin(); i != board_config.end(); ++i )
+	{
+		const CONFIG_ENTRY& bc = config->get_config_entry( *i );
+		LOG_DEBUG( "Adding board to reactor: " + bc.get_part_as_string( 0 ) );
+		IOCOMM::SER_IO_COMM* ser_comm = create_board_io( bc );
+
+		if ( ser_comm == nullptr )
+		{
+			/*
+			The boards created so far have not been registered yet so they're ours to delete.
+			*/
+			for ( auto j = boards.begin(); j != boards.end(); ++j )
+			{
+				delete *j;
+			}
+
+			delete reactor;
+			return false;
+		}
+
+		boards.push_back( ser_comm );
+	}
+
+	for ( auto i = boards.begin(); i != boards.end(); ++i )
+	{
+		reactor->add_board( *i );
+	}
+
+	reactor->start_thread();
+	return true;
+}
+
+bool start_io_threads( CONFIGURATOR* config, const COMMAND_LINE_PARMS& _clp )
 {
 	const CONFIG_TYPE_INDEX_TYPE& board_config = config->get_board_index();
+	auto mode = _clp.ex_parm_values.find( CMDP_IO_MODE );
+	auto depth = _clp.ex_parm_values.find( CMDP_HISTORY_DEPTH );
+	auto capture = _clp.ex_parm_values.find( CMDP_CAPTURE_DIR );
+	auto attach = _clp.ex_parm_values.find( CMDP_BOARD_ATTACH );
+
+	if ( attach != _clp.ex_parm_values.end() )
+	{
+		if ( attach->second == BOARD_ATTACH_WARM )
+		{
+			LOG_INFO( "Adopting boards that are already streaming." );
+			warm_attach = true;
+		}
+		else if ( attach->second != BOARD_ATTACH_RESET )
+		{
+			LOG_ERROR( "Unknown board attach mode: " + attach->second );
+			return false;
+		}
+	}
+
+	if ( capture != _clp.ex_parm_values.end() )
+	{
+		capture_dir = capture->second;
+		LOG_INFO( "Capturing serial traffic into " + capture_dir );
+	}
+
+	if ( depth != _clp.ex_parm_values.end() )
+	{
+		try
+		{
+			history_depth = ( size_t ) stoul( depth->second );
+		}
+		catch ( const exception& _e )
+		{
+			LOG_ERROR( "Invalid history depth: " + depth->second );
+			return false;
+		}
+
+		LOG_INFO( "Keeping " + num_to_str( ( unsigned long ) history_depth ) + " samples of history per board." );
+	}
+
+	if ( mode != _clp.ex_parm_values.end() )
+	{
+		if ( mode->second == IO_MODE_REACTOR )
+		{
+			LOG_INFO( "Servicing IO boards from a single reactor thread." );
+			return start_io_reactor( config );
+		}
+		else if ( mode->second != IO_MODE_THREAD )
+		{
+			LOG_ERROR( "Unknown IO mode: " + mode->second );
+			return false;
+		}
+	}
 
 	for ( CONFIG_TYPE_INDEX_TYPE::const_iterator i = board_config.begin(); i != board_config.end(); ++i )
 	{
@@ -160,6 +345,62 @@ void io_death_listener( const std::string& _tag )
 	return;
 }
 
+/**
+Waits for every board to have a complete state so that the logic thread starts off of the actual board state.
+Gives up after GC_BOARD_READY_TIMEOUT microseconds.  The boards that are not ready by then are logged and the logic thread is started anyway.
+*/
+void wait_for_boards( CONFIGURATOR* config )
+{
+	const CONFIG_TYPE_INDEX_TYPE& board_config = config->get_board_index();
+	uint64_t start = monotonic_usec();
+	std::vector<string> waiting;
+
+	while ( GLOBALS::global_exit_flag == false )
+	{
+		waiting.clear();
+
+		for ( CONFIG_TYPE_INDEX_TYPE::const_iterator i = board_config.begin(); i != board_config.end(); ++i )
+		{
+			const string board_name = config->get_config_entry( *i ).get_part_as_string( 0 );
+
+			try
+			{
+				if ( !THREAD_REGISTRY::get_serial_io_thread( board_name )->has_valid_state() )
+				{
+					waiting.push_back( board_name );
+				}
+			}
+			catch ( const exception& _e )
+			{
+				/*
+				The board's IO thread is being restarted.
+				*/
+				waiting.push_back( board_name );
+			}
+		}
+
+		if ( waiting.empty() )
+		{
+			LOG_INFO( "All boards ready after " + num_to_str( ( unsigned long )( monotonic_usec() - start ) ) + " usec." );
+			return;
+		}
+
+		if ( monotonic_usec() - start >= GC_BOARD_READY_TIMEOUT )
+		{
+			break;
+		}
+
+		usleep( 10000 );
+	}
+
+	for ( auto i = waiting.begin(); i != waiting.end(); ++i )
+	{
+		LOG_WARNING( "Board " + *i + " is not ready.  Starting the logic thread without it." );
+	}
+
+	return;
+}
+
 bool start_threads( CONFIGURATOR* config, const COMMAND_LINE_PARMS& _clp )
 {
 	GLOBALS::configure_watchdog();
@@ -170,13 +411,13 @@ bool start_threads( CONFIGURATOR* config, const COMMAND_LINE_PARMS& _clp )
 		return false;
 	}
 
-	if ( !start_io_threads( config ) )
+	if ( !start_io_threads( config, _clp ) )
 	{
 		LOG_ERROR( "Failed to start IO threads." );
 		return false;
 	}
 
-	sleep( 2 );
+	wait_for_boards( config );
 
 	if ( !start_logic_thread( config ) )
 	{
@@ -255,7 +496,13 @@ int do_main( const COMMAND_LINE_PARMS& _clp )
 
 int main( int argc, const char** argv )
 {
-	COMMAND_LINE_PARMS clp( ( size_t )argc, argv );
+	COMMAND_LINE_PARMS::EX_PARAM_LIST ex_parms;
+	ex_parms[CMDP_IO_MODE] = "How to service the IO boards [THREAD|REACTOR]\n\t\tTHREAD (default) - one thread per board.\n\t\tREACTOR - one thread for all boards.";
+	ex_parms[CMDP_CAPTURE_DIR] = "Directory to capture the serial traffic of each board into.  Captures are appended to and can be replayed with BOARD_SIM --replay.";
+	ex_parms[CMDP_BOARD_ATTACH] = "What to do with boards that are already running [RESET|WARM]\n\t\tRESET (default) - reset every board.\n\t\tWARM - adopt the state of boards that are already streaming and reset the rest.";
+	ex_parms[CMDP_HISTORY_DEPTH] = "Number of samples kept in each board's sample history.  Zero disables the history.  Default: " + num_to_str( ( unsigned long ) GC_IO_HISTORY_DEPTH ) + ".";
+
+	COMMAND_LINE_PARMS clp( ( size_t )argc, argv, ex_parms );
 
 	// If there is an error in command line parms this method never returns.
 	clp.process();
@@ -316,32 +316,30 @@ void MESSAGE_BUS::emit_get_status_message( const MESSAGE& _message , const BBB_H
 
 	do_states.resize( GC_IO_DO_COUNT );
 
-	const vector<string>& parts = _data->get_parts( );
-
 	for ( size_t i = 0; i < ( size_t )adc_values.size(); ++i )
 	{
-		BBB_HVAC::IOCOMM::ADC_CACHE_ENTRY adc_val( parts[i] );
+		BBB_HVAC::IOCOMM::ADC_CACHE_ENTRY adc_val( _data->get_part_as_s( i ) );
 		adc_values[i] = adc_val.get_value();
 
 		/*
 		In the message from the logic core, l1 cal values are after the AI_COUNT AI values, DO status and PMIC status.
 		l2 cal values are after the l1 cal values.
 		*/
-		BBB_HVAC::IOCOMM::CAL_VALUE_ENTRY cv_l1( parts[( GC_IO_AI_COUNT + 2 ) + i] );
-		BBB_HVAC::IOCOMM::CAL_VALUE_ENTRY cv_l2( parts[( ( GC_IO_AI_COUNT * 2 ) + 2 ) + i] );
+		BBB_HVAC::IOCOMM::CAL_VALUE_ENTRY cv_l1( _data->get_part_as_s( ( GC_IO_AI_COUNT + 2 ) + i ) );
+		BBB_HVAC::IOCOMM::CAL_VALUE_ENTRY cv_l2( _data->get_part_as_s( ( ( GC_IO_AI_COUNT * 2 ) + 2 ) + i ) );
 
 		cal_vals_l1[i] = cv_l1.get_value();
 		cal_vals_l2[i] = cv_l2.get_value();
 	}
 
-	BBB_HVAC::IOCOMM::PMIC_CACHE_ENTRY pmic_value( parts[GC_IO_AI_COUNT + 1] );
+	BBB_HVAC::IOCOMM::PMIC_CACHE_ENTRY pmic_value( _data->get_part_as_s( GC_IO_AI_COUNT + 1 ) );
 
 	pmic_ai_en =  pmic_value.get_value( ) & GC_PMIC_AI_EN_MASK;
 	pmic_ai_fault =  pmic_value.get_value( ) & GC_PMIC_AI_ERR_MASK;
 	pmic_do_en = pmic_value.get_value( ) & GC_PMIC_DO_EN_MASK;
 	pmic_do_fault = pmic_value.get_value( ) & GC_PMIC_DO_ERR_MASK;
 
-	BBB_HVAC::IOCOMM::DO_CACHE_ENTRY do_value( parts[GC_IO_AI_COUNT] );
+	BBB_HVAC::IOCOMM::DO_CACHE_ENTRY do_value( _data->get_part_as_s( GC_IO_AI_COUNT ) );
 	uint8_t mask = 1;
 
 	for ( size_t i = 0; i < ( size_t )do_states.size(); i++ )